@@ -0,0 +1,281 @@
+/*
+ * Open Surge Engine
+ * bench.c - benchmark harness
+ * Copyright (C) 2013  Alexandre Martins <alemartf(at)gmail(dot)com>
+ * http://opensnc.sourceforge.net
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <allegro.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bench.h"
+#include "../core/engine.h"
+#include "../core/global.h"
+#include "../core/util.h"
+#include "../core/stringutil.h"
+#include "../core/osspec.h"
+#include "../core/scene.h"
+#include "../core/timer.h"
+#include "../core/loader.h"
+#include "../core/profiler.h"
+
+/* private stuff */
+#define BENCH_ROUNDS        7       /* rounds of a micro-benchmark */
+#define BENCH_ROUND_TIME    20000   /* a round takes at least this many microseconds */
+#define BENCH_DEFAULT_TICKS 1200    /* logic steps per level */
+#define BENCH_SEED          12345   /* for the random number generator */
+
+typedef struct benchresult_t benchresult_t;
+struct benchresult_t {
+    char name[128];
+    const char *kind; /* "micro" or "macro" */
+    const char *unit;
+    int samples;
+    float min, median, mean, p99, max;
+};
+
+static benchresult_t *result = NULL;
+static int result_count = 0, result_capacity = 0;
+static const char *filter = NULL;
+
+static void add_result(const char *name, const char *kind, const char *unit, float *sample, int sample_count);
+static void write_json(FILE *fp);
+static int compare_floats(const void *a, const void *b);
+static void pop_all_scenes();
+
+
+
+/*
+ * main()
+ * Entry point of opensurge_bench
+ */
+int main(int argc, char *argv[])
+{
+    const char *output = NULL;
+    char **engine_argv;
+    int i, engine_argc = 0, ticks = BENCH_DEFAULT_TICKS;
+    FILE *fp;
+
+    /* our options; the others go to the engine */
+    engine_argv = mallocx((argc + 2) * sizeof(*engine_argv));
+    engine_argv[engine_argc++] = argv[0];
+    engine_argv[engine_argc++] = "--headless";
+    for(i=1; i<argc; i++) {
+        if(str_icmp(argv[i], "--help") == 0) {
+            printf(
+                "usage: %s [options ...] [game options ...]\n"
+                "\n"
+                "where options include:\n"
+                "    --help              displays this message\n"
+                "    --ticks N           simulates N logic steps of each level (default: %d)\n"
+                "    --filter TEXT       runs only the benchmarks whose name contains TEXT\n"
+                "    --output FILEPATH   writes the results (JSON) to FILEPATH instead of the standard output\n"
+                "\n"
+                "The game options are the ones of %s (e.g., --basedir). The game runs headless.\n",
+                basename(argv[0]), BENCH_DEFAULT_TICKS, GAME_UNIXNAME
+            );
+            return 0;
+        }
+        else if(str_icmp(argv[i], "--ticks") == 0) {
+            if(++i < argc)
+                ticks = max(1, atoi(argv[i]));
+        }
+        else if(str_icmp(argv[i], "--filter") == 0) {
+            if(++i < argc)
+                filter = argv[i];
+        }
+        else if(str_icmp(argv[i], "--output") == 0) {
+            if(++i < argc)
+                output = argv[i];
+        }
+        else
+            engine_argv[engine_argc++] = argv[i];
+    }
+
+    /* the engine runs without a window, and doesn't
+       depend on the speed of the machine */
+    engine_init(engine_argc, engine_argv);
+    pop_all_scenes();
+    timer_use_step_clock(TRUE);
+    loader_set_synchronous(TRUE);
+    srand(BENCH_SEED);
+
+    /* running the benchmarks */
+    micro_benchmarks();
+    macro_benchmarks(ticks);
+
+    /* writing the results */
+    if(output != NULL) {
+        if(NULL != (fp = fopen(output, "w"))) {
+            write_json(fp);
+            fclose(fp);
+        }
+        else
+            fprintf(stderr, "Can't write to \"%s\"\n", output);
+    }
+    else
+        write_json(stdout);
+
+    /* done! */
+    pop_all_scenes();
+    engine_release();
+    free(result);
+    free(engine_argv);
+    return 0;
+}
+END_OF_MAIN()
+
+
+
+/* public methods */
+
+/*
+ * bench_run()
+ * Runs a micro-benchmark
+ */
+void bench_run(const char *name, void (*setup)(), void (*fun)(int n), void (*teardown)())
+{
+    float sample[BENCH_ROUNDS];
+    uint64 start, elapsed;
+    int i, n;
+
+    if(!bench_wanted(name))
+        return;
+
+    if(setup != NULL)
+        setup();
+
+    /* calibrating */
+    for(n = 1; ; n *= 2) {
+        start = profiler_get_time();
+        fun(n);
+        elapsed = profiler_get_time() - start;
+        if(elapsed >= BENCH_ROUND_TIME || n >= (1 << 30))
+            break;
+    }
+
+    /* measuring */
+    for(i=0; i<BENCH_ROUNDS; i++) {
+        start = profiler_get_time();
+        fun(n);
+        elapsed = profiler_get_time() - start;
+        sample[i] = (float)elapsed * 1000.0f / (float)n; /* nanoseconds per operation */
+    }
+
+    if(teardown != NULL)
+        teardown();
+
+    add_result(name, "micro", "ns/op", sample, BENCH_ROUNDS);
+}
+
+/*
+ * bench_report()
+ * Reports a macro-benchmark
+ */
+void bench_report(const char *name, const float *tick_time, int tick_count)
+{
+    float *sample;
+    int i;
+
+    if(tick_count <= 0)
+        return;
+
+    sample = mallocx(tick_count * sizeof *sample);
+    for(i=0; i<tick_count; i++)
+        sample[i] = tick_time[i] * 0.001f; /* milliseconds */
+
+    add_result(name, "macro", "ms/tick", sample, tick_count);
+    free(sample);
+}
+
+/*
+ * bench_wanted()
+ * Should we run the given benchmark?
+ */
+int bench_wanted(const char *name)
+{
+    return filter == NULL || strstr(name, filter) != NULL;
+}
+
+
+
+/* private methods */
+
+/* adds a result, computing its statistics. sample gets sorted */
+void add_result(const char *name, const char *kind, const char *unit, float *sample, int sample_count)
+{
+    benchresult_t *r;
+    double sum = 0.0;
+    int i;
+
+    if(result_count >= result_capacity) {
+        result_capacity = max(16, 2 * result_capacity);
+        result = reallocx(result, result_capacity * sizeof *result);
+    }
+
+    qsort(sample, sample_count, sizeof *sample, compare_floats);
+    for(i=0; i<sample_count; i++)
+        sum += sample[i];
+
+    r = &(result[result_count++]);
+    str_cpy(r->name, name, sizeof(r->name));
+    r->kind = kind;
+    r->unit = unit;
+    r->samples = sample_count;
+    r->min = sample[0];
+    r->median = sample[sample_count / 2];
+    r->mean = (float)(sum / sample_count);
+    r->p99 = sample[min(sample_count - 1, (sample_count * 99) / 100)];
+    r->max = sample[sample_count - 1];
+
+    fprintf(stderr, "%-40s %12.3f %s\n", r->name, r->median, r->unit);
+}
+
+/* writes the results */
+void write_json(FILE *fp)
+{
+    const benchresult_t *r;
+    int i;
+
+    fprintf(fp, "{\n");
+    fprintf(fp, "  \"game\": \"%s\",\n", GAME_TITLE);
+    fprintf(fp, "  \"version\": \"%s\",\n", GAME_VERSION_STRING);
+    fprintf(fp, "  \"benchmarks\": [");
+    for(i=0; i<result_count; i++) {
+        r = &(result[i]);
+        fprintf(fp, "%s\n    { \"name\": \"%s\", \"kind\": \"%s\", \"unit\": \"%s\", \"samples\": %d, "
+            "\"min\": %.4f, \"median\": %.4f, \"mean\": %.4f, \"p99\": %.4f, \"max\": %.4f }",
+            (i > 0) ? "," : "", r->name, r->kind, r->unit, r->samples,
+            r->min, r->median, r->mean, r->p99, r->max);
+    }
+    fprintf(fp, "\n  ]\n}\n");
+}
+
+/* for qsort() */
+int compare_floats(const void *a, const void *b)
+{
+    float x = *((const float*)a), y = *((const float*)b);
+    return (x > y) - (x < y);
+}
+
+/* empties the scene stack */
+void pop_all_scenes()
+{
+    while(!scenestack_empty())
+        scenestack_pop();
+}
@@ -0,0 +1,49 @@
+/*
+ * Open Surge Engine
+ * bench.h - benchmark harness
+ * Copyright (C) 2013  Alexandre Martins <alemartf(at)gmail(dot)com>
+ * http://opensnc.sourceforge.net
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _BENCH_H
+#define _BENCH_H
+
+/*
+ * opensurge_bench measures hot paths of the engine, without a
+ * window: micro-benchmarks time a single operation in isolation
+ * (see micro.c) and macro-benchmarks simulate the shipped levels
+ * (see macro.c). The results are written in JSON.
+ *
+ * A micro-benchmark is a function that runs its operation n times.
+ * bench_run() calibrates n so that a round takes a few milliseconds,
+ * runs a few rounds and reports the time per operation.
+ */
+
+/* runs a micro-benchmark; setup() and teardown() may be NULL */
+void bench_run(const char *name, void (*setup)(), void (*fun)(int n), void (*teardown)());
+
+/* reports a macro-benchmark, given the duration of each tick in microseconds */
+void bench_report(const char *name, const float *tick_time, int tick_count);
+
+/* should the benchmark with this name run? (see --filter) */
+int bench_wanted(const char *name);
+
+/* the benchmarks */
+void micro_benchmarks();
+void macro_benchmarks(int ticks);
+
+#endif
@@ -0,0 +1,161 @@
+/*
+ * Open Surge Engine
+ * macro.c - macro-benchmarks
+ * Copyright (C) 2013  Alexandre Martins <alemartf(at)gmail(dot)com>
+ * http://opensnc.sourceforge.net
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "bench.h"
+#include "../core/util.h"
+#include "../core/stringutil.h"
+#include "../core/osspec.h"
+#include "../core/scene.h"
+#include "../core/storyboard.h"
+#include "../core/timer.h"
+#include "../core/loader.h"
+#include "../core/profiler.h"
+#include "../core/engine.h"
+
+/* private stuff */
+#define MAX_LEVELS          256
+#define PACING_FPS          60
+#define PACING_FRAMES       180     /* 3 seconds */
+
+static char *level_path[MAX_LEVELS];
+static int level_count = 0;
+
+static int add_level(const char *filename, void *param);
+static void simulate_level(const char *filepath, int ticks);
+static void measure_pacing(const char *name, int optimize_cpu_usage);
+
+
+
+/*
+ * macro_benchmarks()
+ * Measures the frame pacing of the timer, then
+ * simulates each of the shipped levels for
+ * the given number of ticks (logic steps)
+ */
+void macro_benchmarks(int ticks)
+{
+    int i;
+
+    measure_pacing("pacing:sleep", TRUE);
+    measure_pacing("pacing:spin", FALSE);
+
+    level_count = 0;
+    foreach_resource("levels/*.lev", add_level, NULL, FALSE);
+
+    for(i=0; i<level_count; i++) {
+        simulate_level(level_path[i], ticks);
+        free(level_path[i]);
+    }
+}
+
+
+
+/* private methods */
+
+/* adds a level to the list */
+int add_level(const char *filename, void *param)
+{
+    if(level_count < MAX_LEVELS)
+        level_path[level_count++] = str_dup(filename);
+
+    return 0;
+}
+
+/* runs a level for a number of ticks, as the main loop would
+   do in headless mode (one logic step per frame) */
+void simulate_level(const char *filepath, int ticks)
+{
+    char name[1024];
+    float *tick_time;
+    scene_t *scn;
+    uint64 start;
+    int i;
+
+    snprintf(name, sizeof(name), "level:%s", basename(filepath));
+    if(!bench_wanted(name))
+        return;
+
+    tick_time = mallocx(ticks * sizeof *tick_time);
+    scenestack_push(storyboard_get_scene(SCENE_LEVEL), (void*)filepath);
+
+    for(i=0; i<ticks && !scenestack_empty() && !game_is_over(); i++) {
+        start = profiler_get_time();
+
+        timer_update();
+        loader_update();
+        if(timer_begin_step()) {
+            scn = engine_step();
+            if(!scenestack_empty() && scn == scenestack_top())
+                scn->render();
+        }
+
+        tick_time[i] = (float)(profiler_get_time() - start);
+    }
+
+    bench_report(name, tick_time, i);
+    while(!scenestack_empty())
+        scenestack_pop();
+
+    free(tick_time);
+}
+
+/* runs empty frames at PACING_FPS, measuring the time between
+   consecutive frames (the jitter) and the cpu time spent in
+   timer_update() while waiting for the next frame */
+void measure_pacing(const char *name, int optimize_cpu_usage)
+{
+    float frame_time[PACING_FRAMES], cpu_time[PACING_FRAMES];
+    int was_optimized = timer_is_cpu_usage_optimized();
+    char cpu_name[256];
+    uint64 now, last;
+    clock_t c;
+    int i;
+
+    if(!bench_wanted(name))
+        return;
+
+    timer_optimize_cpu_usage(optimize_cpu_usage);
+    timer_set_unpaced(FALSE);
+    timer_set_max_fps(PACING_FPS);
+
+    timer_update();
+    last = profiler_get_time();
+    for(i=0; i<PACING_FRAMES; i++) {
+        c = clock();
+        timer_update();
+        cpu_time[i] = (float)((double)(clock() - c) * 1000000.0 / (double)CLOCKS_PER_SEC);
+
+        now = profiler_get_time();
+        frame_time[i] = (float)(now - last);
+        last = now;
+    }
+
+    snprintf(cpu_name, sizeof(cpu_name), "%s:cpu", name);
+    bench_report(name, frame_time, PACING_FRAMES);
+    bench_report(cpu_name, cpu_time, PACING_FRAMES);
+
+    /* back to headless mode */
+    timer_set_unpaced(TRUE);
+    timer_optimize_cpu_usage(was_optimized);
+}
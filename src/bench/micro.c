@@ -0,0 +1,282 @@
+/*
+ * Open Surge Engine
+ * micro.c - micro-benchmarks
+ * Copyright (C) 2013  Alexandre Martins <alemartf(at)gmail(dot)com>
+ * http://opensnc.sourceforge.net
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "bench.h"
+#include "../core/util.h"
+#include "../core/image.h"
+#include "../core/video.h"
+#include "../core/font.h"
+#include "../core/osspec.h"
+#include "../core/spatialhash.h"
+#include "../core/nanocalc/nanocalc.h"
+#include "../core/nanoparser/nanoparser.h"
+#include "../entities/item.h"
+#include "../entities/actor.h"
+#include "../entities/renderqueue.h"
+#include "../entities/physics/obstacle.h"
+#include "../entities/physics/obstaclemap.h"
+#include "../entities/physics/physicsactor.h"
+
+/* spatial hash */
+#define SH_ELEMENTS         10000
+#define SH_WORLD_WIDTH      32000
+#define SH_WORLD_HEIGHT     4000
+
+typedef struct benchrect_t benchrect_t;
+struct benchrect_t { int x, y, w, h; };
+static int benchrect_xpos(const benchrect_t *r) { return r->x; }
+static int benchrect_ypos(const benchrect_t *r) { return r->y; }
+static int benchrect_width(const benchrect_t *r) { return r->w; }
+static int benchrect_height(const benchrect_t *r) { return r->h; }
+static benchrect_t* benchrect_destroy(benchrect_t *r) { free(r); return NULL; }
+SPATIALHASH_GENERATE_CODE(benchrect_t)
+
+static spatialhash_benchrect_t *sh = NULL;
+
+static int count_rect(benchrect_t *r, void *count)
+{
+    (*((int*)count))++;
+    return 0;
+}
+
+static void spatialhash_setup()
+{
+    benchrect_t *r;
+    int i;
+
+    sh = spatialhash_benchrect_t_create_ex(benchrect_destroy, benchrect_xpos, benchrect_ypos, benchrect_width, benchrect_height, SH_WORLD_WIDTH, SH_WORLD_HEIGHT);
+    for(i=0; i<SH_ELEMENTS; i++) {
+        r = mallocx(sizeof *r);
+        r->x = random(SH_WORLD_WIDTH);
+        r->y = random(SH_WORLD_HEIGHT);
+        r->w = r->h = 16 + random(48);
+        spatialhash_benchrect_t_add_new(sh, r);
+    }
+}
+
+static void spatialhash_query(int n)
+{
+    int count = 0;
+
+    while(n--)
+        spatialhash_benchrect_t_foreach(sh, (n * 97) % SH_WORLD_WIDTH, (n * 31) % SH_WORLD_HEIGHT, 480, 360, &count, count_rect);
+}
+
+static void spatialhash_teardown()
+{
+    sh = spatialhash_benchrect_t_destroy(sh);
+}
+
+/* obstacle map */
+#define OM_OBSTACLES        500
+
+static obstaclemap_t *om = NULL;
+static image_t *slope = NULL;
+
+static void obstaclemap_setup()
+{
+    int i;
+
+    slope = image_create(64, 64);
+    image_clear(slope, video_get_maskcolor());
+    for(i=0; i<64; i++)
+        image_line(slope, i, 63 - i, i, 63, image_rgb(255, 255, 255));
+
+    om = obstaclemap_create();
+    for(i=0; i<OM_OBSTACLES; i++)
+        obstaclemap_add_obstacle(om, obstacle_create_solid(slope, 0, v2d_new(i * 64, 256 + (i % 7) * 16)));
+}
+
+static void obstaclemap_query(int n)
+{
+    int x;
+
+    while(n--) {
+        x = (n * 37) % (OM_OBSTACLES * 64);
+        obstaclemap_get_best_obstacle_at(om, x, 200, x + 20, 340, MM_FLOOR);
+    }
+}
+
+static void obstaclemap_teardown()
+{
+    om = obstaclemap_destroy(om);
+    image_destroy(slope);
+    slope = NULL;
+}
+
+/* pixel-perfect collision */
+static image_t *ball[2] = { NULL, NULL };
+
+static void collision_setup()
+{
+    int i;
+
+    for(i=0; i<2; i++) {
+        ball[i] = image_create(64, 64);
+        image_clear(ball[i], video_get_maskcolor());
+        image_ellipse(ball[i], 32, 32, 30, 30, image_rgb(255, 255, 255));
+    }
+}
+
+static void collision_check(int n)
+{
+    while(n--)
+        image_pixelperfect_collision(ball[0], ball[1], 0, 0, 40 + (n % 8), 8);
+}
+
+static void collision_teardown()
+{
+    image_destroy(ball[0]);
+    image_destroy(ball[1]);
+    ball[0] = ball[1] = NULL;
+}
+
+/* nanocalc */
+static symboltable_t *st = NULL;
+static expression_t *expr = NULL;
+
+static void nanocalc_setup()
+{
+    st = symboltable_new();
+    expr = expression_new("($x * 2 + sin($y) * 100) / (1 + abs($x - $y)) >= 10 and $y < 1000", st);
+}
+
+static void nanocalc_evaluate(int n)
+{
+    while(n--) {
+        symboltable_set(st, "$x", (float)(n % 100));
+        symboltable_set(st, "$y", (float)(n % 777));
+        expression_evaluate(expr);
+    }
+}
+
+static void nanocalc_teardown()
+{
+    expression_destroy(expr);
+    symboltable_destroy(st);
+    expr = NULL;
+    st = NULL;
+}
+
+/* nanoparser */
+static char script_path[1024];
+
+static void nanoparser_parse(int n)
+{
+    while(n--)
+        nanoparser_deconstruct_tree(nanoparser_construct_tree(script_path));
+}
+
+/* render queue */
+#define RQ_ITEMS            1000
+
+static item_t *rq_item[RQ_ITEMS];
+
+static void renderqueue_setup()
+{
+    int i;
+
+    for(i=0; i<RQ_ITEMS; i++) {
+        rq_item[i] = item_create(IT_RING);
+        rq_item[i]->actor->position = v2d_new(random(VIDEO_SCREEN_W), random(VIDEO_SCREEN_H));
+    }
+}
+
+static void renderqueue_sort_and_render(int n)
+{
+    v2d_t camera = v2d_new(VIDEO_SCREEN_W/2, VIDEO_SCREEN_H/2);
+    int i;
+
+    while(n--) {
+        renderqueue_begin(camera);
+        for(i=0; i<RQ_ITEMS; i++)
+            renderqueue_enqueue_item(rq_item[i]);
+        renderqueue_end();
+    }
+}
+
+static void renderqueue_teardown()
+{
+    int i;
+
+    for(i=0; i<RQ_ITEMS; i++)
+        rq_item[i] = item_destroy(rq_item[i]);
+}
+
+/* scaling the backbuffer */
+static void fast2x_setup() { video_changemode(VIDEORESOLUTION_2X, FALSE, FALSE); }
+static void hq2x_setup() { video_changemode(VIDEORESOLUTION_2X, TRUE, FALSE); }
+static void scale_teardown() { video_changemode(VIDEORESOLUTION_1X, FALSE, FALSE); }
+
+static void scale_backbuffer(int n)
+{
+    while(n--)
+        video_scale_backbuffer();
+}
+
+/* font layout */
+static font_t *fnt = NULL;
+
+static void font_setup()
+{
+    fnt = font_create("dialogbox");
+    font_set_width(fnt, 200);
+}
+
+static void font_layout(int n)
+{
+    while(n--) {
+        font_set_text(fnt, "<color=ffff00>Surge</color>: the quick brown fox jumps over the lazy dog, %d times. Press $INPUT_FIRE1 to continue.", n);
+        font_get_textsize(fnt);
+    }
+}
+
+static void font_teardown()
+{
+    font_destroy(fnt);
+    fnt = NULL;
+}
+
+
+
+/*
+ * micro_benchmarks()
+ * Runs the micro-benchmarks
+ */
+void micro_benchmarks()
+{
+    bench_run("spatialhash_foreach", spatialhash_setup, spatialhash_query, spatialhash_teardown);
+    bench_run("obstaclemap_get_best_obstacle_at", obstaclemap_setup, obstaclemap_query, obstaclemap_teardown);
+    bench_run("image_pixelperfect_collision", collision_setup, collision_check, collision_teardown);
+    bench_run("nanocalc_evaluate", nanocalc_setup, nanocalc_evaluate, nanocalc_teardown);
+
+    resource_filepath(script_path, "objects/bosses/bigwolf.obj", sizeof(script_path), RESFP_READ);
+    if(filepath_exists(script_path))
+        bench_run("nanoparser_construct_tree", NULL, nanoparser_parse, NULL);
+
+    bench_run("renderqueue_1000_items", renderqueue_setup, renderqueue_sort_and_render, renderqueue_teardown);
+    bench_run("video_scale_fast2x", fast2x_setup, scale_backbuffer, scale_teardown);
+    if(video_get_color_depth() == 32)
+        bench_run("video_scale_hq2x", hq2x_setup, scale_backbuffer, scale_teardown);
+    bench_run("font_layout", font_setup, font_layout, font_teardown);
+}
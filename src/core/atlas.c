@@ -0,0 +1,299 @@
+/*
+ * Open Surge Engine
+ * atlas.c - texture atlas
+ * Copyright (C) 2013  Alexandre Martins <alemartf(at)gmail(dot)com>
+ * http://opensnc.sourceforge.net
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <string.h>
+#include "atlas.h"
+#include "util.h"
+#include "video.h"
+#include "logfile.h"
+
+/* a skyline is a list of horizontal segments describing
+   the top edge of the space already taken in a page */
+typedef struct atlas_segment_t atlas_segment_t;
+struct atlas_segment_t {
+    int x, y, width;
+};
+
+/* atlas page */
+typedef struct atlas_page_t atlas_page_t;
+struct atlas_page_t {
+    image_t *image;
+    int segment_count;
+    atlas_segment_t *segment; /* sorted by x */
+    int region_count;
+    image_t **region; /* sub-images handed out by atlas_add() */
+    atlas_page_t *next;
+};
+
+/* atlas structure */
+struct atlas_t {
+    int page_width, page_height;
+    int page_count;
+    atlas_page_t *page; /* most recent page first */
+};
+
+/* private stuff */
+static atlas_page_t *page_new(int width, int height);
+static atlas_page_t *page_delete(atlas_page_t *page);
+static int page_fit(const atlas_page_t *page, int width, int height, int *x, int *y, int *index);
+static void page_insert(atlas_page_t *page, int index, int x, int y, int width, int height);
+
+
+
+/* public methods */
+
+/*
+ * atlas_create()
+ * Creates an empty atlas. Pages are created on demand.
+ */
+atlas_t *atlas_create(int page_width, int page_height)
+{
+    atlas_t *atlas = mallocx(sizeof *atlas);
+
+    atlas->page_width = max(1, page_width);
+    atlas->page_height = max(1, page_height);
+    atlas->page_count = 0;
+    atlas->page = NULL;
+
+    return atlas;
+}
+
+/*
+ * atlas_destroy()
+ * Destroys an atlas and all of its pages
+ */
+atlas_t *atlas_destroy(atlas_t *atlas)
+{
+    atlas_page_t *next;
+
+    while(atlas->page != NULL) {
+        next = atlas->page->next;
+        page_delete(atlas->page);
+        atlas->page = next;
+    }
+
+    free(atlas);
+    return NULL;
+}
+
+/*
+ * atlas_add()
+ * Copies the (x, y, width, height) region of src into the atlas
+ * and returns a sub-image of the page that holds it. Regions that
+ * are larger than a page get a page of their own.
+ */
+image_t *atlas_add(atlas_t *atlas, const image_t *src, int x, int y, int width, int height)
+{
+    atlas_page_t *page;
+    int px = 0, py = 0, index = 0;
+
+    width = max(1, width);
+    height = max(1, height);
+
+    /* find room in an existing page */
+    for(page = atlas->page; page != NULL; page = page->next) {
+        if(page_fit(page, width, height, &px, &py, &index))
+            break;
+    }
+
+    /* we need a new page */
+    if(page == NULL) {
+        page = page_new(max(width, atlas->page_width), max(height, atlas->page_height));
+        page->next = atlas->page;
+        atlas->page = page;
+        atlas->page_count++;
+        if(!page_fit(page, width, height, &px, &py, &index))
+            fatal_error("atlas_add(): can't fit a %dx%d region into a new page", width, height);
+    }
+
+    /* copy the pixels */
+    page_insert(page, index, px, py, width, height);
+    image_blit(src, page->image, x, y, px, py, width, height);
+    page->region = reallocx(page->region, (page->region_count + 1) * sizeof *(page->region));
+    page->region[page->region_count] = image_create_shared(page->image, px, py, width, height);
+    return page->region[page->region_count++];
+}
+
+/*
+ * atlas_remove()
+ * Destroys a sub-image returned by atlas_add(). The pages
+ * that are left empty are released (the packer can't reuse
+ * the holes left in the other pages)
+ */
+void atlas_remove(atlas_t *atlas, image_t *region)
+{
+    atlas_page_t *page, *prev = NULL;
+    int i;
+
+    for(page = atlas->page; page != NULL; prev = page, page = page->next) {
+        for(i=0; i<page->region_count && page->region[i] != region; i++);
+        if(i < page->region_count) {
+            page->region[i] = page->region[--(page->region_count)];
+            image_destroy(region);
+
+            if(page->region_count == 0) {
+                if(prev != NULL)
+                    prev->next = page->next;
+                else
+                    atlas->page = page->next;
+                page_delete(page);
+                atlas->page_count--;
+            }
+
+            return;
+        }
+    }
+
+    logfile_message("atlas_remove(): the region doesn't belong to the atlas");
+}
+
+/*
+ * atlas_page_count()
+ * Number of pages
+ */
+int atlas_page_count(const atlas_t *atlas)
+{
+    return atlas->page_count;
+}
+
+/*
+ * atlas_memory_usage()
+ * The size of all the pages, in bytes
+ */
+int atlas_memory_usage(const atlas_t *atlas)
+{
+    const atlas_page_t *page;
+    int bytes = 0;
+
+    for(page = atlas->page; page != NULL; page = page->next)
+        bytes += image_memory_usage(page->image);
+
+    return bytes;
+}
+
+
+
+/* private methods */
+
+/* creates a new empty page */
+atlas_page_t *page_new(int width, int height)
+{
+    atlas_page_t *page = mallocx(sizeof *page);
+
+    logfile_message("atlas: creating a %dx%d page", width, height);
+    page->image = image_create(width, height);
+    image_clear(page->image, video_get_maskcolor());
+    page->segment_count = 1;
+    page->segment = mallocx(sizeof *(page->segment));
+    page->segment[0].x = 0;
+    page->segment[0].y = 0;
+    page->segment[0].width = width;
+    page->region_count = 0;
+    page->region = NULL;
+    page->next = NULL;
+
+    return page;
+}
+
+/* deletes a page */
+atlas_page_t *page_delete(atlas_page_t *page)
+{
+    image_destroy(page->image);
+    free(page->segment);
+    if(page->region != NULL)
+        free(page->region);
+    free(page);
+    return NULL;
+}
+
+/* finds the bottom-left position for a width x height region.
+   Returns FALSE if there is no room for it */
+int page_fit(const atlas_page_t *page, int width, int height, int *x, int *y, int *index)
+{
+    int i, j, top, remaining, best_bottom = INFINITY, best_width = INFINITY;
+    int page_w = image_width(page->image), page_h = image_height(page->image);
+
+    for(i=0; i<page->segment_count; i++) {
+        if(page->segment[i].x + width > page_w)
+            break;
+
+        /* the region rests on the highest segment below it */
+        top = 0;
+        remaining = width;
+        for(j=i; j<page->segment_count && remaining > 0; j++) {
+            top = max(top, page->segment[j].y);
+            remaining -= page->segment[j].width;
+        }
+
+        if(top + height <= page_h) {
+            if(top + height < best_bottom || (top + height == best_bottom && page->segment[i].width < best_width)) {
+                best_bottom = top + height;
+                best_width = page->segment[i].width;
+                *x = page->segment[i].x;
+                *y = top;
+                *index = i;
+            }
+        }
+    }
+
+    return best_bottom != INFINITY;
+}
+
+/* raises the skyline after placing a region at (x, y) */
+void page_insert(atlas_page_t *page, int index, int x, int y, int width, int height)
+{
+    int i, shrink;
+
+    page->segment = reallocx(page->segment, (page->segment_count + 1) * sizeof *(page->segment));
+    for(i=page->segment_count; i>index; i--)
+        page->segment[i] = page->segment[i-1];
+    page->segment[index].x = x;
+    page->segment[index].y = y + height;
+    page->segment[index].width = width;
+    page->segment_count++;
+
+    /* shrink or remove the segments covered by the new one */
+    for(i=index+1; i<page->segment_count; ) {
+        shrink = (page->segment[i-1].x + page->segment[i-1].width) - page->segment[i].x;
+        if(shrink <= 0)
+            break;
+
+        page->segment[i].x += shrink;
+        page->segment[i].width -= shrink;
+        if(page->segment[i].width <= 0) {
+            memmove(page->segment + i, page->segment + i + 1, (page->segment_count - i - 1) * sizeof *(page->segment));
+            page->segment_count--;
+        }
+        else
+            break;
+    }
+
+    /* merge neighbours at the same height */
+    for(i=0; i<page->segment_count-1; ) {
+        if(page->segment[i].y == page->segment[i+1].y) {
+            page->segment[i].width += page->segment[i+1].width;
+            memmove(page->segment + i + 1, page->segment + i + 2, (page->segment_count - i - 2) * sizeof *(page->segment));
+            page->segment_count--;
+        }
+        else
+            i++;
+    }
+}
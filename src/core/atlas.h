@@ -0,0 +1,49 @@
+/*
+ * Open Surge Engine
+ * atlas.h - texture atlas
+ * Copyright (C) 2013  Alexandre Martins <alemartf(at)gmail(dot)com>
+ * http://opensnc.sourceforge.net
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _ATLAS_H
+#define _ATLAS_H
+
+#include "image.h"
+
+/*
+ * A texture atlas packs many small images into a few large surfaces
+ * (pages). Regions are placed using a skyline bottom-left packer.
+ *
+ * atlas_add() returns a sub-image of one of the pages. Please destroy
+ * those sub-images before destroying the atlas, or give them back with
+ * atlas_remove(): the pages that have no sub-images left are released.
+ */
+
+/* opaque atlas type */
+typedef struct atlas_t atlas_t;
+
+/* atlas management */
+atlas_t *atlas_create(int page_width, int page_height); /* creates an empty atlas */
+atlas_t *atlas_destroy(atlas_t *atlas); /* destroys the atlas and its pages. Returns NULL */
+image_t *atlas_add(atlas_t *atlas, const image_t *src, int x, int y, int width, int height); /* copies a region of src into the atlas */
+void atlas_remove(atlas_t *atlas, image_t *region); /* destroys a sub-image returned by atlas_add(), releasing its page if it's left empty */
+
+/* properties */
+int atlas_page_count(const atlas_t *atlas); /* number of pages */
+int atlas_memory_usage(const atlas_t *atlas); /* size of all pages, in bytes */
+
+#endif
@@ -27,7 +27,10 @@
 #include "resourcemanager.h"
 #include "logfile.h"
 #include "timer.h"
+#include "thread.h"
 #include "util.h"
+#include "profiler.h"
+#include "pcmcache.h"
 
 #ifndef __USE_OPENAL__
 #include <logg.h>
@@ -35,48 +38,82 @@
 #include <AL/alure.h> /* PulseAudio isn't Allegro-friendly */
 #endif
 
+/*
+ * When there's a sound device, a dedicated audio thread keeps the
+ * music streams fed and talks to the device. The public functions
+ * (main thread) don't touch the device: they post commands to a
+ * lock-free queue (single producer, single consumer) that is read by
+ * the audio thread. This way, a long frame never starves the streams.
+ *
+ * The audio thread holds audio_mutex while it works. The main thread
+ * takes it (see lock_audio()) when it must touch the device itself,
+ * e.g., to destroy a sample. Without a sound device (headless mode),
+ * there's no audio thread: the commands run right away.
+ *
+ * The state that the game reads (the volume, is it playing?) is
+ * mirrored on the main thread, so that it doesn't lag behind the
+ * commands that haven't run yet. A play is identified by a serial
+ * number: the audio thread reports the last one that has finished.
+ */
+
 /* private definitions */
 #define IS_WAV(path)                (str_icmp((path)+strlen(path)-4, ".wav") == 0)
 #define IS_OGG(path)                (str_icmp((path)+strlen(path)-4, ".ogg") == 0)
 #define IS_VALID_FORMAT(path)       (IS_OGG(path) || IS_WAV(path))
-#define SOUND_INVALID_VOICE         -1
 #define PREFERRED_NUMBER_OF_VOICES  16
+#define MAX_INSTANCES_PER_SAMPLE    4   /* a sample can't be played more than this at the same time */
+#define MERGE_INTERVAL              15000000ULL /* in nanoseconds: triggers of the same sample closer than this are merged */
+#define MUSIC_CHUNK_LENGTH          250000 /* in bytes (OpenAL streams) */
+#define MUSIC_STREAM_MEMORY         131072 /* approximate memory used by a LOGG stream, in bytes */
+#define AUDIO_QUEUE_SIZE            256 /* commands; must be a power of two */
+#define AUDIO_THREAD_INTERVAL       5   /* in milliseconds */
 
 /* private stuff */
 #ifndef __USE_OPENAL__
 struct music_t {
-    LOGG_Stream *stream;
-    int loops_left;
-    int is_paused;
-    float elapsed_time;
+    LOGG_Stream *stream; /* NULL if it couldn't be reopened (see rewind_music()) */
+    float duration; /* in seconds. It's kept here, since the audio thread reopens the stream */
+    int is_paused; /* main thread */
+    uint32 played; /* main thread: serial number of the last play */
+    volatile uint32 finished; /* audio thread: serial number of the last play that has ended */
+    uint32 serial; /* audio thread: the play being streamed */
+    int loops_left; /* audio thread */
+    float elapsed_time; /* audio thread */
 };
 
 struct sound_t {
     SAMPLE *data;
-    int voice_id;
+    void *own_data; /* if data->data points to the sample cache, the buffer allocated by Allegro; NULL otherwise */
+    uint32 played, stopped; /* main thread: serial numbers */
+    volatile uint32 finished; /* audio thread: serial number of the last play that has ended */
+    uint32 serial; /* audio thread: the last play */
+    int voices; /* audio thread: how many voices are playing this sample */
 };
 
-#define MUSIC_DURATION(m)           ((float)(m->stream->len) / (float)(m->stream->freq))
+static int rewind_music(music_t *music);
+static SAMPLE* map_sample(const pcmsample_t *pcm, void **own_data);
+
 #else
 struct music_t {
     alureStream *stream;
-    volatile int is_paused;
-    volatile int is_playing;
+    int is_paused; /* main thread */
+    uint32 played; /* main thread: serial number of the last play */
+    volatile uint32 finished; /* audio thread: serial number of the last play that has ended */
+    uint32 serial; /* audio thread: the play being streamed */
 };
 
 struct sound_t {
     ALuint buf; /* sound buffer */
-    volatile ALuint *src; /* points to an element of src[] */
-    volatile int loops_left;
-    volatile int is_playing;
-    volatile float vol, pan, freq;
+    uint32 played, stopped; /* main thread: serial numbers */
+    volatile uint32 finished; /* audio thread: serial number of the last play that has ended */
+    uint32 serial; /* audio thread: the last play */
+    int voices; /* audio thread: how many voices are playing this sample */
 };
 
 static int quiet;
 
-static ALuint src[PREFERRED_NUMBER_OF_VOICES]; /* audio sources for sound_t's */
+static ALuint src[PREFERRED_NUMBER_OF_VOICES]; /* audio sources for sound_t's: src[i] belongs to voice[i] */
 static int src_count; /* number of valid elements of src[] */
-static int src_ptr; /* next src[] index to be used */
 static ALuint srcmus; /* audio source for the music */
 
 static ALuint *sbuf; /* array of ALuint: will hold all created buffers */
@@ -85,13 +122,96 @@ static int sbuf_count; /* length of sbuf[] */
 
 static void eos_callback(void *userdata, ALuint source);
 static void eom_callback(void *userdata, ALuint source);
+static ALuint create_buffer(const char *abs_path);
+static ALuint buffer_from_pcm(const pcmsample_t *pcm);
 
 #define NUM_BUFS 3
 #endif
 
+/* audio commands */
+typedef enum {
+    AUDIOCMD_MUSIC_PLAY,
+    AUDIOCMD_MUSIC_STOP,
+    AUDIOCMD_MUSIC_PAUSE,
+    AUDIOCMD_MUSIC_RESUME,
+    AUDIOCMD_MUSIC_VOLUME,
+    AUDIOCMD_SOUND_PLAY,
+    AUDIOCMD_SOUND_STOP
+} audiocmdtype_t;
+
+typedef struct audiocmd_t audiocmd_t;
+struct audiocmd_t {
+    audiocmdtype_t type;
+    music_t *music;
+    sound_t *sample;
+    uint32 serial; /* of the play */
+    float vol, pan, freq;
+    int loop;
+};
+
+static audiocmd_t queue[AUDIO_QUEUE_SIZE];
+static volatile uint32 queue_head; /* next command to be run (written by the consumer) */
+static volatile uint32 queue_tail; /* next free slot (written by the main thread) */
+static thread_t *audio_thread; /* NULL if there's no sound device */
+static mutex_t *audio_mutex;
+static volatile int audio_thread_quit;
+
+static void start_audio_thread();
+static void stop_audio_thread();
+static void audio_routine(void *arg);
+static void send_command(const audiocmd_t *cmd); /* main thread */
+static void run_commands(); /* audio thread, or main thread holding the lock */
+static void run_command(const audiocmd_t *cmd);
+static void lock_audio(); /* main thread */
+static void unlock_audio();
+
+/* voice manager (audio thread): the samples that are playing. When
+   all voices are taken, a new sound steals the voice of the least
+   important one (the oldest, among the least important ones) */
+typedef struct voice_t voice_t;
+struct voice_t {
+    sound_t *sample; /* NULL if the voice is free */
+    uint32 serial; /* of the play */
+    float priority;
+    uint64 start_time; /* in nanoseconds */
+    float vol, pan, freq;
+    int loops_left;
+#ifndef __USE_OPENAL__
+    int id; /* Allegro voice */
+#endif
+};
+
+static voice_t voice[PREFERRED_NUMBER_OF_VOICES];
+static int voice_count;
+static int play_count, merge_count, steal_count, drop_count; /* statistics */
+
+static void init_voices(int count);
+static voice_t *find_voice(sound_t *sample, float priority, uint64 now);
+static void release_voice(voice_t *v);
+static float sound_priority(float vol, int loop);
+
+/* backend (audio thread) */
+static void feed_streams(float dt); /* dt: elapsed time, in seconds */
+static int start_voice(voice_t *v); /* returns FALSE on failure */
+static void stop_voice(voice_t *v);
+static void set_voice_volume(voice_t *v, float vol);
+static void refresh_voices(); /* releases the voices that have finished playing */
+static void exec_music_play(music_t *music, int loop, uint32 serial);
+static void exec_music_stop();
+static void exec_music_pause();
+static void exec_music_resume();
+static void exec_music_set_volume(float volume);
+static void exec_sound_play(sound_t *sample, float vol, float pan, float freq, int loop, uint32 serial);
+static void exec_sound_stop(sound_t *sample);
+
+/* sample cache */
+static void sample_to_pcm(const SAMPLE *spl, pcmsample_t *pcm);
 
 /* private stuff*/
-static music_t *current_music; /* music being played at the moment (NULL if none) */
+static music_t *current_music; /* main thread: music being played at the moment (NULL if none) */
+static float music_volume; /* main thread: volume of the current music */
+static music_t *streamed_music; /* audio thread: the music at the device (NULL if none) */
+static int streamed_music_paused; /* audio thread */
 
 
 /*
@@ -106,28 +226,34 @@ music_t *music_load(const char *path)
 
     if(NULL == (m = resourcemanager_find_music(path))) {
         resource_filepath(abs_path, path, sizeof(abs_path), RESFP_READ);
-        logfile_message("music_load('%s')", abs_path);
+        logfile_debug("music_load('%s')", abs_path);
 
         /* build the music object */
         m = mallocx(sizeof *m);
-        m->loops_left = 0;
         m->is_paused = FALSE;
+        m->played = m->finished = m->serial = 0;
+        m->loops_left = 0;
         m->elapsed_time = 0.0f;
 
         /* load the ogg stream */
+        profiler_begin(PROF_RESOURCES);
+        lock_audio(); /* it reserves a voice */
         m->stream = logg_get_stream(abs_path, 255, 128, 0);
+        unlock_audio();
+        profiler_end(PROF_RESOURCES);
         if(m->stream == NULL) {
             logfile_message("music_load() error: can't get ogg stream");
             free(m);
             return NULL;
         }
+        m->duration = (float)(m->stream->len) / (float)(m->stream->freq);
 
         /* adding it to the resource manager */
         resourcemanager_add_music(path, m);
         resourcemanager_ref_music(path);
 
         /* done! */
-        logfile_message("music_load() ok");
+        logfile_debug("music_load() ok");
     }
     else
         resourcemanager_ref_music(path);
@@ -140,17 +266,22 @@ music_t *music_load(const char *path)
     char abs_path[1024];
     music_t *m;
 
+    if(quiet)
+        return NULL;
+
     if(NULL == (m = resourcemanager_find_music(path))) {
         resource_filepath(abs_path, path, sizeof(abs_path), RESFP_READ);
-        logfile_message("music_load('%s')", abs_path);
+        logfile_debug("music_load('%s')", abs_path);
 
         /* build the music object */
         m = mallocx(sizeof *m);
-        m->is_playing = FALSE;
         m->is_paused = FALSE;
+        m->played = m->finished = m->serial = 0;
 
         /* load the stream */
-        if(!(IS_VALID_FORMAT(path) && (m->stream = alureCreateStreamFromFile(abs_path, 250000, 0, NULL)))) {
+        profiler_begin(PROF_RESOURCES);
+        if(!(IS_VALID_FORMAT(path) && (m->stream = alureCreateStreamFromFile(abs_path, MUSIC_CHUNK_LENGTH, 0, NULL)))) {
+            profiler_end(PROF_RESOURCES);
 
             if(!IS_VALID_FORMAT(path)) {
                 logfile_message("music_load() invalid file format");
@@ -162,13 +293,14 @@ music_t *music_load(const char *path)
             free(m);
             return NULL;
         }
+        profiler_end(PROF_RESOURCES);
 
         /* adding it to the resource manager */
         resourcemanager_add_music(path, m);
         resourcemanager_ref_music(path);
 
         /* done! */
-        logfile_message("music_load() ok");
+        logfile_debug("music_load() ok");
     }
     else
         resourcemanager_ref_music(path);
@@ -207,6 +339,25 @@ int music_unref(const char *path)
 
 
 
+/*
+ * music_memory_usage()
+ * Approximate number of bytes used by a music.
+ * Musics are streamed: this is about the buffers.
+ */
+#ifndef __USE_OPENAL__
+int music_memory_usage(const music_t *music)
+{
+    return MUSIC_STREAM_MEMORY;
+}
+#else
+int music_memory_usage(const music_t *music)
+{
+    return MUSIC_CHUNK_LENGTH * NUM_BUFS;
+}
+#endif
+
+
+
 /*
  * music_destroy()
  * Destroys a music. This is called automatically
@@ -217,9 +368,15 @@ void music_destroy(music_t *music)
 {
     if(music != NULL) {
         if(music == current_music)
-            music_stop();
+            current_music = NULL;
+
+        lock_audio();
+        if(music == streamed_music)
+            exec_music_stop();
+        if(music->stream != NULL)
+            logg_destroy_stream(music->stream);
+        unlock_audio();
 
-        logg_destroy_stream(music->stream);
         free(music);
     }
 }
@@ -228,9 +385,14 @@ void music_destroy(music_t *music)
 {
     if(music != NULL) {
         if(music == current_music)
-            music_stop();
+            current_music = NULL;
 
+        lock_audio();
+        if(music == streamed_music)
+            exec_music_stop();
         alureDestroyStream(music->stream, 0, NULL);
+        unlock_audio();
+
         free(music);
     }
 }
@@ -242,103 +404,58 @@ void music_destroy(music_t *music)
  * Plays the given music and loops [loop] times.
  * Set loop equal to INFINITY to make it loop forever.
  */
-#ifndef __USE_OPENAL__
 void music_play(music_t *music, int loop)
 {
-    music_stop();
-
-    if(music != NULL) {
-        music->loops_left = loop;
-        music->is_paused = FALSE;
-        music->elapsed_time = 0.0f;
-        music->stream->loop = (loop >= INFINITY); /* "gambiarra", because LOGG lacks features */
-    }
+    audiocmd_t cmd;
 
-    current_music = music;
-    music_set_volume(1.0f);
-}
-#else
-void music_play(music_t *music, int loop)
-{
     music_stop();
 
     if(music != NULL) {
-        if(alurePlaySourceStream(srcmus, music->stream, NUM_BUFS, loop, eom_callback, (void*)music) == AL_FALSE) {
-            current_music = NULL;
-            return;
-        }
-
-        music->is_playing = TRUE;
         music->is_paused = FALSE;
+
+        cmd.type = AUDIOCMD_MUSIC_PLAY;
+        cmd.music = music;
+        cmd.loop = loop;
+        cmd.serial = ++(music->played);
+        send_command(&cmd);
     }
 
     current_music = music;
     music_set_volume(1.0f);
 }
 
-void eom_callback(void *userdata, ALuint source)
-{
-    music_t *music = (music_t*)userdata;
-
-    if(music != NULL) {
-        alureRewindStream(music->stream);
-        music->is_playing = FALSE;
-        music->is_paused = FALSE;
-    }
-
-    (void)source;
-}
-#endif
-
 
 /*
  * music_stop()
  * Stops the current music (if any)
  */
-#ifndef __USE_OPENAL__
 void music_stop()
 {
+    audiocmd_t cmd;
+
     if(current_music != NULL) {
-        char *filename = str_dup(current_music->stream->filename);
-        logg_destroy_stream(current_music->stream);
-        current_music->stream = logg_get_stream(filename, 255, 128, 0);
-        free(filename);
+        cmd.type = AUDIOCMD_MUSIC_STOP;
+        send_command(&cmd);
     }
 
     current_music = NULL;
 }
-#else
-void music_stop()
-{
-    if(current_music != NULL)
-        alureStopSource(srcmus, AL_TRUE); /* will call eom_callback */
-
-    current_music = NULL;
-}
-#endif
 
 
 /*
  * music_pause()
  * Pauses the current music
  */
-#ifndef __USE_OPENAL__
 void music_pause()
 {
-    if(current_music != NULL && !(current_music->is_paused)) {
-        current_music->is_paused = TRUE;
-        voice_stop(current_music->stream->audio_stream->voice);
-    }
-}
-#else
-void music_pause()
-{
-    if(current_music != NULL && current_music->is_playing && !(current_music->is_paused)) {
+    audiocmd_t cmd;
+
+    if(music_is_playing()) {
         current_music->is_paused = TRUE;
-        alurePauseSource(srcmus);
+        cmd.type = AUDIOCMD_MUSIC_PAUSE;
+        send_command(&cmd);
     }
 }
-#endif
 
 
 
@@ -346,23 +463,16 @@ void music_pause()
  * music_resume()
  * Resumes the current music
  */
-#ifndef __USE_OPENAL__
 void music_resume()
 {
+    audiocmd_t cmd;
+
     if(current_music != NULL && current_music->is_paused) {
         current_music->is_paused = FALSE;
-        voice_start(current_music->stream->audio_stream->voice);
-    }
-}
-#else
-void music_resume()
-{
-    if(current_music != NULL && current_music->is_playing && current_music->is_paused) {
-        current_music->is_paused = FALSE;
-        alureResumeSource(srcmus);
+        cmd.type = AUDIOCMD_MUSIC_RESUME;
+        send_command(&cmd);
     }
 }
-#endif
 
 
 /*
@@ -371,24 +481,17 @@ void music_resume()
  * 0.0f (quiet) <= volume <= 1.0f (loud)
  * default = 1.0f
  */
-#ifndef __USE_OPENAL__
-void music_set_volume(float volume)
-{
-    if(current_music != NULL) {
-        volume = clip(volume, 0.0f, 1.0f);
-        current_music->stream->volume = (int)(255.0f * volume);
-        voice_set_volume(current_music->stream->audio_stream->voice, current_music->stream->volume);
-    }
-}
-#else
 void music_set_volume(float volume)
 {
+    audiocmd_t cmd;
+
     if(current_music != NULL) {
-        volume = clip(volume, 0.0f, 1.0f);
-        alSourcef(srcmus, AL_GAIN, volume);
+        music_volume = clip(volume, 0.0f, 1.0f);
+        cmd.type = AUDIOCMD_MUSIC_VOLUME;
+        cmd.vol = music_volume;
+        send_command(&cmd);
     }
 }
-#endif
 
 
 /*
@@ -396,26 +499,10 @@ void music_set_volume(float volume)
  * Returns the volume of the current music.
  * 0.0f <= volume <= 1.0f
  */
-#ifndef __USE_OPENAL__
 float music_get_volume()
 {
-    if(current_music != NULL)
-        return (float)current_music->stream->volume / 255.0f;
-    else
-        return 0.0f;
-}
-#else
-float music_get_volume()
-{
-    if(current_music != NULL) {
-        float vol = 1.0f;
-        alGetSourcef(srcmus, AL_GAIN, &vol);
-        return vol;
-    }
-    else
-        return 0.0f;
+    return (current_music != NULL) ? music_volume : 0.0f;
 }
-#endif
 
 
 
@@ -424,17 +511,10 @@ float music_get_volume()
  * Returns TRUE if a music is playing, FALSE
  * otherwise.
  */
-#ifndef __USE_OPENAL__
-int music_is_playing()
-{
-    return (current_music != NULL) && !(current_music->is_paused) && (current_music->loops_left >= 0);
-}
-#else
 int music_is_playing()
 {
-    return (current_music != NULL) && !(current_music->is_paused) && (current_music->is_playing);
+    return (current_music != NULL) && !(current_music->is_paused) && (current_music->played != current_music->finished);
 }
-#endif
 
 
 /*
@@ -444,11 +524,13 @@ int music_is_playing()
 #ifndef __USE_OPENAL__
 float music_duration()
 {
-    return current_music ? MUSIC_DURATION(current_music) : 0.0f;
+    return current_music ? current_music->duration : 0.0f;
 }
 #else
 float music_duration()
 {
+    float duration = 0.0f;
+
     if(current_music != NULL) {
         /* the length of a sample
         ALint buf, bufSize, frequency, bitsPerSample, channels;
@@ -459,13 +541,18 @@ float music_duration()
         alGetBufferi(buf, AL_BITS, &bitsPerSample);    
         return ((float)bufSize) / (frequency * channels * (bitsPerSample / 8)); */
         ALint buf, freq;
-        alureInt64 numberOfSamples = alureGetStreamLength(current_music->stream);
+        alureInt64 numberOfSamples;
+
+        lock_audio();
+        numberOfSamples = alureGetStreamLength(current_music->stream);
         alGetSourcei(srcmus, AL_BUFFER, &buf);
         alGetBufferi(buf, AL_FREQUENCY, &freq); /* samples per second */
-        return (float)(numberOfSamples / ((alureInt64)freq));
+        unlock_audio();
+
+        duration = (float)(numberOfSamples / ((alureInt64)freq));
     }
-    else
-        return 0.0f;
+
+    return duration;
 }
 #endif
 
@@ -483,18 +570,29 @@ float music_duration()
 sound_t *sound_load(const char *path)
 {
     char abs_path[1024];
+    pcmsample_t pcm;
     sound_t *s;
 
     if(NULL == (s = resourcemanager_find_sample(path))) {
         resource_filepath(abs_path, path, sizeof(abs_path), RESFP_READ);
-        logfile_message("sound_load('%s')", abs_path);
+        logfile_debug("sound_load('%s')", abs_path);
 
         /* build the sound object */
         s = mallocx(sizeof *s);
-        s->voice_id = SOUND_INVALID_VOICE;
-
-        /* loading the sample */
-        if(NULL == (s->data = IS_OGG(path) ? logg_load(abs_path) : load_sample(abs_path))) {
+        s->played = s->stopped = s->finished = s->serial = 0;
+        s->voices = 0;
+        s->own_data = NULL;
+
+        /* loading the sample (decoded, if it's in the cache) */
+        profiler_begin(PROF_RESOURCES);
+        if(pcmcache_find(abs_path, &pcm))
+            s->data = map_sample(&pcm, &(s->own_data));
+        else if(NULL != (s->data = IS_OGG(path) ? logg_load(abs_path) : load_sample(abs_path))) {
+            sample_to_pcm(s->data, &pcm);
+            pcmcache_add(abs_path, &pcm);
+        }
+        profiler_end(PROF_RESOURCES);
+        if(s->data == NULL) {
             logfile_message("sound_load() error: %s", allegro_error);
             free(s);
             return NULL;
@@ -505,7 +603,7 @@ sound_t *sound_load(const char *path)
         resourcemanager_ref_sample(path);
 
         /* done! */
-        logfile_message("sound_load() ok");
+        logfile_debug("sound_load() ok");
     }
     else
         resourcemanager_ref_sample(path);
@@ -523,16 +621,17 @@ sound_t *sound_load(const char *path)
 
     if(NULL == (s = resourcemanager_find_sample(path))) {
         resource_filepath(abs_path, path, sizeof(abs_path), RESFP_READ);
-        logfile_message("sound_load('%s')", abs_path);
+        logfile_debug("sound_load('%s')", abs_path);
 
         /* build the sound object */
         s = mallocx(sizeof *s);
-        s->loops_left = 0;
-        s->is_playing = FALSE;
-        s->src = NULL;
+        s->played = s->stopped = s->finished = s->serial = 0;
+        s->voices = 0;
 
         /* loading the sample */
-        if(!(IS_VALID_FORMAT(path) && (s->buf = alureCreateBufferFromFile(abs_path)))) {
+        profiler_begin(PROF_RESOURCES);
+        if(!(IS_VALID_FORMAT(path) && (s->buf = create_buffer(abs_path)))) {
+            profiler_end(PROF_RESOURCES);
             
             if(!IS_VALID_FORMAT(path)) {
                 logfile_message("sound_load() error: invalid file format");
@@ -544,6 +643,7 @@ sound_t *sound_load(const char *path)
             free(s);
             return NULL;
         }
+        profiler_end(PROF_RESOURCES);
 
         /* we'll need to release the array of buffers later */
         sbuf[sbuf_count] = s->buf;
@@ -558,7 +658,7 @@ sound_t *sound_load(const char *path)
         resourcemanager_ref_sample(path);
 
         /* done! */
-        logfile_message("sound_load() ok");
+        logfile_debug("sound_load() ok");
     }
     else
         resourcemanager_ref_sample(path);
@@ -603,17 +703,45 @@ int sound_unref(const char *path)
 void sound_destroy(sound_t *sample)
 {
     if(sample != NULL) {
-        sound_stop(sample);
+        lock_audio();
+        exec_sound_stop(sample);
+        if(sample->own_data != NULL)
+            sample->data->data = sample->own_data; /* don't free the sample cache */
         destroy_sample(sample->data);
+        unlock_audio();
+
         free(sample);
     }
 }
 #else
 void sound_destroy(sound_t *sample)
 {
+    int i;
+    ALint buf;
+
     if(sample != NULL) {
-        sound_stop(sample);
-        /* the buffers will be deleted later, in audio_release() */
+        lock_audio();
+        exec_sound_stop(sample);
+
+        /* a buffer can't be deleted while it's attached to a source */
+        for(i=0; i<src_count; i++) {
+            alGetSourcei(src[i], AL_BUFFER, &buf);
+            if((ALuint)buf == sample->buf) {
+                alSourceStop(src[i]);
+                alSourcei(src[i], AL_BUFFER, 0);
+            }
+        }
+
+        /* delete the buffer and forget it (see audio_release()) */
+        for(i=0; i<sbuf_count; i++) {
+            if(sbuf[i] == sample->buf) {
+                alDeleteBuffers(1, &(sbuf[i]));
+                sbuf[i] = sbuf[--sbuf_count];
+                break;
+            }
+        }
+
+        unlock_audio();
         free(sample);
     }
 }
@@ -621,20 +749,32 @@ void sound_destroy(sound_t *sample)
 
 
 /*
- * sound_play()
- * Plays the given sample
+ * sound_memory_usage()
+ * Number of bytes used by a sample
  */
 #ifndef __USE_OPENAL__
-void sound_play(sound_t *sample)
+int sound_memory_usage(const sound_t *sample)
 {
-    sound_play_ex(sample, 1.0, 0.0, 1.0, 0);
+    return (int)(sample->data->len) * (sample->data->bits / 8) * (sample->data->stereo ? 2 : 1);
 }
 #else
+int sound_memory_usage(const sound_t *sample)
+{
+    ALint size = 0;
+    alGetBufferi(sample->buf, AL_SIZE, &size);
+    return (int)size;
+}
+#endif
+
+
+/*
+ * sound_play()
+ * Plays the given sample
+ */
 void sound_play(sound_t *sample)
 {
     sound_play_ex(sample, 1.0, 0.0, 1.0, 0);
 }
-#endif
 
 
 /*
@@ -646,73 +786,24 @@ void sound_play(sound_t *sample)
  * 1.0 = default frequency
  * 0 = no loops
  */
-#ifndef __USE_OPENAL__
 void sound_play_ex(sound_t *sample, float vol, float pan, float freq, int loop)
 {
-    int id;
+    audiocmd_t cmd;
 
     if(sample) {
         /* ajusting parameters */
-        vol = clip(vol, 0.0f, 1.0f);
-        pan = clip(pan, -1.0f, 1.0f);
-        freq = max(freq, 0.0f);
-        loop = (loop < 0) ? -1 : loop;
+        cmd.type = AUDIOCMD_SOUND_PLAY;
+        cmd.sample = sample;
+        cmd.vol = clip(vol, 0.0f, 1.0f);
+        cmd.pan = clip(pan, -1.0f, 1.0f);
+        cmd.freq = max(freq, 0.0f);
+        cmd.loop = (loop < 0) ? -1 : loop;
+        cmd.serial = ++(sample->played);
 
         /* playing the sample */
-        id = play_sample(sample->data, (int)(255.0f * vol), min(255.0f, 128.0f + (int)(128.0f * pan)), (int)(1000.0f * freq), loop);
-        sample->voice_id = id < 0 ? SOUND_INVALID_VOICE : id;
+        send_command(&cmd);
     }
 }
-#else
-void sound_play_ex(sound_t *sample, float vol, float pan, float freq, int loop)
-{
-    if(sample) {
-        /* ajusting parameters */
-        vol = clip(vol, 0.0f, 1.0f);
-        pan = clip(pan, -1.0f, 1.0f);
-        freq = max(freq, 0.0f);
-        loop = (loop < 0) ? -1 : loop;
-
-        /* saving the parameters */
-        sample->loops_left = loop;
-        sample->vol = vol;
-        sample->pan = pan;
-        sample->freq = freq;
-
-        /* find a sound source */
-        src_ptr = (src_ptr + 1) % src_count;
-        sample->src = src + src_ptr;
-        alureStopSource(*(sample->src), AL_FALSE);
-
-        /* configuring... */
-        alSourcei(*(sample->src), AL_BUFFER, sample->buf);
-        alSourcef(*(sample->src), AL_GAIN, vol);
-        alSourcef(*(sample->src), AL_PITCH, freq); /* I hope this is correct... ;) */
-        alSource3f(*(sample->src), AL_POSITION, 1.0f * pan, 0.0f, 0.0f); /* ??????? */
-
-        /* playing the sample */
-        if(alurePlaySource(*(sample->src), eos_callback, (void*)sample) != AL_FALSE)
-            sample->is_playing = TRUE;
-        else
-            sample->is_playing = FALSE;
-    }
-}
-
-/* gets called when a sample finishes playing */
-void eos_callback(void *userdata, ALuint source)
-{
-    sound_t *sample = (sound_t*)userdata;
-
-    if(sample != NULL) {
-        if(sample->loops_left > 0)
-            sound_play_ex(sample, sample->vol, sample->pan, sample->freq, sample->loops_left-1);
-        else
-            sample->is_playing = FALSE;
-    }
-
-    (void)source;
-}
-#endif
 
 
 
@@ -720,44 +811,30 @@ void eos_callback(void *userdata, ALuint source)
  * sound_stop()
  * Stops a sample
  */
-#ifndef __USE_OPENAL__
-void sound_stop(sound_t *sample)
-{
-    if(sample)
-        stop_sample(sample->data);
-}
-#else
 void sound_stop(sound_t *sample)
 {
-    if(sample && sample->is_playing) {
-        alureStopSource(*(sample->src), AL_FALSE);
-        sample->is_playing = FALSE;
+    audiocmd_t cmd;
+
+    if(sample) {
+        sample->stopped = sample->played;
+        cmd.type = AUDIOCMD_SOUND_STOP;
+        cmd.sample = sample;
+        send_command(&cmd);
     }
 }
-#endif
 
 
 /*
  * sound_is_playing()
  * Checks if a given sound is playing or not
  */
-#ifndef __USE_OPENAL__
-int sound_is_playing(sound_t *sample)
-{
-    if(sample && sample->voice_id != SOUND_INVALID_VOICE)
-        return (voice_check(sample->voice_id) == sample->data);
-    else
-        return FALSE;
-}
-#else
 int sound_is_playing(sound_t *sample)
 {
     if(sample)
-        return sample->is_playing;
+        return (sample->played != sample->stopped) && (sample->played != sample->finished);
     else
         return FALSE;
 }
-#endif
 
 
 
@@ -773,11 +850,23 @@ int sound_is_playing(sound_t *sample)
  * Initializes the Audio Manager
  */
 #ifndef __USE_OPENAL__
-void audio_init()
+void audio_init(int headless)
 {
     int voices;
     logfile_message("audio_init(): using Allegro for audio playback...");
-    current_music = NULL;
+    current_music = streamed_music = NULL;
+    music_volume = 1.0f;
+    audio_thread = NULL;
+    init_voices(0);
+
+    /* headless mode: no sound device */
+    if(headless) {
+        if(install_sound(DIGI_NONE, MIDI_NONE, NULL) != 0)
+            logfile_message("Warning: can't install the null sound driver.\n%s\n", allegro_error);
+        init_voices(PREFERRED_NUMBER_OF_VOICES);
+        logfile_message("audio_init() ok (headless)");
+        return;
+    }
 
     /* allocates a few voices */
     voices = PREFERRED_NUMBER_OF_VOICES;
@@ -786,6 +875,8 @@ void audio_init()
         reserve_voices(voices, 0);
         if(install_sound(DIGI_AUTODETECT, MIDI_NONE, NULL) == 0) {
             logfile_message("Reserved %d voices.", voices);
+            init_voices(voices - 1); /* one is for the music */
+            start_audio_thread();
             logfile_message("audio_init() ok");
             return;
         }
@@ -795,13 +886,23 @@ void audio_init()
     logfile_message("Warning: unable to reserve voices.\n%s\n", allegro_error);
 }
 #else
-void audio_init()
+void audio_init(int headless)
 {
     int sources;
 
     logfile_message("audio_init(): using OpenAL for audio playback...");
+    current_music = streamed_music = NULL;
+    music_volume = 1.0f;
+    audio_thread = NULL;
+    init_voices(0);
     quiet = TRUE;
 
+    /* headless mode: no sound device */
+    if(headless) {
+        logfile_message("audio_init() ok (headless)");
+        return;
+    }
+
     /* initialize the OpenAL device */
     if(alureInitDevice(NULL, NULL)) {
         /* allocating some buffers */
@@ -819,11 +920,11 @@ void audio_init()
                 logfile_message("%d sources have been generated.", src_count = sources);
                 alGenSources(1, &srcmus);
                 if(alGetError() == AL_NO_ERROR) {
-                    logfile_message("audio_init() ok");
-                    src_ptr = 0;
+                    init_voices(src_count);
                     quiet = FALSE;
                     alureStreamSizeIsMicroSec(AL_TRUE);
-                    alureUpdateInterval(0.125f);
+                    start_audio_thread(); /* it calls alureUpdate() */
+                    logfile_message("audio_init() ok");
                     return;
                 }
                 else
@@ -850,12 +951,16 @@ void audio_init()
 void audio_release()
 {
     logfile_message("audio_release()");
+    stop_audio_thread();
+    logfile_message("Sounds: %d played, %d merged, %d stole a voice, %d dropped", play_count, merge_count, steal_count, drop_count);
     logfile_message("audio_release() ok");
 }
 #else
 void audio_release()
 {
     logfile_message("audio_release()");
+    stop_audio_thread();
+    logfile_message("Sounds: %d played, %d merged, %d stole a voice, %d dropped", play_count, merge_count, steal_count, drop_count);
 
     if(!quiet) {
         logfile_message("Deleting audio buffers...");
@@ -874,32 +979,595 @@ void audio_release()
 
 /*
  * audio_update()
- * Updates the audio manager
+ * Updates the audio manager. If there's an
+ * audio thread, it does the job instead
  */
-#ifndef __USE_OPENAL__
 void audio_update()
 {
-    /* updating the music */
-    if(current_music != NULL && !(current_music->is_paused)) {
-        logg_update_stream(current_music->stream);
+    if(audio_thread == NULL)
+        feed_streams(timer_get_delta());
+}
+
+
+
+
+
+/* private methods */
+
+/* starts the audio thread */
+void start_audio_thread()
+{
+    logfile_message("Starting the audio thread...");
+    queue_head = queue_tail = 0;
+    audio_thread_quit = FALSE;
+    audio_mutex = mutex_create();
+    audio_thread = thread_create(audio_routine, NULL);
+}
+
+/* stops the audio thread, running the remaining commands */
+void stop_audio_thread()
+{
+    if(audio_thread != NULL) {
+        logfile_message("Stopping the audio thread...");
+        audio_thread_quit = TRUE;
+        audio_thread = thread_join(audio_thread);
+        run_commands();
+        audio_mutex = mutex_destroy(audio_mutex);
+    }
+}
+
+/* the audio thread: runs the commands and feeds the streams */
+void audio_routine(void *arg)
+{
+    uint64 now, last = timer_get_nanoseconds();
+
+    while(!audio_thread_quit) {
+        mutex_lock(audio_mutex);
+        run_commands();
+        now = timer_get_nanoseconds();
+        feed_streams((float)((double)(now - last) * 1e-9));
+        last = now;
+        mutex_unlock(audio_mutex);
+
+        thread_sleep(AUDIO_THREAD_INTERVAL);
+    }
+}
+
+/* posts a command to the audio thread, or runs it
+   right away if there's no audio thread (main thread) */
+void send_command(const audiocmd_t *cmd)
+{
+    if(audio_thread == NULL) {
+        run_command(cmd);
+        return;
+    }
+
+    /* the queue is full: the audio thread is stuck? */
+    while(queue_tail - queue_head >= AUDIO_QUEUE_SIZE)
+        thread_sleep(1);
+
+    queue[queue_tail % AUDIO_QUEUE_SIZE] = *cmd;
+    thread_barrier(); /* the command must be written before it's published */
+    queue_tail++;
+}
+
+/* runs the pending commands. There's only one consumer at
+   a time: the audio thread, or the main thread holding
+   audio_mutex (see lock_audio()) */
+void run_commands()
+{
+    while(queue_head != queue_tail) {
+        thread_barrier(); /* don't read the command before seeing the tail */
+        run_command(&queue[queue_head % AUDIO_QUEUE_SIZE]);
+        thread_barrier(); /* done with the slot before releasing it */
+        queue_head++;
+    }
+}
+
+/* runs a command */
+void run_command(const audiocmd_t *cmd)
+{
+    switch(cmd->type) {
+        case AUDIOCMD_MUSIC_PLAY:   exec_music_play(cmd->music, cmd->loop, cmd->serial); break;
+        case AUDIOCMD_MUSIC_STOP:   exec_music_stop(); break;
+        case AUDIOCMD_MUSIC_PAUSE:  exec_music_pause(); break;
+        case AUDIOCMD_MUSIC_RESUME: exec_music_resume(); break;
+        case AUDIOCMD_MUSIC_VOLUME: exec_music_set_volume(cmd->vol); break;
+        case AUDIOCMD_SOUND_PLAY:   exec_sound_play(cmd->sample, cmd->vol, cmd->pan, cmd->freq, cmd->loop, cmd->serial); break;
+        case AUDIOCMD_SOUND_STOP:   exec_sound_stop(cmd->sample); break;
+    }
+}
+
+/* the main thread needs to touch the device: it makes the
+   audio thread wait and runs the pending commands itself, so
+   that none of them refers to something that's about to go */
+void lock_audio()
+{
+    if(audio_thread != NULL) {
+        mutex_lock(audio_mutex);
+        run_commands();
+    }
+}
+
+/* lets the audio thread work again */
+void unlock_audio()
+{
+    if(audio_thread != NULL)
+        mutex_unlock(audio_mutex);
+}
+
+
+
+/* voice manager: these run on the audio thread (or on the main
+   thread, if there's no audio thread or if it holds the lock) */
+
+/* plays a sample */
+void exec_sound_play(sound_t *sample, float vol, float pan, float freq, int loop, uint32 serial)
+{
+    uint64 now = timer_get_nanoseconds();
+    float priority = sound_priority(vol, loop);
+    voice_t *v;
+    int i;
+
+    refresh_voices();
+    sample->serial = serial;
+    play_count++;
+
+    /* the same sample has just been triggered: one voice is enough */
+    if(loop == 0) {
+        for(i=0; i<voice_count; i++) {
+            v = &(voice[i]);
+            if(v->sample == sample && v->loops_left == 0 && now - v->start_time < MERGE_INTERVAL) {
+                if(vol > v->vol)
+                    set_voice_volume(v, vol);
+                v->serial = serial;
+                merge_count++;
+                return;
+            }
+        }
+    }
+
+    /* find a voice */
+    if(NULL == (v = find_voice(sample, priority, now))) {
+        /* all the voices are playing more important stuff */
+        if(sample->voices == 0)
+            sample->finished = serial;
+        drop_count++;
+        return;
+    }
+    else if(v->sample != NULL) {
+        stop_voice(v);
+        release_voice(v);
+        steal_count++;
+    }
+
+    /* play it */
+    v->sample = sample;
+    v->serial = serial;
+    v->priority = priority;
+    v->start_time = now;
+    v->vol = vol;
+    v->pan = pan;
+    v->freq = freq;
+    v->loops_left = loop;
+    sample->voices++;
+    if(!start_voice(v))
+        release_voice(v);
+}
+
+/* stops all the voices playing a sample */
+void exec_sound_stop(sound_t *sample)
+{
+    int i;
+
+    for(i=0; i<voice_count; i++) {
+        if(voice[i].sample == sample) {
+            stop_voice(&(voice[i]));
+            release_voice(&(voice[i]));
+        }
+    }
+}
+
+/* sets up the voice manager */
+void init_voices(int count)
+{
+    int i;
+
+    voice_count = clip(count, 0, PREFERRED_NUMBER_OF_VOICES);
+    for(i=0; i<PREFERRED_NUMBER_OF_VOICES; i++)
+        voice[i].sample = NULL;
+
+    play_count = merge_count = steal_count = drop_count = 0;
+}
+
+/* finds a voice for a new sound: a free one, or the oldest
+   voice of the same sample if it's being played too many
+   times, or the least important one. Returns NULL if all
+   the voices are playing more important sounds */
+voice_t *find_voice(sound_t *sample, float priority, uint64 now)
+{
+    voice_t *v, *free_voice = NULL, *oldest = NULL, *victim = NULL;
+    int i, instances = 0;
+
+    for(i=0; i<voice_count; i++) {
+        v = &(voice[i]);
+        if(v->sample == NULL) {
+            if(free_voice == NULL)
+                free_voice = v;
+        }
+        else if(v->sample == sample) {
+            instances++;
+            if(oldest == NULL || v->start_time < oldest->start_time)
+                oldest = v;
+        }
+        else if(v->priority <= priority) {
+            if(victim == NULL || v->priority < victim->priority || (v->priority == victim->priority && v->start_time < victim->start_time))
+                victim = v;
+        }
+    }
+
+    if(instances >= MAX_INSTANCES_PER_SAMPLE)
+        return oldest;
+    else if(free_voice != NULL)
+        return free_voice;
+    else if(victim != NULL)
+        return victim;
+    else
+        return oldest; /* restarts a copy of the same sample */
+}
+
+/* the voice is no longer playing its sample */
+void release_voice(voice_t *v)
+{
+    sound_t *sample = v->sample;
+
+    if(sample != NULL) {
+        if(--(sample->voices) <= 0) {
+            sample->voices = 0;
+            sample->finished = sample->serial;
+        }
+        v->sample = NULL;
+    }
+}
+
+/* how important is a sound? Louder sounds are more important, and
+   looping sounds (e.g., alarms) are the most noticeable when cut */
+float sound_priority(float vol, int loop)
+{
+    return vol + ((loop != 0) ? 1.0f : 0.0f);
+}
+
+
+
+/* backend: these run on the audio thread (or on the main
+   thread, if there's no audio thread or if it holds the lock) */
+
+#ifndef __USE_OPENAL__
+
+/* keeps the music stream fed */
+void feed_streams(float dt)
+{
+    music_t *m = streamed_music;
+
+    if(m != NULL && !streamed_music_paused) {
+        logg_update_stream(m->stream);
 
         /* "gambiarra" (ugly hack), because LOGG lacks features */
-        if(!(current_music->stream->loop)) {
-            current_music->elapsed_time += timer_get_delta();
-            if(current_music->elapsed_time >= MUSIC_DURATION(current_music) + 0.25f) {
-                if(--(current_music->loops_left) >= 0)
-                    music_play(current_music, current_music->loops_left);
-                else
-                    music_stop();
+        if(!(m->stream->loop)) {
+            m->elapsed_time += dt;
+            if(m->elapsed_time >= m->duration + 0.25f) {
+                if(--(m->loops_left) < 0 || !rewind_music(m))
+                    exec_music_stop();
             }
         }
     }
 }
+
+void exec_music_play(music_t *music, int loop, uint32 serial)
+{
+    exec_music_stop();
+
+    music->serial = serial;
+    if(music->stream == NULL) {
+        music->finished = serial;
+        return;
+    }
+
+    music->loops_left = loop;
+    music->elapsed_time = 0.0f;
+    music->stream->loop = (loop >= INFINITY); /* "gambiarra", because LOGG lacks features */
+
+    streamed_music = music;
+    streamed_music_paused = FALSE;
+}
+
+void exec_music_stop()
+{
+    if(streamed_music != NULL) {
+        rewind_music(streamed_music);
+        streamed_music->finished = streamed_music->serial;
+    }
+
+    streamed_music = NULL;
+}
+
+void exec_music_pause()
+{
+    if(streamed_music != NULL && !streamed_music_paused) {
+        streamed_music_paused = TRUE;
+        voice_stop(streamed_music->stream->audio_stream->voice);
+    }
+}
+
+void exec_music_resume()
+{
+    if(streamed_music != NULL && streamed_music_paused) {
+        streamed_music_paused = FALSE;
+        voice_start(streamed_music->stream->audio_stream->voice);
+    }
+}
+
+void exec_music_set_volume(float volume)
+{
+    if(streamed_music != NULL) {
+        streamed_music->stream->volume = (int)(255.0f * volume);
+        voice_set_volume(streamed_music->stream->audio_stream->voice, streamed_music->stream->volume);
+    }
+}
+
+int start_voice(voice_t *v)
+{
+    SAMPLE *data = v->sample->data;
+
+    /* if Allegro runs out of voices, it reuses the one with the lowest priority */
+    data->priority = clip((int)(v->priority * 127.0f), 0, 255);
+    v->id = play_sample(data, (int)(255.0f * v->vol), min(255.0f, 128.0f + (int)(128.0f * v->pan)), (int)(1000.0f * v->freq), v->loops_left);
+    return v->id >= 0;
+}
+
+void stop_voice(voice_t *v)
+{
+    if(voice_check(v->id) == v->sample->data)
+        deallocate_voice(v->id);
+}
+
+void set_voice_volume(voice_t *v, float vol)
+{
+    v->vol = vol;
+    if(voice_check(v->id) == v->sample->data)
+        voice_set_volume(v->id, (int)(255.0f * vol));
+}
+
+/* Allegro releases the voices by itself */
+void refresh_voices()
+{
+    int i;
+
+    for(i=0; i<voice_count; i++) {
+        if(voice[i].sample != NULL && voice_check(voice[i].id) != voice[i].sample->data)
+            release_voice(&(voice[i]));
+    }
+}
+
+/* LOGG can't rewind a stream: we open it again. Returns
+   FALSE if that fails (the music can't be played anymore) */
+int rewind_music(music_t *music)
+{
+    char *filename;
+
+    if(music->stream == NULL)
+        return FALSE;
+
+    filename = str_dup(music->stream->filename);
+    logg_destroy_stream(music->stream);
+    music->stream = logg_get_stream(filename, 255, 128, 0);
+    music->elapsed_time = 0.0f;
+    free(filename);
+
+    return music->stream != NULL;
+}
+
+/* creates a SAMPLE whose audio lives in the sample cache. Allegro's
+   own buffer is kept in *own_data, so that we can destroy it later */
+SAMPLE* map_sample(const pcmsample_t *pcm, void **own_data)
+{
+    SAMPLE *spl;
+
+    if(NULL == (spl = create_sample(pcm->bits, pcm->channels == 2, pcm->freq, 1)))
+        return NULL;
+
+    *own_data = spl->data;
+    spl->data = (void*)pcm->data;
+    spl->len = spl->loop_end = pcm->length;
+    return spl;
+}
+
 #else
-void audio_update()
+
+/* ALURE feeds the music stream and calls eos_callback()
+   and eom_callback() from alureUpdate() */
+void feed_streams(float dt)
 {
-    /* alureUpdate() somehow won't call the eos_callbacks... */
-    /*if(!quiet)
-        alureUpdate();*/
+    if(!quiet)
+        alureUpdate();
+
+    (void)dt;
+}
+
+void exec_music_play(music_t *music, int loop, uint32 serial)
+{
+    exec_music_stop();
+
+    music->serial = serial;
+    if(alurePlaySourceStream(srcmus, music->stream, NUM_BUFS, loop, eom_callback, (void*)music) == AL_FALSE) {
+        music->finished = serial;
+        return;
+    }
+
+    streamed_music = music;
+    streamed_music_paused = FALSE;
+}
+
+/* gets called when the music finishes playing */
+void eom_callback(void *userdata, ALuint source)
+{
+    music_t *music = (music_t*)userdata;
+
+    if(music != NULL) {
+        alureRewindStream(music->stream);
+        music->finished = music->serial;
+        if(music == streamed_music)
+            streamed_music = NULL;
+    }
+
+    (void)source;
 }
+
+void exec_music_stop()
+{
+    if(streamed_music != NULL)
+        alureStopSource(srcmus, AL_TRUE); /* will call eom_callback */
+
+    streamed_music = NULL;
+}
+
+void exec_music_pause()
+{
+    if(streamed_music != NULL && !streamed_music_paused) {
+        streamed_music_paused = TRUE;
+        alurePauseSource(srcmus);
+    }
+}
+
+void exec_music_resume()
+{
+    if(streamed_music != NULL && streamed_music_paused) {
+        streamed_music_paused = FALSE;
+        alureResumeSource(srcmus);
+    }
+}
+
+void exec_music_set_volume(float volume)
+{
+    if(streamed_music != NULL)
+        alSourcef(srcmus, AL_GAIN, volume);
+}
+
+int start_voice(voice_t *v)
+{
+    ALuint source = src[v - voice];
+
+    /* configuring... */
+    alureStopSource(source, AL_FALSE);
+    alSourcei(source, AL_BUFFER, v->sample->buf);
+    alSourcef(source, AL_GAIN, v->vol);
+    alSourcef(source, AL_PITCH, v->freq); /* I hope this is correct... ;) */
+    alSource3f(source, AL_POSITION, 1.0f * v->pan, 0.0f, 0.0f); /* ??????? */
+
+    /* playing the sample */
+    return alurePlaySource(source, eos_callback, (void*)v) != AL_FALSE;
+}
+
+/* gets called when a voice finishes playing */
+void eos_callback(void *userdata, ALuint source)
+{
+    voice_t *v = (voice_t*)userdata;
+
+    if(v != NULL && v->sample != NULL) {
+        if(v->loops_left > 0) {
+            v->loops_left--;
+            if(!start_voice(v))
+                release_voice(v);
+        }
+        else
+            release_voice(v);
+    }
+
+    (void)source;
+}
+
+void stop_voice(voice_t *v)
+{
+    alureStopSource(src[v - voice], AL_FALSE);
+}
+
+void set_voice_volume(voice_t *v, float vol)
+{
+    v->vol = vol;
+    alSourcef(src[v - voice], AL_GAIN, vol);
+}
+
+/* eos_callback() releases the voices */
+void refresh_voices()
+{
+}
+
+/* loads a sample into a new buffer. ALURE doesn't give us the
+   decoded audio, so we decode the WAVs ourselves in order to
+   cache them. Returns 0 on error */
+ALuint create_buffer(const char *abs_path)
+{
+    pcmsample_t pcm;
+    SAMPLE *spl;
+    ALuint buf;
+
+    if(pcmcache_find(abs_path, &pcm))
+        return buffer_from_pcm(&pcm);
+
+    if(IS_WAV(abs_path) && NULL != (spl = load_sample(abs_path))) {
+        sample_to_pcm(spl, &pcm);
+        if(0 != (buf = buffer_from_pcm(&pcm)))
+            pcmcache_add(abs_path, &pcm);
+        destroy_sample(spl);
+        if(buf != 0)
+            return buf;
+    }
+
+    return alureCreateBufferFromFile(abs_path);
+}
+
+/* creates a buffer with the given audio. Returns 0 on error */
+ALuint buffer_from_pcm(const pcmsample_t *pcm)
+{
+    const void *data = pcm->data;
+    short *converted = NULL;
+    ALenum format;
+    ALuint buf = 0;
+    int i, n = pcm->length * pcm->channels;
+
+    if(pcm->bits == 16) {
+        /* Allegro's 16-bit samples are unsigned; OpenAL's are signed */
+        converted = mallocx(n * sizeof *converted);
+        for(i=0; i<n; i++)
+            converted[i] = (short)(((const unsigned short*)pcm->data)[i] ^ 0x8000);
+        data = converted;
+        format = (pcm->channels == 2) ? AL_FORMAT_STEREO16 : AL_FORMAT_MONO16;
+    }
+    else
+        format = (pcm->channels == 2) ? AL_FORMAT_STEREO8 : AL_FORMAT_MONO8;
+
+    alGetError();
+    alGenBuffers(1, &buf);
+    alBufferData(buf, format, data, n * (pcm->bits / 8), pcm->freq);
+    if(alGetError() != AL_NO_ERROR && buf != 0) {
+        alDeleteBuffers(1, &buf);
+        buf = 0;
+    }
+
+    if(converted != NULL)
+        free(converted);
+
+    return buf;
+}
+
 #endif
+
+/* describes the audio of an Allegro sample */
+void sample_to_pcm(const SAMPLE *spl, pcmsample_t *pcm)
+{
+    pcm->freq = spl->freq;
+    pcm->bits = spl->bits;
+    pcm->channels = spl->stereo ? 2 : 1;
+    pcm->length = (int)spl->len;
+    pcm->data = spl->data;
+}
@@ -28,7 +28,7 @@ typedef struct sound_t sound_t;
 
 
 /* audio manager */
-void audio_init();
+void audio_init(int headless); /* if headless, no sound device is used */
 void audio_update();
 void audio_release();
 
@@ -45,6 +45,7 @@ float music_get_volume();
 int music_is_playing();
 int music_unref(const char *path); /* returns the number of active references */
 float music_duration(); /* in seconds */
+int music_memory_usage(const music_t *music); /* approximate, in bytes */
 
 
 /* sample management */
@@ -55,5 +56,6 @@ void sound_play_ex(sound_t *sample, float vol, float pan, float freq, int loop);
 void sound_stop(sound_t *sample);
 int sound_is_playing(sound_t *sample);
 int sound_unref(const char *path); /* returns the number of active references */
+int sound_memory_usage(const sound_t *sample); /* in bytes */
 
 #endif
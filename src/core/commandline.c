@@ -31,6 +31,7 @@
 #include "video.h"
 #include "lang.h"
 #include "preferences.h"
+#include "levelfile.h"
 
 #ifdef __WIN32__
 #include <allegro.h>
@@ -67,6 +68,19 @@ commandline_t commandline_parse(int argc, char **argv)
     cmd.use_gamepad = preferences_get_usegamepad();
     cmd.optimize_cpu_usage = TRUE;
     cmd.allow_font_smoothing = TRUE;
+    cmd.flip_cache_budget = 4096;
+    cmd.use_script_cache = TRUE;
+    cmd.use_sample_cache = TRUE;
+    cmd.memory_budget = 131072;
+    cmd.tick_rate = 60;
+    cmd.max_fps = 60;
+    cmd.headless = FALSE;
+    cmd.quit_after = 0;
+    str_cpy(cmd.record_path, "", sizeof(cmd.record_path));
+    str_cpy(cmd.replay_path, "", sizeof(cmd.replay_path));
+    cmd.profile = FALSE;
+    str_cpy(cmd.trace_path, "", sizeof(cmd.trace_path));
+    cmd.hitch_threshold = 50;
 
     /* logfile */
     logfile_message("game arguments:");
@@ -98,6 +112,20 @@ commandline_t commandline_parse(int argc, char **argv)
                 "    --basedir \"/path/to/data\" pretends that all data files are located in the provided folder (***)\n"
                 "    --full-cpu-usage          uses 100%% of the CPU (**)\n"
                 "    --no-font-smoothing       disable antialiased fonts (improves the speed **)\n"
+                "    --flip-cache-budget X     uses at most X kilobytes to store pre-flipped sprite frames (default: %d)\n"
+                "    --no-script-cache         always parse the scripts, ignoring the precompiled ones\n"
+                "    --no-sample-cache         always decode the samples, ignoring the cached ones\n"
+                "    --memory-budget X         unused images, samples and musics are released when the resources take more than X kilobytes (default: %d)\n"
+                "    --tick-rate X             runs the game logic X times per second (default: %d)\n"
+                "    --max-fps X               renders at most X frames per second, or as fast as possible if X = 0 (default: %d)\n"
+                "    --headless                runs without a window, sound or input devices, as fast as possible\n"
+                "    --quit-after X            quits after X steps of the game logic\n"
+                "    --record \"FILEPATH\"       records the input of this session to a replay file\n"
+                "    --replay \"FILEPATH\"       plays the session recorded in a replay file, then quits\n"
+                "    --profile                 shows where the time of each frame goes\n"
+                "    --trace \"FILEPATH\"        profiles the game and writes the last frames to FILEPATH (chrome://tracing) when quitting\n"
+                "    --hitch-threshold X       reports the frames that take longer than X milliseconds (and where their time went, if profiling) in the logfile, or none if X = 0 (default: %d)\n"
+                "    --convert-level SRC DEST  converts the level SRC from the text form (.lev) to the binary form, or vice-versa, and quits\n"
                 "\n"
                 "(*) This option may be used to improve the graphic quality using a special algorithm.\n"
                 "    You should NOT use this option on slow computers, since it may imply a severe performance hit.\n"
@@ -111,7 +139,7 @@ commandline_t commandline_parse(int argc, char **argv)
             GAME_TITLE, basename(argv[0]),
             VIDEO_SCREEN_W, VIDEO_SCREEN_H, VIDEO_SCREEN_W*2, VIDEO_SCREEN_H*2,
             VIDEO_SCREEN_W*3, VIDEO_SCREEN_H*3, VIDEO_SCREEN_W*4, VIDEO_SCREEN_H*4,
-            DEFAULT_LANGUAGE_FILEPATH, GAME_UNIXNAME);
+            DEFAULT_LANGUAGE_FILEPATH, cmd.flip_cache_budget, cmd.memory_budget, cmd.tick_rate, cmd.max_fps, cmd.hitch_threshold, GAME_UNIXNAME);
             exit(0);
         }
 
@@ -173,6 +201,72 @@ commandline_t commandline_parse(int argc, char **argv)
         else if(str_icmp(argv[i], "--no-font-smoothing") == 0)
             cmd.allow_font_smoothing = FALSE;
 
+        else if(str_icmp(argv[i], "--flip-cache-budget") == 0) {
+            if(++i < argc)
+                cmd.flip_cache_budget = max(0, atoi(argv[i]));
+        }
+
+        else if(str_icmp(argv[i], "--no-script-cache") == 0)
+            cmd.use_script_cache = FALSE;
+
+        else if(str_icmp(argv[i], "--no-sample-cache") == 0)
+            cmd.use_sample_cache = FALSE;
+
+        else if(str_icmp(argv[i], "--memory-budget") == 0) {
+            if(++i < argc)
+                cmd.memory_budget = max(0, atoi(argv[i]));
+        }
+
+        else if(str_icmp(argv[i], "--tick-rate") == 0) {
+            if(++i < argc)
+                cmd.tick_rate = clip(atoi(argv[i]), 10, 1000);
+        }
+
+        else if(str_icmp(argv[i], "--max-fps") == 0) {
+            if(++i < argc)
+                cmd.max_fps = max(0, atoi(argv[i]));
+        }
+
+        else if(str_icmp(argv[i], "--headless") == 0)
+            cmd.headless = TRUE;
+
+        else if(str_icmp(argv[i], "--quit-after") == 0) {
+            if(++i < argc)
+                cmd.quit_after = max(0, atoi(argv[i]));
+        }
+
+        else if(str_icmp(argv[i], "--record") == 0) {
+            if(++i < argc)
+                str_cpy(cmd.record_path, argv[i], sizeof(cmd.record_path));
+        }
+
+        else if(str_icmp(argv[i], "--replay") == 0) {
+            if(++i < argc)
+                str_cpy(cmd.replay_path, argv[i], sizeof(cmd.replay_path));
+        }
+
+        else if(str_icmp(argv[i], "--profile") == 0)
+            cmd.profile = TRUE;
+
+        else if(str_icmp(argv[i], "--trace") == 0) {
+            if(++i < argc)
+                str_cpy(cmd.trace_path, argv[i], sizeof(cmd.trace_path));
+        }
+
+        else if(str_icmp(argv[i], "--hitch-threshold") == 0) {
+            if(++i < argc)
+                cmd.hitch_threshold = max(0, atoi(argv[i]));
+        }
+
+        else if(str_icmp(argv[i], "--convert-level") == 0) {
+            if(i + 2 < argc) {
+                int ok = levelfile_convert(argv[i+1], argv[i+2]);
+                display_message(ok ? "\"%s\" has been converted to \"%s\"." : "Can't convert \"%s\" to \"%s\".", argv[i+1], argv[i+2]);
+                exit(ok ? 0 : 1);
+            }
+            i += 2;
+        }
+
         else if(str_icmp(argv[i], "--level") == 0) {
             if(++i < argc) {
                 cmd.custom_level = TRUE;
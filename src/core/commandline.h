@@ -45,6 +45,19 @@ typedef struct commandline_t {
     int use_gamepad;
     int optimize_cpu_usage;
     int allow_font_smoothing;
+    int flip_cache_budget; /* in kilobytes */
+    int use_script_cache; /* keep precompiled scripts? */
+    int use_sample_cache; /* keep decoded samples? */
+    int memory_budget; /* in kilobytes: unused resources are evicted beyond this */
+    int tick_rate; /* logic steps per second */
+    int max_fps; /* 0 = uncapped */
+    int headless; /* no window, no sound device, no input devices */
+    int quit_after; /* in logic steps; 0 = never */
+    char record_path[1024]; /* record a replay to this file (if not empty) */
+    char replay_path[1024]; /* play the replay stored in this file (if not empty) */
+    int profile; /* show the profiler overlay? */
+    char trace_path[1024]; /* at exit, write the profiled frames to this file (if not empty) */
+    int hitch_threshold; /* in milliseconds: slower frames are reported in the logfile; 0 = never */
 } commandline_t;
 
 /* command line interface */
@@ -21,6 +21,7 @@
 
 #include <allegro.h>
 #include <string.h>
+#include <errno.h>
 #include "engine.h"
 #include "global.h"
 #include "scene.h"
@@ -44,6 +45,14 @@
 #include "font.h"
 #include "fontext.h"
 #include "nanoparser/nanoparser.h"
+#include "scriptcache.h"
+#include "pcmcache.h"
+#include "prefetch.h"
+#include "thread.h"
+#include "loader.h"
+#include "replay.h"
+#include "profiler.h"
+#include "framestats.h"
 #include "nanocalc/nanocalc.h"
 #include "nanocalc/nanocalc_addons.h"
 #include "nanocalcext.h"
@@ -56,10 +65,11 @@
 
 /* private stuff ;) */
 static void clean_garbage();
-static void init_basic_stuff(const char *basedir);
+static void init_basic_stuff(const char *basedir, int headless);
 static void init_managers(commandline_t cmd);
 static void init_accessories(commandline_t cmd);
 static void init_game_data();
+static void init_replay(commandline_t cmd);
 static void push_initial_scene(commandline_t cmd);
 static void release_accessories();
 static void release_managers();
@@ -73,8 +83,45 @@ static void calc_error(const char *msg);
 static void init_nanocalc();
 static void release_nanocalc();
 static const char* find_basedir(int argc, char *argv[]);
+static int find_headless(int argc, char *argv[]);
+static int quit_after = 0; /* in logic steps; 0 = never */
+static int show_profiler = FALSE; /* display the profiler overlay? */
 static int display_langselect_screen = FALSE;
 
+/* startup phases: they form a dependency graph. A phase runs (on
+   the main thread) once the phases it depends on have run and the
+   workers have decoded its images. Ties are broken by the order of
+   the table */
+#define STARTUP_MAX_DEPENDENCIES    3
+#define STARTUP_MAX_WILDCARDS       3
+#define STARTUP_PREFETCH_WORKERS    2
+static commandline_t startup_cmd;
+static void load_sprites();
+static void load_fonts();
+static void load_lang();
+static int startup_phase_index(const char *name);
+static int startup_phase_ready(int phase);
+static struct {
+    const char *name;
+    void (*run)();
+    const char *after[STARTUP_MAX_DEPENDENCIES]; /* phases that must run before this one */
+    const char *scripts; /* the images these scripts name are decoded by the workers before this phase runs */
+    const char *wildcard[STARTUP_MAX_WILDCARDS]; /* other files to be read ahead of time */
+    int done;
+} startup_phase[] = {
+    { "sprites",        load_sprites,           { NULL },                                   NULL,           { "sprites/*.spr", NULL } },
+    { "fonts",          load_fonts,             { NULL },                                   "fonts/*.fnt",  { "fonts/*", "ttf/*", NULL } },
+    { "sound factory",  soundfactory_init,      { NULL },                                   NULL,           { "samples/*", NULL } },
+    { "characters",     charactersystem_init,   { "sprites", NULL },                        NULL,           { "characters/*.chr", NULL } },
+    { "objects",        objects_init,           { NULL },                                   NULL,           { "objects/*.obj", NULL } },
+    { "storyboard",     storyboard_init,        { NULL },                                   NULL,           { NULL } },
+    { "screenshots",    screenshot_init,        { NULL },                                   NULL,           { NULL } },
+    { "fade effects",   fadefx_init,            { NULL },                                   NULL,           { NULL } },
+    { "languages",      load_lang,              { "fonts", NULL },                          NULL,           { "languages/*.lng", NULL } },
+    { "scene stack",    scenestack_init,        { "storyboard", "languages", NULL },        NULL,           { NULL } }
+};
+#define STARTUP_PHASES ((int)(sizeof(startup_phase) / sizeof(startup_phase[0])))
+
 
 
 /* public functions */
@@ -88,48 +135,131 @@ void engine_init(int argc, char **argv)
 {
     commandline_t cmd;
 
-    init_basic_stuff(find_basedir(argc, argv));
+    init_basic_stuff(find_basedir(argc, argv), find_headless(argc, argv));
     cmd = commandline_parse(argc, argv);
+    quit_after = cmd.quit_after;
+    show_profiler = cmd.profile;
 
     init_managers(cmd);
     init_accessories(cmd);
     init_game_data();
+    init_replay(cmd);
 
     push_initial_scene(cmd);
 }
 
 
+/*
+ * find_headless()
+ * Parses the command line and tells whether --headless is
+ * there. Allegro needs to know it before anything else.
+ */
+int find_headless(int argc, char *argv[])
+{
+    int i;
+
+    for(i=0; i<argc; i++) {
+        if(str_icmp(argv[i], "--headless") == 0)
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+
 /*
  * engine_mainloop()
- * A classic main loop
+ * The main loop. The logic runs in fixed steps (zero,
+ * one or more per frame); the rendering happens once
+ * per frame, interpolated between the last two steps
  */
 void engine_mainloop()
 {
-    scene_t *scn;
+    scene_t *scn, *updated_scn = NULL;
 
     while(!game_is_over() && !scenestack_empty()) {
+        profiler_begin_frame();
+
         /* updating the managers */
+        profiler_begin(PROF_IDLE);
         timer_update();
-        input_update();
+        profiler_end(PROF_IDLE);
+
+        profiler_begin(PROF_AUDIO);
         audio_update();
+        profiler_end(PROF_AUDIO);
+
+        osspec_update();
+
+        profiler_begin(PROF_LOADER);
+        loader_update();
+        profiler_end(PROF_LOADER);
+
+        /* current scene: logic */
+        while(timer_begin_step()) {
+            scn = engine_step();
+            updated_scn = scn;
+
+            if(quit_after > 0 && timer_get_step_count() >= quit_after)
+                game_quit();
+
+            if(game_is_over() || scenestack_empty() || scn != scenestack_top())
+                break; /* the remaining steps will run in the next frame */
+        }
 
-        /* current scene: logic & rendering */
-        scn = scenestack_top();
-        scn->update();
-        if(scn == scenestack_top()) /* scn may have been 'popped' out */
-            scn->render();
+        /* current scene: rendering */
+        profiler_begin(PROF_RENDER);
+        if(!scenestack_empty() && updated_scn == scenestack_top()) /* don't render a scene before updating it */
+            updated_scn->render();
+        profiler_end(PROF_RENDER);
 
         /* more rendering */
         screenshot_update();
         fadefx_update();
+        if(show_profiler) {
+            profiler_render(video_get_backbuffer());
+            framestats_render(video_get_backbuffer());
+        }
+
+        profiler_begin(PROF_VIDEO);
         video_render();
+        profiler_end(PROF_VIDEO);
 
         /* calling the garbage collector */
         clean_garbage();
+
+        profiler_end_frame();
+        framestats_end_frame();
     }
 }
 
 
+/*
+ * engine_step()
+ * Runs one logic step of the scene on top of the
+ * stack and returns it. Call it after timer_begin_step().
+ * The main loop and the benchmarks share this.
+ */
+scene_t* engine_step()
+{
+    scene_t *scn;
+
+    actor_begin_step();
+
+    profiler_begin(PROF_INPUT);
+    input_update();
+    profiler_end(PROF_INPUT);
+
+    scn = scenestack_top();
+    profiler_begin(PROF_LOGIC);
+    scn->update();
+    profiler_end(PROF_LOGIC);
+    timer_end_step();
+
+    return scn;
+}
+
+
 /*
  * engine_release()
  * Releases the game engine and its
@@ -168,10 +298,13 @@ void clean_garbage()
  * Initializes the basic stuff, such as Allegro.
  * Call this before anything else.
  */
-void init_basic_stuff(const char *basedir) /* basedir may be NULL */
+void init_basic_stuff(const char *basedir, int headless) /* basedir may be NULL */
 {
     set_uformat(U_UTF8);
-    allegro_init();
+    if(!headless)
+        allegro_init();
+    else
+        install_allegro(SYSTEM_NONE, &errno, atexit); /* no display needed */
     randomize();
     osspec_init(basedir);
     logfile_init();
@@ -188,12 +321,20 @@ void init_basic_stuff(const char *basedir) /* basedir may be NULL */
 void init_managers(commandline_t cmd)
 {
     timer_init(cmd.optimize_cpu_usage);
-    video_init(get_window_title(), cmd.video_resolution, cmd.smooth_graphics, cmd.fullscreen, cmd.color_depth);
+    profiler_init(cmd.profile || *(cmd.trace_path)); /* the hitch detector runs on its own; it only lists the scopes when profiling */
+    framestats_init(cmd.hitch_threshold);
+    timer_set_step_rate(cmd.tick_rate);
+    timer_set_max_fps(cmd.max_fps);
+    timer_set_unpaced(cmd.headless);
+    video_init(get_window_title(), cmd.video_resolution, cmd.smooth_graphics, cmd.fullscreen, cmd.color_depth, cmd.headless);
     video_show_fps(cmd.show_fps);
-    audio_init();
-    input_init();
+    audio_init(cmd.headless);
+    input_init(cmd.headless);
     input_ignore_joystick(!cmd.use_gamepad);
-    resourcemanager_init();
+    resourcemanager_init(cmd.memory_budget);
+    loader_init();
+    scriptcache_init(cmd.use_script_cache);
+    pcmcache_init(cmd.use_sample_cache);
 }
 
 
@@ -203,20 +344,119 @@ void init_managers(commandline_t cmd)
  */
 void init_accessories(commandline_t cmd)
 {
+    int i, j, remaining;
+    uint32 start, t;
+
     video_display_loading_screen();
-    sprite_init();
-    font_init(cmd.allow_font_smoothing);
+    startup_cmd = cmd;
+
+    /* validating the dependency graph */
+    for(i=0; i<STARTUP_PHASES; i++) {
+        startup_phase[i].done = FALSE;
+        for(j=0; j<STARTUP_MAX_DEPENDENCIES && startup_phase[i].after[j] != NULL; j++) {
+            if(startup_phase_index(startup_phase[i].after[j]) < 0)
+                fatal_error("startup: phase '%s' depends on the unknown phase '%s'", startup_phase[i].name, startup_phase[i].after[j]);
+        }
+    }
+
+    /* the workers decode the images first (they're on the critical
+       path), and then read the other files ahead of time. The sprite
+       sheets are decoded on demand, in parallel (see the loader) */
+    prefetch_init();
+    for(i=0; i<STARTUP_PHASES; i++) {
+        if(startup_phase[i].scripts != NULL)
+            prefetch_decode_scripts(startup_phase[i].scripts, i);
+    }
+    for(i=0; i<STARTUP_PHASES; i++) {
+        for(j=0; j<STARTUP_MAX_WILDCARDS && startup_phase[i].wildcard[j] != NULL; j++)
+            prefetch_add(startup_phase[i].wildcard[j]);
+    }
+    prefetch_start(STARTUP_PREFETCH_WORKERS);
+
+    /* loading stuff: the phases run on this thread (nanoparser
+       and Allegro aren't thread-safe). The decoded images of a
+       phase are committed (turned into bitmaps) right before it */
+    start = timer_get_ticks();
+    for(remaining = STARTUP_PHASES; remaining > 0; ) {
+        for(i=0; i<STARTUP_PHASES && !startup_phase_ready(i); i++);
+        if(i == STARTUP_PHASES) {
+            /* nothing to do but to wait for the workers... or to lend them a hand */
+            for(j=0; j<STARTUP_PHASES && (startup_phase[j].done || prefetch_pending(j) == 0); j++);
+            if(j == STARTUP_PHASES)
+                fatal_error("startup: the phases have circular dependencies");
+            else if(!prefetch_help())
+                thread_sleep(1);
+            continue;
+        }
+
+        t = timer_get_ticks();
+        prefetch_commit(i);
+        startup_phase[i].run();
+        startup_phase[i].done = TRUE;
+        remaining--;
+        logfile_message("startup: %s took %d ms", startup_phase[i].name, (int)(timer_get_ticks() - t));
+    }
+
+    prefetch_release();
+    logfile_message("startup: the accessories took %d ms", (int)(timer_get_ticks() - start));
+}
+
+/*
+ * startup_phase_index()
+ * The index of a startup phase, or -1 if there's no such phase
+ */
+int startup_phase_index(const char *name)
+{
+    int i;
+
+    for(i=0; i<STARTUP_PHASES; i++) {
+        if(strcmp(startup_phase[i].name, name) == 0)
+            return i;
+    }
+
+    return -1;
+}
+
+/*
+ * startup_phase_ready()
+ * Can the given startup phase run now?
+ */
+int startup_phase_ready(int phase)
+{
+    int j;
+
+    if(startup_phase[phase].done || prefetch_pending(phase) > 0)
+        return FALSE;
+
+    for(j=0; j<STARTUP_MAX_DEPENDENCIES && startup_phase[phase].after[j] != NULL; j++) {
+        if(!startup_phase[startup_phase_index(startup_phase[phase].after[j])].done)
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+
+/*
+ * load_sprites(), load_fonts(), load_lang()
+ * Startup phases that need the command line
+ */
+void load_sprites()
+{
+    sprite_init(startup_cmd.flip_cache_budget);
+}
+
+void load_fonts()
+{
+    font_init(startup_cmd.allow_font_smoothing);
     fontext_register_variables();
-    soundfactory_init();
-    charactersystem_init();
-    objects_init();
-    storyboard_init();
-    screenshot_init();
-    fadefx_init();
+}
+
+void load_lang()
+{
     lang_init();
-    if(strcmp(cmd.language_filepath, "") != 0)
-        lang_loadfile(cmd.language_filepath);
-    scenestack_init();
+    if(strcmp(startup_cmd.language_filepath, "") != 0)
+        lang_loadfile(startup_cmd.language_filepath);
 }
 
 
@@ -251,6 +491,30 @@ void push_initial_scene(commandline_t cmd)
 }
 
 
+/*
+ * init_replay()
+ * Starts recording or playing a replay, if requested.
+ * Either way, the run must not depend on the speed of
+ * the machine: the clock counts logic steps and the
+ * loader works synchronously
+ */
+void init_replay(commandline_t cmd)
+{
+    if(*(cmd.replay_path)) {
+        replay_play(cmd.replay_path);
+        timer_set_step_rate(replay_step_rate());
+    }
+    else if(*(cmd.record_path))
+        replay_record(cmd.record_path, (uint32)time(NULL), cmd.tick_rate);
+    else
+        return;
+
+    srand(replay_seed());
+    timer_use_step_clock(TRUE);
+    loader_set_synchronous(TRUE);
+}
+
+
 /*
  * release_accessories()
  * Releases the previously loaded accessories
@@ -275,10 +539,18 @@ void release_accessories()
  */
 void release_managers()
 {
+    replay_stop();
+    loader_release();
     input_release();
     video_release();
+    scriptcache_release();
     resourcemanager_release();
     audio_release();
+    pcmcache_release(); /* after the samples are gone */
+    if(*(startup_cmd.trace_path))
+        profiler_export(startup_cmd.trace_path);
+    framestats_release();
+    profiler_release();
     timer_release();
 }
 
@@ -22,8 +22,11 @@
 #ifndef _ENGINE_H
 #define _ENGINE_H
 
+struct scene_t;
+
 void engine_init(int argc, char **argv);
 void engine_mainloop();
+struct scene_t* engine_step(); /* runs one logic step; call it after timer_begin_step() */
 void engine_release();
 
 #endif
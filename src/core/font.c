@@ -33,6 +33,7 @@
 #include "logfile.h"
 #include "hashtable.h"
 #include "nanoparser/nanoparser.h"
+#include "scriptcache.h"
 
 /* private stuff */
 #define IMAGE2BITMAP(img)       (*((BITMAP**)(img)))   /* whoooa, this is crazy stuff */
@@ -48,6 +49,17 @@ static void callbacktable_release();
 static void callbacktable_add(const char *variable_name, fontcallback_t callback);
 static fontcallback_t callbacktable_find(const char *variable_name);
 
+/* tinted glyph cache: colored versions of the characters, indexed by (character, color) */
+#define TINTEDGLYPH_BUCKETS     64
+#define TINTEDGLYPH_MAX         1024 /* the cache is flushed when it gets bigger than this */
+typedef struct tintedglyph_t tintedglyph_t;
+struct tintedglyph_t {
+    int ch; /* character */
+    uint32 color; /* tint */
+    image_t *image; /* colored character */
+    tintedglyph_t *next; /* linked list */
+};
+
 /* fontdata_t: stores the attributes of each font class (set of fonts with the same name) */
 typedef struct fontdata_t fontdata_t;
 struct fontdata_t { /* abstract font: base class */
@@ -55,7 +67,12 @@ struct fontdata_t { /* abstract font: base class */
     void (*release)(fontdata_t*); /* release the fontdata_t */
     v2d_t (*charspacing)(fontdata_t*); /* a pair (hspace, vspace) */
     v2d_t (*textsize)(fontdata_t*,const char*); /* text size, in pixels */
+    tintedglyph_t *tinted[TINTEDGLYPH_BUCKETS]; /* tinted glyph cache */
+    int tinted_count; /* number of cached tinted glyphs */
 };
+static void tintedglyph_init(fontdata_t *fnt);
+static void tintedglyph_release(fontdata_t *fnt);
+static const image_t* tintedglyph_get(fontdata_t *fnt, const image_t *char_image, int ch, uint32 color);
 static fontdata_t* fontdata_bmp_new(const char *source_file, const char *keymap, int sheet_source_x, int sheet_source_y, int sheet_width, int sheet_height, int char_width, int char_height);
 static fontdata_t* fontdata_ttf_new(const char *source_file, int size, int antialias, int shadow);
 
@@ -105,6 +122,15 @@ static fontdata_t* fontdata_list_find(const char *name);
 #define FONTARGS_MAX 3
 typedef char* fontargs_t[FONTARGS_MAX];
 
+/* glyph run: the laid out text, ready to be rendered */
+typedef struct fontglyph_t fontglyph_t;
+struct fontglyph_t {
+    int ch; /* character */
+    int index; /* index of the character in the text (tags excluded) */
+    int x, y; /* offset relative to the position of the font */
+    uint32 color; /* color */
+};
+
 /* font struct: this struct is used by the external world */
 struct font_t {
     fontdata_t *my_class;
@@ -114,6 +140,9 @@ struct font_t {
     int visible; /* is this font visible? */
     int index_of_first_char, length; /* substring */
     fontargs_t argument; /* text arguments: $1, $2 ... $<FONTARGS_MAX> */
+    fontglyph_t *glyph; /* cached glyph run */
+    int glyph_count; /* length of the glyph run */
+    int glyph_run_ready; /* is the glyph run up-to-date? */
 };
 
 /* ------------------------------- */
@@ -132,6 +161,8 @@ static int has_variables_to_expand(const char *str);
 static void expand_variables(char *str, fontargs_t args);
 static uint8 hex2dec(char digit);
 static char* remove_tags(const char *str);
+static void layout_glyphs(font_t *f);
+static void invalidate_glyphs(font_t *f);
 
 typedef struct fontscript_t fontscript_t;
 struct fontscript_t {
@@ -234,6 +265,9 @@ font_t *font_create(const char *font_name)
     f->position = v2d_new(0, 0);
     f->index_of_first_char = 0;
     f->length = INFINITY;
+    f->glyph = NULL;
+    f->glyph_count = 0;
+    f->glyph_run_ready = FALSE;
 
     f->my_class = fontdata_list_find(font_name);
     if(f->my_class == NULL)
@@ -261,6 +295,9 @@ void font_destroy(font_t *f)
             free(f->argument[i]);
     }
 
+    if(f->glyph)
+        free(f->glyph);
+
     free(f->text);
     free(f);
 }
@@ -276,7 +313,7 @@ void font_set_text(font_t *f, const char *fmt, ...)
 {
     static char buf[FONT_TEXTMAXLENGTH];
     va_list args;
-    char *p, *q;
+    char *p, *q, *text;
 
     va_start(args, fmt);
     vsnprintf(buf, (FONT_TEXTMAXLENGTH*2)/3, fmt, args);
@@ -285,10 +322,8 @@ void font_set_text(font_t *f, const char *fmt, ...)
     while(has_variables_to_expand(buf))
         expand_variables(buf, f->argument);
 
-    if(f->text) free(f->text);
-    f->text = mallocx(sizeof(char) * (strlen(buf) + 1));
-
-    for(p=buf,q=f->text; *p; p++,q++) {
+    text = mallocx(sizeof(char) * (strlen(buf) + 1));
+    for(p=buf,q=text; *p; p++,q++) {
         if(*p == '\\') {
             switch( *(p+1) ) {
                 case 'n':
@@ -311,6 +346,16 @@ void font_set_text(font_t *f, const char *fmt, ...)
     }
 
     *q = 0;
+
+    /* many fonts get the very same text on every frame */
+    if(f->text != NULL && strcmp(f->text, text) == 0) {
+        free(text);
+        return;
+    }
+
+    if(f->text) free(f->text);
+    f->text = text;
+    invalidate_glyphs(f);
 }
 
 
@@ -355,7 +400,10 @@ const char *font_get_text(const font_t *f)
  */
 void font_set_width(font_t *f, int w)
 {
-    f->width = max(0, w);
+    if(f->width != max(0, w)) {
+        f->width = max(0, w);
+        invalidate_glyphs(f);
+    }
 }
 
 
@@ -365,109 +413,21 @@ void font_set_width(font_t *f, int w)
  */
 void font_render(const font_t *f, v2d_t camera_position)
 {
-    /* this routine is horrible (it has suffered too many mutations through time).
-       it should be rewritten some time... :(
-       
-       ...but it works and I'm lazy ;) */
-
-    int offx = 0, offy = 0;
-    char *p, s[8];
-    uint32 color[FONT_STACKCAPACITY];
-    int i, top = 0, w = 0, h = 0;
-    int wordwrap;
-    v2d_t textsize, charspacing = font_get_charspacing(f);
-    int hspace = charspacing.x, vspace = charspacing.y;
-    char *text = f->text;
-    int wide_char = 0;
-    int idx = 0;
-
-    color[top++] = image_rgb(255,255,255);
-    if(f->visible && text) {
-        for(p=text; *p; p++) {
-            /* wordwrap */
-            wordwrap = FALSE;
-            if(p == text || (p != text && isspace((unsigned char)*(p-1)))) {
-                char *q;
-                int tag = FALSE;
-                int line_width = 0;
-
-                for(q=p; !(*q=='\0' || isspace((unsigned char)*q)); q++) {
-                    if(*q == '<') tag = TRUE;
-                    if(!tag) {
-                        uszprintf(s, sizeof(s), "%lc", ugetat(q, 0));
-                        line_width += (int)(f->my_class->textsize(f->my_class, s).x) + hspace;
-                    }
-                    if(*q == '>') tag = FALSE;
-                }
-
-                wordwrap = ((f->width > 0) && ((offx + line_width - hspace) > f->width));
-            }
-
-            /* tags */
-            if(*p == '<') {
-
-                if(strncmp(p+1, "color=", 6) == 0) {
-                    char *orig = p;
-                    uint8 r, g, b;
-                    char tc;
-                    int valid = TRUE;
-
-                    p += 7;
-                    for(i=0; i<6 && valid; i++) {
-                        tc = tolower( *(p+i) );
-                        valid = ((tc >= '0' && tc <= '9') || (tc >= 'a' && tc <= 'f'));
-                    }
-                    valid = valid && (*(p+6) == '>');
-
-                    if(valid) {
-                        r = (hex2dec(*(p+0)) << 4) | hex2dec(*(p+1));
-                        g = (hex2dec(*(p+2)) << 4) | hex2dec(*(p+3));
-                        b = (hex2dec(*(p+4)) << 4) | hex2dec(*(p+5));
-                        p += 7;
-                        if(top < FONT_STACKCAPACITY)
-                            color[top++] = image_rgb(r,g,b);
-                    }
-                    else
-                        p = orig;
-                }
+    const fontglyph_t *g;
+    int i;
 
-                if(strncmp(p+1, "/color>", 7) == 0) {
-                    p += 8;
-                    if(top >= 2) /* we must not clear the color stack */
-                        top--;
-                }
+    if(!(f->visible && f->text))
+        return;
 
-                if(!*p)
-                    break;
-            }
+    /* the glyph run is just a cache, so f is still logically const */
+    if(!f->glyph_run_ready)
+        layout_glyphs((font_t*)f);
 
-            /* skip it! */
-            if(idx < f->index_of_first_char) { idx++; continue; }
-            if(idx >= f->index_of_first_char + f->length) { break; }
-            idx++;
-
-            /* character size */
-            wide_char = ugetat(p, 0);
-            uszprintf(s, sizeof(s), "%lc", wide_char);
-            textsize = f->my_class->textsize(f->my_class, s);
-            w = (int)textsize.x; h = (int)textsize.y;
-
-            /* printing text */
-            if(wordwrap) { offx = 0; offy += h + vspace; }
-            if(*p != '\n') {
-                p += uoffset(p, 1) - 1; /* ugly hack */
-                f->my_class->renderchar(f->my_class, video_get_backbuffer(), wide_char, (int)(f->position.x+offx-(camera_position.x-VIDEO_SCREEN_W/2)), (int)(f->position.y+offy-(camera_position.y-VIDEO_SCREEN_H/2)), color[top-1]);
-                offx += w + hspace;
-
-                /* gulp... o_o' */
-                if(wide_char >= 0x80 && f->my_class->renderchar == fontdata_bmp_renderchar)
-                    offx += -w + (w>>1);
-            }
-            else {
-                offx = 0;
-                offy += h + vspace;
-            }
-        }
+    for(i=0; i<f->glyph_count; i++) {
+        g = &(f->glyph[i]);
+        if(g->index >= f->index_of_first_char + f->length)
+            break;
+        f->my_class->renderchar(f->my_class, video_get_backbuffer(), g->ch, (int)(f->position.x+g->x-(camera_position.x-VIDEO_SCREEN_W/2)), (int)(f->position.y+g->y-(camera_position.y-VIDEO_SCREEN_H/2)), g->color);
     }
 }
 
@@ -540,7 +500,12 @@ void font_set_visible(font_t *f, int is_visible)
  */
 void font_use_substring(font_t *f, int index_of_first_char, int length)
 {
-    f->index_of_first_char = max(0, index_of_first_char);
+    /* the length doesn't change the layout: the glyph run is truncated when rendering */
+    if(f->index_of_first_char != max(0, index_of_first_char)) {
+        f->index_of_first_char = max(0, index_of_first_char);
+        invalidate_glyphs(f);
+    }
+
     f->length = max(0, length);
 }
 
@@ -549,6 +514,130 @@ void font_use_substring(font_t *f, int index_of_first_char, int length)
 /* private utilities */
 /* ------------------------------------------------- */
 
+/* lays out the text, computing the glyph run of the font.
+   The substring length is not taken into account here. */
+void layout_glyphs(font_t *f)
+{
+    /* this routine is horrible (it has suffered too many mutations through time).
+       it should be rewritten some time... :(
+       
+       ...but it works and I'm lazy ;) */
+
+    int offx = 0, offy = 0;
+    char *p, s[8];
+    uint32 color[FONT_STACKCAPACITY];
+    int i, top = 0, w = 0, h = 0;
+    int wordwrap;
+    v2d_t textsize, charspacing = font_get_charspacing(f);
+    int hspace = charspacing.x, vspace = charspacing.y;
+    char *text = f->text;
+    int wide_char = 0;
+    int idx = 0;
+
+    if(f->glyph)
+        free(f->glyph);
+    f->glyph = mallocx((1 + strlen(text)) * sizeof *(f->glyph));
+    f->glyph_count = 0;
+    f->glyph_run_ready = TRUE;
+
+    color[top++] = image_rgb(255,255,255);
+    for(p=text; *p; p++) {
+        /* wordwrap */
+        wordwrap = FALSE;
+        if(p == text || (p != text && isspace((unsigned char)*(p-1)))) {
+            char *q;
+            int tag = FALSE;
+            int line_width = 0;
+
+            for(q=p; !(*q=='\0' || isspace((unsigned char)*q)); q++) {
+                if(*q == '<') tag = TRUE;
+                if(!tag) {
+                    uszprintf(s, sizeof(s), "%lc", ugetat(q, 0));
+                    line_width += (int)(f->my_class->textsize(f->my_class, s).x) + hspace;
+                }
+                if(*q == '>') tag = FALSE;
+            }
+
+            wordwrap = ((f->width > 0) && ((offx + line_width - hspace) > f->width));
+        }
+
+        /* tags */
+        if(*p == '<') {
+
+            if(strncmp(p+1, "color=", 6) == 0) {
+                char *orig = p;
+                uint8 r, g, b;
+                char tc;
+                int valid = TRUE;
+
+                p += 7;
+                for(i=0; i<6 && valid; i++) {
+                    tc = tolower( *(p+i) );
+                    valid = ((tc >= '0' && tc <= '9') || (tc >= 'a' && tc <= 'f'));
+                }
+                valid = valid && (*(p+6) == '>');
+
+                if(valid) {
+                    r = (hex2dec(*(p+0)) << 4) | hex2dec(*(p+1));
+                    g = (hex2dec(*(p+2)) << 4) | hex2dec(*(p+3));
+                    b = (hex2dec(*(p+4)) << 4) | hex2dec(*(p+5));
+                    p += 7;
+                    if(top < FONT_STACKCAPACITY)
+                        color[top++] = image_rgb(r,g,b);
+                }
+                else
+                    p = orig;
+            }
+
+            if(strncmp(p+1, "/color>", 7) == 0) {
+                p += 8;
+                if(top >= 2) /* we must not clear the color stack */
+                    top--;
+            }
+
+            if(!*p)
+                break;
+        }
+
+        /* skip it! */
+        if(idx < f->index_of_first_char) { idx++; continue; }
+        idx++;
+
+        /* character size */
+        wide_char = ugetat(p, 0);
+        uszprintf(s, sizeof(s), "%lc", wide_char);
+        textsize = f->my_class->textsize(f->my_class, s);
+        w = (int)textsize.x; h = (int)textsize.y;
+
+        /* laying out text */
+        if(wordwrap) { offx = 0; offy += h + vspace; }
+        if(*p != '\n') {
+            fontglyph_t *g = &(f->glyph[f->glyph_count++]);
+            p += uoffset(p, 1) - 1; /* ugly hack */
+            g->ch = wide_char;
+            g->index = idx - 1;
+            g->x = offx;
+            g->y = offy;
+            g->color = color[top-1];
+            offx += w + hspace;
+
+            /* gulp... o_o' */
+            if(wide_char >= 0x80 && f->my_class->renderchar == fontdata_bmp_renderchar)
+                offx += -w + (w>>1);
+        }
+        else {
+            offx = 0;
+            offy += h + vspace;
+        }
+    }
+}
+
+/* the glyph run must be computed again */
+void invalidate_glyphs(font_t *f)
+{
+    f->glyph_run_ready = FALSE;
+}
+
 /* returns a static char* (case insensitive search) */
 const char* get_variable(const char *key)
 {
@@ -657,7 +746,7 @@ char* remove_tags(const char *str)
 int dirfill(const char *filename, void *param)
 {
     parsetree_program_t** p = (parsetree_program_t**)param;
-    *p = nanoparser_append_program(*p, nanoparser_construct_tree(filename));
+    *p = nanoparser_append_program(*p, scriptcache_construct_tree(filename));
     return 0;
 }
 
@@ -940,6 +1029,7 @@ fontdata_t* fontdata_bmp_new(const char *source_file, const char *keymap, int sh
     ((fontdata_t*)f)->release = fontdata_bmp_release;
     ((fontdata_t*)f)->charspacing = fontdata_bmp_charspacing;
     ((fontdata_t*)f)->textsize = fontdata_bmp_textsize;
+    tintedglyph_init((fontdata_t*)f);
 
     /* validating */
     if(sheet_source_x < 0 || sheet_source_y < 0)
@@ -981,24 +1071,8 @@ void fontdata_bmp_renderchar(fontdata_t *fnt, image_t *img, int ch, int x, int y
     image_t *char_image = f->bmp[ch & 0xFF];
 
     if(char_image != NULL) {
-        if(color != image_rgb(255,255,255)) {
-            int l, c;
-            uint8 r, g, b;
-            uint8 cr, cg, cb;
-            uint32 px, mask = video_get_maskcolor();
-
-            image_color2rgb(color, &cr, &cg, &cb);
-            for(l=0; l<image_height(char_image); l++) {
-                for(c=0; c<image_width(char_image); c++) {
-                    px = image_getpixel(char_image, c, l);
-                    if(px != mask) {
-                        image_color2rgb(px, &r, &g, &b);
-                        r &= cr; g &= cg; b &= cb;
-                        image_putpixel(img, x+c, y+l, image_rgb(r,g,b));
-                    }
-                }
-            }
-        }
+        if(color != image_rgb(255,255,255))
+            image_draw(tintedglyph_get(fnt, char_image, ch, color), img, x, y, IF_NONE);
         else
             image_draw(char_image, img, x, y, IF_NONE);
     }
@@ -1014,6 +1088,7 @@ void fontdata_bmp_release(fontdata_t *fnt)
             image_destroy(f->bmp[i]);
     }
 
+    tintedglyph_release(fnt);
     free(f);
 }
 
@@ -1033,6 +1108,86 @@ v2d_t fontdata_bmp_textsize(fontdata_t *fnt, const char *string)
     return v2d_new((f->charsize.x+cw) * len - cw, f->charsize.y);
 }
 
+/* ------------------------------------------------- */
+/* tinted glyph cache */
+/* ------------------------------------------------- */
+
+void tintedglyph_init(fontdata_t *fnt)
+{
+    int i;
+
+    for(i=0; i<TINTEDGLYPH_BUCKETS; i++)
+        fnt->tinted[i] = NULL;
+
+    fnt->tinted_count = 0;
+}
+
+void tintedglyph_release(fontdata_t *fnt)
+{
+    tintedglyph_t *it, *next;
+    int i;
+
+    for(i=0; i<TINTEDGLYPH_BUCKETS; i++) {
+        for(it=fnt->tinted[i]; it; it=next) {
+            next = it->next;
+            image_destroy(it->image);
+            free(it);
+        }
+        fnt->tinted[i] = NULL;
+    }
+
+    fnt->tinted_count = 0;
+}
+
+/* returns a colored version of char_image (the image of character ch) */
+const image_t* tintedglyph_get(fontdata_t *fnt, const image_t *char_image, int ch, uint32 color)
+{
+    int k = (int)(((unsigned)ch * 31u + color) % TINTEDGLYPH_BUCKETS);
+    tintedglyph_t *it;
+    int l, c;
+    uint8 r, g, b;
+    uint8 cr, cg, cb;
+    uint32 px, mask = video_get_maskcolor();
+
+    for(it=fnt->tinted[k]; it; it=it->next) {
+        if(it->ch == ch && it->color == color)
+            return it->image;
+    }
+
+    /* too many colors? */
+    if(fnt->tinted_count >= TINTEDGLYPH_MAX) {
+        tintedglyph_release(fnt);
+        k = (int)(((unsigned)ch * 31u + color) % TINTEDGLYPH_BUCKETS);
+    }
+
+    /* tinting the character */
+    it = mallocx(sizeof *it);
+    it->ch = ch;
+    it->color = color;
+    it->image = image_create(image_width(char_image), image_height(char_image));
+    image_clear(it->image, mask);
+
+    image_color2rgb(color, &cr, &cg, &cb);
+    for(l=0; l<image_height(char_image); l++) {
+        for(c=0; c<image_width(char_image); c++) {
+            px = image_getpixel(char_image, c, l);
+            if(px != mask) {
+                image_color2rgb(px, &r, &g, &b);
+                r &= cr; g &= cg; b &= cb;
+                px = image_rgb(r,g,b);
+                if(px == mask) /* this pixel must not become transparent */
+                    px = image_rgb(r,g,b^1);
+                image_putpixel(it->image, c, l, px);
+            }
+        }
+    }
+
+    it->next = fnt->tinted[k];
+    fnt->tinted[k] = it;
+    fnt->tinted_count++;
+    return it->image;
+}
+
 /* ------------------------------------------------- */
 /* ttf fonts */
 /* ------------------------------------------------- */
@@ -1047,6 +1202,7 @@ fontdata_t* fontdata_ttf_new(const char *source_file, int size, int antialias, i
     ((fontdata_t*)f)->release = fontdata_ttf_release;
     ((fontdata_t*)f)->charspacing = fontdata_ttf_charspacing;
     ((fontdata_t*)f)->textsize = fontdata_ttf_textsize;
+    tintedglyph_init((fontdata_t*)f);
 
     resource_filepath(abs_path, source_file, sizeof(abs_path), RESFP_READ);
     logfile_message("Loading TrueType font '%s'...", abs_path);
@@ -1095,24 +1251,8 @@ void fontdata_ttf_renderchar(fontdata_t *fnt, image_t *img, int ch, int x, int y
     if(!aa && (ch >= 32 && ch <= 127)) {
         /* this character is in cache */
         image_t *char_image = f->cached_character[ch-32];
-        if(color != image_rgb(255,255,255)) {
-            int l, c;
-            uint8 r, g, b;
-            uint8 cr, cg, cb;
-            uint32 px, mask = video_get_maskcolor();
-
-            image_color2rgb(color, &cr, &cg, &cb);
-            for(l=0; l<image_height(char_image); l++) {
-                for(c=0; c<image_width(char_image); c++) {
-                    px = image_getpixel(char_image, c, l);
-                    if(px != mask) {
-                        image_color2rgb(px, &r, &g, &b);
-                        r &= cr; g &= cg; b &= cb;
-                        image_putpixel(img, x+c, y+l, image_rgb(r,g,b));
-                    }
-                }
-            }
-        }
+        if(color != image_rgb(255,255,255))
+            image_draw(tintedglyph_get(fnt, char_image, ch, color), img, x, y, IF_NONE);
         else
             image_draw(char_image, img, x, y, IF_NONE);
     }
@@ -1135,6 +1275,7 @@ void fontdata_ttf_release(fontdata_t *fnt)
             image_destroy(f->cached_character[ch-32]);
     }
 
+    tintedglyph_release(fnt);
     alfont_destroy_font(f->ttf);
     free(f);
 }
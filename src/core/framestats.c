@@ -0,0 +1,230 @@
+/*
+ * Open Surge Engine
+ * framestats.c - frame-time histogram and hitch detector
+ * Copyright (C) 2013  Alexandre Martins <alemartf(at)gmail(dot)com>
+ * http://opensnc.sourceforge.net
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <allegro.h>
+#include <math.h>
+#include "framestats.h"
+#include "profiler.h"
+#include "image.h"
+#include "util.h"
+#include "logfile.h"
+
+/* private stuff */
+#define IMAGE2BITMAP(img)       (*((BITMAP**)(img)))   /* whoooa, this is crazy stuff */
+#define SUB_BITS                5       /* each power of two is split in 2^SUB_BITS buckets */
+#define SUB_COUNT               (1 << SUB_BITS)
+#define EXACT_COUNT             (2 * SUB_COUNT) /* values below this have a bucket of their own */
+#define BUCKET_COUNT            (EXACT_COUNT + (32 - SUB_BITS - 1) * SUB_COUNT)
+#define MAX_LOGGED_HITCHES      100
+#define OVERLAY_WIDTH           128     /* in pixels */
+
+static uint32 histogram[BUCKET_COUNT];
+static uint32 frame_count, hitch_count, max_time;
+static uint32 hitch_threshold; /* in microseconds */
+static uint64 last_time;
+static int has_last_time = FALSE;
+
+static int bucket_of(uint32 t);
+static uint32 bucket_upper_bound(int b);
+
+
+
+/* public methods */
+
+/*
+ * framestats_init()
+ * Initializes the frame statistics. Frames longer than
+ * hitch_threshold milliseconds will be reported (0 = never)
+ */
+void framestats_init(int threshold)
+{
+    int i;
+
+    logfile_message("framestats_init()");
+
+    for(i=0; i<BUCKET_COUNT; i++)
+        histogram[i] = 0;
+
+    frame_count = hitch_count = max_time = 0;
+    hitch_threshold = (uint32)max(0, threshold) * 1000;
+    has_last_time = FALSE;
+}
+
+/*
+ * framestats_release()
+ * Writes a summary of the frame times to the logfile
+ */
+void framestats_release()
+{
+    uint32 t;
+    int i;
+
+    logfile_message("framestats_release()");
+    if(frame_count == 0)
+        return;
+
+    logfile_message("frame times: %u frames, p50 %.2f ms, p95 %.2f ms, p99 %.2f ms, max %.2f ms, %u hitches",
+        frame_count,
+        framestats_percentile(50.0f) * 0.001f, framestats_percentile(95.0f) * 0.001f,
+        framestats_percentile(99.0f) * 0.001f, max_time * 0.001f, hitch_count
+    );
+
+    logfile_message("frame time histogram:");
+    for(i=0; i<BUCKET_COUNT; i++) {
+        if(histogram[i] > 0) {
+            t = min(bucket_upper_bound(i), max_time);
+            logfile_message("    <= %8.2f ms: %u", t * 0.001f, histogram[i]);
+        }
+    }
+}
+
+/*
+ * framestats_end_frame()
+ * Measures the time elapsed since the previous call
+ */
+void framestats_end_frame()
+{
+    uint64 now = profiler_get_time();
+    uint32 t;
+
+    if(has_last_time) {
+        t = (uint32)min(now - last_time, (uint64)0xFFFFFFFF);
+        histogram[bucket_of(t)]++;
+        max_time = max(max_time, t);
+        frame_count++;
+
+        if(hitch_threshold > 0 && t > hitch_threshold) {
+            if(++hitch_count <= MAX_LOGGED_HITCHES) {
+                logfile_message("hitch: frame %u took %.2f ms", frame_count, t * 0.001f);
+                profiler_log_last_frame();
+                if(hitch_count == MAX_LOGGED_HITCHES)
+                    logfile_message("hitch: further hitches won't be reported");
+            }
+        }
+    }
+
+    last_time = now;
+    has_last_time = TRUE;
+}
+
+/*
+ * framestats_percentile()
+ * The time (in microseconds) that p percent of the
+ * frames didn't exceed, 0.0 <= p <= 100.0. It is
+ * rounded up to the upper bound of its bucket
+ */
+uint32 framestats_percentile(float p)
+{
+    uint32 rank, count = 0;
+    int i;
+
+    if(frame_count == 0)
+        return 0;
+
+    p = clip(p, 0.0f, 100.0f);
+    rank = max(1, (uint32)ceil(p * 0.01f * frame_count));
+    for(i=0; i<BUCKET_COUNT; i++) {
+        if((count += histogram[i]) >= rank)
+            return min(bucket_upper_bound(i), max_time);
+    }
+
+    return max_time;
+}
+
+/*
+ * framestats_max()
+ * The time of the slowest frame, in microseconds
+ */
+uint32 framestats_max()
+{
+    return max_time;
+}
+
+/*
+ * framestats_frame_count()
+ * How many frames have been measured?
+ */
+int framestats_frame_count()
+{
+    return (int)frame_count;
+}
+
+/*
+ * framestats_hitch_count()
+ * How many frames took longer than the hitch threshold?
+ */
+int framestats_hitch_count()
+{
+    return (int)hitch_count;
+}
+
+/*
+ * framestats_render()
+ * Renders the percentiles on the top-right corner of the screen
+ */
+void framestats_render(image_t *dest)
+{
+    static const float p[] = { 50.0f, 95.0f, 99.0f };
+    int x = image_width(dest) - OVERLAY_WIDTH, i;
+    uint32 t; /* in hundredths of a millisecond */
+
+    image_rectfill(dest, x, 0, image_width(dest) - 1, 43, image_rgb(0, 0, 0));
+    for(i=0; i<3; i++) {
+        t = framestats_percentile(p[i]) / 10;
+        textprintf_ex(IMAGE2BITMAP(dest), font, x + 2, 2 + i * 8, makecol(255,255,255), -1, "p%-2d  %6u.%02u ms", (int)p[i], t / 100, t % 100);
+    }
+
+    t = max_time / 10;
+    textprintf_ex(IMAGE2BITMAP(dest), font, x + 2, 26, makecol(255,255,255), -1, "max  %6u.%02u ms", t / 100, t % 100);
+    textprintf_ex(IMAGE2BITMAP(dest), font, x + 2, 34, makecol(255,255,0), -1, "hitches %8u", hitch_count);
+}
+
+
+
+/* private methods */
+
+/* the bucket of a time t: exact below EXACT_COUNT,
+   then SUB_COUNT linear buckets per power of two */
+int bucket_of(uint32 t)
+{
+    int m = 0;
+
+    if(t < EXACT_COUNT)
+        return (int)t;
+
+    while((t >> m) > 1)
+        m++; /* m is the index of the highest bit */
+
+    return EXACT_COUNT + (m - SUB_BITS - 1) * SUB_COUNT + (int)((t >> (m - SUB_BITS)) & (SUB_COUNT - 1));
+}
+
+/* the largest time that falls in bucket b */
+uint32 bucket_upper_bound(int b)
+{
+    int m, sub;
+
+    if(b < EXACT_COUNT)
+        return (uint32)b;
+
+    m = (b - EXACT_COUNT) / SUB_COUNT + SUB_BITS + 1;
+    sub = (b - EXACT_COUNT) % SUB_COUNT;
+    return ((uint32)(SUB_COUNT + sub) << (m - SUB_BITS)) + (((uint32)1 << (m - SUB_BITS)) - 1);
+}
@@ -0,0 +1,53 @@
+/*
+ * Open Surge Engine
+ * framestats.h - frame-time histogram and hitch detector
+ * Copyright (C) 2013  Alexandre Martins <alemartf(at)gmail(dot)com>
+ * http://opensnc.sourceforge.net
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _FRAMESTATS_H
+#define _FRAMESTATS_H
+
+#include "global.h"
+
+/*
+ * The time of each frame is recorded in a histogram with
+ * logarithmic buckets (each power of two is split in 32 linear
+ * buckets, so that the relative error stays below ~3% from a
+ * few microseconds up to hours). It costs a few integer
+ * operations per frame and a fixed amount of memory.
+ *
+ * A frame that takes longer than the hitch threshold is
+ * reported in the logfile, along with the time taken by each
+ * scope of the profiler (if it's enabled). The histogram is
+ * dumped to the logfile when the engine quits.
+ */
+
+struct image_t;
+
+void framestats_init(int hitch_threshold); /* in milliseconds; 0 disables the hitch detector */
+void framestats_release(); /* writes a summary to the logfile */
+void framestats_end_frame(); /* call once per frame */
+
+uint32 framestats_percentile(float p); /* in microseconds; 0.0 <= p <= 100.0 */
+uint32 framestats_max(); /* in microseconds */
+int framestats_frame_count();
+int framestats_hitch_count();
+
+void framestats_render(struct image_t *dest); /* the overlay */
+
+#endif
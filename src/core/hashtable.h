@@ -24,167 +24,263 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <ctype.h>
 #include "util.h"
 #include "stringutil.h"
 #include "logfile.h"
 
 /* utilities */
-#define HASHTABLE_TABLESIZE 97 /* prime number */
-#define HASHTABLE_HASHFUNCTION(x) (((str_to_hash(x)%HASHTABLE_TABLESIZE)+HASHTABLE_TABLESIZE)%HASHTABLE_TABLESIZE)
+#define HASHTABLE_INITIAL_CAPACITY 64 /* must be a power of two */
 
-/* hashtable_<typename> class: pretty much like C++ templates */
+/*
+ * hashtable_<typename> class: pretty much like C++ templates
+ *
+ * This is an open addressing hash table using Robin Hood hashing:
+ * the table grows as needed, the hashes are stored in the slots and
+ * the keys are stored case-folded, so that a probe rarely needs to
+ * compare strings. Once release_unreferenced_entries() has been
+ * called, entries whose reference count drops to zero are queued,
+ * so that it doesn't need to scan the whole table again.
+ */
 #define HASHTABLE_GENERATE_CODE(T) \
 typedef struct hashtable_##T hashtable_##T; \
-typedef struct hashtable_list_##T hashtable_list_##T; \
+typedef struct hashtable_slot_##T hashtable_slot_##T; \
 struct hashtable_##T { \
-    hashtable_list_##T *data[HASHTABLE_TABLESIZE]; \
+    hashtable_slot_##T *slot; /* capacity is a power of two */ \
+    int capacity, count; \
+    char **queue; /* circular queue of (possibly) unreferenced keys */ \
+    int queue_head, queue_length, queue_capacity; \
+    int tracking; /* are we queueing the unreferenced keys? */ \
     void (*destroy_element)(T*); \
 }; \
-struct hashtable_list_##T { \
-    char *key; \
-    T *value;\
-    int reference_count;\
-    hashtable_list_##T *next; \
+struct hashtable_slot_##T { \
+    char *key; /* case-folded. NULL means an empty slot */ \
+    unsigned hash; \
+    T *value; \
+    int reference_count; \
+    int queued; /* is key in the queue? */ \
 }; \
+static unsigned hashtable_##T##_hash(const char *key) /* case insensitive */ \
+{ \
+    unsigned h = (unsigned)str_to_hash(key); \
+    h = (h ^ (h >> 16)) * 0x45d9f3bu; \
+    return h ^ (h >> 16); \
+} \
+static int hashtable_##T##_lookup(const hashtable_##T *h, const char *key) /* returns the index of the slot, or -1 */ \
+{ \
+    unsigned hash = hashtable_##T##_hash(key), mask = h->capacity - 1, i = hash & mask, dist = 0; \
+    const char *p, *q; \
+    for(;; i = (i+1) & mask, dist++) { \
+        const hashtable_slot_##T *s = &(h->slot[i]); \
+        if(s->key == NULL || ((i - (s->hash & mask)) & mask) < dist) \
+            return -1; \
+        if(s->hash == hash) { \
+            for(p=s->key, q=key; *p && *p == tolower((unsigned char)*q); p++, q++); \
+            if(*p == 0 && *q == 0) \
+                return (int)i; \
+        } \
+    } \
+} \
+static void hashtable_##T##_insert(hashtable_##T *h, hashtable_slot_##T entry) /* entry.key must not be in the table */ \
+{ \
+    unsigned mask = h->capacity - 1, i = entry.hash & mask, dist = 0, d; \
+    hashtable_slot_##T tmp; \
+    for(;; i = (i+1) & mask, dist++) { \
+        if(h->slot[i].key == NULL) { \
+            h->slot[i] = entry; \
+            return; \
+        } \
+        d = (i - (h->slot[i].hash & mask)) & mask; \
+        if(d < dist) { /* Robin Hood: take from the rich */ \
+            tmp = h->slot[i]; \
+            h->slot[i] = entry; \
+            entry = tmp; \
+            dist = d; \
+        } \
+    } \
+} \
+static void hashtable_##T##_grow(hashtable_##T *h) \
+{ \
+    hashtable_slot_##T *old = h->slot; \
+    int i, n = h->capacity; \
+    h->capacity *= 2; \
+    h->slot = mallocx(h->capacity * sizeof *(h->slot)); \
+    for(i=0; i<h->capacity; i++) \
+        h->slot[i].key = NULL; \
+    for(i=0; i<n; i++) { \
+        if(old[i].key != NULL) \
+            hashtable_##T##_insert(h, old[i]); \
+    } \
+    free(old); \
+} \
+static void hashtable_##T##_erase(hashtable_##T *h, int k) /* backward shift deletion */ \
+{ \
+    unsigned mask = h->capacity - 1, i = (unsigned)k, j = (i+1) & mask; \
+    if(h->destroy_element != NULL) \
+        h->destroy_element(h->slot[i].value); \
+    free(h->slot[i].key); \
+    while(h->slot[j].key != NULL && ((j - (h->slot[j].hash & mask)) & mask) > 0) { \
+        h->slot[i] = h->slot[j]; \
+        i = j; \
+        j = (j+1) & mask; \
+    } \
+    h->slot[i].key = NULL; \
+    h->count--; \
+} \
+static void hashtable_##T##_enqueue(hashtable_##T *h, int k) \
+{ \
+    if(h->tracking && !h->slot[k].queued) { \
+        if(h->queue_length > 2 * h->count + 64) { /* too many stale keys: rebuild the queue */ \
+            int i; \
+            for(i=0; i<h->queue_length; i++) \
+                free(h->queue[(h->queue_head + i) % h->queue_capacity]); \
+            h->queue_head = h->queue_length = 0; \
+            for(i=0; i<h->capacity; i++) { \
+                if(h->slot[i].key != NULL && h->slot[i].queued && h->slot[i].reference_count <= 0) \
+                    h->queue[h->queue_length++] = str_dup(h->slot[i].key); \
+                else \
+                    h->slot[i].queued = FALSE; \
+            } \
+            if(h->slot[k].queued) \
+                return; \
+        } \
+        if(h->queue_length >= h->queue_capacity) { \
+            int i, n = max(16, 2 * h->queue_capacity); \
+            char **queue = mallocx(n * sizeof *queue); \
+            for(i=0; i<h->queue_length; i++) \
+                queue[i] = h->queue[(h->queue_head + i) % h->queue_capacity]; \
+            free(h->queue); \
+            h->queue = queue; \
+            h->queue_head = 0; \
+            h->queue_capacity = n; \
+        } \
+        h->queue[(h->queue_head + h->queue_length++) % h->queue_capacity] = str_dup(h->slot[k].key); \
+        h->slot[k].queued = TRUE; \
+    } \
+} \
 hashtable_##T* hashtable_##T##_create(void (*destroy_element_strategy)(T*)) /* destroy_element_strategy may be NULL */ \
 { \
     int i; \
     hashtable_##T *h = mallocx(sizeof *h); \
-    logfile_message("hashtable_" #T "_create()"); \
+    logfile_debug("hashtable_" #T "_create()"); \
     h->destroy_element = destroy_element_strategy; \
-    for(i=0; i<HASHTABLE_TABLESIZE; i++) \
-        h->data[i] = NULL; \
+    h->capacity = HASHTABLE_INITIAL_CAPACITY; \
+    h->count = 0; \
+    h->slot = mallocx(h->capacity * sizeof *(h->slot)); \
+    for(i=0; i<h->capacity; i++) \
+        h->slot[i].key = NULL; \
+    h->queue = NULL; \
+    h->queue_head = h->queue_length = h->queue_capacity = 0; \
+    h->tracking = FALSE; \
     return h; \
 } \
 hashtable_##T* hashtable_##T##_destroy(hashtable_##T *h) \
 { \
     int i; \
-    hashtable_list_##T *p, *q; \
-    logfile_message("hashtable_" #T "_destroy()"); \
-    for(i=0; i<HASHTABLE_TABLESIZE; i++) { \
-        p = h->data[i]; \
-        while(p != NULL) { \
-            q = p->next; \
+    logfile_debug("hashtable_" #T "_destroy()"); \
+    for(i=0; i<h->capacity; i++) { \
+        if(h->slot[i].key != NULL) { \
             if(h->destroy_element != NULL) \
-                h->destroy_element(p->value); \
-            free(p->key); \
-            free(p); \
-            p = q; \
+                h->destroy_element(h->slot[i].value); \
+            free(h->slot[i].key); \
         } \
     } \
+    for(i=0; i<h->queue_length; i++) \
+        free(h->queue[(h->queue_head + i) % h->queue_capacity]); \
+    if(h->queue != NULL) \
+        free(h->queue); \
+    free(h->slot); \
     free(h); \
-    logfile_message("hashtable_" #T "_destroy() - success!"); \
+    logfile_debug("hashtable_" #T "_destroy() - success!"); \
     return NULL; \
 } \
 T* hashtable_##T##_find(const hashtable_##T *h, const char *key) \
 { \
-    int k = HASHTABLE_HASHFUNCTION(key); \
-    hashtable_list_##T *q = h->data[k]; \
-    while(q != NULL) { \
-        if(str_icmp(q->key, key) == 0) \
-            return q->value; \
-        else \
-            q = q->next; \
-    } \
-    return NULL; \
+    int k = hashtable_##T##_lookup(h, key); \
+    return k >= 0 ? h->slot[k].value : NULL; \
 } \
 void hashtable_##T##_add(hashtable_##T *h, const char *key, T *value) \
 { \
-    if(NULL == hashtable_##T##_find(h, key)) { \
-        int k = HASHTABLE_HASHFUNCTION(key); \
-        hashtable_list_##T *q; \
-        logfile_message("hashtable_" #T "_add(): adding '%s'...", key); \
-        q = mallocx(sizeof *q); \
-        q->key = str_dup(key); \
-        q->value = value; \
-        q->reference_count = 0;\
-        q->next = h->data[k]; \
-        h->data[k] = q; \
+    if(hashtable_##T##_lookup(h, key) < 0) { \
+        hashtable_slot_##T entry; \
+        char *p; \
+        logfile_debug("hashtable_" #T "_add(): adding '%s'...", key); \
+        if(4 * (h->count + 1) > 3 * h->capacity) \
+            hashtable_##T##_grow(h); \
+        entry.key = str_dup(key); \
+        for(p=entry.key; *p; p++) \
+            *p = tolower((unsigned char)*p); \
+        entry.hash = hashtable_##T##_hash(key); \
+        entry.value = value; \
+        entry.reference_count = 0; \
+        entry.queued = FALSE; \
+        hashtable_##T##_insert(h, entry); \
+        h->count++; \
+        if(h->tracking) \
+            hashtable_##T##_enqueue(h, hashtable_##T##_lookup(h, key)); /* it's unreferenced */ \
     } \
     else \
         logfile_message("hashtable_" #T "_add(): item '%s' already exists! It won't be added.", key); \
 } \
 void hashtable_##T##_remove(hashtable_##T *h, const char *key) \
 { \
-    int k = HASHTABLE_HASHFUNCTION(key); \
-    hashtable_list_##T *p, *q; \
-    logfile_message("hashtable_" #T "_remove(): removing element '%s'...", key); \
-    if(h->data[k] != NULL) { \
-        p = h->data[k]; \
-        if(str_icmp(p->key, key) == 0) { \
-            if(p->reference_count <= 0) { \
-                h->data[k] = p->next; \
-                if(h->destroy_element != NULL) \
-                    h->destroy_element(p->value); \
-                free(p->key); \
-                free(p); \
-            } \
-            else \
-                logfile_message("hashtable_" #T "_remove(): element '%s' has %d active references. It won't be removed.", key, p->reference_count); \
-            return; \
-        } \
-        else { \
-            while(p->next != NULL) { \
-                if(str_icmp(p->next->key, key) == 0) { \
-                    if(p->next->reference_count <= 0) { \
-                        q = p->next; \
-                        p->next = q->next; \
-                        if(h->destroy_element != NULL) \
-                            h->destroy_element(q->value); \
-                        free(q->key); \
-                        free(q); \
-                    } \
-                    else \
-                        logfile_message("hashtable_" #T "_remove(): element '%s' has %d active references. It won't be removed.", key, p->next->reference_count); \
-                    return; \
-                } \
-                p = p->next; \
-            } \
-        } \
+    int k = hashtable_##T##_lookup(h, key); \
+    logfile_debug("hashtable_" #T "_remove(): removing element '%s'...", key); \
+    if(k >= 0) { \
+        if(h->slot[k].reference_count <= 0) \
+            hashtable_##T##_erase(h, k); \
+        else \
+            logfile_message("hashtable_" #T "_remove(): element '%s' has %d active references. It won't be removed.", key, h->slot[k].reference_count); \
+        return; \
     } \
     logfile_message("hashtable_" #T "_remove(): element '%s' does not exist.", key); \
 } \
 int hashtable_##T##_ref(hashtable_##T *h, const char *key) \
 { \
-    int k = HASHTABLE_HASHFUNCTION(key); \
-    hashtable_list_##T *q = h->data[k]; \
-    while(q != NULL) { \
-        if(str_icmp(q->key, key) == 0) \
-            return ++(q->reference_count); \
-        else \
-            q = q->next; \
-    } \
+    int k = hashtable_##T##_lookup(h, key); \
+    if(k >= 0) \
+        return ++(h->slot[k].reference_count); \
     logfile_message("hashtable_" #T "_ref(): element '%s' does not exist.", key); \
     return 0; \
 } \
 int hashtable_##T##_unref(hashtable_##T *h, const char *key) \
 { \
-    int k = HASHTABLE_HASHFUNCTION(key); \
-    hashtable_list_##T *q = h->data[k]; \
-    while(q != NULL) { \
-        if(str_icmp(q->key, key) == 0) { \
-            q->reference_count = max(0, q->reference_count - 1); \
-            return q->reference_count; \
-        } \
-        else \
-            q = q->next; \
+    int k = hashtable_##T##_lookup(h, key); \
+    if(k >= 0) { \
+        h->slot[k].reference_count = max(0, h->slot[k].reference_count - 1); \
+        if(h->slot[k].reference_count == 0) \
+            hashtable_##T##_enqueue(h, k); \
+        return h->slot[k].reference_count; \
     } \
     logfile_message("hashtable_" #T "_unref(): element '%s' does not exist.", key); \
     return 0; \
 } \
-void hashtable_##T##_release_unreferenced_entries(hashtable_##T *h) \
+void hashtable_##T##_release_unreferenced_entries(hashtable_##T *h) /* releases (at most) one unreferenced entry */ \
 { \
-    /* TODO: improve the performance of this routine by using a queue
-             to store the unreferenced entries */ \
-    int i; \
-    hashtable_list_##T *q; \
-    for(i=0; i<HASHTABLE_TABLESIZE; i++) { \
-        for(q=h->data[i]; q!=NULL; q=q->next) { \
-            if(q->reference_count <= 0) { \
-                hashtable_##T##_remove(h, q->key); \
+    char *key; \
+    int k; \
+    if(!h->tracking) { \
+        h->tracking = TRUE; \
+        for(k=0; k<h->capacity; k++) { \
+            if(h->slot[k].key != NULL && h->slot[k].reference_count <= 0) \
+                hashtable_##T##_enqueue(h, k); \
+        } \
+    } \
+    while(h->queue_length > 0) { \
+        key = h->queue[h->queue_head]; \
+        h->queue_head = (h->queue_head + 1) % h->queue_capacity; \
+        h->queue_length--; \
+        k = hashtable_##T##_lookup(h, key); \
+        if(k >= 0) { \
+            h->slot[k].queued = FALSE; \
+            if(h->slot[k].reference_count <= 0) { \
+                logfile_debug("hashtable_" #T "_remove(): removing element '%s'...", key); \
+                hashtable_##T##_erase(h, k); \
+                free(key); \
                 return; \
             } \
         } \
+        free(key); \
     } \
 }
 
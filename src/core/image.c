@@ -29,6 +29,7 @@
 #include "image.h"
 #include "video.h"
 #include "stringutil.h"
+#include "profiler.h"
 #include "logfile.h"
 #include "osspec.h"
 #include "resourcemanager.h"
@@ -40,6 +41,12 @@ struct image_t {
     int w, h;
 };
 
+/* pixels decoded by image_decode(): 8-bit RGB, row by row */
+struct decodedimage_t {
+    int w, h;
+    uint8 *pixels;
+};
+
 /* useful stuff */
 #define IS_PNG(path) (str_icmp((path)+strlen(path)-4, ".png") == 0)
 typedef int (*fast_getpixel_funptr)(BITMAP*,int,int);
@@ -51,6 +58,9 @@ typedef int (*fast_getb_funptr)(int);
 
 /* private stuff */
 static void maskcolor_bugfix(image_t *img);
+static BITMAP* bitmap_from_decoded(const decodedimage_t *decoded);
+static double screen_gamma();
+static void ignore_png_warning(png_structp png, png_const_charp message);
 static fast_getpixel_funptr fast_getpixel_fun(); /* returns a function. this won't do any clipping, so be careful. */
 static fast_putpixel_funptr fast_putpixel_fun(); /* returns a function. this won't do any clipping, so be careful. */
 static fast_makecol_funptr fast_makecol_fun(); /* returns a function */
@@ -66,19 +76,26 @@ static fast_getb_funptr fast_getb_fun(); /* returns a function */
 image_t *image_load(const char *path)
 {
     char abs_path[1024];
+    decodedimage_t *decoded;
     image_t *img;
 
+    /* a worker thread may have decoded it already */
+    decoded = resourcemanager_take_decoded_image(path);
+
     if(NULL == (img = resourcemanager_find_image(path))) {
         resource_filepath(abs_path, path, sizeof(abs_path), RESFP_READ);
-        logfile_message("image_load('%s')", abs_path);
+        logfile_debug("image_load('%s')", abs_path);
 
         /* build the image object */
         img = mallocx(sizeof *img);
 
         /* loading the image */
-        img->data = load_bitmap(abs_path, NULL);
+        profiler_begin(PROF_RESOURCES);
+        img->data = (decoded != NULL) ? bitmap_from_decoded(decoded) : load_bitmap(abs_path, NULL);
+        profiler_end(PROF_RESOURCES);
         if(img->data == NULL) {
             logfile_message("image_load() error: %s", allegro_error);
+            decoded = decodedimage_destroy(decoded);
             free(img);
             return NULL;
         }
@@ -86,18 +103,22 @@ image_t *image_load(const char *path)
         /* configuring the image */
         img->w = img->data->w;
         img->h = img->data->h;
-        maskcolor_bugfix(img);
+        if(decoded == NULL)
+            maskcolor_bugfix(img); /* bitmap_from_decoded() takes care of the mask color */
 
         /* adding it to the resource manager */
         resourcemanager_add_image(path, img);
         resourcemanager_ref_image(path);
 
         /* done! */
-        logfile_message("image_load() ok");
+        logfile_debug("image_load() ok");
     }
     else
         resourcemanager_ref_image(path);
 
+    if(decoded != NULL)
+        decoded = decodedimage_destroy(decoded);
+
     return img;
 }
 
@@ -233,6 +254,101 @@ image_t *image_create_shared(const image_t *parent, int x, int y, int width, int
     return img;
 }
 
+/*
+ * image_decode()
+ * Decodes a PNG file into plain pixels, without touching
+ * Allegro, so that worker threads may call it. Returns
+ * NULL on errors, or if the file isn't a PNG.
+ */
+decodedimage_t *image_decode(const char *abs_path)
+{
+    decodedimage_t *volatile decoded = NULL;
+    png_bytep *volatile rows = NULL;
+    png_structp png = NULL;
+    png_infop info = NULL;
+    png_uint_32 width, height, j;
+    int bit_depth, color_type;
+    double gamma, file_gamma;
+    png_byte signature[8];
+    FILE *fp;
+
+    if(!IS_PNG(abs_path) || NULL == (fp = fopen(abs_path, "rb")))
+        return NULL;
+
+    if(fread(signature, 1, sizeof(signature), fp) != sizeof(signature) || png_sig_cmp(signature, 0, sizeof(signature)) != 0) {
+        fclose(fp);
+        return NULL;
+    }
+
+    png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, ignore_png_warning);
+    info = (png != NULL) ? png_create_info_struct(png) : NULL;
+    if(info == NULL) {
+        png_destroy_read_struct(&png, NULL, NULL);
+        fclose(fp);
+        return NULL;
+    }
+
+    /* libpng jumps back here on errors */
+    if(setjmp(png_jmpbuf(png))) {
+        png_destroy_read_struct(&png, &info, NULL);
+        decodedimage_destroy(decoded);
+        free(rows);
+        fclose(fp);
+        return NULL;
+    }
+
+    png_init_io(png, fp);
+    png_set_sig_bytes(png, sizeof(signature));
+    png_read_info(png, info);
+    png_get_IHDR(png, info, &width, &height, &bit_depth, &color_type, NULL, NULL, NULL);
+
+    /* we want 8-bit RGB. Like the color conversion of Allegro, we drop the alpha channel */
+    png_set_expand(png);
+    png_set_strip_16(png);
+    png_set_strip_alpha(png);
+    if(color_type == PNG_COLOR_TYPE_GRAY || color_type == PNG_COLOR_TYPE_GRAY_ALPHA)
+        png_set_gray_to_rgb(png);
+    if((gamma = screen_gamma()) != 0.0) /* just like loadpng */
+        png_set_gamma(png, gamma, png_get_gAMA(png, info, &file_gamma) ? file_gamma : 0.45455);
+    png_set_interlace_handling(png);
+    png_read_update_info(png, info);
+
+    if(png_get_rowbytes(png, info) != 3 * width)
+        png_error(png, "unexpected row size");
+
+    /* decoding */
+    if(NULL == (decoded = malloc(sizeof *decoded)))
+        png_error(png, "out of memory");
+    decoded->w = (int)width;
+    decoded->h = (int)height;
+    if(NULL == (decoded->pixels = malloc((size_t)width * height * 3)) || NULL == (rows = malloc(height * sizeof *rows)))
+        png_error(png, "out of memory");
+    for(j=0; j<height; j++)
+        rows[j] = decoded->pixels + (size_t)j * width * 3;
+    png_read_image(png, rows);
+    png_read_end(png, NULL);
+
+    /* done! */
+    png_destroy_read_struct(&png, &info, NULL);
+    free(rows);
+    fclose(fp);
+    return decoded;
+}
+
+/*
+ * decodedimage_destroy()
+ * Releases pixels that haven't become an image
+ */
+decodedimage_t *decodedimage_destroy(decodedimage_t *decoded)
+{
+    if(decoded != NULL) {
+        free(decoded->pixels);
+        free(decoded);
+    }
+
+    return NULL;
+}
+
 /*
  * image_width()
  * The width of the image
@@ -263,6 +379,17 @@ uint32 image_getpixel(const image_t *img, int x, int y)
 }
 
 
+/*
+ * image_memory_usage()
+ * Approximate size of the pixel data, in bytes. Sub-images
+ * report the size of the region they share with their parent.
+ */
+int image_memory_usage(const image_t *img)
+{
+    return img->w * img->h * ((bitmap_color_depth(img->data) + 7) / 8);
+}
+
+
 /*
  * image_putpixel()
  * Plots a pixel into the given image
@@ -567,6 +694,54 @@ void maskcolor_bugfix(image_t *img)
 }
 
 
+/*
+ * bitmap_from_decoded()
+ * Turns the pixels decoded by a worker thread into a bitmap
+ * of the current color depth (main thread). Magenta becomes
+ * the mask color, as in maskcolor_bugfix()
+ */
+BITMAP* bitmap_from_decoded(const decodedimage_t *decoded)
+{
+    int i, j, mask = (int)video_get_maskcolor();
+    fast_putpixel_funptr fast_putpixel = fast_putpixel_fun();
+    fast_makecol_funptr fast_makecol = fast_makecol_fun();
+    const uint8 *p = decoded->pixels;
+    BITMAP *bmp;
+
+    if(NULL == (bmp = create_bitmap(decoded->w, decoded->h)))
+        return NULL;
+
+    for(j=0; j<decoded->h; j++) {
+        for(i=0; i<decoded->w; i++, p+=3)
+            fast_putpixel(bmp, i, j, (p[0] == 255 && p[1] == 0 && p[2] == 255) ? mask : fast_makecol(p[0], p[1], p[2]));
+    }
+
+    return bmp;
+}
+
+/*
+ * screen_gamma()
+ * The gamma of the screen, as loadpng sees it
+ */
+double screen_gamma()
+{
+    const char *str;
+
+    if(_png_screen_gamma != -1.0)
+        return _png_screen_gamma;
+
+    return (NULL != (str = getenv("SCREEN_GAMMA"))) ? atof(str) : 2.2;
+}
+
+/*
+ * ignore_png_warning()
+ * libpng warnings are of no interest to us
+ */
+void ignore_png_warning(png_structp png, png_const_charp message)
+{
+    ;
+}
+
 /*
  * fast_getpixel_ptr()
  * Returns a fast getpixel function. It won't perform any
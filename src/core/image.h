@@ -28,6 +28,9 @@
 /* opaque image type */
 typedef struct image_t image_t;
 
+/* pixels decoded by a worker thread, not yet turned into an image */
+typedef struct decodedimage_t decodedimage_t;
+
 /* image flags (bitwise OR) */
 #define IF_NONE                 0
 #define IF_HFLIP                1
@@ -41,6 +44,10 @@ void image_destroy(image_t *img); /* call this after image_create() */
 void image_save(const image_t *img, const char *path); /* saves the image to a file */
 image_t *image_create_shared(const image_t *parent, int x, int y, int width, int height); /* creates a sub-image */
 
+/* decoding in worker threads (these two are thread-safe) */
+decodedimage_t *image_decode(const char *abs_path); /* PNG only. Returns NULL on errors. Hand it over with resourcemanager_add_decoded_image() */
+decodedimage_t *decodedimage_destroy(decodedimage_t *decoded); /* returns NULL */
+
 /* properties */
 inline int image_width(const image_t *img);
 inline int image_height(const image_t *img);
@@ -48,6 +55,7 @@ uint32 image_rgb(uint8 r, uint8 g, uint8 b);
 void image_color2rgb(uint32 color, uint8 *r, uint8 *g, uint8 *b);
 int image_pixelperfect_collision(const image_t *img1, const image_t *img2, int x1, int y1, int x2, int y2);
 uint32 image_getpixel(const image_t *img, int x, int y);
+int image_memory_usage(const image_t *img); /* approximate size of the pixel data, in bytes */
 
 /* drawing primitives */
 void image_clear(image_t *img, uint32 color);
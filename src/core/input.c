@@ -27,6 +27,7 @@
 #include "timer.h"
 #include "inputmap.h"
 #include "stringutil.h"
+#include "replay.h"
 
 /* input strcuture (private) */
 /* <base class> */
@@ -79,12 +80,16 @@ static input_list_t *inlist;
 static int got_joystick;
 static int ignore_joystick;
 static int plugged_joysticks;
+static int no_devices; /* headless mode: the states only change when simulated */
 
 /* private methods */
 static int are_all_joysticks_valid();
 static void input_register(input_t *in);
 static void input_unregister(input_t *in);
 static void get_mouse_mickeys_ex(int *mickey_x, int *mickey_y, int *mickey_z);
+static int is_replayable(const input_t *in);
+static void record_step();
+static void play_step();
 
 
 
@@ -92,10 +97,24 @@ static void get_mouse_mickeys_ex(int *mickey_x, int *mickey_y, int *mickey_z);
  * input_init()
  * Initializes the input module
  */
-void input_init()
+void input_init(int headless)
 {
     logfile_message("input_init()");
 
+    /* initializing */
+    inlist = NULL;
+    got_joystick = FALSE;
+    ignore_joystick = TRUE;
+    plugged_joysticks = 0;
+    no_devices = headless;
+
+    /* headless mode: nothing is pressed, unless simulated */
+    if(no_devices) {
+        logfile_message("input_init(): headless mode");
+        inputmap_init();
+        return;
+    }
+
     /* installing Allegro stuff */
     logfile_message("Installing Allegro input devices...");
     if(install_keyboard() != 0)
@@ -103,13 +122,7 @@ void input_init()
     if(install_mouse() == -1)
         logfile_message("install_mouse() failed: %s", allegro_error);
 
-    /* initializing */
-    inlist = NULL;
-
     /* joystick */
-    got_joystick = FALSE;
-    ignore_joystick = TRUE;
-    plugged_joysticks = 0;
     if(install_joystick(JOY_TYPE_AUTODETECT) == 0) {
         if(num_joysticks > 0 && are_all_joysticks_valid()) {
             got_joystick = TRUE;
@@ -144,14 +157,16 @@ void input_update()
     input_list_t *it;
 
     /* polling devices */
-    if(keyboard_needs_poll())
-        poll_keyboard();
+    if(!no_devices) {
+        if(keyboard_needs_poll())
+            poll_keyboard();
 
-    if(mouse_needs_poll())
-        poll_mouse();
+        if(mouse_needs_poll())
+            poll_mouse();
 
-    if(input_joystick_available())
-        poll_joystick();
+        if(input_joystick_available())
+            poll_joystick();
+    }
 
     /* updating input objects */
     for(it = inlist; it; it=it->next) {
@@ -160,11 +175,22 @@ void input_update()
         for(i=0; i<IB_MAX; i++)
             it->data->oldstate[i] = it->data->state[i];
 
-        /* update the appropriate input device */
-        it->data->update(it->data);
+        /* update the appropriate input device (if there's no
+           device, the states only change when simulated) */
+        if(!no_devices && !(replay_is_playing() && is_replayable(it->data)))
+            it->data->update(it->data);
 
     }
 
+    /* replays */
+    if(replay_is_recording())
+        record_step();
+    else if(replay_is_playing())
+        play_step();
+
+    if(no_devices)
+        return;
+
     /* lock mouse? */
     if(lock_mouse && video_is_window_active())
         position_mouse(SCREEN_W/2, SCREEN_H/2);
@@ -553,6 +579,61 @@ void inputmouse_update(input_t* in)
     in->state[IB_FIRE8] = FALSE;
 }
 
+/* replays hold the states of the user-defined devices */
+int is_replayable(const input_t *in)
+{
+    return in->update == inputuserdefined_update;
+}
+
+/* records the states of the replayable devices, newest first */
+void record_step()
+{
+    uint16 mask[REPLAY_MAX_DEVICES];
+    input_list_t *it;
+    int i, n = 0;
+
+    for(it = inlist; it && n < REPLAY_MAX_DEVICES; it=it->next) {
+        if(is_replayable(it->data)) {
+            mask[n] = 0;
+            for(i=0; i<IB_MAX; i++)
+                mask[n] |= it->data->state[i] ? (1 << i) : 0;
+            n++;
+        }
+    }
+
+    replay_write_step(mask, n);
+}
+
+/* sets the states of the replayable devices. The game
+   quits at the end of the replay */
+void play_step()
+{
+    static int warned = FALSE;
+    uint16 mask[REPLAY_MAX_DEVICES];
+    input_list_t *it;
+    int i, j = 0, n = replay_read_step(mask, REPLAY_MAX_DEVICES);
+
+    if(n < 0) {
+        logfile_message("The replay has ended.");
+        replay_stop();
+        game_quit();
+        return;
+    }
+
+    for(it = inlist; it; it=it->next) {
+        if(is_replayable(it->data)) {
+            for(i=0; i<IB_MAX; i++)
+                it->data->state[i] = (j < n && (mask[j] & (1 << i))) ? TRUE : FALSE;
+            j++;
+        }
+    }
+
+    if(j != n && !warned) {
+        logfile_message("WARNING: the replay is out of sync (%d input devices were recorded, but there are %d)", n, j);
+        warned = TRUE;
+    }
+}
+
 void inputcomputer_update(input_t* in)
 {
     ;
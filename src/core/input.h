@@ -49,7 +49,7 @@ enum inputbutton_t {
 };
 
 /* public methods */
-void input_init();
+void input_init(int headless); /* if headless, no input device is installed */
 void input_update();
 void input_release();
 
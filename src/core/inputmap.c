@@ -28,6 +28,7 @@
 #include "osspec.h"
 #include "hashtable.h"
 #include "nanoparser/nanoparser.h"
+#include "scriptcache.h"
 
 #define INPUTMAP_FILE           "config/input.def"
 
@@ -568,7 +569,7 @@ void load_inputmap_table()
     logfile_message("inputmap: loading the input mappings...");
     resource_filepath(abs_path, INPUTMAP_FILE, sizeof(abs_path), RESFP_READ);
 
-    s = nanoparser_construct_tree(abs_path);
+    s = scriptcache_construct_tree(abs_path);
     nanoparser_traverse_program(s, traverse);
     s = nanoparser_deconstruct_tree(s);
 }
@@ -28,6 +28,7 @@
 #include "logfile.h"
 #include "hashtable.h"
 #include "nanoparser/nanoparser.h"
+#include "scriptcache.h"
 
 /* fake string type */
 typedef struct { char *data; } stringadapter_t;
@@ -90,7 +91,7 @@ void lang_loadfile(const char *filepath)
         fatal_error("\"%s\" (version %d.%d.%d) is not compatible with version %d.%d.%d of the engine", filepath, ver, subver, wipver, GAME_VERSION, GAME_SUB_VERSION, GAME_WIP_VERSION);
 
     resource_filepath(abs_path, filepath, sizeof(abs_path), RESFP_READ);
-    prog = nanoparser_construct_tree(abs_path);
+    prog = scriptcache_construct_tree(abs_path);
     nanoparser_traverse_program(prog, traverse);
     prog = nanoparser_deconstruct_tree(prog);
 }
@@ -111,7 +112,7 @@ void lang_readstring(const char *filepath, const char *desired_key, char *str, i
     param.key = desired_key;
     param.value = NULL;
 
-    prog = nanoparser_construct_tree(abs_path);
+    prog = scriptcache_construct_tree(abs_path);
     nanoparser_traverse_program_ex(prog, (void*)(&param), traverse_inout);
 
     if(param.value == NULL)
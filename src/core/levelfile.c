@@ -0,0 +1,832 @@
+/*
+ * Open Surge Engine
+ * levelfile.c - level files: text and binary forms
+ * Copyright (C) 2013  Alexandre Martins <alemartf(at)gmail(dot)com>
+ * http://opensnc.sourceforge.net
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "levelfile.h"
+#include "global.h"
+#include "util.h"
+#include "stringutil.h"
+#include "logfile.h"
+
+/* private stuff */
+#define LEVELFILE_MAGIC         "OSLV"
+#define LEVELFILE_VERSION       3
+#define HEADER_SIZE             12 /* magic, version, position of the brick records */
+#define BRICK_RECORD_SIZE       20 /* type, x, y, layer, order */
+#define MAX_PARAMS              1024
+
+typedef struct sortkey_t { int sector_y, sector_x, order, index; } sortkey_t;
+
+static void add_command(levelfile_t *lf, int identifier, int param_count, const int *param, int line);
+static void add_brick(levelfile_t *lf, int type, int x, int y, int layer, int order);
+static void add_item(levelfile_t *lf, int type, int x, int y);
+static void add_object(levelfile_t *lf, int name, int x, int y);
+static void add_sector(levelfile_t *lf, int x, int y, int first_brick, int brick_count);
+static int sector_of(int coordinate);
+static int compare_sortkeys(const void *a, const void *b);
+static int compare_brick_order(const void *a, const void *b);
+static void rebuild_string_lookup(levelfile_t *lf, int capacity);
+static unsigned hash_string(const char *str);
+static int read_text(levelfile_t *lf, char *data, long size);
+static int read_binary(levelfile_t *lf, const unsigned char *data, long size, int load_bricks);
+static int read_u32(uint32 *x, const unsigned char *data, long size, long *ptr);
+static int read_index(int *x, int count, const unsigned char *data, long size, long *ptr);
+static void write_u32(FILE *fp, uint32 x);
+static void write_token(FILE *fp, const char *str);
+static void *grow(void *array, int *capacity, int needed, size_t element_size);
+
+
+
+/* public methods */
+
+/*
+ * levelfile_create()
+ * Creates an empty level file
+ */
+levelfile_t* levelfile_create()
+{
+    levelfile_t *lf = mallocx(sizeof *lf);
+
+    lf->command = NULL;
+    lf->param = NULL;
+    lf->brick = NULL;
+    lf->item = NULL;
+    lf->object = NULL;
+    lf->sector = NULL;
+    lf->command_count = lf->param_count = lf->brick_count = lf->item_count = lf->object_count = lf->sector_count = 0;
+    lf->command_capacity = lf->param_capacity = lf->brick_capacity = lf->item_capacity = lf->object_capacity = lf->sector_capacity = 0;
+    lf->bricks_on_disk = FALSE;
+    lf->brick_offset = 0;
+
+    lf->string_data = NULL;
+    lf->string_offset = NULL;
+    lf->string_lookup = NULL;
+    lf->string_count = lf->string_data_size = 0;
+    lf->string_capacity = lf->string_data_capacity = lf->string_lookup_capacity = 0;
+
+    return lf;
+}
+
+/*
+ * levelfile_destroy()
+ * Destroys a level file
+ */
+levelfile_t* levelfile_destroy(levelfile_t *lf)
+{
+    free(lf->command);
+    free(lf->param);
+    free(lf->brick);
+    free(lf->item);
+    free(lf->object);
+    free(lf->sector);
+    free(lf->string_data);
+    free(lf->string_offset);
+    free(lf->string_lookup);
+    free(lf);
+    return NULL;
+}
+
+/*
+ * levelfile_load()
+ * Reads a level file, either in the text or in the
+ * binary form. Returns NULL on error.
+ */
+levelfile_t* levelfile_load(const char *abs_path)
+{
+    return levelfile_load_ex(abs_path, TRUE);
+}
+
+/*
+ * levelfile_load_ex()
+ * Reads a level file. If load_bricks is FALSE and the file
+ * is in the binary form, the brick records are not read:
+ * only their sectors are. Returns NULL on error.
+ */
+levelfile_t* levelfile_load_ex(const char *abs_path, int load_bricks)
+{
+    unsigned char header[HEADER_SIZE];
+    levelfile_t *lf;
+    char *data;
+    long size, ptr = 8;
+    uint32 brick_offset;
+    int ok;
+    FILE *fp;
+
+    if(NULL == (fp = fopen(abs_path, "rb")))
+        return NULL;
+
+    /* read the whole file at once, unless we're leaving the bricks on the disk */
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    if(!load_bricks && size >= HEADER_SIZE && fread(header, 1, HEADER_SIZE, fp) == HEADER_SIZE && memcmp(header, LEVELFILE_MAGIC, 4) == 0) {
+        if(read_u32(&brick_offset, header, HEADER_SIZE, &ptr) && (long)brick_offset + 4 <= size)
+            size = (long)brick_offset + 4; /* up to the number of bricks */
+    }
+    fseek(fp, 0, SEEK_SET);
+    data = mallocx(max(1, size + 1));
+    if(size < 0 || fread(data, 1, size, fp) != (size_t)size) {
+        logfile_message("levelfile_load(\"%s\"): read error", abs_path);
+        free(data);
+        fclose(fp);
+        return NULL;
+    }
+    data[size] = 0;
+    fclose(fp);
+
+    /* parse it */
+    lf = levelfile_create();
+    if(size >= 4 && memcmp(data, LEVELFILE_MAGIC, 4) == 0)
+        ok = read_binary(lf, (const unsigned char*)data, size, load_bricks);
+    else
+        ok = read_text(lf, data, size);
+    free(data);
+
+    if(!ok) {
+        logfile_message("levelfile_load(\"%s\"): invalid or outdated file", abs_path);
+        lf = levelfile_destroy(lf);
+    }
+
+    return lf;
+}
+
+/*
+ * levelfile_read_bricks()
+ * Reads brick records of the binary form from the disk.
+ * This only does plain file I/O, so it may be called
+ * from any thread.
+ */
+int levelfile_read_bricks(const char *abs_path, const levelfile_t *lf, int first_brick, int brick_count, levelfile_brick_t *dest)
+{
+    unsigned char buf[BRICK_RECORD_SIZE * 256];
+    long ptr;
+    uint32 v[5];
+    int i, j, n, ok = TRUE;
+    FILE *fp;
+
+    if(first_brick < 0 || brick_count < 0 || first_brick + brick_count > lf->brick_count)
+        return FALSE;
+
+    if(NULL == (fp = fopen(abs_path, "rb")))
+        return FALSE;
+
+    if(0 != fseek(fp, lf->brick_offset + (long)BRICK_RECORD_SIZE * first_brick, SEEK_SET))
+        ok = FALSE;
+
+    for(i=0; i<brick_count && ok; i+=n) {
+        n = min(brick_count - i, (int)(sizeof(buf) / BRICK_RECORD_SIZE));
+        if(fread(buf, BRICK_RECORD_SIZE, n, fp) != (size_t)n) {
+            ok = FALSE;
+            break;
+        }
+
+        for(ptr=0, j=0; j<n; j++) {
+            read_u32(&v[0], buf, sizeof(buf), &ptr);
+            read_u32(&v[1], buf, sizeof(buf), &ptr);
+            read_u32(&v[2], buf, sizeof(buf), &ptr);
+            read_u32(&v[3], buf, sizeof(buf), &ptr);
+            read_u32(&v[4], buf, sizeof(buf), &ptr);
+            dest[i+j].type = (int)v[0];
+            dest[i+j].x = (int)v[1];
+            dest[i+j].y = (int)v[2];
+            dest[i+j].layer = ((int)v[3] >= -1 && (int)v[3] < lf->string_count) ? (int)v[3] : -1;
+            dest[i+j].order = (int)v[4];
+        }
+    }
+
+    fclose(fp);
+    return ok;
+}
+
+/*
+ * levelfile_save_text()
+ * Writes the text form of a level file
+ */
+int levelfile_save_text(const levelfile_t *lf, const char *abs_path)
+{
+    int i, j;
+    FILE *fp;
+
+    if(NULL == (fp = fopen(abs_path, "w"))) {
+        logfile_message("levelfile_save_text(): can't open \"%s\" for writing", abs_path);
+        return FALSE;
+    }
+
+    fprintf(fp, "// ------------------------------------------------------------\n");
+    fprintf(fp, "// %s %d.%d.%d level\n", GAME_TITLE, GAME_VERSION, GAME_SUB_VERSION, GAME_WIP_VERSION);
+    fprintf(fp, "// ------------------------------------------------------------\n\n");
+
+    for(i=0; i<lf->command_count; i++) {
+        const levelfile_command_t *cmd = &(lf->command[i]);
+        fputs(levelfile_string(lf, cmd->identifier), fp);
+        for(j=0; j<cmd->param_count; j++)
+            write_token(fp, levelfile_string(lf, lf->param[cmd->first_param + j]));
+        fputc('\n', fp);
+    }
+
+    fprintf(fp, "\n// brick list\n");
+    for(i=0; i<lf->brick_count; i++) {
+        fprintf(fp, "brick %d %d %d", lf->brick[i].type, lf->brick[i].x, lf->brick[i].y);
+        if(lf->brick[i].layer >= 0)
+            write_token(fp, levelfile_string(lf, lf->brick[i].layer));
+        fputc('\n', fp);
+    }
+
+    fprintf(fp, "\n// item list\n");
+    for(i=0; i<lf->item_count; i++)
+        fprintf(fp, "item %d %d %d\n", lf->item[i].type, lf->item[i].x, lf->item[i].y);
+
+    fprintf(fp, "\n// object list\n");
+    for(i=0; i<lf->object_count; i++) {
+        fputs("object", fp);
+        write_token(fp, levelfile_string(lf, lf->object[i].name));
+        fprintf(fp, " %d %d\n", lf->object[i].x, lf->object[i].y);
+    }
+
+    fprintf(fp, "\n// EOF");
+    fclose(fp);
+    return TRUE;
+}
+
+/*
+ * levelfile_save_binary()
+ * Writes the binary form of a level file. All the numbers
+ * are 32-bit little-endian integers:
+ *
+ * "OSLV" version brick_offset
+ * string_count { length bytes }
+ * command_count { identifier line param_count { param } }
+ * item_count { type x y }
+ * object_count { name x y }
+ * sector_count { x y first_brick brick_count }
+ * brick_count { type x y layer order } <-- at brick_offset
+ *
+ * Strings are referred to by their index in the string table.
+ * The bricks are sorted by sector; within a sector, they keep
+ * their order, which is the drawing order of overlapping bricks.
+ */
+int levelfile_save_binary(const levelfile_t *lf, const char *abs_path)
+{
+    levelfile_brick_t *brick;
+    sortkey_t *key;
+    long brick_offset;
+    int i, j, first;
+    FILE *fp;
+
+    if(lf->bricks_on_disk)
+        return FALSE;
+
+    if(NULL == (fp = fopen(abs_path, "wb"))) {
+        logfile_message("levelfile_save_binary(): can't open \"%s\" for writing", abs_path);
+        return FALSE;
+    }
+
+    /* group the bricks by sector */
+    key = mallocx(max(1, lf->brick_count) * sizeof *key);
+    for(i=0; i<lf->brick_count; i++) {
+        key[i].sector_y = sector_of(lf->brick[i].y);
+        key[i].sector_x = sector_of(lf->brick[i].x);
+        key[i].order = lf->brick[i].order;
+        key[i].index = i;
+    }
+    merge_sort(key, lf->brick_count, sizeof *key, compare_sortkeys);
+
+    brick = mallocx(max(1, lf->brick_count) * sizeof *brick);
+    for(i=0; i<lf->brick_count; i++)
+        brick[i] = lf->brick[key[i].index];
+    free(key);
+
+    fwrite(LEVELFILE_MAGIC, 1, 4, fp);
+    write_u32(fp, LEVELFILE_VERSION);
+    write_u32(fp, 0); /* brick_offset: we'll come back to it */
+
+    write_u32(fp, lf->string_count);
+    for(i=0; i<lf->string_count; i++) {
+        const char *str = levelfile_string(lf, i);
+        uint32 len = strlen(str);
+        write_u32(fp, len);
+        fwrite(str, 1, len, fp);
+    }
+
+    write_u32(fp, lf->command_count);
+    for(i=0; i<lf->command_count; i++) {
+        const levelfile_command_t *cmd = &(lf->command[i]);
+        write_u32(fp, cmd->identifier);
+        write_u32(fp, cmd->line);
+        write_u32(fp, cmd->param_count);
+        for(j=0; j<cmd->param_count; j++)
+            write_u32(fp, lf->param[cmd->first_param + j]);
+    }
+
+    write_u32(fp, lf->item_count);
+    for(i=0; i<lf->item_count; i++) {
+        write_u32(fp, (uint32)lf->item[i].type);
+        write_u32(fp, (uint32)lf->item[i].x);
+        write_u32(fp, (uint32)lf->item[i].y);
+    }
+
+    write_u32(fp, lf->object_count);
+    for(i=0; i<lf->object_count; i++) {
+        write_u32(fp, (uint32)lf->object[i].name);
+        write_u32(fp, (uint32)lf->object[i].x);
+        write_u32(fp, (uint32)lf->object[i].y);
+    }
+
+    for(i=j=0; i<lf->brick_count; i++) {
+        if(i == 0 || sector_of(brick[i].x) != sector_of(brick[i-1].x) || sector_of(brick[i].y) != sector_of(brick[i-1].y))
+            j++;
+    }
+    write_u32(fp, j);
+    for(first=0, i=1; i<=lf->brick_count; i++) {
+        if(i == lf->brick_count || sector_of(brick[i].x) != sector_of(brick[first].x) || sector_of(brick[i].y) != sector_of(brick[first].y)) {
+            write_u32(fp, (uint32)sector_of(brick[first].x));
+            write_u32(fp, (uint32)sector_of(brick[first].y));
+            write_u32(fp, first);
+            write_u32(fp, i - first);
+            first = i;
+        }
+    }
+
+    brick_offset = ftell(fp);
+    write_u32(fp, lf->brick_count);
+    for(i=0; i<lf->brick_count; i++) {
+        write_u32(fp, (uint32)brick[i].type);
+        write_u32(fp, (uint32)brick[i].x);
+        write_u32(fp, (uint32)brick[i].y);
+        write_u32(fp, (uint32)brick[i].layer);
+        write_u32(fp, (uint32)brick[i].order);
+    }
+
+    fseek(fp, 8, SEEK_SET);
+    write_u32(fp, (uint32)brick_offset);
+
+    free(brick);
+    fclose(fp);
+    return TRUE;
+}
+
+/*
+ * levelfile_convert()
+ * Converts a level from the text form to the binary form,
+ * or vice-versa, depending on the form of src_path
+ */
+int levelfile_convert(const char *src_path, const char *dest_path)
+{
+    char magic[4];
+    int ok, binary = FALSE;
+    levelfile_t *lf;
+    FILE *fp;
+
+    if(NULL != (fp = fopen(src_path, "rb"))) {
+        binary = (fread(magic, 1, 4, fp) == 4 && memcmp(magic, LEVELFILE_MAGIC, 4) == 0);
+        fclose(fp);
+    }
+
+    if(NULL == (lf = levelfile_load(src_path))) {
+        logfile_message("levelfile_convert(): can't read \"%s\"", src_path);
+        return FALSE;
+    }
+
+    ok = binary ? levelfile_save_text(lf, dest_path) : levelfile_save_binary(lf, dest_path);
+    logfile_message("levelfile_convert(): \"%s\" -> \"%s\" (%d bricks, %d items, %d objects, %d strings) %s", src_path, dest_path, lf->brick_count, lf->item_count, lf->object_count, lf->string_count, ok ? "ok" : "failed");
+
+    lf = levelfile_destroy(lf);
+    return ok;
+}
+
+/*
+ * levelfile_add_string()
+ * Adds a string to the string table (if it's not
+ * there yet) and returns its index
+ */
+int levelfile_add_string(levelfile_t *lf, const char *str)
+{
+    int len = strlen(str), mask, k;
+
+    if(2 * (lf->string_count + 1) > lf->string_lookup_capacity)
+        rebuild_string_lookup(lf, max(256, 2 * lf->string_lookup_capacity));
+
+    /* is it there already? */
+    mask = lf->string_lookup_capacity - 1;
+    for(k = hash_string(str) & mask; lf->string_lookup[k] != 0; k = (k + 1) & mask) {
+        if(strcmp(levelfile_string(lf, lf->string_lookup[k] - 1), str) == 0)
+            return lf->string_lookup[k] - 1;
+    }
+
+    /* new string */
+    lf->string_data = grow(lf->string_data, &(lf->string_data_capacity), lf->string_data_size + len + 1, sizeof(char));
+    lf->string_offset = grow(lf->string_offset, &(lf->string_capacity), lf->string_count + 1, sizeof(int));
+    memcpy(lf->string_data + lf->string_data_size, str, len + 1);
+    lf->string_offset[lf->string_count] = lf->string_data_size;
+    lf->string_data_size += len + 1;
+    lf->string_lookup[k] = ++(lf->string_count);
+
+    return lf->string_count - 1;
+}
+
+/*
+ * levelfile_add_line()
+ * Adds a line of the text form of a level file
+ */
+void levelfile_add_line(levelfile_t *lf, const char *line, int fileline)
+{
+    int i, param_count, param[MAX_PARAMS];
+    const char *p, *identifier, *token[MAX_PARAMS];
+    char small_buf[2048], *buf, *q, *end;
+    size_t buf_size;
+
+    /* skip spaces */
+    for(p=line; isspace((unsigned char)*p); p++);
+    if(0 == *p) return;
+
+    /* the tokens are copied to buf, one after the other */
+    buf_size = 2 * strlen(p) + 2;
+    buf = (buf_size <= sizeof(small_buf)) ? small_buf : mallocx(buf_size);
+
+    /* reading the identifier */
+    identifier = q = buf;
+    for(end=q+1023; *p && !isspace((unsigned char)*p) && q<end; *q++ = *p++);
+    *q++ = 0;
+    if(identifier[0] == '/' && identifier[1] == '/') { /* comment */
+        if(buf != small_buf)
+            free(buf);
+        return;
+    }
+
+    /* skip spaces */
+    for(; isspace((unsigned char)*p); p++);
+
+    /* read the arguments */
+    param_count = 0;
+    while(*p && param_count<MAX_PARAMS) {
+        int quotes = (*p == '"') && !!(p++); /* short-circuit AND */
+        token[param_count++] = q;
+        for(end=q+1023; *p && ((!quotes && !isspace((unsigned char)*p)) || (quotes && !(*p == '"' && *(p-1) != '\\'))) && q<end; *q++ = *p++);
+        *q++ = 0;
+        if(*p == '"') p++;
+        for(; isspace((unsigned char)*p); p++); /* skip spaces */
+    }
+
+    /* records: only their strings go to the string table */
+    if(str_icmp(identifier, "brick") == 0 && param_count >= 3 && param_count <= 4)
+        add_brick(lf, atoi(token[0]), atoi(token[1]), atoi(token[2]), param_count >= 4 ? levelfile_add_string(lf, token[3]) : -1, lf->brick_count);
+    else if(str_icmp(identifier, "item") == 0 && param_count == 3)
+        add_item(lf, atoi(token[0]), atoi(token[1]), atoi(token[2]));
+    else if((str_icmp(identifier, "object") == 0 || str_icmp(identifier, "enemy") == 0) && param_count == 3)
+        add_object(lf, levelfile_add_string(lf, token[0]), atoi(token[1]), atoi(token[2]));
+    else {
+        for(i=0; i<param_count; i++)
+            param[i] = levelfile_add_string(lf, token[i]);
+        add_command(lf, levelfile_add_string(lf, identifier), param_count, param, fileline);
+    }
+
+    if(buf != small_buf)
+        free(buf);
+}
+
+/*
+ * levelfile_string()
+ * Gets a string of the string table
+ */
+const char* levelfile_string(const levelfile_t *lf, int index)
+{
+    return (index >= 0 && index < lf->string_count) ? lf->string_data + lf->string_offset[index] : "";
+}
+
+
+
+/* private methods */
+
+/* adds a generic command */
+void add_command(levelfile_t *lf, int identifier, int param_count, const int *param, int line)
+{
+    levelfile_command_t *cmd;
+
+    lf->command = grow(lf->command, &(lf->command_capacity), lf->command_count + 1, sizeof *(lf->command));
+    lf->param = grow(lf->param, &(lf->param_capacity), lf->param_count + param_count, sizeof *(lf->param));
+
+    cmd = &(lf->command[lf->command_count++]);
+    cmd->identifier = identifier;
+    cmd->param_count = param_count;
+    cmd->first_param = lf->param_count;
+    cmd->line = line;
+
+    memcpy(lf->param + lf->param_count, param, param_count * sizeof *param);
+    lf->param_count += param_count;
+}
+
+/* adds a brick record */
+void add_brick(levelfile_t *lf, int type, int x, int y, int layer, int order)
+{
+    levelfile_brick_t *b;
+
+    lf->brick = grow(lf->brick, &(lf->brick_capacity), lf->brick_count + 1, sizeof *(lf->brick));
+    b = &(lf->brick[lf->brick_count++]);
+    b->type = type;
+    b->x = x;
+    b->y = y;
+    b->layer = layer;
+    b->order = order;
+}
+
+/* adds an item record */
+void add_item(levelfile_t *lf, int type, int x, int y)
+{
+    levelfile_item_t *it;
+
+    lf->item = grow(lf->item, &(lf->item_capacity), lf->item_count + 1, sizeof *(lf->item));
+    it = &(lf->item[lf->item_count++]);
+    it->type = type;
+    it->x = x;
+    it->y = y;
+}
+
+/* adds an object record */
+void add_object(levelfile_t *lf, int name, int x, int y)
+{
+    levelfile_object_t *o;
+
+    lf->object = grow(lf->object, &(lf->object_capacity), lf->object_count + 1, sizeof *(lf->object));
+    o = &(lf->object[lf->object_count++]);
+    o->name = name;
+    o->x = x;
+    o->y = y;
+}
+
+/* adds a sector */
+void add_sector(levelfile_t *lf, int x, int y, int first_brick, int brick_count)
+{
+    levelfile_sector_t *sec;
+
+    lf->sector = grow(lf->sector, &(lf->sector_capacity), lf->sector_count + 1, sizeof *(lf->sector));
+    sec = &(lf->sector[lf->sector_count++]);
+    sec->x = x;
+    sec->y = y;
+    sec->first_brick = first_brick;
+    sec->brick_count = brick_count;
+}
+
+/* the sector of a world coordinate */
+int sector_of(int coordinate)
+{
+    return (coordinate >= 0) ? coordinate / LEVELFILE_SECTOR_SIZE : -((LEVELFILE_SECTOR_SIZE - 1 - coordinate) / LEVELFILE_SECTOR_SIZE);
+}
+
+/* sorts the bricks by sector (y,x), keeping the order of the bricks of a sector */
+int compare_sortkeys(const void *a, const void *b)
+{
+    const sortkey_t *p = (const sortkey_t*)a, *q = (const sortkey_t*)b;
+
+    if(p->sector_y != q->sector_y)
+        return p->sector_y < q->sector_y ? -1 : 1;
+    else if(p->sector_x != q->sector_x)
+        return p->sector_x < q->sector_x ? -1 : 1;
+    else if(p->order != q->order)
+        return p->order < q->order ? -1 : 1;
+    else
+        return p->index - q->index;
+}
+
+/* sorts the bricks by their position in the text form */
+int compare_brick_order(const void *a, const void *b)
+{
+    const levelfile_brick_t *p = (const levelfile_brick_t*)a, *q = (const levelfile_brick_t*)b;
+    return (p->order > q->order) - (p->order < q->order);
+}
+
+/* (re)builds the lookup table of the strings */
+void rebuild_string_lookup(levelfile_t *lf, int capacity)
+{
+    int i, k, mask;
+
+    while(capacity < 2 * (lf->string_count + 1))
+        capacity *= 2;
+
+    free(lf->string_lookup);
+    lf->string_lookup = mallocx(capacity * sizeof *(lf->string_lookup));
+    lf->string_lookup_capacity = capacity;
+    for(i=0; i<capacity; i++)
+        lf->string_lookup[i] = 0;
+
+    mask = capacity - 1;
+    for(i=0; i<lf->string_count; i++) {
+        for(k = hash_string(levelfile_string(lf, i)) & mask; lf->string_lookup[k] != 0; k = (k + 1) & mask);
+        lf->string_lookup[k] = i + 1;
+    }
+}
+
+/* FNV-1a */
+unsigned hash_string(const char *str)
+{
+    unsigned h = 2166136261u;
+
+    while(*str)
+        h = (h ^ (unsigned char)*str++) * 16777619u;
+
+    return h;
+}
+
+/* reads the text form */
+int read_text(levelfile_t *lf, char *data, long size)
+{
+    char *line = data, *end;
+    int ln = 0;
+
+    while(line < data + size) {
+        if(NULL != (end = strchr(line, '\n')))
+            *end = 0;
+
+        levelfile_add_line(lf, line, ++ln);
+
+        if(end == NULL)
+            break;
+        line = end + 1;
+    }
+
+    return TRUE;
+}
+
+/* reads the binary form */
+int read_binary(levelfile_t *lf, const unsigned char *data, long size, int load_bricks)
+{
+    uint32 version, brick_offset, n, len, line, i, j, v[5];
+    int param[MAX_PARAMS], identifier, layer, name;
+    long ptr = 4;
+
+    if(!read_u32(&version, data, size, &ptr) || version != LEVELFILE_VERSION || !read_u32(&brick_offset, data, size, &ptr))
+        return FALSE;
+
+    /* string table */
+    if(!read_u32(&n, data, size, &ptr) || n > (uint32)(size - ptr) / 4)
+        return FALSE;
+    lf->string_offset = grow(lf->string_offset, &(lf->string_capacity), n, sizeof(int));
+    lf->string_data = grow(lf->string_data, &(lf->string_data_capacity), (int)(size - ptr), sizeof(char));
+    for(i=0; i<n; i++) {
+        if(!read_u32(&len, data, size, &ptr) || len > (uint32)(size - ptr))
+            return FALSE;
+        lf->string_offset[i] = lf->string_data_size;
+        memcpy(lf->string_data + lf->string_data_size, data + ptr, len);
+        lf->string_data[lf->string_data_size + len] = 0;
+        lf->string_data_size += len + 1;
+        lf->string_count++;
+        ptr += len;
+    }
+
+    /* generic commands */
+    if(!read_u32(&n, data, size, &ptr) || n > (uint32)(size - ptr) / 12)
+        return FALSE;
+    for(i=0; i<n; i++) {
+        if(!read_index(&identifier, lf->string_count, data, size, &ptr) || !read_u32(&line, data, size, &ptr) || !read_u32(&len, data, size, &ptr) || len > MAX_PARAMS)
+            return FALSE;
+        for(j=0; j<len; j++) {
+            if(!read_index(&param[j], lf->string_count, data, size, &ptr))
+                return FALSE;
+        }
+        add_command(lf, identifier, (int)len, param, (int)line);
+    }
+
+    /* items */
+    if(!read_u32(&n, data, size, &ptr) || n > (uint32)(size - ptr) / 12)
+        return FALSE;
+    lf->item = grow(lf->item, &(lf->item_capacity), n, sizeof *(lf->item));
+    for(i=0; i<n; i++) {
+        for(j=0; j<3; j++)
+            read_u32(&v[j], data, size, &ptr);
+        add_item(lf, (int)v[0], (int)v[1], (int)v[2]);
+    }
+
+    /* objects */
+    if(!read_u32(&n, data, size, &ptr) || n > (uint32)(size - ptr) / 12)
+        return FALSE;
+    lf->object = grow(lf->object, &(lf->object_capacity), n, sizeof *(lf->object));
+    for(i=0; i<n; i++) {
+        if(!read_index(&name, lf->string_count, data, size, &ptr))
+            return FALSE;
+        for(j=1; j<3; j++)
+            read_u32(&v[j], data, size, &ptr);
+        add_object(lf, name, (int)v[1], (int)v[2]);
+    }
+
+    /* sectors */
+    if(!read_u32(&n, data, size, &ptr) || n > (uint32)(size - ptr) / 16)
+        return FALSE;
+    lf->sector = grow(lf->sector, &(lf->sector_capacity), n, sizeof *(lf->sector));
+    for(i=0; i<n; i++) {
+        for(j=0; j<4; j++)
+            read_u32(&v[j], data, size, &ptr);
+        add_sector(lf, (int)v[0], (int)v[1], (int)v[2], (int)v[3]);
+    }
+
+    /* bricks */
+    if((long)brick_offset != ptr || !read_u32(&n, data, size, &ptr))
+        return FALSE;
+    lf->brick_offset = ptr;
+    for(i=0; i<(uint32)lf->sector_count; i++) {
+        const levelfile_sector_t *sec = &(lf->sector[i]);
+        if(sec->first_brick < 0 || sec->brick_count < 0 || (uint32)sec->first_brick + (uint32)sec->brick_count > n)
+            return FALSE;
+    }
+
+    if(!load_bricks) {
+        lf->bricks_on_disk = TRUE;
+        lf->brick_count = (int)n;
+        return TRUE;
+    }
+
+    if(n > (uint32)(size - ptr) / BRICK_RECORD_SIZE)
+        return FALSE;
+    lf->brick = grow(lf->brick, &(lf->brick_capacity), n, sizeof *(lf->brick));
+    for(i=0; i<n; i++) {
+        for(j=0; j<5; j++)
+            read_u32(&v[j], data, size, &ptr);
+        layer = (int)v[3];
+        if(layer < -1 || layer >= lf->string_count)
+            return FALSE;
+        add_brick(lf, (int)v[0], (int)v[1], (int)v[2], layer, (int)v[4]);
+    }
+
+    /* put the bricks back in the order of the text form */
+    merge_sort(lf->brick, lf->brick_count, sizeof *(lf->brick), compare_brick_order);
+    return TRUE;
+}
+
+/* reads a 32-bit little-endian integer */
+int read_u32(uint32 *x, const unsigned char *data, long size, long *ptr)
+{
+    if(*ptr + 4 > size)
+        return FALSE;
+
+    *x = (uint32)data[*ptr] | ((uint32)data[*ptr+1] << 8) | ((uint32)data[*ptr+2] << 16) | ((uint32)data[*ptr+3] << 24);
+    *ptr += 4;
+    return TRUE;
+}
+
+/* reads an index of the string table */
+int read_index(int *x, int count, const unsigned char *data, long size, long *ptr)
+{
+    uint32 u;
+
+    if(!read_u32(&u, data, size, ptr) || u >= (uint32)count)
+        return FALSE;
+
+    *x = (int)u;
+    return TRUE;
+}
+
+/* writes a 32-bit little-endian integer */
+void write_u32(FILE *fp, uint32 x)
+{
+    fputc((int)(x & 0xFF), fp);
+    fputc((int)((x >> 8) & 0xFF), fp);
+    fputc((int)((x >> 16) & 0xFF), fp);
+    fputc((int)((x >> 24) & 0xFF), fp);
+}
+
+/* writes a parameter of the text form, so that it
+   reads back the same: numbers go unquoted, tokens
+   that were read without quotes (i.e., the ones that
+   have an unescaped quote) are written as they are */
+void write_token(FILE *fp, const char *str)
+{
+    const char *p;
+    int quote = (*str == 0) || (strspn(str, "0123456789+-.") != strlen(str));
+
+    for(p=str; *p && quote; p++) {
+        if(*p == '"' && (p == str || *(p-1) != '\\'))
+            quote = FALSE;
+    }
+
+    fprintf(fp, quote ? " \"%s\"" : " %s", str);
+}
+
+/* grows an array, so that it holds at least the needed number of elements */
+void *grow(void *array, int *capacity, int needed, size_t element_size)
+{
+    if(needed > *capacity) {
+        *capacity = max(max(16, needed), 2 * (*capacity));
+        array = reallocx(array, (*capacity) * element_size);
+    }
+
+    return array;
+}
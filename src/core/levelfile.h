@@ -0,0 +1,115 @@
+/*
+ * Open Surge Engine
+ * levelfile.h - level files: text and binary forms
+ * Copyright (C) 2013  Alexandre Martins <alemartf(at)gmail(dot)com>
+ * http://opensnc.sourceforge.net
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _LEVELFILE_H
+#define _LEVELFILE_H
+
+/*
+ * A level file (.lev) in memory. The text form is the authoring
+ * format; the binary form holds the same data (comments aside)
+ * and loads much faster: the bricks, the items and the objects
+ * are stored as contiguous arrays of fixed-size records, and all
+ * the strings are kept in a single string table.
+ *
+ * Any command other than brick, item and object/enemy (name,
+ * theme, players, dialogbox, ...) is kept as a generic command,
+ * in the order it appears in the file.
+ *
+ * In the binary form, the bricks are grouped by sector (a square
+ * of LEVELFILE_SECTOR_SIZE pixels) and placed at the end of the
+ * file, so that huge levels may leave them on the disk and read
+ * the sectors as needed (see levelfile_load_ex()). Each brick
+ * keeps its position in the text form, and the bricks that are
+ * loaded along with the file are put back in that order (the
+ * sectors then refer to the records on the disk only).
+ */
+
+#define LEVELFILE_SECTOR_SIZE   1024
+
+/* a generic command */
+typedef struct levelfile_command_t {
+    int identifier; /* index of the string table */
+    int param_count;
+    int first_param; /* param[first_param .. first_param + param_count - 1] */
+    int line; /* where it appears in the text form */
+} levelfile_command_t;
+
+/* records */
+typedef struct levelfile_brick_t {
+    int type, x, y;
+    int layer; /* index of the string table, or -1 if unspecified */
+    int order; /* position in the text form: overlapping bricks are drawn in this order */
+} levelfile_brick_t;
+
+typedef struct levelfile_item_t {
+    int type, x, y;
+} levelfile_item_t;
+
+typedef struct levelfile_object_t {
+    int name; /* index of the string table */
+    int x, y;
+} levelfile_object_t;
+
+typedef struct levelfile_sector_t {
+    int x, y; /* sector coordinates: the sector spans [x,x+1) * LEVELFILE_SECTOR_SIZE horizontally */
+    int first_brick, brick_count; /* brick[first_brick .. first_brick + brick_count - 1] */
+} levelfile_sector_t;
+
+/* the level file */
+typedef struct levelfile_t levelfile_t;
+struct levelfile_t {
+    levelfile_command_t *command;
+    int *param; /* indexes of the string table */
+    levelfile_brick_t *brick;
+    levelfile_item_t *item;
+    levelfile_object_t *object;
+    levelfile_sector_t *sector; /* sorted by (y,x). Only the binary form has sectors. first_brick refers to the records on the disk */
+    int command_count, param_count, brick_count, item_count, object_count, sector_count;
+    int bricks_on_disk; /* if TRUE, brick is NULL: use levelfile_read_bricks() */
+    long brick_offset; /* position of the brick records in the binary form */
+
+    /* private */
+    char *string_data; /* the strings, one after the other */
+    int *string_offset;
+    int *string_lookup; /* open addressing: 1 + index of the string table, or 0 */
+    int string_count, string_data_size;
+    int command_capacity, param_capacity, brick_capacity, item_capacity, object_capacity, sector_capacity;
+    int string_capacity, string_data_capacity, string_lookup_capacity;
+};
+
+/* public methods */
+levelfile_t* levelfile_create(); /* creates an empty level file */
+levelfile_t* levelfile_destroy(levelfile_t *lf); /* returns NULL */
+levelfile_t* levelfile_load(const char *abs_path); /* reads a level (either form). Returns NULL on error */
+levelfile_t* levelfile_load_ex(const char *abs_path, int load_bricks); /* if load_bricks is FALSE, the bricks of the binary form are left on the disk */
+int levelfile_read_bricks(const char *abs_path, const levelfile_t *lf, int first_brick, int brick_count, levelfile_brick_t *dest); /* reads brick records from the disk. Thread-safe. Returns TRUE on success */
+int levelfile_save_text(const levelfile_t *lf, const char *abs_path); /* returns TRUE on success */
+int levelfile_save_binary(const levelfile_t *lf, const char *abs_path); /* returns TRUE on success */
+int levelfile_convert(const char *src_path, const char *dest_path); /* text to binary or binary to text, depending on the form of src_path */
+
+/* building a level file */
+int levelfile_add_string(levelfile_t *lf, const char *str); /* returns the index of str in the string table */
+void levelfile_add_line(levelfile_t *lf, const char *line, int fileline); /* adds a line of the text form */
+
+/* the string table */
+const char* levelfile_string(const levelfile_t *lf, int index);
+
+#endif
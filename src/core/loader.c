@@ -0,0 +1,526 @@
+/*
+ * Open Surge Engine
+ * loader.c - asynchronous resource loader
+ * Copyright (C) 2013  Alexandre Martins <alemartf(at)gmail(dot)com>
+ * http://opensnc.sourceforge.net
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>
+#include "loader.h"
+#include "thread.h"
+#include "image.h"
+#include "audio.h"
+#include "video.h"
+#include "osspec.h"
+#include "resourcemanager.h"
+#include "stringutil.h"
+#include "timer.h"
+#include "logfile.h"
+#include "util.h"
+
+/* private stuff */
+#define LOADER_WORKERS      2
+#define LOADER_TIME_SLICE   8       /* how many milliseconds per frame we may spend resolving requests */
+#define CHUNK_SIZE          65536
+
+typedef enum { LOAD_IMAGE, LOAD_MUSIC, LOAD_TASK } loadtype_t;
+typedef enum { LOAD_QUEUED, LOAD_READING, LOAD_READ } loadstate_t;
+
+struct loadhandle_t {
+    loadtype_t type;
+    loadstate_t state; /* protected by mutex */
+    int cancelled; /* the handle has been destroyed before the resource got loaded (protected by mutex) */
+    int done; /* has the resource been resolved? (main thread only) */
+    void *data; /* the resource itself, if done (NULL on errors) */
+    void (*task)(void*); /* LOAD_TASK only: task(arg) */
+    void *arg;
+    char *path; /* relative filepath (the key of the resource manager) */
+    char *abs_path; /* what the workers read */
+    loadhandle_t *next;
+};
+
+static loadhandle_t *request_list = NULL, *request_tail = NULL; /* in the order they were made */
+static mutex_t *mutex = NULL;
+static image_t *placeholder = NULL;
+static int batch_size = 0, batch_done = 0; /* progress */
+
+static thread_t *worker[LOADER_WORKERS];
+static int worker_id[LOADER_WORKERS];
+static int worker_running[LOADER_WORKERS]; /* protected by mutex */
+static int quitting; /* protected by mutex */
+static int synchronous = FALSE; /* resolve the requests right away? */
+
+static char **decode_path = NULL, **decode_abs_path = NULL; /* see loader_decode_images() (protected by mutex) */
+static int decode_count = 0, decode_next = 0, decode_left = 0; /* protected by mutex */
+
+static loadhandle_t* enqueue(loadtype_t type, const char *path, void (*task)(void*), void *arg);
+static void resolve(loadhandle_t *h);
+static void unlink_request(loadhandle_t *h);
+static void delete_request(loadhandle_t *h);
+static void spawn_workers();
+static int decode_next_image();
+static void worker_routine(void *param);
+
+
+
+/* public methods */
+
+/*
+ * loader_init()
+ * Initializes the loader
+ */
+void loader_init()
+{
+    int i;
+
+    request_list = request_tail = NULL;
+    mutex = mutex_create();
+    batch_size = batch_done = 0;
+    quitting = FALSE;
+    decode_path = decode_abs_path = NULL;
+    decode_count = decode_next = decode_left = 0;
+
+    for(i=0; i<LOADER_WORKERS; i++) {
+        worker[i] = NULL;
+        worker_id[i] = i;
+        worker_running[i] = FALSE;
+    }
+
+    placeholder = image_create(1, 1);
+    image_clear(placeholder, video_get_maskcolor());
+}
+
+/*
+ * loader_release()
+ * Waits for the workers and releases the loader.
+ * Handles that haven't been destroyed become invalid.
+ */
+void loader_release()
+{
+    loadhandle_t *h, *next;
+    int i;
+
+    mutex_lock(mutex);
+    quitting = TRUE;
+    mutex_unlock(mutex);
+
+    for(i=0; i<LOADER_WORKERS; i++) {
+        if(worker[i] != NULL)
+            worker[i] = thread_join(worker[i]);
+    }
+
+    for(h=request_list; h; h=next) {
+        next = h->next;
+        delete_request(h);
+    }
+    request_list = request_tail = NULL;
+
+    image_destroy(placeholder);
+    placeholder = NULL;
+    mutex = mutex_destroy(mutex);
+}
+
+/*
+ * loader_update()
+ * Resolves the requests that the workers are done with,
+ * in the order they were made, for up to LOADER_TIME_SLICE
+ * milliseconds. Images come already decoded; musics are
+ * decoded here. Tasks run here, one at a time.
+ */
+void loader_update()
+{
+    uint32 start = timer_get_ticks();
+    loadhandle_t *h, *next;
+    loadstate_t state;
+    int cancelled;
+
+    for(h=request_list; h; h=next) {
+        next = h->next;
+        if(h->done)
+            continue;
+
+        mutex_lock(mutex);
+        state = h->state;
+        cancelled = h->cancelled;
+        mutex_unlock(mutex);
+
+        if(state != LOAD_READ)
+            break; /* keep the order */
+
+        if(cancelled) {
+            if(h->type == LOAD_IMAGE)
+                decodedimage_destroy(resourcemanager_take_decoded_image(h->path));
+            unlink_request(h);
+            delete_request(h);
+            batch_done++;
+            continue;
+        }
+
+        resolve(h);
+        if(timer_get_ticks() >= start + LOADER_TIME_SLICE)
+            break;
+    }
+
+    if(batch_done >= batch_size)
+        batch_size = batch_done = 0;
+}
+
+/*
+ * loader_pending()
+ * Number of requests that haven't been resolved yet
+ */
+int loader_pending()
+{
+    return batch_size - batch_done;
+}
+
+/*
+ * loader_set_synchronous()
+ * If TRUE, the requests are resolved as soon as they're
+ * made, on this thread. The number of frames it takes to
+ * load stuff then doesn't depend on the speed of the disk
+ */
+void loader_set_synchronous(int sync)
+{
+    synchronous = sync;
+}
+
+/*
+ * loader_progress()
+ * How much of the current batch of requests has been resolved
+ */
+float loader_progress()
+{
+    return batch_size > 0 ? (float)batch_done / (float)batch_size : 1.0f;
+}
+
+/*
+ * loader_decode_images()
+ * Decodes a batch of images right away: the workers and the
+ * calling thread share the work. It returns once they're all
+ * ready to be loaded cheaply by image_load() (main thread)
+ */
+void loader_decode_images(const char **path, int count)
+{
+    char abs_path[1024];
+    int i, n;
+
+    if(count <= 0)
+        return;
+
+    mutex_lock(mutex);
+    decode_path = mallocx(count * sizeof *decode_path);
+    decode_abs_path = mallocx(count * sizeof *decode_abs_path);
+    for(i=n=0; i<count; i++) {
+        if(resourcemanager_find_image(path[i]) == NULL) {
+            resource_filepath(abs_path, path[i], sizeof(abs_path), RESFP_READ);
+            decode_path[n] = str_dup(path[i]);
+            decode_abs_path[n++] = str_dup(abs_path);
+        }
+    }
+    decode_count = decode_left = n;
+    decode_next = 0;
+    mutex_unlock(mutex);
+
+    if(n > 1)
+        spawn_workers();
+
+    for(;;) {
+        if(!decode_next_image()) {
+            mutex_lock(mutex);
+            n = decode_left;
+            mutex_unlock(mutex);
+            if(n == 0)
+                break;
+            thread_sleep(1); /* the workers are finishing the last ones */
+        }
+    }
+
+    mutex_lock(mutex);
+    for(i=0; i<decode_count; i++) {
+        free(decode_path[i]);
+        free(decode_abs_path[i]);
+    }
+    free(decode_path);
+    free(decode_abs_path);
+    decode_path = decode_abs_path = NULL;
+    decode_count = decode_next = 0;
+    mutex_unlock(mutex);
+}
+
+/*
+ * image_load_async()
+ * Requests an image. It will be loaded in the background
+ */
+loadhandle_t* image_load_async(const char *path)
+{
+    return enqueue(LOAD_IMAGE, path, NULL, NULL);
+}
+
+/*
+ * music_load_async()
+ * Requests a music. It will be loaded in the background
+ */
+loadhandle_t* music_load_async(const char *path)
+{
+    return enqueue(LOAD_MUSIC, path, NULL, NULL);
+}
+
+/*
+ * task_run_async()
+ * Schedules a piece of loading work: task(arg) will run on
+ * the main thread, in loader_update(), once the requests
+ * made before it have been resolved. The name is used in
+ * the logfile. Destroy the handle to cancel the task.
+ */
+loadhandle_t* task_run_async(const char *name, void (*task)(void*), void *arg)
+{
+    return enqueue(LOAD_TASK, name, task, arg);
+}
+
+/*
+ * loadhandle_destroy()
+ * Destroys a handle. If the resource has been loaded already,
+ * its reference is given back to the resource manager.
+ */
+loadhandle_t* loadhandle_destroy(loadhandle_t *handle)
+{
+    if(handle->done) {
+        unlink_request(handle);
+        delete_request(handle);
+    }
+    else {
+        mutex_lock(mutex);
+        handle->cancelled = TRUE; /* loader_update() will delete it */
+        mutex_unlock(mutex);
+    }
+
+    return NULL;
+}
+
+/*
+ * loadhandle_ready()
+ * Has the resource been loaded?
+ */
+int loadhandle_ready(const loadhandle_t *handle)
+{
+    return handle->done;
+}
+
+/*
+ * loadhandle_image()
+ * The requested image, or a (blank) placeholder
+ */
+image_t* loadhandle_image(const loadhandle_t *handle)
+{
+    if(handle->type == LOAD_IMAGE && handle->done && handle->data != NULL)
+        return (image_t*)handle->data;
+    else
+        return placeholder;
+}
+
+/*
+ * loadhandle_music()
+ * The requested music, or NULL
+ */
+music_t* loadhandle_music(const loadhandle_t *handle)
+{
+    return (handle->type == LOAD_MUSIC && handle->done) ? (music_t*)handle->data : NULL;
+}
+
+
+
+/* private methods */
+
+/* creates a request and hands it to the workers (main thread) */
+loadhandle_t* enqueue(loadtype_t type, const char *path, void (*task)(void*), void *arg)
+{
+    char abs_path[1024] = "";
+    loadhandle_t *h = mallocx(sizeof *h);
+
+    if(type != LOAD_TASK)
+        resource_filepath(abs_path, path, sizeof(abs_path), RESFP_READ);
+    h->type = type;
+    h->state = (synchronous || type == LOAD_TASK) ? LOAD_READ : LOAD_QUEUED; /* the workers have nothing to do with tasks */
+    if(type == LOAD_IMAGE && resourcemanager_find_image(path) != NULL)
+        h->state = LOAD_READ; /* nothing to decode */
+    h->path = str_dup(path);
+    h->abs_path = str_dup(abs_path);
+    h->cancelled = FALSE;
+    h->done = FALSE;
+    h->data = NULL;
+    h->task = task;
+    h->arg = arg;
+    h->next = NULL;
+
+    mutex_lock(mutex);
+    if(request_tail != NULL)
+        request_tail->next = h;
+    else
+        request_list = h;
+    request_tail = h;
+    mutex_unlock(mutex);
+
+    batch_size++;
+    if(synchronous)
+        resolve(h);
+    else if(type != LOAD_TASK)
+        spawn_workers();
+
+    return h;
+}
+
+/* resolves a request the workers are done with (main thread) */
+void resolve(loadhandle_t *h)
+{
+    switch(h->type) {
+        case LOAD_IMAGE: h->data = image_load(h->path); break; /* it takes the decoded pixels */
+        case LOAD_MUSIC: h->data = music_load(h->path); break;
+        case LOAD_TASK:
+            logfile_message("loader: %s", h->path);
+            h->task(h->arg);
+            break;
+    }
+
+    if(h->data == NULL && h->type != LOAD_TASK)
+        logfile_message("loader: can't load '%s'", h->path);
+
+    h->done = TRUE;
+    batch_done++;
+}
+
+/* removes a request from the list (main thread) */
+void unlink_request(loadhandle_t *h)
+{
+    loadhandle_t **p, *prev = NULL;
+
+    mutex_lock(mutex);
+    for(p = &request_list; *p != NULL; prev = *p, p = &((*p)->next)) {
+        if(*p == h) {
+            *p = h->next;
+            if(request_tail == h)
+                request_tail = prev;
+            break;
+        }
+    }
+    mutex_unlock(mutex);
+}
+
+/* deletes a request that's no longer in the list */
+void delete_request(loadhandle_t *h)
+{
+    if(h->done && h->data != NULL) {
+        switch(h->type) {
+            case LOAD_IMAGE: image_unref(h->path); break;
+            case LOAD_MUSIC: music_unref(h->path); break;
+            case LOAD_TASK: break;
+        }
+    }
+
+    free(h->abs_path);
+    free(h->path);
+    free(h);
+}
+
+/* makes sure that there are workers to read the queued files (main thread) */
+void spawn_workers()
+{
+    int i, running;
+
+    for(i=0; i<LOADER_WORKERS; i++) {
+        mutex_lock(mutex);
+        running = worker_running[i];
+        mutex_unlock(mutex);
+
+        if(!running) {
+            if(worker[i] != NULL)
+                worker[i] = thread_join(worker[i]); /* it has already quit */
+            worker_running[i] = TRUE;
+            worker[i] = thread_create(worker_routine, (void*)(&worker_id[i]));
+        }
+    }
+}
+
+/* decodes the queued images, handing them over to the resource
+   manager. Other files are just read, so that they're in the file
+   cache when the main thread decodes them (worker threads).
+   A worker quits as soon as there's nothing left to do */
+void worker_routine(void *param)
+{
+    static char buf[LOADER_WORKERS][CHUNK_SIZE];
+    int id = *((int*)param);
+    char *chunk = buf[id];
+    decodedimage_t *decoded;
+    loadhandle_t *h, *o;
+    int skip;
+    FILE *fp;
+
+    for(;;) {
+        if(decode_next_image())
+            continue; /* a batch of loader_decode_images() comes first */
+
+        mutex_lock(mutex);
+        for(h=request_list; h && h->state != LOAD_QUEUED; h=h->next);
+        if(h == NULL || quitting) {
+            worker_running[id] = FALSE;
+            mutex_unlock(mutex);
+            break;
+        }
+        h->state = LOAD_READING;
+        skip = h->cancelled;
+        for(o=request_list; o != h && !skip; o=o->next)
+            skip = (o->type == LOAD_IMAGE && h->type == LOAD_IMAGE && str_icmp(o->path, h->path) == 0); /* it's being decoded already */
+        mutex_unlock(mutex);
+
+        if(!skip && h->type == LOAD_IMAGE && NULL != (decoded = image_decode(h->abs_path)))
+            resourcemanager_add_decoded_image(h->path, decoded);
+        else if(!skip && NULL != (fp = fopen(h->abs_path, "rb"))) {
+            while(fread(chunk, 1, CHUNK_SIZE, fp) > 0);
+            fclose(fp);
+        }
+
+        mutex_lock(mutex);
+        h->state = LOAD_READ;
+        mutex_unlock(mutex);
+    }
+}
+
+/* decodes the next image of loader_decode_images(), handing
+   it over to the resource manager. Returns FALSE if there's
+   none left to take (any thread) */
+int decode_next_image()
+{
+    decodedimage_t *decoded;
+    int i;
+
+    mutex_lock(mutex);
+    i = (decode_next < decode_count) ? decode_next++ : -1;
+    mutex_unlock(mutex);
+
+    if(i < 0)
+        return FALSE;
+
+    /* if it can't be decoded here, image_load() will load it as usual */
+    if(NULL != (decoded = image_decode(decode_abs_path[i])))
+        resourcemanager_add_decoded_image(decode_path[i], decoded);
+
+    mutex_lock(mutex);
+    decode_left--;
+    mutex_unlock(mutex);
+
+    return TRUE;
+}
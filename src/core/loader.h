@@ -0,0 +1,69 @@
+/*
+ * Open Surge Engine
+ * loader.h - asynchronous resource loader
+ * Copyright (C) 2013  Alexandre Martins <alemartf(at)gmail(dot)com>
+ * http://opensnc.sourceforge.net
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _LOADER_H
+#define _LOADER_H
+
+/*
+ * The loader lets the game keep running while resources are
+ * being loaded. Worker threads decode the images (PNG) and read
+ * the other files ahead of time; they never touch Allegro (see
+ * thread.h). The main thread resolves the requests in order, a
+ * few milliseconds per frame, in loader_update(): it turns the
+ * decoded pixels into images, decodes musics, and runs the
+ * tasks, i.e., pieces of loading work that must happen on the
+ * main thread (creating the entities of a level, ...). Sounds
+ * are loaded right away by sound_load(), from the sample cache
+ * (see pcmcache.h): they have no asynchronous path.
+ *
+ * A handle resolves to a placeholder until its resource is
+ * ready: a blank image for images, NULL (silence) for musics.
+ * Since an image handle resolves to a different image_t once
+ * it's ready, don't keep the placeholder around
+ * (nor create shared images out of it): ask the handle again.
+ */
+
+/* forward declarations */
+struct image_t;
+struct music_t;
+typedef struct loadhandle_t loadhandle_t;
+
+/* loader */
+void loader_init();
+void loader_release();
+void loader_update(); /* call it once per frame, in the main thread */
+int loader_pending(); /* number of requests that haven't been resolved yet */
+float loader_progress(); /* 0.0 <= progress <= 1.0, considering the requests made since the loader was last idle */
+void loader_set_synchronous(int synchronous); /* if TRUE, requests are resolved as soon as they're made (replays) */
+void loader_decode_images(const char **path, int count); /* decodes a batch of images in parallel and waits for them. image_load() takes the pixels */
+
+/* asynchronous loading */
+loadhandle_t* image_load_async(const char *path);
+loadhandle_t* music_load_async(const char *path);
+loadhandle_t* task_run_async(const char *name, void (*task)(void*), void *arg); /* task(arg) runs on the main thread after the requests made before it */
+
+/* handles */
+loadhandle_t* loadhandle_destroy(loadhandle_t *handle); /* releases the handle and its reference to the resource. Returns NULL */
+int loadhandle_ready(const loadhandle_t *handle); /* has the resource been loaded? */
+struct image_t* loadhandle_image(const loadhandle_t *handle); /* the image, or a placeholder */
+struct music_t* loadhandle_music(const loadhandle_t *handle); /* the music, or NULL */
+
+#endif
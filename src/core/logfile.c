@@ -21,14 +21,32 @@
 
 #include <stdio.h>
 #include <stdarg.h>
+#include <string.h>
 #include "logfile.h"
 #include "global.h"
 #include "osspec.h"
+#include "thread.h"
+#include "util.h"
 
 
 /* private stuff ;) */
 #define LOGFILE_PATH        "logfile.txt" /* default log file */
-static FILE *logfile;
+#define RING_SIZE           262144 /* how many bytes of messages may be queued */
+#define MESSAGE_MAXLENGTH   2048
+#define WRITER_INTERVAL     10 /* in milliseconds */
+static FILE *logfile = NULL;
+
+static char ring[RING_SIZE]; /* the queued messages: ring[tail .. head-1], modulo RING_SIZE */
+static unsigned long head = 0, tail = 0; /* protected by ring_mutex */
+static int quitting = FALSE; /* protected by ring_mutex */
+static mutex_t *ring_mutex = NULL; /* if NULL, the messages are written right away */
+static mutex_t *file_mutex = NULL; /* one writer at a time */
+static thread_t *writer = NULL;
+
+static void print(int severity, const char *fmt, va_list args);
+static void enqueue(const char *msg, int length);
+static int drain();
+static void writer_routine(void *param);
 
 
 /*
@@ -44,6 +62,12 @@ void logfile_init()
     if(NULL == (logfile = fopen(abs_path, "w")))
         logfile_message("WARNING: couldn't open %s for writing.\n", LOGFILE_PATH);
     else {
+        head = tail = 0;
+        quitting = FALSE;
+        ring_mutex = mutex_create();
+        file_mutex = mutex_create();
+        writer = thread_create(writer_routine, NULL);
+
         logfile_message("%s version %s", GAME_TITLE, GAME_VERSION_STRING);
         logfile_message("logfile_init()");
     }
@@ -57,18 +81,42 @@ void logfile_init()
  */
 void logfile_message(const char *fmt, ...)
 {
-    char buf[2048];
     va_list args;
 
     va_start(args, fmt);
-    vsprintf(buf, fmt, args);
+    print(LOGFILE_INFO, fmt, args);
     va_end(args);
+}
 
-    fprintf(logfile ? logfile : stderr, "%s\n", buf);
-    fflush(logfile ? logfile : stderr);
+
+/*
+ * logfile_message_ex()
+ * Prints a message of the given severity
+ * (LOGFILE_*) on the logfile
+ */
+void logfile_message_ex(int severity, const char *fmt, ...)
+{
+    va_list args;
+
+    va_start(args, fmt);
+    print(severity, fmt, args);
+    va_end(args);
 }
 
 
+/*
+ * logfile_flush()
+ * Writes the queued messages right away.
+ * Call it before the program dies.
+ */
+void logfile_flush()
+{
+    if(ring_mutex != NULL)
+        drain();
+    else
+        fflush(logfile ? logfile : stderr);
+}
+
 
 /* 
  * logfile_release()
@@ -77,7 +125,115 @@ void logfile_message(const char *fmt, ...)
 void logfile_release()
 {
     logfile_message("logfile_release()\ntchau!");
+
+    if(ring_mutex != NULL) {
+        mutex_lock(ring_mutex);
+        quitting = TRUE;
+        mutex_unlock(ring_mutex);
+        writer = thread_join(writer); /* it writes what's left */
+        file_mutex = mutex_destroy(file_mutex);
+        ring_mutex = mutex_destroy(ring_mutex);
+    }
+
     if(logfile)
         fclose(logfile);
+    logfile = NULL;
+}
+
+
+
+/* private methods */
+
+/* formats a message and queues it */
+void print(int severity, const char *fmt, va_list args)
+{
+    char buf[MESSAGE_MAXLENGTH];
+    int length;
+
+    if(severity < LOGFILE_MIN_SEVERITY)
+        return;
+
+    vsnprintf(buf, sizeof(buf) - 1, fmt, args);
+    buf[sizeof(buf) - 2] = 0;
+    length = strlen(buf);
+    buf[length++] = '\n';
+    buf[length] = 0;
+
+    if(ring_mutex != NULL)
+        enqueue(buf, length);
+    else {
+        fputs(buf, logfile ? logfile : stderr);
+        fflush(logfile ? logfile : stderr);
+    }
+}
+
+/* adds a message to the ring buffer. If it's full, waits for the writer */
+void enqueue(const char *msg, int length)
+{
+    int i, n;
+
+    for(;;) {
+        mutex_lock(ring_mutex);
+        if(head - tail + length <= RING_SIZE)
+            break;
+        mutex_unlock(ring_mutex);
+        thread_sleep(1);
+    }
+
+    i = (int)(head % RING_SIZE);
+    n = min(length, RING_SIZE - i);
+    memcpy(ring + i, msg, n);
+    memcpy(ring, msg + n, length - n);
+    head += length;
+
+    mutex_unlock(ring_mutex);
+}
+
+/* writes the queued messages to the disk. Returns the number of bytes written */
+int drain()
+{
+    unsigned long from, to;
+    int i, n, k;
+
+    mutex_lock(file_mutex);
+
+    mutex_lock(ring_mutex);
+    from = tail;
+    to = head;
+    mutex_unlock(ring_mutex);
+
+    /* ring[from .. to-1] belongs to us: the producers won't touch it */
+    if((n = (int)(to - from)) > 0) {
+        i = (int)(from % RING_SIZE);
+        k = min(n, RING_SIZE - i);
+        fwrite(ring + i, 1, k, logfile);
+        fwrite(ring, 1, n - k, logfile);
+        fflush(logfile);
+
+        mutex_lock(ring_mutex);
+        tail = to;
+        mutex_unlock(ring_mutex);
+    }
+
+    mutex_unlock(file_mutex);
+    return n;
 }
 
+/* writes the queued messages every now and then (writer thread).
+   Plain stdio only! */
+void writer_routine(void *param)
+{
+    int q;
+
+    for(;;) {
+        mutex_lock(ring_mutex);
+        q = quitting;
+        mutex_unlock(ring_mutex);
+
+        if(drain() == 0) {
+            if(q)
+                break;
+            thread_sleep(WRITER_INTERVAL);
+        }
+    }
+}
@@ -22,9 +22,53 @@
 #ifndef _LOGFILE_H
 #define _LOGFILE_H
 
+/*
+ * Messages are formatted by the caller and queued in a ring
+ * buffer; a background thread writes them to the disk, so that
+ * logging doesn't stall the game. Call logfile_flush() before
+ * the program dies (fatal_error() does).
+ *
+ * Messages less severe than LOGFILE_MIN_SEVERITY are compiled out
+ * when logged through the logfile_debug() ... logfile_error() macros.
+ */
+
+/* severities */
+#define LOGFILE_DEBUG           0
+#define LOGFILE_INFO            1
+#define LOGFILE_WARNING         2
+#define LOGFILE_ERROR           3
+
+#ifndef LOGFILE_MIN_SEVERITY
+#define LOGFILE_MIN_SEVERITY    LOGFILE_INFO
+#endif
+
+/* public methods */
 void logfile_init(); /* initializes the logfile module */
-void logfile_message(const char *fmt, ...); /* prints a message to the logfile (printf style) */
+void logfile_message(const char *fmt, ...); /* prints a message to the logfile (printf style). Severity: LOGFILE_INFO */
+void logfile_message_ex(int severity, const char *fmt, ...); /* prints a message of the given severity to the logfile */
+void logfile_flush(); /* writes the queued messages right away */
 void logfile_release(); /* releases the logfile module */
 
+/* logging with a severity */
+#if LOGFILE_MIN_SEVERITY <= LOGFILE_DEBUG
+#define logfile_debug(...)      logfile_message_ex(LOGFILE_DEBUG, __VA_ARGS__)
+#else
+#define logfile_debug(...)      ((void)0)
+#endif
+
+#if LOGFILE_MIN_SEVERITY <= LOGFILE_INFO
+#define logfile_info(...)       logfile_message_ex(LOGFILE_INFO, __VA_ARGS__)
+#else
+#define logfile_info(...)       ((void)0)
+#endif
+
+#if LOGFILE_MIN_SEVERITY <= LOGFILE_WARNING
+#define logfile_warning(...)    logfile_message_ex(LOGFILE_WARNING, __VA_ARGS__)
+#else
+#define logfile_warning(...)    ((void)0)
+#endif
+
+#define logfile_error(...)      logfile_message_ex(LOGFILE_ERROR, __VA_ARGS__)
+
 #endif
 
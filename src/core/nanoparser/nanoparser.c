@@ -254,6 +254,7 @@ typedef char* pchar;
 GENERATE_INTERFACE_OF_EXPANDABLE_ARRAY(pchar);
 GENERATE_IMPLEMENTATION_OF_EXPANDABLE_ARRAY(pchar);
 static expandable_array_pchar* preprocessor_include_table; /* avoids infinite recursive inclusions */
+static expandable_array_pchar* dependency_table = NULL; /* the include table of the last constructed tree */
 static int preprocessor_line; /* current line number */
 
 static void preprocessor_init();
@@ -344,6 +345,35 @@ static void nq();
 static int traversal_adapter(const parsetree_statement_t *stmt, void *eval_fun);
 
 
+/* binary form */
+#define BINARYFORM_MAGIC        "NPT1"
+#define BINARYFORM_MAXDEPTH     256
+
+typedef struct {
+    unsigned char *data; size_t size; size_t capacity; /* output buffer */
+    const char **string; int string_count; int string_capacity; /* string pool */
+    int *slot; int slot_count; /* hash table: string -> index of the string pool */
+} binarywriter_t;
+
+typedef struct {
+    const unsigned char *data; size_t size; size_t ptr; /* input buffer */
+    char **string; unsigned long string_count; /* string pool */
+    int failed; /* is the input invalid? */
+} binaryreader_t;
+
+static void binarywriter_put_u8(binarywriter_t *w, unsigned char x);
+static void binarywriter_put_u32(binarywriter_t *w, unsigned long x);
+static void binarywriter_put_string(binarywriter_t *w, const char *str); /* interns the string */
+static void binarywriter_put_program(binarywriter_t *w, const parsetree_program_t *prog);
+static void binarywriter_put_parameter(binarywriter_t *w, const parsetree_parameter_t *param);
+static unsigned char binaryreader_get_u8(binaryreader_t *r);
+static unsigned long binaryreader_get_u32(binaryreader_t *r);
+static const char* binaryreader_get_string(binaryreader_t *r);
+static parsetree_program_t* binaryreader_get_program(binaryreader_t *r, int depth);
+static parsetree_parameter_t* binaryreader_get_parameter(binaryreader_t *r, int depth);
+static unsigned long string_hash(const char *str);
+
+
 
 
 
@@ -397,6 +427,19 @@ parsetree_program_t* nanoparser_deconstruct_tree(parsetree_program_t *tree)
     return tree;
 }
 
+int nanoparser_get_number_of_dependencies()
+{
+    return (dependency_table != NULL) ? expandable_array_pchar_size(dependency_table) : 0;
+}
+
+const char* nanoparser_get_nth_dependency(int n)
+{
+    if(n >= 1 && n <= nanoparser_get_number_of_dependencies())
+        return *(expandable_array_pchar_at(dependency_table, n-1));
+    else
+        return NULL;
+}
+
 void nanoparser_set_error_function(void (*fun)(const char*))
 {
     error_fun = fun;
@@ -906,15 +949,21 @@ void preprocessor_init()
 
 void preprocessor_release()
 {
-    int i, len = expandable_array_pchar_size(preprocessor_include_table);
+    int i, len;
 
-    for(i=0; i<len; i++) {
-        char **p = expandable_array_pchar_at(preprocessor_include_table, i);
-        free(*p);
-        *p = NULL;
+    /* the include table becomes the dependency table */
+    if(dependency_table != NULL) {
+        len = expandable_array_pchar_size(dependency_table);
+        for(i=0; i<len; i++) {
+            char **p = expandable_array_pchar_at(dependency_table, i);
+            free(*p);
+            *p = NULL;
+        }
+        dependency_table = expandable_array_pchar_delete(dependency_table);
     }
 
-    preprocessor_include_table = expandable_array_pchar_delete(preprocessor_include_table);
+    dependency_table = preprocessor_include_table;
+    preprocessor_include_table = NULL;
     preprocessor_line = 1;
     vfile_rewind();
 }
@@ -1187,6 +1236,316 @@ int traversal_adapter(const parsetree_statement_t *stmt, void *eval_fun)
 }
 
 
+/* ---------------------------------------------
+ * binary form
+ * ---------------------------------------------- */
+
+/*
+
+Binary form (integers are 32-bit little-endian):
+
+<binary> ::= MAGIC <pool> <program>
+<pool> ::= COUNT <string>*
+<string> ::= LENGTH BYTE*
+<program> ::= COUNT <statement>*
+<statement> ::= STRING_INDEX FILE_STRING_INDEX LINE <parameter>
+<parameter> ::= 0 | 1 STRING_INDEX <parameter> | 2 <program>
+
+where the tag of <parameter> is a single byte
+
+*/
+
+void* nanoparser_serialize_tree(const parsetree_program_t *tree, size_t *size)
+{
+    binarywriter_t tree_writer, w;
+    int i;
+
+    /* writes the tree, interning its strings */
+    tree_writer.data = NULL;
+    tree_writer.size = tree_writer.capacity = 0;
+    tree_writer.string_count = 0;
+    tree_writer.string_capacity = 64;
+    tree_writer.string = malloc_x(tree_writer.string_capacity * sizeof(*(tree_writer.string)));
+    tree_writer.slot_count = 2 * tree_writer.string_capacity;
+    tree_writer.slot = malloc_x(tree_writer.slot_count * sizeof(*(tree_writer.slot)));
+    for(i=0; i<tree_writer.slot_count; i++)
+        tree_writer.slot[i] = -1;
+    binarywriter_put_program(&tree_writer, tree);
+
+    /* writes the header and the string pool */
+    w.data = NULL;
+    w.size = w.capacity = 0;
+    for(i=0; i<4; i++)
+        binarywriter_put_u8(&w, (unsigned char)BINARYFORM_MAGIC[i]);
+    binarywriter_put_u32(&w, tree_writer.string_count);
+    for(i=0; i<tree_writer.string_count; i++) {
+        const char *p = tree_writer.string[i];
+        binarywriter_put_u32(&w, strlen(p));
+        while(*p)
+            binarywriter_put_u8(&w, (unsigned char)(*(p++)));
+    }
+
+    /* appends the tree */
+    for(i=0; i<(int)tree_writer.size; i++)
+        binarywriter_put_u8(&w, tree_writer.data[i]);
+
+    /* done! */
+    free(tree_writer.slot);
+    free(tree_writer.string);
+    free(tree_writer.data);
+    *size = w.size;
+    return w.data;
+}
+
+parsetree_program_t* nanoparser_unserialize_tree(const void *data, size_t size)
+{
+    binaryreader_t r;
+    parsetree_program_t *prog = NULL;
+    unsigned long i, j, len;
+    int k;
+
+    r.data = (const unsigned char*)data;
+    r.size = size;
+    r.ptr = 0;
+    r.string = NULL;
+    r.string_count = 0;
+    r.failed = FALSE;
+
+    /* header */
+    for(k=0; k<4; k++) {
+        if(binaryreader_get_u8(&r) != (unsigned char)BINARYFORM_MAGIC[k])
+            r.failed = TRUE;
+    }
+
+    /* string pool */
+    if(!r.failed) {
+        len = binaryreader_get_u32(&r);
+        if(!r.failed && len <= (r.size - r.ptr) / 4) { /* every string takes at least 4 bytes */
+            r.string = malloc_x((1 + len) * sizeof(*(r.string)));
+            for(i=0; i<len && !r.failed; i++) {
+                unsigned long n = binaryreader_get_u32(&r);
+                if(!r.failed && n <= r.size - r.ptr) {
+                    r.string[i] = malloc_x((n + 1) * sizeof(char));
+                    for(j=0; j<n; j++)
+                        r.string[i][j] = (char)r.data[r.ptr++];
+                    r.string[i][n] = 0;
+                    r.string_count++;
+                }
+                else
+                    r.failed = TRUE;
+            }
+        }
+        else
+            r.failed = TRUE;
+    }
+
+    /* tree */
+    if(!r.failed) {
+        prog = binaryreader_get_program(&r, 0);
+        if(r.failed || r.ptr != r.size)
+            prog = parsetree_program_delete(prog);
+    }
+
+    /* done! */
+    for(i=0; i<r.string_count; i++)
+        free(r.string[i]);
+    free(r.string);
+    return prog;
+}
+
+void binarywriter_put_u8(binarywriter_t *w, unsigned char x)
+{
+    if(w->size >= w->capacity) {
+        w->capacity = (w->capacity > 0) ? 2 * w->capacity : 1024;
+        w->data = realloc_x(w->data, w->capacity);
+    }
+
+    w->data[w->size++] = x;
+}
+
+void binarywriter_put_u32(binarywriter_t *w, unsigned long x)
+{
+    binarywriter_put_u8(w, (unsigned char)(x & 0xFF));
+    binarywriter_put_u8(w, (unsigned char)((x >> 8) & 0xFF));
+    binarywriter_put_u8(w, (unsigned char)((x >> 16) & 0xFF));
+    binarywriter_put_u8(w, (unsigned char)((x >> 24) & 0xFF));
+}
+
+void binarywriter_put_string(binarywriter_t *w, const char *str)
+{
+    int i, k = (int)(string_hash(str) % (unsigned long)w->slot_count);
+
+    /* has str been interned already? */
+    while(w->slot[k] >= 0) {
+        if(strcmp(w->string[w->slot[k]], str) == 0) {
+            binarywriter_put_u32(w, w->slot[k]);
+            return;
+        }
+        k = (k + 1) % w->slot_count;
+    }
+
+    /* new string */
+    if(w->string_count >= w->string_capacity) {
+        w->string_capacity *= 2;
+        w->string = realloc_x(w->string, w->string_capacity * sizeof(*(w->string)));
+    }
+    w->slot[k] = w->string_count;
+    w->string[w->string_count++] = str;
+    binarywriter_put_u32(w, w->slot[k]);
+
+    /* keep the hash table at most half full */
+    if(2 * w->string_count > w->slot_count) {
+        w->slot_count *= 2;
+        w->slot = realloc_x(w->slot, w->slot_count * sizeof(*(w->slot)));
+        for(i=0; i<w->slot_count; i++)
+            w->slot[i] = -1;
+        for(i=0; i<w->string_count; i++) {
+            k = (int)(string_hash(w->string[i]) % (unsigned long)w->slot_count);
+            while(w->slot[k] >= 0)
+                k = (k + 1) % w->slot_count;
+            w->slot[k] = i;
+        }
+    }
+}
+
+void binarywriter_put_program(binarywriter_t *w, const parsetree_program_t *prog)
+{
+    const parsetree_program_t *it;
+    unsigned long n = 0;
+
+    for(it=prog; it; it=it->next)
+        n++;
+
+    binarywriter_put_u32(w, n);
+    for(it=prog; it; it=it->next) {
+        binarywriter_put_string(w, it->statement->string);
+        binarywriter_put_string(w, sourcelocation_get_file(it->statement->source_location));
+        binarywriter_put_u32(w, (unsigned long)sourcelocation_get_line(it->statement->source_location));
+        binarywriter_put_parameter(w, it->statement->parameter);
+    }
+}
+
+void binarywriter_put_parameter(binarywriter_t *w, const parsetree_parameter_t *param)
+{
+    for(; param != NULL && param->type == VALUE; param = param->data.value.next) {
+        binarywriter_put_u8(w, 1);
+        binarywriter_put_string(w, param->data.value.string);
+    }
+
+    if(param != NULL) {
+        binarywriter_put_u8(w, 2);
+        binarywriter_put_program(w, param->data.program);
+    }
+    else
+        binarywriter_put_u8(w, 0);
+}
+
+unsigned char binaryreader_get_u8(binaryreader_t *r)
+{
+    if(r->ptr < r->size)
+        return r->data[r->ptr++];
+
+    r->failed = TRUE;
+    return 0;
+}
+
+unsigned long binaryreader_get_u32(binaryreader_t *r)
+{
+    unsigned long x = 0;
+
+    x |= (unsigned long)binaryreader_get_u8(r);
+    x |= (unsigned long)binaryreader_get_u8(r) << 8;
+    x |= (unsigned long)binaryreader_get_u8(r) << 16;
+    x |= (unsigned long)binaryreader_get_u8(r) << 24;
+
+    return x;
+}
+
+const char* binaryreader_get_string(binaryreader_t *r)
+{
+    unsigned long k = binaryreader_get_u32(r);
+
+    if(!r->failed && k < r->string_count)
+        return r->string[k];
+
+    r->failed = TRUE;
+    return "";
+}
+
+parsetree_program_t* binaryreader_get_program(binaryreader_t *r, int depth)
+{
+    parsetree_program_t *head = NULL, *tail = NULL, *node;
+    parsetree_statement_t *stmt;
+    parsetree_parameter_t *element;
+    unsigned long i, n = binaryreader_get_u32(r);
+
+    if(depth > BINARYFORM_MAXDEPTH)
+        r->failed = TRUE;
+
+    for(i=0; i<n && !r->failed; i++) {
+        /* statement */
+        stmt = malloc_x(sizeof *stmt);
+        stmt->string = str_dup(binaryreader_get_string(r));
+        stmt->source_location = malloc_x(sizeof *(stmt->source_location));
+        stmt->source_location->file = str_dup(binaryreader_get_string(r));
+        stmt->source_location->line = (int)binaryreader_get_u32(r);
+        stmt->parameter = NULL;
+
+        /* link it now, so that it gets released if something goes wrong */
+        node = parsetree_program_new(stmt, NULL);
+        if(tail != NULL)
+            tail->next = node;
+        else
+            head = node;
+        tail = node;
+
+        /* parameters */
+        stmt->parameter = binaryreader_get_parameter(r, depth);
+        for(element = stmt->parameter; element != NULL; element = (element->type == VALUE) ? element->data.value.next : NULL)
+            element->stmt = stmt;
+    }
+
+    return head;
+}
+
+parsetree_parameter_t* binaryreader_get_parameter(binaryreader_t *r, int depth)
+{
+    parsetree_parameter_t *head = NULL, **tail = &head;
+
+    while(!r->failed) {
+        switch(binaryreader_get_u8(r)) {
+            case 0:
+                return head;
+
+            case 1:
+                *tail = parsetree_parameter_new_value(binaryreader_get_string(r), NULL);
+                tail = &((*tail)->data.value.next);
+                break;
+
+            case 2:
+                *tail = parsetree_parameter_new_program(binaryreader_get_program(r, depth+1));
+                return head;
+
+            default:
+                r->failed = TRUE;
+                break;
+        }
+    }
+
+    return head;
+}
+
+unsigned long string_hash(const char *str)
+{
+    unsigned long h = 5381;
+
+    while(*str)
+        h = ((h << 5) + h) ^ (unsigned char)(*(str++));
+
+    return h;
+}
+
+
 /* ---------------------------------------------
  * source location
  * ---------------------------------------------- */
@@ -59,6 +59,8 @@ III) "my text file.txt" example:
 #ifndef _NANOPARSER_H
 #define _NANOPARSER_H
 
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -88,6 +90,28 @@ parsetree_program_t* nanoparser_deconstruct_tree(parsetree_program_t *tree);
 
 
 
+/* ===== BINARY FORM ===== */
+
+/* serializes a parse tree into a compact binary form (with an interned string pool). Returns a buffer of *size bytes, which you must free() */
+void* nanoparser_serialize_tree(const parsetree_program_t *tree, size_t *size);
+
+/* reconstructs a parse tree from its binary form. Returns NULL if the data is not valid. */
+parsetree_program_t* nanoparser_unserialize_tree(const void *data, size_t size);
+
+
+
+
+/* ===== DEPENDENCIES ===== */
+
+/* the number of files read (the file itself plus the #included ones) by the last call to nanoparser_construct_tree() */
+int nanoparser_get_number_of_dependencies();
+
+/* the Nth file (N >= 1) read by the last call to nanoparser_construct_tree(). Returns NULL if it doesn't exist. */
+const char* nanoparser_get_nth_dependency(int n);
+
+
+
+
 /* ===== OPERATIONS ===== */
 
 /* appends src to dest. Returns dest. */
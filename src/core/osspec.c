@@ -63,7 +63,9 @@
 #ifndef __WIN32__
 
 #include <pwd.h>
+#include <fcntl.h>
 #include <unistd.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
@@ -73,6 +75,11 @@
 
 #endif
 
+#if defined(__linux__) && !defined(DISABLE_FILEPATH_OPTIMIZATIONS)
+#include <sys/inotify.h>
+#define HAVE_INOTIFY
+#endif
+
 
 
 
@@ -101,22 +108,49 @@ typedef struct {
 static int foreach_file_callback(const char *filename, int attrib, void *param);
 
 #ifndef DISABLE_FILEPATH_OPTIMIZATIONS
-/* cache stuff (also private): it's a basic dictionary */
-static void cache_init(); /* hi! :-) */
-static void cache_release(); /* bye! */
-static char *cache_search(const char *key); /* searches for key */
-static void cache_insert(const char *key, const char *value); /* new key */
-static void cache_update(const char *key, const char *value); /* will update key, if it exists */
-
-/* the cache is implemented as a simple binary tree */
-typedef struct cache_t {
-    char *key, *value;
-    struct cache_t *left, *right;
-} cache_t;
-static cache_t *cache_root;
-static cache_t *cachetree_release(cache_t *node);
-static cache_t *cachetree_search(cache_t *node, const char *key);
-static cache_t *cachetree_insert(cache_t *node, const char *key, const char *value);
+/* resource index (also private): it maps case-folded relative filepaths
+ * to absolute filepaths. The resource folders of the game and of the home
+ * folders are scanned once, so that resource_filepath() finds a file with
+ * a single hash probe, without touching the disk. */
+#define RESINDEX_MAX_DEPTH  32
+static const char* resindex_folder[] = { /* what we scan (other than the files at the root) */
+    "characters", "config", "fonts", "images", "languages", "levels", "licenses", "musics",
+    "objects", "quests", "samples", "screenshots", "sprites", "themes", "ttf", NULL
+};
+static void resindex_init(); /* scans the folders */
+static void resindex_release();
+static const char *resindex_search(const char *relativefp); /* returns an absolute filepath, or NULL if relativefp isn't indexed */
+static void resindex_update(const char *relativefp, const char *absolutefp); /* adds or replaces an entry */
+
+typedef struct resindex_entry_t {
+    char *key; /* case-folded relative filepath */
+    char *name; /* relative filepath, as given */
+    char *path; /* absolute filepath */
+    struct resindex_entry_t *next;
+} resindex_entry_t;
+static resindex_entry_t **resindex_bucket;
+static int resindex_bucket_count, resindex_entry_count;
+static char resindex_root[2][1024]; /* install folder, home folder */
+static int resindex_root_count;
+
+static void resindex_scan(int root, const char *dir, int depth); /* dir is relative to the root, e.g., "" or "images/" */
+static void resindex_add(const char *name, const char *path);
+static void resindex_remove(const char *name, const char *path);
+static resindex_entry_t *resindex_find(const char *key, const char *name);
+static char *resindex_fold(char *dest, const char *relativefp, size_t dest_size);
+static unsigned resindex_hash(const char *key);
+static int resindex_is_home(const char *path);
+static int resindex_is_folder(const char *name);
+
+#ifdef HAVE_INOTIFY
+/* directory-change notifications keep the index up-to-date */
+typedef struct { int wd, root; char *dir; } resindex_watch_t;
+static int resindex_inotify;
+static resindex_watch_t *resindex_watch;
+static int resindex_watch_count, resindex_watch_capacity;
+static void resindex_watch_dir(int root, const char *dir);
+static void resindex_poll();
+#endif
 #endif
 
 
@@ -167,6 +201,7 @@ void osspec_init(const char *basedir)
         if(NULL != (userinfo = getpwuid(getuid()))) {
             char *subdirs[] = {   /* subfolders at $HOME/.$GAME_UNIXNAME/ */
                 "",
+                "cache",
                 "characters",
                 "config",
                 "fonts",
@@ -199,8 +234,8 @@ void osspec_init(const char *basedir)
 #endif
 
 #ifndef DISABLE_FILEPATH_OPTIMIZATIONS
-    /* initializing the cache */
-    cache_init();
+    /* indexing the resources */
+    resindex_init();
 #endif
 }
 
@@ -212,8 +247,8 @@ void osspec_init(const char *basedir)
 void osspec_release()
 {
 #ifndef DISABLE_FILEPATH_OPTIMIZATIONS
-    /* releasing the cache */
-    cache_release();
+    /* releasing the index */
+    resindex_release();
 #endif
 
     /* base directory */
@@ -271,6 +306,19 @@ int foreach_resource(const char *wildcard, int (*callback)(const char *filename,
 }
 
 
+/*
+ * osspec_update()
+ * Call it once per frame: applies the changes that have
+ * been made to the resource folders (if we're notified)
+ */
+void osspec_update()
+{
+#if !defined(DISABLE_FILEPATH_OPTIMIZATIONS) && defined(HAVE_INOTIFY)
+    resindex_poll();
+#endif
+}
+
+
 /*
  * resource_filepath()
  * Similar to install_filepath() and home_filepath(), but this routine
@@ -288,14 +336,14 @@ void resource_filepath(char *dest, const char *relativefp, size_t dest_size, res
 
             /* optimizations: without this, the game could become terribly slow
              * when the files are distributed over a network (example: nfs) */
-            char *path;
+            const char *path;
             if(is_relative_filename(relativefp)) {
-                if(NULL == (path=cache_search(relativefp))) {
-                    /* I'll have to search the file... */
+                if(NULL == (path=resindex_search(relativefp))) {
+                    /* not indexed: I'll have to search the file... */
                     search_the_file(dest, relativefp, dest_size);
 
                     /* store the resulting filepath in the memory */
-                    cache_insert(relativefp, dest);
+                    resindex_update(relativefp, dest);
                 }
                 else
                     str_cpy(dest, path, dest_size);
@@ -349,10 +397,8 @@ void resource_filepath(char *dest, const char *relativefp, size_t dest_size, res
 
 #ifndef DISABLE_FILEPATH_OPTIMIZATIONS
             /* this is sooo important... */
-            if(cache_search(relativefp) != NULL)
-                cache_update(relativefp, dest);
-            else
-                cache_insert(relativefp, dest);
+            if(is_relative_filename(relativefp))
+                resindex_update(relativefp, dest);
 #endif
             break;
         }
@@ -421,6 +467,93 @@ char *basename(const char *path)
 
 
 
+/*
+ * map_file()
+ * Maps a whole file into memory (read-only, shared with the
+ * other processes). Returns NULL on error (an empty file is
+ * an error too). Release it with unmap_file()
+ */
+const void* map_file(const char *filepath, long *size)
+{
+#ifndef __WIN32__
+    struct stat st;
+    void *p;
+    int fd;
+
+    if((fd = open(filepath, O_RDONLY)) < 0)
+        return NULL;
+
+    if(fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return NULL;
+    }
+
+    p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd); /* the mapping keeps the file open */
+    if(p == MAP_FAILED)
+        return NULL;
+
+    *size = (long)st.st_size;
+    return p;
+#else
+    HANDLE file, mapping;
+    DWORD file_size;
+    void *p = NULL;
+
+    file = CreateFileA(filepath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if(file == INVALID_HANDLE_VALUE)
+        return NULL;
+
+    file_size = GetFileSize(file, NULL);
+    if(file_size != INVALID_FILE_SIZE && file_size > 0) {
+        if(NULL != (mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL))) {
+            p = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            CloseHandle(mapping); /* the view keeps the mapping alive */
+        }
+    }
+
+    CloseHandle(file);
+    if(p == NULL)
+        return NULL;
+
+    *size = (long)file_size;
+    return p;
+#endif
+}
+
+
+/*
+ * unmap_file()
+ * Releases a file mapped with map_file()
+ */
+void unmap_file(const void *data, long size)
+{
+    if(data == NULL)
+        return;
+
+#ifndef __WIN32__
+    munmap((void*)data, (size_t)size);
+#else
+    UnmapViewOfFile(data);
+#endif
+}
+
+
+/*
+ * prefetch_mapped_file()
+ * Asks the OS to bring a file mapped with
+ * map_file() into memory in the background
+ */
+void prefetch_mapped_file(const void *data, long size)
+{
+#ifndef __WIN32__
+    if(data != NULL)
+        posix_madvise((void*)data, (size_t)size, POSIX_MADV_WILLNEED);
+#endif
+}
+
+
+
 
 /*
  * launch_url()
@@ -834,98 +967,366 @@ char *url_encode(const char *str) {
 
 
 #ifndef DISABLE_FILEPATH_OPTIMIZATIONS
-/* ------- cache interface -------- */
+/* ------- resource index -------- */
 
-/* initializes the cache */
-void cache_init()
+/* scans the game and the home folders */
+void resindex_init()
 {
-    cache_root = NULL;
+    int i, n;
+
+    resindex_bucket_count = 1024;
+    resindex_entry_count = 0;
+    resindex_bucket = mallocx(resindex_bucket_count * sizeof *resindex_bucket);
+    for(i=0; i<resindex_bucket_count; i++)
+        resindex_bucket[i] = NULL;
+
+#ifdef HAVE_INOTIFY
+    resindex_watch = NULL;
+    resindex_watch_count = resindex_watch_capacity = 0;
+    resindex_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+
+    /* the roots */
+    install_filepath(resindex_root[0], "", sizeof(resindex_root[0]));
+    home_filepath(resindex_root[1], "", sizeof(resindex_root[1]));
+    for(i=0; i<2; i++) {
+        fix_filename_slashes(resindex_root[i]);
+        n = strlen(resindex_root[i]);
+        if(n > 0 && n + 1 < sizeof(resindex_root[i])) {
+            if(resindex_root[i][n-1] != OTHER_PATH_SEPARATOR && resindex_root[i][n-1] != '/') {
+                resindex_root[i][n] = OTHER_PATH_SEPARATOR;
+                resindex_root[i][n+1] = 0;
+            }
+        }
+    }
+    resindex_root_count = (strcmp(resindex_root[0], resindex_root[1]) == 0) ? 1 : 2;
+
+    /* scanning: entries found in the home folder may override the ones of the game folder */
+    for(i=0; i<resindex_root_count; i++)
+        resindex_scan(i, "", 0);
 }
 
-/* releases the cache */
-void cache_release()
+/* releases the index */
+void resindex_release()
 {
-    cache_root = cachetree_release(cache_root);
+    resindex_entry_t *e, *next;
+    int i;
+
+#ifdef HAVE_INOTIFY
+    if(resindex_inotify >= 0)
+        close(resindex_inotify);
+    for(i=0; i<resindex_watch_count; i++)
+        free(resindex_watch[i].dir);
+    if(resindex_watch != NULL)
+        free(resindex_watch);
+#endif
+
+    for(i=0; i<resindex_bucket_count; i++) {
+        for(e=resindex_bucket[i]; e; e=next) {
+            next = e->next;
+            free(e->key);
+            free(e->name);
+            free(e->path);
+            free(e);
+        }
+    }
+
+    free(resindex_bucket);
+    resindex_bucket = NULL;
+    resindex_bucket_count = resindex_entry_count = 0;
 }
 
-/* finds a string in the dictionary */
-char *cache_search(const char *key)
+/* finds a relative filepath in the index */
+const char *resindex_search(const char *relativefp)
 {
-    cache_t *node = cachetree_search(cache_root, key);
-    return node ? node->value : NULL;
+    char key[1024];
+    resindex_entry_t *e;
+
+    resindex_fold(key, relativefp, sizeof(key));
+    e = resindex_find(key, relativefp);
+    return e ? e->path : NULL;
 }
 
-/* inserts a string into the dictionary */
-void cache_insert(const char *key, const char *value)
+/* adds or replaces an entry of the index */
+void resindex_update(const char *relativefp, const char *absolutefp)
 {
-    cache_root = cachetree_insert(cache_root, key, value);
+    char key[1024];
+    resindex_entry_t *e;
+
+    resindex_fold(key, relativefp, sizeof(key));
+    if(NULL != (e = resindex_find(key, relativefp)) && strcmp(e->name, relativefp) == 0) {
+        free(e->path);
+        e->path = str_dup(absolutefp);
+    }
+    else {
+        unsigned h = resindex_hash(key) % resindex_bucket_count;
+        e = mallocx(sizeof *e);
+        e->key = str_dup(key);
+        e->name = str_dup(relativefp);
+        e->path = str_dup(absolutefp);
+        e->next = resindex_bucket[h];
+        resindex_bucket[h] = e;
+
+        /* growing the table */
+        if(++resindex_entry_count > resindex_bucket_count) {
+            int i, n = 2 * resindex_bucket_count;
+            resindex_entry_t **bucket = mallocx(n * sizeof *bucket), *next;
+
+            for(i=0; i<n; i++)
+                bucket[i] = NULL;
+            for(i=0; i<resindex_bucket_count; i++) {
+                for(e=resindex_bucket[i]; e; e=next) {
+                    next = e->next;
+                    h = resindex_hash(e->key) % n;
+                    e->next = bucket[h];
+                    bucket[h] = e;
+                }
+            }
+
+            free(resindex_bucket);
+            resindex_bucket = bucket;
+            resindex_bucket_count = n;
+        }
+    }
 }
 
-/* will update an entry of the dictionary, if that entry exists */
-void cache_update(const char *key, const char *value)
+/* recursively adds the contents of a directory to the index. At
+ * the root, only the files and the resource folders are scanned */
+void resindex_scan(int root, const char *dir, int depth)
 {
-    cache_t *node = cachetree_search(cache_root, key);
-    if(node != NULL) {
-        free(node->value);
-        node->value = str_dup(value);
+    struct al_ffblk info;
+    char wildcard[1024], name[1024], path[1024];
+
+    if(depth > RESINDEX_MAX_DEPTH)
+        return;
+
+#ifdef HAVE_INOTIFY
+    resindex_watch_dir(root, dir);
+#endif
+
+    snprintf(wildcard, sizeof(wildcard), "%s%s*", resindex_root[root], dir);
+    if(al_findfirst(wildcard, &info, FA_ALL) == 0) {
+        do {
+            if(strcmp(info.name, "") != 0 && strcmp(info.name, ".") != 0 && strcmp(info.name, "..") != 0 && !(info.attrib & FA_LABEL)) {
+                if((info.attrib & FA_DIREC) && depth == 0 && !resindex_is_folder(info.name))
+                    continue; /* e.g., src/ or .git/ */
+
+                snprintf(name, sizeof(name), "%s%s", dir, info.name);
+                snprintf(path, sizeof(path), "%s%s", resindex_root[root], name);
+                fix_filename_slashes(path);
+                resindex_add(name, path);
+
+                if(info.attrib & FA_DIREC) {
+                    str_cpy(path, name, sizeof(path));
+                    snprintf(name, sizeof(name), "%s/", path);
+                    resindex_scan(root, name, depth + 1);
+                }
+            }
+        } while(al_findnext(&info) == 0);
+        al_findclose(&info);
     }
 }
 
-/* ------ cache implementation --------- */
-cache_t *cachetree_release(cache_t *node)
+/* adds a file that has been found on the disk. If the same file
+ * exists both in the game and in the home folders, we keep the
+ * newest one (home wins ties), just like search_the_file() */
+void resindex_add(const char *name, const char *path)
 {
-    if(node) {
-        node->left = cachetree_release(node->left);
-        node->right = cachetree_release(node->right);
-        free(node->key);
-        free(node->value);
-        free(node);
+    char key[1024];
+    resindex_entry_t *e;
+    const char *install_path, *home_path;
+
+    resindex_fold(key, name, sizeof(key));
+    if(NULL != (e = resindex_find(key, name)) && strcmp(e->name, name) == 0 && strcmp(e->path, path) != 0) {
+        if(resindex_is_home(path)) {
+            home_path = path;
+            install_path = e->path;
+        }
+        else {
+            home_path = e->path;
+            install_path = path;
+        }
+
+        if(difftime(file_time(install_path), file_time(home_path)) > 0)
+            path = install_path;
+        else
+            path = home_path;
+
+        if(path == e->path)
+            return;
     }
 
-    return NULL;
+    resindex_update(name, path);
+}
+
+/* removes a file that no longer exists on the disk */
+void resindex_remove(const char *name, const char *path)
+{
+    char key[1024];
+    resindex_entry_t *e, **p;
+
+    resindex_fold(key, name, sizeof(key));
+    for(p = &(resindex_bucket[resindex_hash(key) % resindex_bucket_count]); (e = *p) != NULL; p = &(e->next)) {
+        if(strcmp(e->name, name) == 0 && strcmp(e->path, path) == 0) {
+            *p = e->next;
+            free(e->key);
+            free(e->name);
+            free(e->path);
+            free(e);
+            resindex_entry_count--;
+            break;
+        }
+    }
 }
 
-cache_t *cachetree_search(cache_t *node, const char *key)
+/* finds an entry given its key. Exact matches are preferred
+ * (on *nix, two files may differ only by case) */
+resindex_entry_t *resindex_find(const char *key, const char *name)
 {
-    int cmp;
+    resindex_entry_t *e, *found = NULL;
+
+    for(e = resindex_bucket[resindex_hash(key) % resindex_bucket_count]; e; e = e->next) {
+        if(strcmp(e->key, key) == 0) {
+            if(strcmp(e->name, name) == 0)
+                return e;
+            else if(found == NULL)
+                found = e;
+        }
+    }
 
-    if(node) {
-        cmp = strcmp(key, node->key);
+    return found;
+}
 
-        if(cmp < 0)
-            return cachetree_search(node->left, key);
-        else if(cmp > 0)
-            return cachetree_search(node->right, key);
+/* case-folds a relative filepath: "./Images//Foo.PNG" becomes "images/foo.png" */
+char *resindex_fold(char *dest, const char *relativefp, size_t dest_size)
+{
+    const char *p = relativefp;
+    char *q = dest, *end = dest + dest_size - 1;
+
+    while(*p && q < end) {
+        if(*p == '/' || *p == '\\') {
+            if(q > dest && *(q-1) != '/')
+                *q++ = '/';
+            p++;
+        }
+        else if(*p == '.' && (q == dest || *(q-1) == '/') && (*(p+1) == '/' || *(p+1) == '\\' || *(p+1) == 0))
+            p++; /* skip "./" */
         else
-            return node;
+            *q++ = tolower((unsigned char)*p++);
     }
-    else
-        return NULL;
+
+    if(q > dest && *(q-1) == '/')
+        q--;
+
+    *q = 0;
+    return dest;
 }
 
-cache_t *cachetree_insert(cache_t *node, const char *key, const char *value)
+/* FNV-1a */
+unsigned resindex_hash(const char *key)
 {
-    int cmp;
-    cache_t *t;
+    unsigned h = 2166136261u;
 
-    if(node) {
-        cmp = strcmp(key, node->key);
+    while(*key)
+        h = (h ^ (unsigned char)*key++) * 16777619u;
 
-        if(cmp < 0)
-            node->left = cachetree_insert(node->left, key, value);
-        else if(cmp > 0)
-            node->right = cachetree_insert(node->right, key, value);
+    return h;
+}
 
-        return node;
+/* is name (a directory at the root) one of the resource folders? */
+int resindex_is_folder(const char *name)
+{
+    int i;
+
+    for(i=0; resindex_folder[i] != NULL; i++) {
+        if(str_icmp(resindex_folder[i], name) == 0)
+            return TRUE;
     }
-    else {
-        t = mallocx(sizeof *t);
-        t->key = str_dup(key);
-        t->value = str_dup(value);
-        t->left = t->right = NULL;
-        return t;
+
+    return FALSE;
+}
+
+/* is the given absolute filepath located in the home folder? */
+int resindex_is_home(const char *path)
+{
+    return resindex_root_count > 1 && strncmp(path, resindex_root[1], strlen(resindex_root[1])) == 0;
+}
+
+#ifdef HAVE_INOTIFY
+/* watches a directory of the index */
+void resindex_watch_dir(int root, const char *dir)
+{
+    char path[1024];
+    int wd;
+
+    if(resindex_inotify < 0)
+        return;
+
+    snprintf(path, sizeof(path), "%s%s", resindex_root[root], dir);
+    if((wd = inotify_add_watch(resindex_inotify, path, IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_MODIFY | IN_CLOSE_WRITE)) < 0)
+        return;
+
+    if(resindex_watch_count >= resindex_watch_capacity) {
+        resindex_watch_capacity = max(32, 2 * resindex_watch_capacity);
+        resindex_watch = reallocx(resindex_watch, resindex_watch_capacity * sizeof *resindex_watch);
     }
+
+    resindex_watch[resindex_watch_count].wd = wd;
+    resindex_watch[resindex_watch_count].root = root;
+    resindex_watch[resindex_watch_count].dir = str_dup(dir);
+    resindex_watch_count++;
 }
+
+/* applies the pending directory-change notifications to the index. A
+ * file that's been written is added again: it may now be the newest of
+ * the game and the home folders */
+void resindex_poll()
+{
+    char buf[4096], name[1024], path[1024];
+    const struct inotify_event *ev;
+    ssize_t len;
+    char *p;
+    int i;
+
+    if(resindex_inotify < 0)
+        return;
+
+    while((len = read(resindex_inotify, buf, sizeof(buf))) > 0) {
+        for(p = buf; p < buf + len; p += sizeof(struct inotify_event) + ev->len) {
+            ev = (const struct inotify_event*)p;
+            if(ev->len == 0)
+                continue;
+
+            for(i=0; i<resindex_watch_count; i++) {
+                if(resindex_watch[i].wd == ev->wd)
+                    break;
+            }
+            if(i == resindex_watch_count)
+                continue;
+
+            if((ev->mask & IN_ISDIR) && *(resindex_watch[i].dir) == 0 && !resindex_is_folder(ev->name))
+                continue;
+
+            snprintf(name, sizeof(name), "%s%s", resindex_watch[i].dir, ev->name);
+            snprintf(path, sizeof(path), "%s%s", resindex_root[resindex_watch[i].root], name);
+            if(ev->mask & (IN_MODIFY | IN_CLOSE_WRITE)) {
+                if(!(ev->mask & IN_ISDIR))
+                    resindex_add(name, path);
+            }
+            else if(ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+                resindex_add(name, path);
+                if(ev->mask & IN_ISDIR) {
+                    str_cpy(path, name, sizeof(path));
+                    snprintf(name, sizeof(name), "%s/", path);
+                    resindex_scan(resindex_watch[i].root, name, 0);
+                }
+            }
+            else if(ev->mask & (IN_DELETE | IN_MOVED_FROM))
+                resindex_remove(name, path);
+        }
+    }
+}
+#endif
 #endif
 
 
@@ -27,6 +27,7 @@
 /* engine functions */
 void osspec_init(const char *basedir); /* call this before everything else. You may pass NULL to basedir. */
 void osspec_release(); /* call this after everything else */
+void osspec_update(); /* call this once per frame: keeps track of the changes made to the resource folders */
 
 /* resource access. Resources are stored either in the game folder, or in the home folder (*nix). */
 typedef enum { RESFP_READ, RESFP_WRITE } resfp_t; /* do you want to access the resource for writing or for reading? */
@@ -36,6 +37,9 @@ int foreach_resource(const char *wildcard, int (*callback)(const char *filename,
 /* simple file access */
 int filepath_exists(const char *filepath); /* does the given (absolute) filepath exist? */
 char* basename(const char *path); /* basename of path */
+const void* map_file(const char *filepath, long *size); /* maps a whole file into memory (read-only). Returns NULL on error */
+void unmap_file(const void *data, long size); /* releases a file mapped with map_file() */
+void prefetch_mapped_file(const void *data, long size); /* asks the OS to read a mapped file ahead of time */
 int launch_url(const char *url); /* launches an URL: returns TRUE on success */
 
 #endif
@@ -0,0 +1,443 @@
+/*
+ * Open Surge Engine
+ * pcmcache.c - cache of decoded samples
+ * Copyright (C) 2013  Alexandre Martins <alemartf(at)gmail(dot)com>
+ * http://opensnc.sourceforge.net
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <allegro.h>
+#include <stdio.h>
+#include <string.h>
+#include "pcmcache.h"
+#include "global.h"
+#include "osspec.h"
+#include "util.h"
+#include "stringutil.h"
+#include "logfile.h"
+#include "hashtable.h"
+
+/* private stuff */
+#define PCMCACHE_FILE           "cache/samples.bin"
+#define PCMCACHE_TEMP_FILE      "cache/samples.bin.tmp"
+#define PCMCACHE_MAGIC          "OSPC"
+#define PCMCACHE_VERSION        1
+#define PCMCACHE_ALIGNMENT      16 /* the sample data is aligned to this many bytes */
+
+/* a cached sample */
+typedef struct pcmcache_entry_t pcmcache_entry_t;
+struct pcmcache_entry_t {
+    char *filepath; /* absolute path of the sample */
+    uint32 size; /* size of the sample file */
+    uint32 time; /* modification time of the sample file */
+    uint32 freq, bits, channels, length; /* format */
+    const unsigned char *data; /* decoded audio */
+    uint32 data_size; /* size of the decoded audio */
+    unsigned char *owned_data; /* data, if it's not stored in the pack */
+    pcmcache_entry_t *next; /* linked list */
+};
+
+HASHTABLE_GENERATE_CODE(pcmcache_entry_t)
+
+static int enabled = FALSE;
+static const unsigned char *pack = NULL; /* the cache file, mapped into memory */
+static long pack_size = 0;
+static pcmcache_entry_t *entries = NULL;
+static hashtable_pcmcache_entry_t *lookup_table = NULL;
+static int dirty = FALSE; /* do we need to save the cache? */
+static int hits = 0, misses = 0;
+
+static void load_pack();
+static int save_pack();
+static void unmap_pack();
+static pcmcache_entry_t* entry_create(const char *filepath);
+static pcmcache_entry_t* entry_destroy(pcmcache_entry_t *e);
+static void entry_add(pcmcache_entry_t *e);
+static void entry_remove(pcmcache_entry_t *e);
+static int entry_is_valid(const pcmcache_entry_t *e);
+static int read_u32(uint32 *x, long *ptr);
+static int read_string(char **str, long *ptr);
+static void write_u32(FILE *fp, uint32 x);
+static void write_string(FILE *fp, const char *str);
+static void write_padding(FILE *fp);
+
+
+
+/* public methods */
+
+/*
+ * pcmcache_init()
+ * Initializes the PCM cache
+ */
+void pcmcache_init(int is_enabled)
+{
+    logfile_message("Initializing the sample cache...");
+
+    enabled = is_enabled;
+    entries = NULL;
+    lookup_table = hashtable_pcmcache_entry_t_create(NULL);
+    dirty = FALSE;
+    hits = misses = 0;
+
+    if(enabled)
+        load_pack();
+    else
+        logfile_message("The sample cache is disabled.");
+}
+
+
+/*
+ * pcmcache_release()
+ * Releases the PCM cache, saving it if necessary.
+ * Call this only after the samples have been released,
+ * since the cached ones point to the mapped file.
+ */
+void pcmcache_release()
+{
+    char abs_path[1024], tmp_path[1024];
+    pcmcache_entry_t *next;
+    int saved = FALSE;
+
+    logfile_message("Releasing the sample cache (%d hits, %d misses)...", hits, misses);
+
+    /* the new pack is written aside, since the current one is still mapped */
+    if(enabled && dirty)
+        saved = save_pack();
+
+    lookup_table = hashtable_pcmcache_entry_t_destroy(lookup_table);
+    while(entries != NULL) {
+        next = entries->next;
+        entry_destroy(entries);
+        entries = next;
+    }
+
+    unmap_pack();
+
+    /* replace the old pack */
+    if(saved) {
+        resource_filepath(abs_path, PCMCACHE_FILE, sizeof(abs_path), RESFP_WRITE);
+        resource_filepath(tmp_path, PCMCACHE_TEMP_FILE, sizeof(tmp_path), RESFP_WRITE);
+        remove(abs_path);
+        if(rename(tmp_path, abs_path) != 0) {
+            logfile_message("Can't save the sample cache \"%s\"", abs_path);
+            remove(tmp_path);
+        }
+    }
+}
+
+
+/*
+ * pcmcache_find()
+ * Looks for the decoded form of the given sample file. Returns
+ * TRUE on success, filling *sample. sample->data points to the
+ * mapped cache file and is valid until pcmcache_release().
+ */
+int pcmcache_find(const char *abs_path, pcmsample_t *sample)
+{
+    pcmcache_entry_t *e;
+
+    if(!enabled)
+        return FALSE;
+
+    if(NULL != (e = hashtable_pcmcache_entry_t_find(lookup_table, abs_path))) {
+        if(entry_is_valid(e)) {
+            sample->freq = (int)e->freq;
+            sample->bits = (int)e->bits;
+            sample->channels = (int)e->channels;
+            sample->length = (int)e->length;
+            sample->data = e->data;
+            hits++;
+            return TRUE;
+        }
+
+        /* outdated */
+        entry_remove(e);
+        dirty = TRUE;
+    }
+
+    misses++;
+    return FALSE;
+}
+
+
+/*
+ * pcmcache_add()
+ * Stores a copy of a freshly decoded sample. It will be
+ * written to the cache file when the cache is released.
+ */
+void pcmcache_add(const char *abs_path, const pcmsample_t *sample)
+{
+    pcmcache_entry_t *e;
+    uint32 data_size;
+
+    if(!enabled || (sample->bits != 8 && sample->bits != 16) || (sample->channels != 1 && sample->channels != 2) || sample->length <= 0)
+        return;
+
+    data_size = (uint32)sample->length * (uint32)sample->channels * (uint32)(sample->bits / 8);
+
+    e = entry_create(abs_path);
+    e->size = (uint32)file_size_ex(abs_path);
+    e->time = (uint32)file_time(abs_path);
+    e->freq = (uint32)sample->freq;
+    e->bits = (uint32)sample->bits;
+    e->channels = (uint32)sample->channels;
+    e->length = (uint32)sample->length;
+    e->owned_data = mallocx(data_size);
+    memcpy(e->owned_data, sample->data, data_size);
+    e->data = e->owned_data;
+    e->data_size = data_size;
+    entry_add(e);
+    dirty = TRUE;
+}
+
+
+/*
+ * pcmcache_prefetch()
+ * Asks the OS to bring the cache file into memory in
+ * the background, so that the samples of a level are
+ * already resident by the time they're first played.
+ */
+void pcmcache_prefetch()
+{
+    prefetch_mapped_file(pack, pack_size);
+}
+
+
+
+/* private methods */
+
+/* maps the cache file (if any) and reads its index */
+void load_pack()
+{
+    char abs_path[1024];
+    long ptr = 0;
+    uint32 i, n, version;
+
+    resource_filepath(abs_path, PCMCACHE_FILE, sizeof(abs_path), RESFP_READ);
+    if(!filepath_exists(abs_path))
+        return;
+
+    if(NULL == (pack = map_file(abs_path, &pack_size))) {
+        logfile_message("Can't read the sample cache \"%s\"", abs_path);
+        return;
+    }
+
+    /* header */
+    if(pack_size < 4 || memcmp(pack, PCMCACHE_MAGIC, 4) != 0 || (ptr = 4, !read_u32(&version, &ptr)) || version != PCMCACHE_VERSION || !read_u32(&n, &ptr)) {
+        logfile_message("Discarding the sample cache \"%s\": invalid or outdated file", abs_path);
+        unmap_pack();
+        return;
+    }
+
+    /* entries */
+    for(i=0; i<n; i++) {
+        char *filepath;
+        pcmcache_entry_t *e;
+
+        if(!read_string(&filepath, &ptr))
+            break;
+
+        e = entry_create(filepath);
+        free(filepath);
+
+        if(!read_u32(&(e->size), &ptr) || !read_u32(&(e->time), &ptr) || !read_u32(&(e->freq), &ptr) || !read_u32(&(e->bits), &ptr) || !read_u32(&(e->channels), &ptr) || !read_u32(&(e->length), &ptr) || !read_u32(&(e->data_size), &ptr)) {
+            entry_destroy(e);
+            break;
+        }
+
+        ptr = (ptr + PCMCACHE_ALIGNMENT - 1) & ~(long)(PCMCACHE_ALIGNMENT - 1);
+        if(ptr > pack_size || e->data_size > (uint32)(pack_size - ptr) || e->data_size != e->length * e->channels * (e->bits / 8)) {
+            entry_destroy(e);
+            break;
+        }
+
+        e->data = pack + ptr;
+        ptr += e->data_size;
+        entry_add(e);
+    }
+
+    logfile_message("Sample cache \"%s\" mapped (%ld bytes).", abs_path, pack_size);
+    pcmcache_prefetch(); /* the sound factory is about to read it */
+}
+
+/* writes the cache to a temporary file. Returns TRUE on success */
+int save_pack()
+{
+    char abs_path[1024];
+    pcmcache_entry_t *e;
+    uint32 n = 0;
+    int ok;
+    FILE *fp;
+
+    resource_filepath(abs_path, PCMCACHE_TEMP_FILE, sizeof(abs_path), RESFP_WRITE);
+    if(NULL == (fp = fopen(abs_path, "wb"))) {
+        logfile_message("Can't save the sample cache \"%s\"", abs_path);
+        return FALSE;
+    }
+
+    for(e=entries; e; e=e->next)
+        n++;
+
+    fwrite(PCMCACHE_MAGIC, 1, 4, fp);
+    write_u32(fp, PCMCACHE_VERSION);
+    write_u32(fp, n);
+    for(e=entries; e; e=e->next) {
+        write_string(fp, e->filepath);
+        write_u32(fp, e->size);
+        write_u32(fp, e->time);
+        write_u32(fp, e->freq);
+        write_u32(fp, e->bits);
+        write_u32(fp, e->channels);
+        write_u32(fp, e->length);
+        write_u32(fp, e->data_size);
+        write_padding(fp);
+        fwrite(e->data, 1, e->data_size, fp);
+    }
+
+    ok = !ferror(fp);
+    if(fclose(fp) != 0 || !ok) {
+        logfile_message("Can't save the sample cache \"%s\"", abs_path);
+        remove(abs_path);
+        return FALSE;
+    }
+
+    logfile_message("Sample cache saved to \"%s\" (%d samples).", abs_path, (int)n);
+    return TRUE;
+}
+
+/* unmaps the cache file */
+void unmap_pack()
+{
+    unmap_file(pack, pack_size);
+    pack = NULL;
+    pack_size = 0;
+}
+
+/* creates a new entry */
+pcmcache_entry_t* entry_create(const char *filepath)
+{
+    pcmcache_entry_t *e = mallocx(sizeof *e);
+
+    e->filepath = str_dup(filepath);
+    e->size = e->time = 0;
+    e->freq = e->bits = e->channels = e->length = 0;
+    e->data = NULL;
+    e->data_size = 0;
+    e->owned_data = NULL;
+    e->next = NULL;
+
+    return e;
+}
+
+/* destroys an entry */
+pcmcache_entry_t* entry_destroy(pcmcache_entry_t *e)
+{
+    if(e->owned_data != NULL)
+        free(e->owned_data);
+
+    free(e->filepath);
+    free(e);
+    return NULL;
+}
+
+/* adds an entry to the cache */
+void entry_add(pcmcache_entry_t *e)
+{
+    if(NULL == hashtable_pcmcache_entry_t_find(lookup_table, e->filepath)) {
+        hashtable_pcmcache_entry_t_add(lookup_table, e->filepath, e);
+        e->next = entries;
+        entries = e;
+    }
+    else
+        entry_destroy(e);
+}
+
+/* removes an entry from the cache */
+void entry_remove(pcmcache_entry_t *e)
+{
+    pcmcache_entry_t *it, *prev = NULL;
+
+    hashtable_pcmcache_entry_t_remove(lookup_table, e->filepath);
+    for(it=entries; it; prev=it, it=it->next) {
+        if(it == e) {
+            if(prev != NULL)
+                prev->next = it->next;
+            else
+                entries = it->next;
+            entry_destroy(it);
+            break;
+        }
+    }
+}
+
+/* checks if the sample file hasn't changed since it was decoded */
+int entry_is_valid(const pcmcache_entry_t *e)
+{
+    return filepath_exists(e->filepath) && (uint32)file_size_ex(e->filepath) == e->size && (uint32)file_time(e->filepath) == e->time;
+}
+
+/* reads a 32-bit little-endian integer from the pack */
+int read_u32(uint32 *x, long *ptr)
+{
+    if(*ptr + 4 > pack_size)
+        return FALSE;
+
+    *x = (uint32)pack[*ptr] | ((uint32)pack[*ptr+1] << 8) | ((uint32)pack[*ptr+2] << 16) | ((uint32)pack[*ptr+3] << 24);
+    *ptr += 4;
+    return TRUE;
+}
+
+/* reads a string from the pack. You must free() it */
+int read_string(char **str, long *ptr)
+{
+    uint32 len;
+
+    if(!read_u32(&len, ptr) || len > (uint32)(pack_size - *ptr))
+        return FALSE;
+
+    *str = mallocx((len + 1) * sizeof(char));
+    memcpy(*str, pack + *ptr, len);
+    (*str)[len] = 0;
+    *ptr += len;
+    return TRUE;
+}
+
+/* writes a 32-bit little-endian integer */
+void write_u32(FILE *fp, uint32 x)
+{
+    fputc((int)(x & 0xFF), fp);
+    fputc((int)((x >> 8) & 0xFF), fp);
+    fputc((int)((x >> 16) & 0xFF), fp);
+    fputc((int)((x >> 24) & 0xFF), fp);
+}
+
+/* writes a string */
+void write_string(FILE *fp, const char *str)
+{
+    uint32 len = strlen(str);
+    write_u32(fp, len);
+    fwrite(str, 1, len, fp);
+}
+
+/* pads the file with zeroes up to the next PCMCACHE_ALIGNMENT boundary */
+void write_padding(FILE *fp)
+{
+    long pos = ftell(fp);
+
+    while(pos++ % PCMCACHE_ALIGNMENT != 0)
+        fputc(0, fp);
+}
@@ -0,0 +1,54 @@
+/*
+ * Open Surge Engine
+ * pcmcache.h - cache of decoded samples
+ * Copyright (C) 2013  Alexandre Martins <alemartf(at)gmail(dot)com>
+ * http://opensnc.sourceforge.net
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _PCMCACHE_H
+#define _PCMCACHE_H
+
+#include "global.h"
+
+/*
+ * The PCM cache keeps the samples (*.wav, *.ogg) already decoded in a
+ * pack file, so that they don't need to be decoded again on later
+ * launches. The pack is memory-mapped: a cached sample is handed to
+ * the audio backend straight from the file, and its pages are shared
+ * by the processes running the game. A sample is considered unchanged
+ * if the size and the modification time of its file are the same.
+ * With OpenAL, only the *.wav samples are cached (ALURE decodes the
+ * others by itself).
+ */
+
+/* decoded audio, as in Allegro's SAMPLE: unsigned, interleaved, native byte order */
+typedef struct pcmsample_t pcmsample_t;
+struct pcmsample_t {
+    int freq; /* samples per second */
+    int bits; /* 8 or 16 */
+    int channels; /* 1 or 2 */
+    int length; /* in sample frames */
+    const void *data; /* length * channels * (bits / 8) bytes */
+};
+
+void pcmcache_init(int enabled); /* maps the cache file */
+void pcmcache_release(); /* saves the new samples and unmaps the cache file */
+int pcmcache_find(const char *abs_path, pcmsample_t *sample); /* returns TRUE if the decoded sample is in the cache */
+void pcmcache_add(const char *abs_path, const pcmsample_t *sample); /* stores a copy of a decoded sample */
+void pcmcache_prefetch(); /* asks the OS to read the cache file in advance */
+
+#endif
@@ -0,0 +1,344 @@
+/*
+ * Open Surge Engine
+ * prefetch.c - decodes images and warms up the OS file cache in background threads
+ * Copyright (C) 2013  Alexandre Martins <alemartf(at)gmail(dot)com>
+ * http://opensnc.sourceforge.net
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "prefetch.h"
+#include "thread.h"
+#include "image.h"
+#include "resourcemanager.h"
+#include "scriptcache.h"
+#include "nanoparser/nanoparser.h"
+#include "osspec.h"
+#include "stringutil.h"
+#include "timer.h"
+#include "logfile.h"
+#include "util.h"
+
+/* private stuff */
+#define MAX_WORKERS         8
+#define CHUNK_SIZE          65536
+
+typedef struct job_t job_t;
+struct job_t {
+    char *abs_path;
+    char *key; /* images only: the key of the resource manager. NULL if we just read the file */
+    int group;
+};
+
+static job_t *queue = NULL;
+static int queue_length = 0, queue_capacity = 0, queue_head = 0;
+static mutex_t *queue_mutex = NULL;
+static int pending[PREFETCH_MAX_GROUPS]; /* images yet to be decoded (protected by queue_mutex) */
+
+static thread_t *worker[MAX_WORKERS];
+static int worker_id[MAX_WORKERS];
+static int number_of_workers = 0;
+static unsigned long bytes_read = 0; /* protected by queue_mutex */
+static int images_decoded = 0; /* protected by queue_mutex */
+static uint32 start_time = 0;
+
+static void enqueue_job(const char *abs_path, const char *key, int group);
+static int enqueue(const char *filename, void *param);
+static int enqueue_script(const char *filename, void *group);
+static int find_source_files(const parsetree_statement_t *stmt, void *group);
+static unsigned long do_job(const job_t *job, char *chunk);
+static void worker_routine(void *param);
+
+
+
+/* public methods */
+
+/*
+ * prefetch_init()
+ * Initializes the prefetcher
+ */
+void prefetch_init()
+{
+    int i;
+
+    queue = NULL;
+    queue_length = queue_capacity = queue_head = 0;
+    queue_mutex = mutex_create();
+    number_of_workers = 0;
+    bytes_read = 0;
+    images_decoded = 0;
+
+    for(i=0; i<PREFETCH_MAX_GROUPS; i++)
+        pending[i] = 0;
+}
+
+/*
+ * prefetch_release()
+ * Waits for the workers and releases the prefetcher
+ */
+void prefetch_release()
+{
+    int i;
+
+    for(i=0; i<number_of_workers; i++)
+        worker[i] = thread_join(worker[i]);
+
+    if(number_of_workers > 0)
+        logfile_message("prefetch: %d workers have processed %d files (%d images decoded, %lu KB read) in %d ms", number_of_workers, queue_head, images_decoded, bytes_read / 1024, (int)(timer_get_ticks() - start_time));
+
+    for(i=0; i<queue_length; i++) {
+        if(queue[i].key != NULL) /* nobody has asked for it */
+            decodedimage_destroy(resourcemanager_take_decoded_image(queue[i].key));
+        free(queue[i].abs_path);
+        free(queue[i].key);
+    }
+    free(queue);
+    queue = NULL;
+    queue_length = queue_capacity = queue_head = 0;
+
+    queue_mutex = mutex_destroy(queue_mutex);
+    number_of_workers = 0;
+}
+
+/*
+ * prefetch_decode_scripts()
+ * Schedules the images named by the scripts: the
+ * source_file entries of PNG files, at any depth
+ */
+void prefetch_decode_scripts(const char *wildcard, int group)
+{
+    if(number_of_workers == 0)
+        foreach_resource(wildcard, enqueue_script, (void*)(&group), TRUE);
+    else
+        logfile_message("prefetch_decode_scripts(\"%s\"): the workers have already been started", wildcard);
+}
+
+/*
+ * prefetch_add()
+ * Schedules the resource files matching the given wildcard
+ */
+void prefetch_add(const char *wildcard)
+{
+    if(number_of_workers == 0)
+        foreach_resource(wildcard, enqueue, NULL, TRUE);
+    else
+        logfile_message("prefetch_add(\"%s\"): the workers have already been started", wildcard);
+}
+
+/*
+ * prefetch_start()
+ * Spawns the workers
+ */
+void prefetch_start(int workers)
+{
+    int i;
+
+    if(number_of_workers > 0)
+        return;
+
+    number_of_workers = clip(workers, 0, MAX_WORKERS);
+    logfile_message("prefetch: processing %d files with %d workers...", queue_length, number_of_workers);
+
+    start_time = timer_get_ticks();
+    for(i=0; i<number_of_workers; i++) {
+        worker_id[i] = i;
+        worker[i] = thread_create(worker_routine, (void*)(&worker_id[i]));
+    }
+}
+
+/*
+ * prefetch_pending()
+ * How many images of the group haven't been decoded yet?
+ */
+int prefetch_pending(int group)
+{
+    int n;
+
+    mutex_lock(queue_mutex);
+    n = pending[clip(group, 0, PREFETCH_MAX_GROUPS-1)];
+    mutex_unlock(queue_mutex);
+
+    return n;
+}
+
+/*
+ * prefetch_help()
+ * Lends the workers a hand: the calling thread decodes the
+ * next image of the queue. Returns FALSE if there's none.
+ */
+int prefetch_help()
+{
+    const job_t *job = NULL;
+
+    mutex_lock(queue_mutex);
+    if(queue_head < queue_length && queue[queue_head].key != NULL)
+        job = &queue[queue_head++];
+    mutex_unlock(queue_mutex);
+
+    if(job == NULL)
+        return FALSE;
+
+    do_job(job, NULL);
+    return TRUE;
+}
+
+
+
+/*
+ * prefetch_commit()
+ * Turns the decoded images of a group into images on
+ * the main thread (Allegro). They stay in the resource
+ * manager, unreferenced, until the loaders ask for them
+ */
+void prefetch_commit(int group)
+{
+    int i, n = 0;
+
+    for(i=0; i<queue_length; i++) {
+        if(queue[i].key != NULL && queue[i].group == group && NULL != image_load(queue[i].key)) {
+            image_unref(queue[i].key);
+            n++;
+        }
+    }
+
+    if(n > 0)
+        logfile_message("prefetch: %d images committed", n);
+}
+
+
+
+/* private methods */
+
+/* adds a job to the queue (main thread) */
+void enqueue_job(const char *abs_path, const char *key, int group)
+{
+    job_t *job;
+    int i;
+
+    /* an image that's been scheduled already */
+    if(key != NULL) {
+        for(i=0; i<queue_length; i++) {
+            if(queue[i].key != NULL && str_icmp(queue[i].key, key) == 0)
+                return;
+        }
+    }
+
+    if(queue_length >= queue_capacity) {
+        queue_capacity = max(64, 2 * queue_capacity);
+        queue = reallocx(queue, queue_capacity * sizeof *queue);
+    }
+
+    job = &queue[queue_length++];
+    job->abs_path = str_dup(abs_path);
+    job->key = (key != NULL) ? str_dup(key) : NULL;
+    job->group = group;
+    if(key != NULL)
+        pending[group]++;
+}
+
+/* adds a file to be read (main thread) */
+int enqueue(const char *filename, void *param)
+{
+    enqueue_job(filename, NULL, 0);
+    return 0;
+}
+
+/* schedules the images named by a script (main thread) */
+int enqueue_script(const char *filename, void *group)
+{
+    parsetree_program_t *script = scriptcache_construct_tree(filename);
+    nanoparser_traverse_program_ex(script, group, find_source_files);
+    script = nanoparser_deconstruct_tree(script);
+    return 0;
+}
+
+/* looks for source_file entries, at any depth (main thread) */
+int find_source_files(const parsetree_statement_t *stmt, void *group)
+{
+    char abs_path[1024];
+    const parsetree_parameter_t *param_list = nanoparser_get_parameter_list(stmt);
+    const parsetree_parameter_t *param;
+    const char *path;
+    int i, n = nanoparser_get_number_of_parameters(param_list);
+
+    if(str_icmp(nanoparser_get_identifier(stmt), "source_file") == 0 && n >= 1) {
+        path = nanoparser_get_string(nanoparser_get_nth_parameter(param_list, 1));
+        if(strlen(path) > 4 && str_icmp(path + strlen(path) - 4, ".png") == 0) {
+            resource_filepath(abs_path, path, sizeof(abs_path), RESFP_READ);
+            enqueue_job(abs_path, path, clip(*((int*)group), 0, PREFETCH_MAX_GROUPS-1));
+        }
+    }
+
+    for(i=1; i<=n; i++) {
+        param = nanoparser_get_nth_parameter(param_list, i);
+        if(nanoparser_get_program(param) != NULL)
+            nanoparser_traverse_program_ex(nanoparser_get_program(param), group, find_source_files);
+    }
+
+    return 0;
+}
+
+/* decodes an image or reads a file. Returns the number of bytes read (any thread) */
+unsigned long do_job(const job_t *job, char *chunk)
+{
+    decodedimage_t *decoded;
+    unsigned long bytes = 0;
+    size_t n;
+    FILE *fp;
+
+    if(job->key != NULL) {
+        /* if it can't be decoded here, the main thread will load it as usual */
+        if(NULL != (decoded = image_decode(job->abs_path)))
+            resourcemanager_add_decoded_image(job->key, decoded);
+
+        mutex_lock(queue_mutex);
+        images_decoded += (decoded != NULL) ? 1 : 0;
+        pending[job->group]--;
+        mutex_unlock(queue_mutex);
+    }
+    else if(NULL != (fp = fopen(job->abs_path, "rb"))) {
+        while((n = fread(chunk, 1, CHUNK_SIZE, fp)) > 0)
+            bytes += n;
+        fclose(fp);
+    }
+
+    return bytes;
+}
+
+/* processes the queued jobs (worker threads) */
+void worker_routine(void *param)
+{
+    static char buf[MAX_WORKERS][CHUNK_SIZE]; /* no need to put 64 KB on the stack */
+    char *chunk = buf[*((int*)param)];
+    unsigned long bytes = 0;
+    const job_t *job;
+
+    for(;;) {
+        mutex_lock(queue_mutex);
+        job = (queue_head < queue_length) ? &queue[queue_head++] : NULL;
+        mutex_unlock(queue_mutex);
+
+        if(job == NULL)
+            break;
+
+        bytes += do_job(job, chunk);
+    }
+
+    mutex_lock(queue_mutex);
+    bytes_read += bytes;
+    mutex_unlock(queue_mutex);
+}
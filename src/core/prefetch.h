@@ -0,0 +1,56 @@
+/*
+ * Open Surge Engine
+ * prefetch.h - decodes images and warms up the OS file cache in background threads
+ * Copyright (C) 2013  Alexandre Martins <alemartf(at)gmail(dot)com>
+ * http://opensnc.sourceforge.net
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _PREFETCH_H
+#define _PREFETCH_H
+
+/*
+ * The prefetcher does some of the work of the (single-threaded)
+ * loaders in worker threads. It decodes images, handing them over
+ * to the resource manager (see image_decode()), and it reads other
+ * resource files, so that they're in the file cache of the operating
+ * system when the loaders ask for them. Workers never touch Allegro
+ * nor the logfile.
+ *
+ * Images belong to groups: prefetch_pending() tells if the images
+ * of a group have been decoded, and prefetch_commit() turns them
+ * into Allegro bitmaps on the main thread, so that the loaders find
+ * them in the resource manager. The images that haven't been asked
+ * for are discarded by prefetch_release().
+ *
+ * Usage: prefetch_init(); prefetch_decode_scripts(...); prefetch_add(...);
+ *        prefetch_start(n); (commit & load stuff); prefetch_release();
+ */
+
+#define PREFETCH_MAX_GROUPS     32
+
+void prefetch_init();
+void prefetch_release(); /* waits for the workers */
+
+void prefetch_decode_scripts(const char *wildcard, int group); /* schedules the PNG images named by the source_file entries of the matching scripts, e.g., "fonts / *.fnt". 0 <= group < PREFETCH_MAX_GROUPS. Call it before prefetch_start() */
+void prefetch_add(const char *wildcard); /* wildcard is a resource path, e.g., "images / *.png". Call it before prefetch_start() */
+void prefetch_start(int number_of_workers); /* the jobs are taken in the order they were added */
+
+int prefetch_pending(int group); /* how many images of the group haven't been decoded yet? */
+int prefetch_help(); /* the calling thread decodes the next queued image. Returns FALSE if there's none */
+void prefetch_commit(int group); /* main thread: turns the decoded images of the group into images. Call it once prefetch_pending(group) is zero */
+
+#endif
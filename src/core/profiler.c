@@ -0,0 +1,383 @@
+/*
+ * Open Surge Engine
+ * profiler.c - frame profiler
+ * Copyright (C) 2013  Alexandre Martins <alemartf(at)gmail(dot)com>
+ * http://opensnc.sourceforge.net
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <allegro.h>
+#include <stdio.h>
+#include "profiler.h"
+#include "image.h"
+#include "util.h"
+#include "logfile.h"
+#include "timer.h"
+
+/* private stuff */
+#define IMAGE2BITMAP(img)       (*((BITMAP**)(img)))   /* whoooa, this is crazy stuff */
+#define PROFILER_FRAMES         600     /* size of the ring buffer */
+#define PROFILER_MAX_EVENTS     128     /* per frame */
+#define PROFILER_MAX_DEPTH      16      /* nesting of the scopes */
+#define GRAPH_WIDTH             160     /* in pixels (one frame per column) */
+#define GRAPH_HEIGHT            50      /* in pixels */
+#define GRAPH_RANGE             33333   /* in microseconds: the height of the graph */
+#define AVERAGE_FRAMES          60      /* the legend shows averages over this many frames */
+
+typedef struct profevent_t profevent_t;
+struct profevent_t {
+    uint8 scope, depth;
+    uint64 start, end; /* in microseconds */
+};
+
+typedef struct profframe_t profframe_t;
+struct profframe_t {
+    uint64 start, end; /* in microseconds */
+    uint32 self_time[PROF_MAX]; /* in microseconds, excluding the nested scopes */
+    int event_count;
+    profevent_t event[PROFILER_MAX_EVENTS];
+};
+
+static const char* scope_name[PROF_MAX] = {
+    "idle", "audio", "loader", "input", "logic", "entities", "items",
+    "objects", "players", "physics", "bricks", "render", "sort", "video",
+    "resources"
+};
+
+static const uint8 scope_color[PROF_MAX][3] = {
+    { 64, 64, 64 }, { 255, 128, 0 }, { 128, 64, 0 }, { 255, 255, 0 },
+    { 0, 128, 255 }, { 0, 255, 255 }, { 255, 0, 255 }, { 128, 0, 255 },
+    { 0, 255, 0 }, { 0, 128, 0 }, { 255, 0, 0 }, { 0, 0, 255 },
+    { 128, 128, 255 }, { 255, 255, 255 }, { 255, 128, 128 }
+};
+
+static int enabled = FALSE;
+static profframe_t *frame = NULL; /* ring buffer */
+static int frame_head = 0, frame_count = 0; /* frame[frame_head] is the current frame */
+static int in_frame = FALSE;
+static int stack[PROFILER_MAX_DEPTH], depth = 0; /* open events (indexes) */
+static uint64 child_time[PROFILER_MAX_DEPTH]; /* time taken by the events nested in the open ones */
+static int overflow = 0; /* scopes that didn't fit */
+static uint64 start_time;
+
+static void close_event(int index, uint64 now);
+
+
+
+/* public methods */
+
+/*
+ * profiler_init()
+ * Initializes the profiler. If it's not enabled,
+ * no memory is allocated and nothing is measured
+ */
+void profiler_init(int enable)
+{
+    enabled = enable;
+    frame_head = frame_count = 0;
+    in_frame = FALSE;
+    depth = overflow = 0;
+
+    if(enabled) {
+        logfile_message("profiler_init()");
+        frame = mallocx(PROFILER_FRAMES * sizeof *frame);
+        start_time = profiler_get_time();
+    }
+}
+
+/*
+ * profiler_release()
+ * Releases the profiler
+ */
+void profiler_release()
+{
+    if(enabled) {
+        logfile_message("profiler_release()");
+        if(overflow > 0)
+            logfile_message("profiler: %d scopes have been dropped (more than %d per frame)", overflow, PROFILER_MAX_EVENTS);
+        free(frame);
+        frame = NULL;
+        enabled = FALSE;
+    }
+}
+
+/*
+ * profiler_is_enabled()
+ * Is the profiler measuring things?
+ */
+int profiler_is_enabled()
+{
+    return enabled;
+}
+
+/*
+ * profiler_get_time()
+ * Monotonic clock, in microseconds. It works
+ * even if the profiler is disabled
+ */
+uint64 profiler_get_time()
+{
+    return timer_get_nanoseconds() / 1000;
+}
+
+/*
+ * profiler_begin_frame()
+ * Starts a new frame, overwriting the oldest one
+ * in the ring buffer if needed
+ */
+void profiler_begin_frame()
+{
+    profframe_t *f;
+    int i;
+
+    if(!enabled)
+        return;
+
+    if(in_frame)
+        profiler_end_frame();
+
+    frame_head = (frame_head + 1) % PROFILER_FRAMES;
+    frame_count = min(frame_count + 1, PROFILER_FRAMES);
+
+    f = &(frame[frame_head]);
+    f->start = f->end = profiler_get_time();
+    f->event_count = 0;
+    for(i=0; i<PROF_MAX; i++)
+        f->self_time[i] = 0;
+
+    depth = 0;
+    in_frame = TRUE;
+}
+
+/*
+ * profiler_end_frame()
+ * Ends the current frame, closing its open scopes
+ */
+void profiler_end_frame()
+{
+    uint64 now;
+
+    if(!enabled || !in_frame)
+        return;
+
+    now = profiler_get_time();
+    while(depth > 0)
+        close_event(stack[--depth], now);
+
+    frame[frame_head].end = now;
+    in_frame = FALSE;
+}
+
+/*
+ * profiler_begin()
+ * Opens a scope
+ */
+void profiler_begin(profscope_t scope)
+{
+    profframe_t *f;
+    profevent_t *e;
+
+    if(!enabled || !in_frame)
+        return;
+
+    f = &(frame[frame_head]);
+    if(f->event_count >= PROFILER_MAX_EVENTS || depth >= PROFILER_MAX_DEPTH) {
+        overflow++;
+        return;
+    }
+
+    e = &(f->event[f->event_count]);
+    e->scope = (uint8)scope;
+    e->depth = (uint8)depth;
+    e->start = e->end = profiler_get_time();
+
+    child_time[depth] = 0;
+    stack[depth++] = f->event_count++;
+}
+
+/*
+ * profiler_end()
+ * Closes a scope (and the ones opened inside it, if any)
+ */
+void profiler_end(profscope_t scope)
+{
+    profframe_t *f;
+    uint64 now;
+    int i;
+
+    if(!enabled || !in_frame)
+        return;
+
+    f = &(frame[frame_head]);
+    for(i=depth-1; i>=0; i--) {
+        if(f->event[stack[i]].scope == (uint8)scope)
+            break;
+    }
+
+    if(i >= 0) {
+        now = profiler_get_time();
+        while(depth > i)
+            close_event(stack[--depth], now);
+    }
+}
+
+/*
+ * profiler_render()
+ * Renders the overlay graph: each column is a frame (the
+ * newest on the right), split by the time of each scope
+ */
+void profiler_render(image_t *dest)
+{
+    uint32 avg[PROF_MAX], other;
+    int i, j, k, x, y, h, n;
+    const profframe_t *f;
+    uint32 color;
+
+    if(!enabled || frame_count == 0)
+        return;
+
+    /* background */
+    image_rectfill(dest, 0, 0, GRAPH_WIDTH + 1, GRAPH_HEIGHT + 10 + PROF_MAX * 8, image_rgb(0, 0, 0));
+
+    /* graph */
+    n = min(frame_count - (in_frame ? 1 : 0), GRAPH_WIDTH);
+    for(k=0; k<n; k++) {
+        f = &(frame[(frame_head - (in_frame ? 1 : 0) - k + 2 * PROFILER_FRAMES) % PROFILER_FRAMES]);
+        x = GRAPH_WIDTH - k;
+        y = GRAPH_HEIGHT;
+        other = (uint32)(f->end - f->start);
+        for(j=0; j<=PROF_MAX && y > 0; j++) {
+            if(j < PROF_MAX) {
+                h = (int)((uint64)f->self_time[j] * GRAPH_HEIGHT / GRAPH_RANGE);
+                color = image_rgb(scope_color[j][0], scope_color[j][1], scope_color[j][2]);
+                other -= min(other, f->self_time[j]);
+            }
+            else {
+                h = (int)((uint64)other * GRAPH_HEIGHT / GRAPH_RANGE);
+                color = image_rgb(128, 128, 128);
+            }
+
+            if(h > 0) {
+                image_line(dest, x, y, x, max(0, y - h + 1), color);
+                y -= h;
+            }
+        }
+    }
+
+    /* 60 fps and 30 fps */
+    image_line(dest, 1, GRAPH_HEIGHT / 2, GRAPH_WIDTH, GRAPH_HEIGHT / 2, image_rgb(255, 255, 255));
+    image_line(dest, 1, 0, GRAPH_WIDTH, 0, image_rgb(255, 0, 0));
+
+    /* legend */
+    for(j=0; j<PROF_MAX; j++)
+        avg[j] = 0;
+
+    n = min(frame_count - (in_frame ? 1 : 0), AVERAGE_FRAMES);
+    for(k=0; k<n; k++) {
+        f = &(frame[(frame_head - (in_frame ? 1 : 0) - k + 2 * PROFILER_FRAMES) % PROFILER_FRAMES]);
+        for(j=0; j<PROF_MAX; j++)
+            avg[j] += f->self_time[j];
+    }
+
+    for(j=0; j<PROF_MAX; j++) {
+        y = GRAPH_HEIGHT + 6 + j * 8;
+        color = image_rgb(scope_color[j][0], scope_color[j][1], scope_color[j][2]);
+        image_rectfill(dest, 2, y + 1, 7, y + 6, color);
+        i = (n > 0) ? (int)(avg[j] / n) : 0;
+        textprintf_ex(IMAGE2BITMAP(dest), font, 10, y, makecol(255,255,255), -1, "%-9s%3d.%02d ms", scope_name[j], i / 1000, (i % 1000) / 10);
+    }
+}
+
+/*
+ * profiler_log_last_frame()
+ * Writes the time taken by each scope of the last
+ * complete frame (excluding nested scopes) to the logfile
+ */
+void profiler_log_last_frame()
+{
+    const profframe_t *f;
+    int j;
+
+    if(!enabled || frame_count - (in_frame ? 1 : 0) <= 0)
+        return;
+
+    f = &(frame[(frame_head - (in_frame ? 1 : 0) + PROFILER_FRAMES) % PROFILER_FRAMES]);
+    for(j=0; j<PROF_MAX; j++) {
+        if(f->self_time[j] >= 100)
+            logfile_message("    %-9s %7.2f ms", scope_name[j], f->self_time[j] * 0.001f);
+    }
+}
+
+/*
+ * profiler_export()
+ * Writes the frames of the ring buffer to a
+ * file, using the trace event format of Chrome
+ */
+int profiler_export(const char *filepath)
+{
+    const profframe_t *f;
+    const profevent_t *e;
+    int i, k, n, first = TRUE;
+    FILE *fp;
+
+    if(!enabled)
+        return FALSE;
+
+    logfile_message("profiler_export(\"%s\")", filepath);
+    if(NULL == (fp = fopen(filepath, "w"))) {
+        logfile_message("profiler_export(): can't open \"%s\" for writing", filepath);
+        return FALSE;
+    }
+
+    /* oldest frames first */
+    fprintf(fp, "{\"traceEvents\":[\n");
+    n = frame_count - (in_frame ? 1 : 0);
+    for(k=n-1; k>=0; k--) {
+        f = &(frame[(frame_head - (in_frame ? 1 : 0) - k + 2 * PROFILER_FRAMES) % PROFILER_FRAMES]);
+        fprintf(fp, "%s{\"name\":\"frame\",\"cat\":\"frame\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%lu,\"dur\":%lu}",
+            first ? "" : ",\n", (unsigned long)(f->start - start_time), (unsigned long)(f->end - f->start));
+        first = FALSE;
+
+        for(i=0; i<f->event_count; i++) {
+            e = &(f->event[i]);
+            fprintf(fp, ",\n{\"name\":\"%s\",\"cat\":\"engine\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%lu,\"dur\":%lu}",
+                scope_name[e->scope], (unsigned long)(e->start - start_time), (unsigned long)(e->end - e->start));
+        }
+    }
+    fprintf(fp, "\n],\"displayTimeUnit\":\"ms\"}\n");
+
+    fclose(fp);
+    return TRUE;
+}
+
+
+
+/* private methods */
+
+/* closes an event of the current frame */
+void close_event(int index, uint64 now)
+{
+    profframe_t *f = &(frame[frame_head]);
+    profevent_t *e = &(f->event[index]);
+    uint64 duration;
+
+    e->end = now;
+    duration = e->end - e->start;
+    f->self_time[e->scope] += (uint32)(duration - min(duration, child_time[e->depth]));
+    if(e->depth > 0)
+        child_time[e->depth - 1] += duration;
+}
+
@@ -0,0 +1,80 @@
+/*
+ * Open Surge Engine
+ * profiler.h - frame profiler
+ * Copyright (C) 2013  Alexandre Martins <alemartf(at)gmail(dot)com>
+ * http://opensnc.sourceforge.net
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _PROFILER_H
+#define _PROFILER_H
+
+#include "global.h"
+
+/*
+ * The profiler tells where the time of each frame goes. Wrap
+ * a piece of code with profiler_begin(scope) and profiler_end(scope);
+ * scopes may be nested, and a scope that is left without calling
+ * profiler_end() (e.g., an early return) is closed with its parent
+ * or at the end of the frame.
+ *
+ * The last PROFILER_FRAMES frames are kept in a ring buffer. They
+ * may be shown as an overlay graph (the time each scope takes,
+ * excluding the scopes nested in it) and exported in the trace
+ * event format of Chrome (chrome://tracing).
+ *
+ * When the profiler is disabled, a scope costs a function call.
+ */
+
+/* scopes */
+typedef enum profscope_t {
+    PROF_IDLE,          /* timer_update(): waiting for the next frame */
+    PROF_AUDIO,         /* audio_update() */
+    PROF_LOADER,        /* loader_update() */
+    PROF_INPUT,         /* input_update() */
+    PROF_LOGIC,         /* the update of the scene */
+    PROF_ENTITIES,      /* level: retrieving the active entities */
+    PROF_ITEMS,         /* level: updating the items */
+    PROF_OBJECTS,       /* level: updating the objects */
+    PROF_PLAYERS,       /* level: updating the players */
+    PROF_PHYSICS,       /* player: the physics adapter */
+    PROF_BRICKS,        /* level: updating the bricks */
+    PROF_RENDER,        /* the rendering of the scene */
+    PROF_SORT,          /* render queue: sorting */
+    PROF_VIDEO,         /* video_render(): scaling and flipping */
+    PROF_RESOURCES,     /* reading and decoding images, musics and sounds */
+    PROF_MAX            /* number of scopes */
+} profscope_t;
+
+/* forward declarations */
+struct image_t;
+
+/* public methods */
+void profiler_init(int enabled);
+void profiler_release();
+int profiler_is_enabled();
+uint64 profiler_get_time(); /* the clock of the profiler: monotonic, in microseconds */
+
+void profiler_begin_frame();
+void profiler_end_frame();
+void profiler_begin(profscope_t scope);
+void profiler_end(profscope_t scope);
+
+void profiler_render(struct image_t *dest); /* the overlay graph */
+void profiler_log_last_frame(); /* writes the time of each scope in the last complete frame to the logfile */
+int profiler_export(const char *filepath); /* writes the frames in the ring buffer to a Chrome trace file. Returns TRUE on success */
+
+#endif
@@ -31,6 +31,7 @@
 #include "quest.h"
 #include "osspec.h"
 #include "nanoparser/nanoparser.h"
+#include "scriptcache.h"
 
 
 
@@ -68,7 +69,7 @@ quest_t *load_quest(const char *abs_path)
     q->is_hidden = FALSE;
 
     /* reading the quest */
-    prog = nanoparser_construct_tree(abs_path);
+    prog = scriptcache_construct_tree(abs_path);
     nanoparser_traverse_program_ex(prog, (void*)q, traverse_quest);
     prog = nanoparser_deconstruct_tree(prog);
 
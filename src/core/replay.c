@@ -0,0 +1,275 @@
+/*
+ * Open Surge Engine
+ * replay.c - input recording and playback
+ * Copyright (C) 2013  Alexandre Martins <alemartf(at)gmail(dot)com>
+ * http://opensnc.sourceforge.net
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "replay.h"
+#include "util.h"
+#include "stringutil.h"
+#include "logfile.h"
+
+/* private stuff */
+#define REPLAY_MAGIC        "OSRP"
+#define REPLAY_VERSION      1
+#define REPLAY_MAX_RUN      65535
+
+typedef enum { REPLAY_IDLE, REPLAY_RECORDING, REPLAY_PLAYING } replaymode_t;
+
+static replaymode_t mode = REPLAY_IDLE;
+static FILE *fp = NULL;
+static char *filepath = NULL;
+static uint32 seed = 0;
+static int step_rate = 60;
+static uint32 step_count = 0;
+
+/* the current record: its masks repeat for run steps */
+static uint16 record_mask[REPLAY_MAX_DEVICES];
+static int record_count = 0;
+static int run = 0; /* recording: steps written so far; playing: steps left */
+
+static void flush_record();
+static int fetch_record();
+static void write_u16(uint16 x);
+static void write_u32(uint32 x);
+static int read_u16(uint16 *x);
+static int read_u32(uint32 *x);
+
+
+
+/* public methods */
+
+/*
+ * replay_record()
+ * Starts recording a replay
+ */
+void replay_record(const char *path, uint32 random_seed, int steps_per_second)
+{
+    replay_stop();
+
+    if(NULL == (fp = fopen(path, "wb")))
+        fatal_error("Can't record the replay \"%s\"", path);
+
+    logfile_message("replay_record(\"%s\")", path);
+    mode = REPLAY_RECORDING;
+    filepath = str_dup(path);
+    seed = random_seed;
+    step_rate = clip(steps_per_second, 10, 1000);
+    step_count = 0;
+    record_count = run = 0;
+
+    fwrite(REPLAY_MAGIC, 1, 4, fp);
+    fputc(REPLAY_VERSION, fp);
+    write_u16((uint16)step_rate);
+    write_u32(seed);
+}
+
+/*
+ * replay_play()
+ * Starts playing a replay
+ */
+void replay_play(const char *path)
+{
+    char magic[4];
+    uint16 rate;
+
+    replay_stop();
+
+    if(NULL == (fp = fopen(path, "rb")))
+        fatal_error("Can't open the replay \"%s\"", path);
+
+    if(fread(magic, 1, 4, fp) != 4 || memcmp(magic, REPLAY_MAGIC, 4) != 0 || fgetc(fp) != REPLAY_VERSION || !read_u16(&rate) || !read_u32(&seed))
+        fatal_error("\"%s\" isn't a valid replay file", path);
+
+    logfile_message("replay_play(\"%s\")", path);
+    mode = REPLAY_PLAYING;
+    filepath = str_dup(path);
+    step_rate = clip((int)rate, 10, 1000);
+    step_count = 0;
+    record_count = run = 0;
+}
+
+/*
+ * replay_stop()
+ * Stops recording or playing a replay
+ */
+void replay_stop()
+{
+    if(mode == REPLAY_RECORDING)
+        flush_record();
+
+    if(mode != REPLAY_IDLE) {
+        logfile_message("replay_stop(): \"%s\", %lu steps", filepath, (unsigned long)step_count);
+        fclose(fp);
+        fp = NULL;
+        free(filepath);
+        filepath = NULL;
+        mode = REPLAY_IDLE;
+    }
+}
+
+/*
+ * replay_is_recording()
+ * Are we recording a replay?
+ */
+int replay_is_recording()
+{
+    return mode == REPLAY_RECORDING;
+}
+
+/*
+ * replay_is_playing()
+ * Are we playing a replay?
+ */
+int replay_is_playing()
+{
+    return mode == REPLAY_PLAYING;
+}
+
+/*
+ * replay_seed()
+ * The seed of the random number generator
+ */
+uint32 replay_seed()
+{
+    return seed;
+}
+
+/*
+ * replay_step_rate()
+ * Logic steps per second
+ */
+int replay_step_rate()
+{
+    return step_rate;
+}
+
+/*
+ * replay_write_step()
+ * Records the button masks of a logic step
+ */
+void replay_write_step(const uint16 *mask, int count)
+{
+    if(mode != REPLAY_RECORDING)
+        return;
+
+    count = clip(count, 0, REPLAY_MAX_DEVICES);
+    if(run > 0 && (run >= REPLAY_MAX_RUN || count != record_count || memcmp(mask, record_mask, count * sizeof(*mask)) != 0))
+        flush_record();
+
+    if(run == 0) {
+        memcpy(record_mask, mask, count * sizeof(*mask));
+        record_count = count;
+    }
+
+    run++;
+    step_count++;
+}
+
+/*
+ * replay_read_step()
+ * Reads the button masks of a logic step
+ */
+int replay_read_step(uint16 *mask, int max_count)
+{
+    if(mode != REPLAY_PLAYING)
+        return -1;
+
+    if(run == 0 && !fetch_record())
+        return -1;
+
+    run--;
+    step_count++;
+    max_count = min(max_count, record_count);
+    memcpy(mask, record_mask, max_count * sizeof(*mask));
+    return record_count;
+}
+
+
+
+/* private methods */
+
+/* writes the current record */
+void flush_record()
+{
+    int i;
+
+    if(run > 0) {
+        write_u16((uint16)run);
+        fputc(record_count, fp);
+        for(i=0; i<record_count; i++)
+            write_u16(record_mask[i]);
+        run = 0;
+    }
+}
+
+/* reads the next record. Returns FALSE at the end of the file */
+int fetch_record()
+{
+    uint16 r;
+    int i, c;
+
+    if(!read_u16(&r) || r == 0 || EOF == (c = fgetc(fp)))
+        return FALSE;
+
+    for(i=0; i<c; i++) {
+        if(!read_u16(&record_mask[i]))
+            return FALSE;
+    }
+
+    run = r;
+    record_count = c;
+    return TRUE;
+}
+
+/* little-endian integers */
+void write_u16(uint16 x)
+{
+    fputc((int)(x & 0xFF), fp);
+    fputc((int)((x >> 8) & 0xFF), fp);
+}
+
+void write_u32(uint32 x)
+{
+    write_u16((uint16)(x & 0xFFFF));
+    write_u16((uint16)((x >> 16) & 0xFFFF));
+}
+
+int read_u16(uint16 *x)
+{
+    int lo = fgetc(fp), hi = fgetc(fp);
+
+    if(lo == EOF || hi == EOF)
+        return FALSE;
+
+    *x = (uint16)(lo | (hi << 8));
+    return TRUE;
+}
+
+int read_u32(uint32 *x)
+{
+    uint16 lo, hi;
+
+    if(!read_u16(&lo) || !read_u16(&hi))
+        return FALSE;
+
+    *x = (uint32)lo | ((uint32)hi << 16);
+    return TRUE;
+}
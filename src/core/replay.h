@@ -0,0 +1,57 @@
+/*
+ * Open Surge Engine
+ * replay.h - input recording and playback
+ * Copyright (C) 2013  Alexandre Martins <alemartf(at)gmail(dot)com>
+ * http://opensnc.sourceforge.net
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _REPLAY_H
+#define _REPLAY_H
+
+#include "global.h"
+
+#define REPLAY_MAX_DEVICES  255 /* input devices per logic step */
+
+/*
+ * A replay file holds everything needed to run a play session
+ * again, step by step: the seed of the random number generator,
+ * the rate of the logic steps and, for each step, the state of
+ * the buttons of the user-defined input devices (see input.h).
+ * Steps with the same input are run-length encoded.
+ *
+ * While recording or playing a replay, timer_get_ticks() counts
+ * logic steps and the loader resolves its requests right away,
+ * so that the session doesn't depend on the speed of the machine.
+ *
+ * File layout (little-endian):
+ *     "OSRP" | version (u8) | step rate (u16) | seed (u32)
+ *     records: run length (u16) | n (u8) | n button masks (u16)
+ */
+
+void replay_record(const char *filepath, uint32 seed, int step_rate); /* starts recording */
+void replay_play(const char *filepath); /* starts playing a replay */
+void replay_stop(); /* stops recording or playing, closing the file */
+
+int replay_is_recording();
+int replay_is_playing();
+uint32 replay_seed(); /* the seed of the replay being recorded or played */
+int replay_step_rate(); /* logic steps per second */
+
+void replay_write_step(const uint16 *mask, int count); /* recording: call once per logic step */
+int replay_read_step(uint16 *mask, int max_count); /* playing: call once per logic step. Returns the number of masks, or -1 at the end of the replay */
+
+#endif
@@ -19,44 +19,141 @@
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
+#include <stdlib.h>
+#include <string.h>
 #include "resourcemanager.h"
 #include "hashtable.h"
+#include "thread.h"
 #include "image.h"
 #include "audio.h"
+#include "timer.h"
+#include "logfile.h"
+#include "util.h"
+
+/* resource types */
+enum { RES_IMAGE, RES_SAMPLE, RES_MUSIC, RES_TYPES };
+static const char* type_name[RES_TYPES] = { "image", "sample", "music" };
+
+/* a resource: the dictionaries store these */
+typedef struct resource_t resource_t;
+struct resource_t {
+    int type; /* RES_* */
+    char *key;
+    void *data; /* image_t*, sound_t* or music_t* */
+    int bytes; /* memory usage */
+    int reference_count;
+    uint32 last_used; /* timer_get_ticks() */
+    resource_t *prev, *next; /* list of resident resources */
+    resource_t *lru_prev, *lru_next; /* list of unreferenced resources: most recently used first */
+};
+
+/* an image decoded by a worker thread, waiting for the main thread */
+typedef struct decoded_t decoded_t;
+struct decoded_t {
+    char *key;
+    decodedimage_t *data;
+    decoded_t *next;
+};
 
 /* code generation */
-HASHTABLE_GENERATE_CODE(image_t)
-HASHTABLE_GENERATE_CODE(sound_t)
-HASHTABLE_GENERATE_CODE(music_t)
+HASHTABLE_GENERATE_CODE(resource_t)
 
 /* private data */
-static hashtable_image_t* images;
-static hashtable_sound_t* samples;
-static hashtable_music_t* musics;
+static hashtable_resource_t* table[RES_TYPES];
+static resource_t *resident; /* all resources */
+static resource_t *lru_head, *lru_tail; /* unreferenced resources */
+static int bytes_in_use[RES_TYPES], resource_count[RES_TYPES];
+static int memory_budget; /* in bytes */
+static int over_budget; /* have we reported it? */
+static decoded_t *decoded_list; /* protected by decoded_mutex */
+static mutex_t *decoded_mutex;
+
+/* private methods */
+static void add_resource(int type, const char *key, void *data, int bytes);
+static void* find_resource(int type, const char *key);
+static int ref_resource(int type, const char *key);
+static int unref_resource(int type, const char *key);
+static void resource_destroy(resource_t *r); /* called by the dictionaries */
+static void lru_push(resource_t *r);
+static void lru_unlink(resource_t *r);
+static int total_bytes();
 
 
 /* public methods */
 
 /* ------ resource manager -------- */
-void resourcemanager_init()
+void resourcemanager_init(int budget)
 {
-    images = hashtable_image_t_create(image_destroy);
-    samples = hashtable_sound_t_create(sound_destroy);
-    musics = hashtable_music_t_create(music_destroy);
+    int i;
+
+    for(i=0; i<RES_TYPES; i++) {
+        table[i] = hashtable_resource_t_create(resource_destroy);
+        bytes_in_use[i] = resource_count[i] = 0;
+    }
+
+    resident = lru_head = lru_tail = NULL;
+    decoded_list = NULL;
+    decoded_mutex = mutex_create();
+    memory_budget = clip(budget, 0, 2097151) * 1024;
+    over_budget = FALSE;
+    logfile_message("Resource manager: the memory budget is %d KB", memory_budget / 1024);
 }
 
 void resourcemanager_release()
 {
-    images = hashtable_image_t_destroy(images);
-    samples = hashtable_sound_t_destroy(samples);
-    musics = hashtable_music_t_destroy(musics);
+    decoded_t *d, *next;
+    int i;
+
+    for(i=0; i<RES_TYPES; i++)
+        table[i] = hashtable_resource_t_destroy(table[i]);
+
+    /* nobody has asked for these */
+    for(d=decoded_list; d; d=next) {
+        next = d->next;
+        decodedimage_destroy(d->data);
+        free(d->key);
+        free(d);
+    }
+    decoded_list = NULL;
+    decoded_mutex = mutex_destroy(decoded_mutex);
 }
 
 void resourcemanager_release_unused_resources()
 {
-    /*hashtable_image_t_release_unreferenced_entries(images);*/ /* can't do it, because we use shared images to display the sprites */
-    hashtable_sound_t_release_unreferenced_entries(samples);
-    hashtable_music_t_release_unreferenced_entries(musics);
+    char key[1024];
+    resource_t *r;
+
+    /* evict the least recently used resources until we're within the budget */
+    while(total_bytes() > memory_budget && (r = lru_tail) != NULL) {
+        logfile_message("Resource manager: evicting %s '%s' (%d KB, unused for %d ms)", type_name[r->type], r->key, r->bytes / 1024, (int)(timer_get_ticks() - r->last_used));
+        str_cpy(key, r->key, sizeof(key));
+        hashtable_resource_t_remove(table[r->type], key);
+    }
+
+    /* everything in use? */
+    if(total_bytes() > memory_budget) {
+        if(!over_budget) {
+            logfile_message("Resource manager: the resources in use exceed the memory budget");
+            resourcemanager_dump();
+            over_budget = TRUE;
+        }
+    }
+    else
+        over_budget = FALSE;
+}
+
+void resourcemanager_dump()
+{
+    uint32 now = timer_get_ticks();
+    resource_t *r;
+    int i;
+
+    logfile_message("Resource manager: %d KB in use (budget: %d KB)", total_bytes() / 1024, memory_budget / 1024);
+    for(i=0; i<RES_TYPES; i++)
+        logfile_message("    %d %s(s): %d KB", resource_count[i], type_name[i], bytes_in_use[i] / 1024);
+
+    for(r=resident; r; r=r->next)
+        logfile_message("    [%s] '%s': %d KB, %d reference(s), last used %d ms ago", type_name[r->type], r->key, r->bytes / 1024, r->reference_count, (int)(now - r->last_used));
 }
 
 
@@ -65,63 +162,269 @@ void resourcemanager_release_unused_resources()
 /* -------- images ------- */
 void resourcemanager_add_image(const char *key, image_t *data)
 {
-    hashtable_image_t_add(images, key, data);
+    add_resource(RES_IMAGE, key, data, image_memory_usage(data));
 }
 
 image_t* resourcemanager_find_image(const char *key)
 {
-    return hashtable_image_t_find(images, key);
+    return (image_t*)find_resource(RES_IMAGE, key);
 }
 
 int resourcemanager_ref_image(const char *key)
 {
-    return hashtable_image_t_ref(images, key);
+    return ref_resource(RES_IMAGE, key);
 }
 
 int resourcemanager_unref_image(const char *key)
 {
-    return hashtable_image_t_unref(images, key);
+    return unref_resource(RES_IMAGE, key);
+}
+
+void resourcemanager_remove_image(const char *key)
+{
+    hashtable_resource_t_remove(table[RES_IMAGE], key);
+}
+
+
+/* -------- decoded images ------- */
+/* called by the worker threads: no mallocx() nor logfile here */
+void resourcemanager_add_decoded_image(const char *key, decodedimage_t *data)
+{
+    decoded_t *dup, *d = malloc(sizeof *d);
+
+    if(d == NULL || NULL == (d->key = malloc(strlen(key) + 1))) {
+        decodedimage_destroy(data); /* the main thread will decode it itself */
+        free(d);
+        return;
+    }
+
+    strcpy(d->key, key);
+    d->data = data;
+
+    mutex_lock(decoded_mutex);
+    for(dup=decoded_list; dup && str_icmp(dup->key, key) != 0; dup=dup->next);
+    if(dup == NULL) {
+        d->next = decoded_list;
+        decoded_list = d;
+    }
+    mutex_unlock(decoded_mutex);
+
+    /* another task has decoded the same image */
+    if(dup != NULL) {
+        decodedimage_destroy(d->data);
+        free(d->key);
+        free(d);
+    }
+}
+
+decodedimage_t* resourcemanager_take_decoded_image(const char *key)
+{
+    decoded_t **p, *d = NULL;
+    decodedimage_t *data = NULL;
+
+    mutex_lock(decoded_mutex);
+    for(p=&decoded_list; *p; p=&((*p)->next)) {
+        if(str_icmp((*p)->key, key) == 0) {
+            d = *p;
+            *p = d->next;
+            break;
+        }
+    }
+    mutex_unlock(decoded_mutex);
+
+    if(d != NULL) {
+        data = d->data;
+        free(d->key);
+        free(d);
+    }
+
+    return data;
 }
 
 
 /* -------- musics --------- */
 void resourcemanager_add_music(const char *key, music_t *data)
 {
-    hashtable_music_t_add(musics, key, data);
+    add_resource(RES_MUSIC, key, data, music_memory_usage(data));
 }
 
 music_t* resourcemanager_find_music(const char *key)
 {
-    return hashtable_music_t_find(musics, key);
+    return (music_t*)find_resource(RES_MUSIC, key);
 }
 
 int resourcemanager_ref_music(const char *key)
 {
-    return hashtable_music_t_ref(musics, key);
+    return ref_resource(RES_MUSIC, key);
 }
 
 int resourcemanager_unref_music(const char *key)
 {
-    return hashtable_music_t_unref(musics, key);
+    return unref_resource(RES_MUSIC, key);
 }
 
 /* ------- samples ------- */
 void resourcemanager_add_sample(const char *key, sound_t *data)
 {
-    hashtable_sound_t_add(samples, key, data);
+    add_resource(RES_SAMPLE, key, data, sound_memory_usage(data));
 }
 
 sound_t* resourcemanager_find_sample(const char *key)
 {
-    return hashtable_sound_t_find(samples, key);
+    return (sound_t*)find_resource(RES_SAMPLE, key);
 }
 
 int resourcemanager_ref_sample(const char *key)
 {
-    return hashtable_sound_t_ref(samples, key);
+    return ref_resource(RES_SAMPLE, key);
 }
 
 int resourcemanager_unref_sample(const char *key)
 {
-    return hashtable_sound_t_unref(samples, key);
+    return unref_resource(RES_SAMPLE, key);
+}
+
+
+
+
+/* private methods */
+
+/* adds a new (unreferenced) resource */
+void add_resource(int type, const char *key, void *data, int bytes)
+{
+    resource_t *r;
+
+    if(NULL != hashtable_resource_t_find(table[type], key)) {
+        logfile_message("resourcemanager: %s '%s' already exists! It won't be added.", type_name[type], key);
+        return;
+    }
+
+    r = mallocx(sizeof *r);
+    r->type = type;
+    r->key = str_dup(key);
+    r->data = data;
+    r->bytes = bytes;
+    r->reference_count = 0;
+    r->last_used = timer_get_ticks();
+
+    r->prev = NULL;
+    r->next = resident;
+    if(resident != NULL)
+        resident->prev = r;
+    resident = r;
+    lru_push(r);
+
+    bytes_in_use[type] += bytes;
+    resource_count[type]++;
+    hashtable_resource_t_add(table[type], key, r);
+}
+
+/* finds a resource, updating its last use time */
+void* find_resource(int type, const char *key)
+{
+    resource_t *r = hashtable_resource_t_find(table[type], key);
+
+    if(r != NULL) {
+        r->last_used = timer_get_ticks();
+        return r->data;
+    }
+
+    return NULL;
+}
+
+/* increments the reference counting */
+int ref_resource(int type, const char *key)
+{
+    resource_t *r = hashtable_resource_t_find(table[type], key);
+    int n = hashtable_resource_t_ref(table[type], key);
+
+    if(r != NULL) {
+        if(r->reference_count <= 0)
+            lru_unlink(r);
+        r->reference_count = n;
+        r->last_used = timer_get_ticks();
+    }
+
+    return n;
+}
+
+/* decrements the reference counting */
+int unref_resource(int type, const char *key)
+{
+    resource_t *r = hashtable_resource_t_find(table[type], key);
+    int n = hashtable_resource_t_unref(table[type], key);
+
+    if(r != NULL) {
+        if(r->reference_count > 0 && n <= 0)
+            lru_push(r);
+        r->reference_count = n;
+        r->last_used = timer_get_ticks();
+    }
+
+    return n;
+}
+
+/* destroys a resource */
+void resource_destroy(resource_t *r)
+{
+    if(r->reference_count <= 0)
+        lru_unlink(r);
+
+    if(r->prev != NULL)
+        r->prev->next = r->next;
+    else
+        resident = r->next;
+    if(r->next != NULL)
+        r->next->prev = r->prev;
+
+    bytes_in_use[r->type] -= r->bytes;
+    resource_count[r->type]--;
+
+    switch(r->type) {
+        case RES_IMAGE:  image_destroy((image_t*)(r->data)); break;
+        case RES_SAMPLE: sound_destroy((sound_t*)(r->data)); break;
+        case RES_MUSIC:  music_destroy((music_t*)(r->data)); break;
+    }
+
+    free(r->key);
+    free(r);
+}
+
+/* adds r to the head of the list of unreferenced resources */
+void lru_push(resource_t *r)
+{
+    r->lru_prev = NULL;
+    r->lru_next = lru_head;
+    if(lru_head != NULL)
+        lru_head->lru_prev = r;
+    else
+        lru_tail = r;
+    lru_head = r;
+}
+
+/* removes r from the list of unreferenced resources */
+void lru_unlink(resource_t *r)
+{
+    if(r->lru_prev != NULL)
+        r->lru_prev->lru_next = r->lru_next;
+    else
+        lru_head = r->lru_next;
+
+    if(r->lru_next != NULL)
+        r->lru_next->lru_prev = r->lru_prev;
+    else
+        lru_tail = r->lru_prev;
+
+    r->lru_prev = r->lru_next = NULL;
+}
+
+/* memory used by all the resources, in bytes */
+int total_bytes()
+{
+    int i, sum = 0;
+
+    for(i=0; i<RES_TYPES; i++)
+        sum += bytes_in_use[i];
+
+    return sum;
 }
@@ -26,17 +26,24 @@
 struct image_t;
 struct sound_t;
 struct music_t;
+struct decodedimage_t;
 
 /* resource manager: public methods */
-void resourcemanager_init(); /* initializes the resource manager */
+void resourcemanager_init(int memory_budget); /* initializes the resource manager. The budget is given in kilobytes */
 void resourcemanager_release(); /* releases the resource manager */
-void resourcemanager_release_unused_resources(); /* memory optimization: reference counting */
+void resourcemanager_release_unused_resources(); /* memory optimization: evicts the least recently used unreferenced resources while we're over the budget */
+void resourcemanager_dump(); /* writes the resident resources (size, references, last use) to the logfile */
 
 /* data handling */
 void resourcemanager_add_image(const char *key, struct image_t *data); /* adds an image to the dictionary */
 struct image_t* resourcemanager_find_image(const char *key); /* finds an image in the dictionary */
 int resourcemanager_ref_image(const char *key); /* increments and returns the reference counting */
 int resourcemanager_unref_image(const char *key); /* decrements and returns the reference counting */
+void resourcemanager_remove_image(const char *key); /* removes an unreferenced image from the dictionary */
+
+/* worker threads hand their decoded images over to the main thread (thread-safe) */
+void resourcemanager_add_decoded_image(const char *key, struct decodedimage_t *decoded); /* takes ownership of decoded */
+struct decodedimage_t* resourcemanager_take_decoded_image(const char *key); /* gives up the ownership. NULL if there's none */
 
 void resourcemanager_add_music(const char *key, struct music_t *data);
 struct music_t* resourcemanager_find_music(const char *key);
@@ -0,0 +1,470 @@
+/*
+ * Open Surge Engine
+ * scriptcache.c - precompiled script cache
+ * Copyright (C) 2013  Alexandre Martins <alemartf(at)gmail(dot)com>
+ * http://opensnc.sourceforge.net
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <allegro.h>
+#include <stdio.h>
+#include <string.h>
+#include "scriptcache.h"
+#include "global.h"
+#include "osspec.h"
+#include "util.h"
+#include "stringutil.h"
+#include "logfile.h"
+#include "hashtable.h"
+
+/* private stuff */
+#define SCRIPTCACHE_FILE        "cache/scripts.bin"
+#define SCRIPTCACHE_TEMP_FILE   "cache/scripts.bin.tmp"
+#define SCRIPTCACHE_MAGIC       "OSSC"
+#define SCRIPTCACHE_VERSION     1
+
+/* a file that has been read when parsing a script */
+typedef struct scriptcache_dependency_t scriptcache_dependency_t;
+struct scriptcache_dependency_t {
+    char *filepath;
+    uint32 size; /* file size */
+    uint32 time; /* modification time */
+    uint32 hash; /* hash of the contents */
+};
+
+/* a cached parse tree */
+typedef struct scriptcache_entry_t scriptcache_entry_t;
+struct scriptcache_entry_t {
+    char *filepath; /* absolute path of the script */
+    int dependency_count;
+    scriptcache_dependency_t *dependency;
+    const unsigned char *tree; /* binary form of the parse tree */
+    uint32 tree_size; /* size of the binary form */
+    unsigned char *owned_tree; /* tree, if it's not stored in the pack */
+    scriptcache_entry_t *next; /* linked list */
+};
+
+HASHTABLE_GENERATE_CODE(scriptcache_entry_t)
+
+static int enabled = FALSE;
+static const unsigned char *pack = NULL; /* the cache file, mapped into memory */
+static long pack_size = 0;
+static scriptcache_entry_t *entries = NULL;
+static hashtable_scriptcache_entry_t *lookup_table = NULL;
+static int dirty = FALSE; /* do we need to save the cache? */
+static int hits = 0, misses = 0;
+
+static void load_pack();
+static int save_pack();
+static scriptcache_entry_t* entry_create(const char *filepath);
+static scriptcache_entry_t* entry_destroy(scriptcache_entry_t *e);
+static void entry_add(scriptcache_entry_t *e);
+static void entry_remove(scriptcache_entry_t *e);
+static int entry_is_valid(scriptcache_entry_t *e);
+static void file_signature(const char *filepath, scriptcache_dependency_t *dep);
+static int read_u32(uint32 *x, long *ptr);
+static int read_string(char **str, long *ptr);
+static void write_u32(FILE *fp, uint32 x);
+static void write_string(FILE *fp, const char *str);
+
+
+
+/* public methods */
+
+/*
+ * scriptcache_init()
+ * Initializes the script cache
+ */
+void scriptcache_init(int is_enabled)
+{
+    logfile_message("Initializing the script cache...");
+
+    enabled = is_enabled;
+    entries = NULL;
+    lookup_table = hashtable_scriptcache_entry_t_create(NULL);
+    dirty = FALSE;
+    hits = misses = 0;
+
+    if(enabled)
+        load_pack();
+    else
+        logfile_message("The script cache is disabled.");
+}
+
+
+/*
+ * scriptcache_release()
+ * Releases the script cache, saving it if necessary
+ */
+void scriptcache_release()
+{
+    char abs_path[1024], tmp_path[1024];
+    scriptcache_entry_t *next;
+    int saved = FALSE;
+
+    logfile_message("Releasing the script cache (%d hits, %d misses)...", hits, misses);
+
+    /* the new pack is written aside, since the current one is still mapped */
+    if(enabled && dirty)
+        saved = save_pack();
+
+    lookup_table = hashtable_scriptcache_entry_t_destroy(lookup_table);
+    while(entries != NULL) {
+        next = entries->next;
+        entry_destroy(entries);
+        entries = next;
+    }
+
+    unmap_file(pack, pack_size);
+    pack = NULL;
+    pack_size = 0;
+
+    /* replace the old pack */
+    if(saved) {
+        resource_filepath(abs_path, SCRIPTCACHE_FILE, sizeof(abs_path), RESFP_WRITE);
+        resource_filepath(tmp_path, SCRIPTCACHE_TEMP_FILE, sizeof(tmp_path), RESFP_WRITE);
+        remove(abs_path);
+        if(rename(tmp_path, abs_path) != 0) {
+            logfile_message("Can't save the script cache \"%s\"", abs_path);
+            remove(tmp_path);
+        }
+    }
+}
+
+
+/*
+ * scriptcache_construct_tree()
+ * Same as nanoparser_construct_tree(), but the parse
+ * tree is taken from the cache if the script hasn't
+ * changed since the last time it was parsed.
+ */
+parsetree_program_t* scriptcache_construct_tree(const char *filepath)
+{
+    scriptcache_entry_t *e;
+    parsetree_program_t *tree;
+    size_t size;
+    int i;
+
+    if(!enabled)
+        return nanoparser_construct_tree(filepath);
+
+    /* cache hit? */
+    if(NULL != (e = hashtable_scriptcache_entry_t_find(lookup_table, filepath))) {
+        if(entry_is_valid(e)) {
+            if(NULL != (tree = nanoparser_unserialize_tree(e->tree, e->tree_size))) {
+                hits++;
+                return tree;
+            }
+        }
+
+        /* outdated */
+        entry_remove(e);
+        dirty = TRUE;
+    }
+
+    /* cache miss: parse the script */
+    misses++;
+    if(NULL == (tree = nanoparser_construct_tree(filepath)))
+        return NULL;
+
+    /* store the parse tree */
+    e = entry_create(filepath);
+    e->dependency_count = nanoparser_get_number_of_dependencies();
+    e->dependency = mallocx(e->dependency_count * sizeof *(e->dependency));
+    for(i=0; i<e->dependency_count; i++)
+        file_signature(nanoparser_get_nth_dependency(1+i), &(e->dependency[i]));
+    e->owned_tree = nanoparser_serialize_tree(tree, &size);
+    e->tree = e->owned_tree;
+    e->tree_size = (uint32)size;
+    entry_add(e);
+    dirty = TRUE;
+
+    return tree;
+}
+
+
+
+/* private methods */
+
+/* maps the cache file (if any) and reads its index */
+void load_pack()
+{
+    char abs_path[1024];
+    long ptr = 0;
+    uint32 i, j, n, version;
+
+    resource_filepath(abs_path, SCRIPTCACHE_FILE, sizeof(abs_path), RESFP_READ);
+    if(!filepath_exists(abs_path))
+        return;
+
+    if(NULL == (pack = map_file(abs_path, &pack_size))) {
+        logfile_message("Can't read the script cache \"%s\"", abs_path);
+        return;
+    }
+
+    /* header */
+    if(pack_size < 4 || memcmp(pack, SCRIPTCACHE_MAGIC, 4) != 0 || (ptr = 4, !read_u32(&version, &ptr)) || version != SCRIPTCACHE_VERSION || !read_u32(&n, &ptr)) {
+        logfile_message("Discarding the script cache \"%s\": invalid or outdated file", abs_path);
+        return;
+    }
+
+    /* entries */
+    for(i=0; i<n; i++) {
+        char *filepath;
+        uint32 dependency_count;
+        scriptcache_entry_t *e;
+
+        if(!read_string(&filepath, &ptr))
+            break;
+
+        e = entry_create(filepath);
+        free(filepath);
+
+        if(!read_u32(&dependency_count, &ptr) || dependency_count > (uint32)(pack_size - ptr) / 16) {
+            entry_destroy(e);
+            break;
+        }
+
+        e->dependency = mallocx((1 + dependency_count) * sizeof *(e->dependency));
+        for(j=0; j<dependency_count; j++) {
+            scriptcache_dependency_t *dep = &(e->dependency[j]);
+            if(!read_string(&(dep->filepath), &ptr))
+                break;
+            e->dependency_count++;
+            if(!read_u32(&(dep->size), &ptr) || !read_u32(&(dep->time), &ptr) || !read_u32(&(dep->hash), &ptr))
+                break;
+        }
+
+        if(j < dependency_count || !read_u32(&(e->tree_size), &ptr) || e->tree_size > (uint32)(pack_size - ptr)) {
+            entry_destroy(e);
+            break;
+        }
+
+        e->tree = pack + ptr;
+        ptr += e->tree_size;
+        entry_add(e);
+    }
+
+    logfile_message("Script cache \"%s\" mapped (%ld bytes).", abs_path, pack_size);
+}
+
+/* writes the cache to a temporary file. Returns TRUE on success */
+int save_pack()
+{
+    char abs_path[1024];
+    scriptcache_entry_t *e;
+    uint32 n = 0;
+    int i, ok;
+    FILE *fp;
+
+    resource_filepath(abs_path, SCRIPTCACHE_TEMP_FILE, sizeof(abs_path), RESFP_WRITE);
+    if(NULL == (fp = fopen(abs_path, "wb"))) {
+        logfile_message("Can't save the script cache \"%s\"", abs_path);
+        return FALSE;
+    }
+
+    for(e=entries; e; e=e->next)
+        n++;
+
+    fwrite(SCRIPTCACHE_MAGIC, 1, 4, fp);
+    write_u32(fp, SCRIPTCACHE_VERSION);
+    write_u32(fp, n);
+    for(e=entries; e; e=e->next) {
+        write_string(fp, e->filepath);
+        write_u32(fp, e->dependency_count);
+        for(i=0; i<e->dependency_count; i++) {
+            write_string(fp, e->dependency[i].filepath);
+            write_u32(fp, e->dependency[i].size);
+            write_u32(fp, e->dependency[i].time);
+            write_u32(fp, e->dependency[i].hash);
+        }
+        write_u32(fp, e->tree_size);
+        fwrite(e->tree, 1, e->tree_size, fp);
+    }
+
+    ok = !ferror(fp);
+    if(fclose(fp) != 0 || !ok) {
+        logfile_message("Can't save the script cache \"%s\"", abs_path);
+        remove(abs_path);
+        return FALSE;
+    }
+
+    logfile_message("Script cache saved to \"%s\" (%d scripts).", abs_path, (int)n);
+    return TRUE;
+}
+
+/* creates a new entry */
+scriptcache_entry_t* entry_create(const char *filepath)
+{
+    scriptcache_entry_t *e = mallocx(sizeof *e);
+
+    e->filepath = str_dup(filepath);
+    e->dependency_count = 0;
+    e->dependency = NULL;
+    e->tree = NULL;
+    e->tree_size = 0;
+    e->owned_tree = NULL;
+    e->next = NULL;
+
+    return e;
+}
+
+/* destroys an entry */
+scriptcache_entry_t* entry_destroy(scriptcache_entry_t *e)
+{
+    int i;
+
+    for(i=0; i<e->dependency_count; i++)
+        free(e->dependency[i].filepath);
+
+    if(e->dependency != NULL)
+        free(e->dependency);
+
+    if(e->owned_tree != NULL)
+        free(e->owned_tree);
+
+    free(e->filepath);
+    free(e);
+    return NULL;
+}
+
+/* adds an entry to the cache */
+void entry_add(scriptcache_entry_t *e)
+{
+    if(NULL == hashtable_scriptcache_entry_t_find(lookup_table, e->filepath)) {
+        hashtable_scriptcache_entry_t_add(lookup_table, e->filepath, e);
+        e->next = entries;
+        entries = e;
+    }
+    else
+        entry_destroy(e);
+}
+
+/* removes an entry from the cache */
+void entry_remove(scriptcache_entry_t *e)
+{
+    scriptcache_entry_t *it, *prev = NULL;
+
+    hashtable_scriptcache_entry_t_remove(lookup_table, e->filepath);
+    for(it=entries; it; prev=it, it=it->next) {
+        if(it == e) {
+            if(prev != NULL)
+                prev->next = it->next;
+            else
+                entries = it->next;
+            entry_destroy(it);
+            break;
+        }
+    }
+}
+
+/* checks if the files read when parsing the script haven't changed.
+   The size and the modification time are trusted: the contents are
+   hashed only if the file has been touched, but kept its size */
+int entry_is_valid(scriptcache_entry_t *e)
+{
+    scriptcache_dependency_t dep;
+    int i;
+
+    for(i=0; i<e->dependency_count; i++) {
+        scriptcache_dependency_t *cached = &(e->dependency[i]);
+
+        /* quick check */
+        if(!filepath_exists(cached->filepath) || (uint32)file_size_ex(cached->filepath) != cached->size)
+            return FALSE;
+        else if((uint32)file_time(cached->filepath) == cached->time)
+            continue;
+
+        /* same contents? */
+        file_signature(cached->filepath, &dep);
+        free(dep.filepath);
+        if(dep.hash != cached->hash)
+            return FALSE;
+
+        /* remember the new time, so that we don't hash it again */
+        cached->time = dep.time;
+        dirty = TRUE;
+    }
+
+    return e->dependency_count > 0;
+}
+
+/* computes the size, the modification time and the hash (FNV-1a) of a file */
+void file_signature(const char *filepath, scriptcache_dependency_t *dep)
+{
+    unsigned char buf[4096];
+    size_t i, n;
+    FILE *fp;
+
+    dep->filepath = str_dup(filepath);
+    dep->size = 0;
+    dep->time = 0;
+    dep->hash = 2166136261u;
+
+    if(NULL != (fp = fopen(filepath, "rb"))) {
+        while((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+            for(i=0; i<n; i++)
+                dep->hash = (dep->hash ^ buf[i]) * 16777619u;
+        }
+        fclose(fp);
+
+        dep->size = (uint32)file_size_ex(filepath);
+        dep->time = (uint32)file_time(filepath);
+    }
+}
+
+/* reads a 32-bit little-endian integer from the pack */
+int read_u32(uint32 *x, long *ptr)
+{
+    if(*ptr + 4 > pack_size)
+        return FALSE;
+
+    *x = (uint32)pack[*ptr] | ((uint32)pack[*ptr+1] << 8) | ((uint32)pack[*ptr+2] << 16) | ((uint32)pack[*ptr+3] << 24);
+    *ptr += 4;
+    return TRUE;
+}
+
+/* reads a string from the pack. You must free() it */
+int read_string(char **str, long *ptr)
+{
+    uint32 len;
+
+    if(!read_u32(&len, ptr) || len > (uint32)(pack_size - *ptr))
+        return FALSE;
+
+    *str = mallocx((len + 1) * sizeof(char));
+    memcpy(*str, pack + *ptr, len);
+    (*str)[len] = 0;
+    *ptr += len;
+    return TRUE;
+}
+
+/* writes a 32-bit little-endian integer */
+void write_u32(FILE *fp, uint32 x)
+{
+    fputc((int)(x & 0xFF), fp);
+    fputc((int)((x >> 8) & 0xFF), fp);
+    fputc((int)((x >> 16) & 0xFF), fp);
+    fputc((int)((x >> 24) & 0xFF), fp);
+}
+
+/* writes a string */
+void write_string(FILE *fp, const char *str)
+{
+    uint32 len = strlen(str);
+    write_u32(fp, len);
+    fwrite(str, 1, len, fp);
+}
@@ -0,0 +1,38 @@
+/*
+ * Open Surge Engine
+ * scriptcache.h - precompiled script cache
+ * Copyright (C) 2013  Alexandre Martins <alemartf(at)gmail(dot)com>
+ * http://opensnc.sourceforge.net
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _SCRIPTCACHE_H
+#define _SCRIPTCACHE_H
+
+#include "nanoparser/nanoparser.h"
+
+/*
+ * The script cache keeps the parse trees of the scripts (*.spr, *.obj, ...)
+ * in a binary form, so that unchanged scripts don't need to be parsed again
+ * on later launches. A script is considered unchanged if neither itself nor
+ * the files it #includes have changed (size, modification time & contents).
+ */
+
+void scriptcache_init(int enabled); /* initializes the script cache */
+void scriptcache_release(); /* releases the script cache, saving it to disk */
+parsetree_program_t* scriptcache_construct_tree(const char *filepath); /* same as nanoparser_construct_tree(), but uses the cache whenever possible */
+
+#endif
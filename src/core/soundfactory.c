@@ -28,6 +28,7 @@
 #include "osspec.h"
 #include "hashtable.h"
 #include "nanoparser/nanoparser.h"
+#include "scriptcache.h"
 
 /* storage */
 typedef struct factorysound_t factorysound_t;
@@ -153,7 +154,7 @@ void load_samples_table()
     logfile_message("soundfactory: loading the samples table...");
     resource_filepath(abs_path, "config/samples.def", sizeof(abs_path), RESFP_READ);
 
-    s = nanoparser_construct_tree(abs_path);
+    s = scriptcache_construct_tree(abs_path);
     nanoparser_traverse_program(s, traverse);
     s = nanoparser_deconstruct_tree(s);
 }
@@ -38,6 +38,7 @@ struct spatialhash_##T { \
     spatialhash_list_##T *persistent_elements; /* persistent elements */  \
     int cell_width, cell_height; /* a cell is an element of a SPATIALHASH_GRID_WIDTH x SPATIALHASH_GRID_HEIGHT grid, also known as the bucket */ \
     int largest_element_width, largest_element_height; \
+    unsigned int insertion_count; /* the elements are numbered in the order they're added */ \
     int (*xpos)(const T*); \
     int (*ypos)(const T*); \
     int (*width)(const T*); \
@@ -46,17 +47,26 @@ struct spatialhash_##T { \
 }; \
 struct spatialhash_list_##T { \
     T *data; \
+    unsigned int order; /* insertion order */ \
     spatialhash_list_##T *next; \
 }; \
+typedef struct spatialhash_visitor_##T spatialhash_visitor_##T; \
+struct spatialhash_visitor_##T { \
+    void *some_user_data; \
+    int (*callback_function)(T*,void*); \
+    spatialhash_list_##T **found; /* used by foreach_ordered */ \
+    int found_count, found_capacity; \
+}; \
 spatialhash_##T* spatialhash_##T##_create_ex(T* (*destroy_element_strategy)(T*), int (*get_element_xpos)(const T*), int (*get_element_ypos)(const T*), int (*get_element_width)(const T*), int (*get_element_height)(const T*), int estimated_world_width, int estimated_world_height) /* destroy_element_strategy may be NULL */ \
 { \
     int i, j; \
     spatialhash_##T *sh = mallocx(sizeof *sh); \
-    logfile_message("spatialhash_" #T "_create_ex(%d, %d)", estimated_world_width, estimated_world_height); \
+    logfile_debug("spatialhash_" #T "_create_ex(%d, %d)", estimated_world_width, estimated_world_height); \
     sh->cell_width = max(1, estimated_world_width / SPATIALHASH_GRID_WIDTH); \
     sh->cell_height = max(1, estimated_world_height / SPATIALHASH_GRID_HEIGHT); \
     sh->largest_element_width = 0; \
     sh->largest_element_height = 0; \
+    sh->insertion_count = 0; \
     sh->xpos = get_element_xpos; \
     sh->ypos = get_element_ypos; \
     sh->width = get_element_width; \
@@ -79,7 +89,7 @@ spatialhash_##T* spatialhash_##T##_destroy(spatialhash_##T *sh) \
 { \
     int i, j; \
     spatialhash_list_##T *p, *q; \
-    logfile_message("spatialhash_" #T "_destroy()"); \
+    logfile_debug("spatialhash_" #T "_destroy()"); \
     for(i=0; i<SPATIALHASH_GRID_HEIGHT; i++) { \
         for(j=0; j<SPATIALHASH_GRID_WIDTH; j++) { \
             p = sh->bucket[i][j]; \
@@ -101,7 +111,7 @@ spatialhash_##T* spatialhash_##T##_destroy(spatialhash_##T *sh) \
         p = q; \
     } \
     free(sh); \
-    logfile_message("spatialhash_" #T "_destroy() - success!"); \
+    logfile_debug("spatialhash_" #T "_destroy() - success!"); \
     return NULL; \
 } \
 /* adds an element to the spatial hash */ \
@@ -126,12 +136,42 @@ void spatialhash_##T##_add(spatialhash_##T *sh, T *element) \
     \
     p = mallocx(sizeof *p); \
     p->data = element; \
+    p->order = sh->insertion_count++; \
     p->next = sh->bucket[row][col]; \
     sh->bucket[row][col] = p; \
     \
     sh->largest_element_width = max(sh->largest_element_width, sh->width(element)); \
     sh->largest_element_height = max(sh->largest_element_height, sh->height(element)); \
 } \
+/* adds an element that is known not to be in the spatial hash (faster: no duplicate check) */ \
+void spatialhash_##T##_add_new(spatialhash_##T *sh, T *element) \
+{ \
+    int row, col; \
+    spatialhash_list_##T *p; \
+    \
+    col = sh->xpos(element) / sh->cell_width; \
+    row = sh->ypos(element) / sh->cell_height; \
+    col = clip(col, 0, SPATIALHASH_GRID_WIDTH-1); \
+    row = clip(row, 0, SPATIALHASH_GRID_HEIGHT-1); \
+    \
+    p = mallocx(sizeof *p); \
+    p->data = element; \
+    p->order = sh->insertion_count++; \
+    p->next = sh->bucket[row][col]; \
+    sh->bucket[row][col] = p; \
+    \
+    sh->largest_element_width = max(sh->largest_element_width, sh->width(element)); \
+    sh->largest_element_height = max(sh->largest_element_height, sh->height(element)); \
+} \
+/* adds a persistent element that is known not to be in the spatial hash */ \
+void spatialhash_##T##_add_persistent_new(spatialhash_##T *sh, T *element) \
+{ \
+    spatialhash_list_##T *p = mallocx(sizeof *p); \
+    p->data = element; \
+    p->order = sh->insertion_count++; \
+    p->next = sh->persistent_elements; \
+    sh->persistent_elements = p; \
+} \
 /* adds a persistent element to the spatial hash */ \
 void spatialhash_##T##_add_persistent(spatialhash_##T *sh, T *element) \
 { \
@@ -148,6 +188,7 @@ void spatialhash_##T##_add_persistent(spatialhash_##T *sh, T *element) \
     \
     p = mallocx(sizeof *p); \
     p->data = element; \
+    p->order = sh->insertion_count++; \
     p->next = sh->persistent_elements; \
     sh->persistent_elements = p; \
 } \
@@ -219,6 +260,27 @@ void spatialhash_##T##_remove(spatialhash_##T *sh, T *element) \
     /* aargh! it's 3:00 AM and we found nothing! */ \
     logfile_message("spatialhash_" #T "_remove(): element '%p' was not found.", element); \
 } \
+/* visitors of spatialhash_##T##_scan */ \
+static void spatialhash_##T##_scan(spatialhash_##T *sh, int rectangle_xpos, int rectangle_ypos, int rectangle_width, int rectangle_height, spatialhash_visitor_##T *visitor, int (*callback_function)(spatialhash_list_##T*,spatialhash_visitor_##T*)); \
+static int spatialhash_##T##_visit(spatialhash_list_##T *node, spatialhash_visitor_##T *visitor) \
+{ \
+    return visitor->callback_function(node->data, visitor->some_user_data); \
+} \
+static int spatialhash_##T##_collect(spatialhash_list_##T *node, spatialhash_visitor_##T *visitor) \
+{ \
+    if(visitor->found_count >= visitor->found_capacity) { \
+        visitor->found_capacity = max(64, 2 * visitor->found_capacity); \
+        visitor->found = reallocx(visitor->found, visitor->found_capacity * sizeof *(visitor->found)); \
+    } \
+    visitor->found[visitor->found_count++] = node; \
+    return 0; \
+} \
+static int spatialhash_##T##_cmp_order(const void *a, const void *b) \
+{ \
+    const spatialhash_list_##T *p = *((const spatialhash_list_##T**)a); \
+    const spatialhash_list_##T *q = *((const spatialhash_list_##T**)b); \
+    return (p->order > q->order) - (p->order < q->order); \
+} \
 /* for each element X in the given rectangle, calls callback_function(X,some_user_data), */ \
 /* where some_user_data, a void pointer, may be anything you need. */ \
 /* callback_function must return zero to let the enumeration proceed, or any non-zero value */ \
@@ -226,6 +288,38 @@ void spatialhash_##T##_remove(spatialhash_##T *sh, T *element) \
 /* ATTENTION! persistent elements ("always_active") are considered even if they're not */ \
 /* inside the given rectangle */ \
 void spatialhash_##T##_foreach(spatialhash_##T *sh, int rectangle_xpos, int rectangle_ypos, int rectangle_width, int rectangle_height, void *some_user_data, int (*callback_function)(T*,void*)) \
+{ \
+    spatialhash_visitor_##T v; \
+    v.some_user_data = some_user_data; \
+    v.callback_function = callback_function; \
+    spatialhash_##T##_scan(sh, rectangle_xpos, rectangle_ypos, rectangle_width, rectangle_height, &v, spatialhash_##T##_visit); \
+} \
+/* like spatialhash_##T##_foreach, but the elements are enumerated in the order they have */ \
+/* been added to the spatial hash (persistent elements included), each one of them once. */ \
+/* The order doesn't depend on the given rectangle: use this to render things. */ \
+void spatialhash_##T##_foreach_ordered(spatialhash_##T *sh, int rectangle_xpos, int rectangle_ypos, int rectangle_width, int rectangle_height, void *some_user_data, int (*callback_function)(T*,void*)) \
+{ \
+    spatialhash_visitor_##T v; \
+    int i; \
+    \
+    v.found = NULL; \
+    v.found_count = v.found_capacity = 0; \
+    spatialhash_##T##_scan(sh, rectangle_xpos, rectangle_ypos, rectangle_width, rectangle_height, &v, spatialhash_##T##_collect); \
+    merge_sort(v.found, v.found_count, sizeof *(v.found), spatialhash_##T##_cmp_order); \
+    \
+    for(i=0; i<v.found_count; i++) { \
+        if(i > 0 && v.found[i] == v.found[i-1]) \
+            continue; /* it has been moved to a bucket that was scanned later */ \
+        if(0 != callback_function(v.found[i]->data, some_user_data)) \
+            break; \
+    } \
+    \
+    if(v.found != NULL) \
+        free(v.found); \
+} \
+/* scans the nodes of the elements in the given rectangle (persistent elements included), */ \
+/* calling callback_function(node,visitor). Elements that have changed cells are moved. */ \
+static void spatialhash_##T##_scan(spatialhash_##T *sh, int rectangle_xpos, int rectangle_ypos, int rectangle_width, int rectangle_height, spatialhash_visitor_##T *visitor, int (*callback_function)(spatialhash_list_##T*,spatialhash_visitor_##T*)) \
 { \
     int r_x1, r_y1, r_x2, r_y2, e_x1, e_y1, e_x2, e_y2; \
     int row, col, first_row, first_col, last_row, last_col; \
@@ -249,7 +343,7 @@ void spatialhash_##T##_foreach(spatialhash_##T *sh, int rectangle_xpos, int rect
     \
     /* scanning persistent elements */ \
     for(p = sh->persistent_elements; p != NULL && !stop_iteration; p = p->next) { \
-        if(0 != callback_function(p->data, some_user_data)) \
+        if(0 != callback_function(p, visitor)) \
             stop_iteration = TRUE; \
     } \
     \
@@ -276,27 +370,26 @@ void spatialhash_##T##_foreach(spatialhash_##T *sh, int rectangle_xpos, int rect
                 if(cx >= first_col && cx <= last_col && cy >= first_row && cy <= last_row) { \
                     /* is p->data inside the given rectangle? (bounding box check) */ \
                     if((e_x1 < r_x2 && e_x2 > r_x1) && (e_y1 < r_y2 && e_y2 > r_y1)) { \
-                        if((!stop_iteration) && (0 != callback_function(p->data, some_user_data))) \
+                        if((!stop_iteration) && (0 != callback_function(p, visitor))) \
                             stop_iteration = TRUE; \
                     } \
                 } \
                 \
                 if(!(cx == col && cy == row)) { \
-                    /* do we need to move p->data to some other bucket? */ \
-                    T *e = p->data; \
+                    /* do we need to move p->data to some other bucket? (it keeps its order) */ \
+                    spatialhash_list_##T *q = p; \
                     if(prev != NULL) { \
-                        prev->next = p->next; \
-                        free(p); \
+                        prev->next = q->next; \
                         p = prev; \
-                        spatialhash_##T##_add(sh, e); \
                     } \
                     else { \
-                        sh->bucket[row][col] = p->next; \
-                        free(p); \
+                        sh->bucket[row][col] = q->next; \
                         p = sh->bucket[row][col]; \
-                        spatialhash_##T##_add(sh, e); \
-                        continue; \
                     } \
+                    q->next = sh->bucket[cy][cx]; \
+                    sh->bucket[cy][cx] = q; \
+                    if(prev == NULL) \
+                        continue; \
                 } \
                 \
                 prev = p; \
@@ -26,14 +26,32 @@
 #include "image.h"
 #include "logfile.h"
 #include "osspec.h"
+#include "video.h"
 #include "hashtable.h"
+#include "atlas.h"
+#include "resourcemanager.h"
+#include "loader.h"
 #include "nanoparser/nanoparser.h"
+#include "scriptcache.h"
 
 /* private stuff ;) */
 #define SPRITE_MAX_ANIM         1000 /* sprites can have at most SPRITE_MAX_ANIM animations (numbered 0 .. SPRITE_MAX_ANIM-1) */
+#define SPRITE_ATLAS_PAGE_SIZE  1024 /* width and height of the pages of the sprite atlas */
 HASHTABLE_GENERATE_CODE(spriteinfo_t)
 static hashtable_spriteinfo_t* sprites;
 
+/* flipped frames cache */
+static int flipcache_budget = 0; /* in bytes */
+static int flipcache_usage = 0; /* in bytes */
+static int flipcache_exhausted = FALSE;
+
+/* sprite atlas */
+static atlas_t *atlas = NULL;
+static spriteinfo_t **unpacked_sprite = NULL; /* requested sprites waiting to be packed */
+static int unpacked_sprite_count = 0;
+static spriteinfo_t **packed_sprite = NULL; /* sprites living in the atlas */
+static int packed_sprite_count = 0;
+
 /* private functions */
 static int dirfill(const char *filename, void *param); /* file system callback */
 static void validate_sprite(spriteinfo_t *spr); /* validates the sprite */
@@ -42,8 +60,15 @@ static void register_sprite(const char *sprite_name, spriteinfo_t *spr); /* adds
 static spriteinfo_t *spriteinfo_new(); /* creates a new spriteinfo_t instance */
 static animation_t *animation_new(int anim_id); /* creates a new animation_t instance */
 static animation_t *animation_delete(animation_t *anim); /* deletes anim */
+static spriteinfo_t *spriteinfo_parse(const parsetree_program_t *tree); /* reads the meta data of a sprite */
 static void load_sprite_images(spriteinfo_t *spr); /* loads the sprite by reading the spritesheet */
+static void create_sprite_frames(spriteinfo_t *spr); /* creates the frames as sub-images of spr->source_image */
+static void request_sprite(spriteinfo_t *spr); /* schedules spr to be packed into the atlas */
+static void pack_sprites(); /* packs the requested sprites into the atlas */
+static void unpack_sprite(spriteinfo_t *spr); /* removes spr from the atlas */
+static int sort_by_height(const void *a, const void *b); /* qsort() callback */
 static void fix_sprite_animations(spriteinfo_t *spr); /* fixes the animations of the given sprite */
+static int build_flipped_frames(spriteinfo_t *spr, int flags); /* builds the flipped frames of the given sprite */
 
 static int traverse(const parsetree_statement_t *stmt);
 static int traverse_sprite_attributes(const parsetree_statement_t *stmt, void *spriteinfo);
@@ -54,14 +79,19 @@ static int traverse_animation_attributes(const parsetree_statement_t *stmt, void
 
 /*
  * sprite_init()
- * Initializes the sprite module
+ * Initializes the sprite module. flip_cache_budget is the
+ * maximum amount of memory, in kilobytes, that may be used
+ * to store pre-flipped frames.
  */
-void sprite_init()
+void sprite_init(int flip_cache_budget)
 {
     const char *path = "sprites/*.spr";
     parsetree_program_t *prog = NULL;
 
     logfile_message("Loading sprites...");
+    flipcache_budget = max(0, flip_cache_budget) * 1024;
+    flipcache_usage = 0;
+    flipcache_exhausted = FALSE;
     sprites = hashtable_spriteinfo_t_create(spriteinfo_destroy);
 
     /* reading the parse tree */
@@ -69,7 +99,7 @@ void sprite_init()
     if(prog == NULL)
         fatal_error("FATAL ERROR: no sprites have been found. Please reinstall the game.");
 
-    /* reading the sprites */
+    /* registering the sprites (their spritesheets will be decoded on demand) */
     nanoparser_traverse_program(prog, traverse);
 
     /* we're done! */
@@ -85,7 +115,20 @@ void sprite_init()
 void sprite_release()
 {
     logfile_message("Releasing sprites...");
+    logfile_message("Flipped frames cache: %d of %d bytes in use", flipcache_usage, flipcache_budget);
     sprites = hashtable_spriteinfo_t_destroy(sprites);
+    if(unpacked_sprite != NULL) {
+        free(unpacked_sprite);
+        unpacked_sprite = NULL;
+        unpacked_sprite_count = 0;
+    }
+    if(packed_sprite != NULL) {
+        free(packed_sprite);
+        packed_sprite = NULL;
+        packed_sprite_count = 0;
+    }
+    if(atlas != NULL)
+        atlas = atlas_destroy(atlas);
 }
 
 
@@ -102,6 +145,12 @@ animation_t *sprite_get_animation(const char *sprite_name, int anim_id)
     /* find the corresponding spriteinfo_t* instance */
     info = hashtable_spriteinfo_t_find(sprites, sprite_name);
     if(info != NULL) {
+        if(info->source_image == NULL) {
+            /* decode the sprite, as well as the preloaded ones */
+            request_sprite(info);
+            pack_sprites();
+        }
+        info->used = TRUE;
         anim_id = clip(anim_id, 0, info->animation_count-1);
         return info->animation_data[anim_id];
     }
@@ -113,6 +162,22 @@ animation_t *sprite_get_animation(const char *sprite_name, int anim_id)
 
 
 
+/*
+ * sprite_preload()
+ * The given sprite will be needed soon: it will be decoded
+ * (along with the other preloaded sprites) as soon as any
+ * sprite that hasn't been decoded yet is requested.
+ */
+void sprite_preload(const char *sprite_name)
+{
+    spriteinfo_t *info = hashtable_spriteinfo_t_find(sprites, sprite_name);
+
+    if(info != NULL && info->source_image == NULL)
+        request_sprite(info);
+}
+
+
+
 /*
  * sprite_get_image()
  * Receives an animation and the desired frame number.
@@ -120,10 +185,85 @@ animation_t *sprite_get_animation(const char *sprite_name, int anim_id)
  */
 image_t *sprite_get_image(const animation_t *anim, int frame_id)
 {
+    spriteinfo_t *spr = anim->sprite;
+
+    if(spr != NULL) {
+        if(spr->source_image == NULL) {
+            /* it has been released by sprite_release_unused() */
+            request_sprite(spr);
+            pack_sprites();
+        }
+        spr->used = TRUE;
+    }
+
     frame_id = clip(frame_id, 0, anim->frame_count-1);
     return anim->frame_data[ anim->data[frame_id] ];
 }
 
+
+/*
+ * sprite_get_image_ex()
+ * Like sprite_get_image(), but it may return a pre-flipped
+ * frame, so that the caller doesn't need to flip it on the fly.
+ * The flags (IF_HFLIP | IF_VFLIP) that have been applied to the
+ * returned image are cleared from *flags. If the flipped frames
+ * cache is full, the regular frame is returned and *flags is
+ * left untouched.
+ */
+image_t *sprite_get_image_ex(const animation_t *anim, int frame_id, uint32 *flags)
+{
+    spriteinfo_t *spr = anim->sprite;
+    int f = (int)(*flags & (IF_HFLIP | IF_VFLIP));
+
+    if(spr != NULL) {
+        if(spr->source_image == NULL) {
+            /* it has been released by sprite_release_unused() */
+            request_sprite(spr);
+            pack_sprites();
+        }
+        spr->used = TRUE;
+    }
+
+    frame_id = clip(frame_id, 0, anim->frame_count-1);
+    if(f != IF_NONE && spr != NULL) {
+        if(spr->flipped_frame_data[f] != NULL || build_flipped_frames(spr, f)) {
+            *flags &= ~((uint32)f);
+            return spr->flipped_frame_data[f][ anim->data[frame_id] ];
+        }
+    }
+
+    return anim->frame_data[ anim->data[frame_id] ];
+}
+
+/*
+ * sprite_release_unused()
+ * Frees the packed sprites that haven't been used since the
+ * last call, as well as the atlas pages they leave empty.
+ * Those sprites will be decoded again if they're needed.
+ */
+void sprite_release_unused()
+{
+    int i, n, released = 0;
+
+    if(atlas == NULL)
+        return;
+
+    for(n=i=0; i<packed_sprite_count; i++) {
+        if(!packed_sprite[i]->used) {
+            unpack_sprite(packed_sprite[i]);
+            released++;
+        }
+        else {
+            packed_sprite[i]->used = FALSE;
+            packed_sprite[n++] = packed_sprite[i];
+        }
+    }
+    packed_sprite_count = n;
+
+    if(released > 0)
+        logfile_message("Sprite atlas: %d unused sprites have been released. %d sprites remain in %d pages (%d bytes)", released, packed_sprite_count, atlas_page_count(atlas), atlas_memory_usage(atlas));
+}
+
 /*
  * spriteinfo_create()
  * Creates and stores on the memory a spriteinfo_t
@@ -133,9 +273,7 @@ spriteinfo_t* spriteinfo_create(const parsetree_program_t *tree)
 {
     spriteinfo_t *sprite;
 
-    sprite = spriteinfo_new();
-    nanoparser_traverse_program_ex(tree, (void*)sprite, traverse_sprite_attributes);
-    validate_sprite(sprite);
+    sprite = spriteinfo_parse(tree);
     load_sprite_images(sprite);
     fix_sprite_animations(sprite);
 
@@ -148,17 +286,35 @@ spriteinfo_t* spriteinfo_create(const parsetree_program_t *tree)
  */
 void spriteinfo_destroy(spriteinfo_t *info)
 {
-    int i;
+    int i, f;
+
+    if(info->holds_sheet)
+        image_unref(info->source_file);
 
     if(info->source_file != NULL)
         free(info->source_file);
 
+    for(f=0; f<4; f++) {
+        if(info->flipped_frame_data[f] != NULL) {
+            for(i=0; i<info->frame_count; i++)
+                image_destroy(info->flipped_frame_data[f][i]);
+            free(info->flipped_frame_data[f]);
+        }
+        if(info->flipped_image[f] != NULL) {
+            flipcache_usage -= image_memory_usage(info->flipped_image[f]);
+            image_destroy(info->flipped_image[f]);
+        }
+    }
+
     if(info->frame_data != NULL) {
         for(i=0; i<info->frame_count; i++)
             image_destroy(info->frame_data[i]);
         free(info->frame_data);
     }
 
+    if(info->source_image != NULL)
+        image_destroy(info->source_image);
+
     if(info->animation_data != NULL) {
         for(i=0; i<info->animation_count; i++)
             info->animation_data[i] = animation_delete(info->animation_data[i]);
@@ -192,7 +348,7 @@ void spriteinfo_destroy(spriteinfo_t *info)
 int dirfill(const char *filename, void *param)
 {
     parsetree_program_t** p = (parsetree_program_t**)param;
-    *p = nanoparser_append_program(*p, nanoparser_construct_tree(filename));
+    *p = nanoparser_append_program(*p, scriptcache_construct_tree(filename));
     return 0;
 }
 
@@ -203,6 +359,7 @@ int dirfill(const char *filename, void *param)
 spriteinfo_t *spriteinfo_new()
 {
     spriteinfo_t *info = mallocx(sizeof *info);
+    int f;
 
     info->source_file = NULL;
     info->rect_x = 0;
@@ -215,6 +372,14 @@ spriteinfo_t *spriteinfo_new()
     info->frame_data = NULL;
     info->animation_count = 0;
     info->animation_data = NULL;
+    info->source_image = NULL;
+    for(f=0; f<4; f++) {
+        info->flipped_image[f] = NULL;
+        info->flipped_frame_data[f] = NULL;
+    }
+    info->pending = FALSE;
+    info->used = FALSE;
+    info->holds_sheet = FALSE;
 
     return info;
 }
@@ -235,6 +400,7 @@ animation_t *animation_new(int anim_id)
     anim->hot_spot = v2d_new(0,0);
     anim->repeat_from = 0;
     anim->frame_data = NULL;
+    anim->sprite = NULL;
 
     return anim;
 }
@@ -320,34 +486,243 @@ void validate_animation(animation_t *anim)
 }
 
 
+/*
+ * spriteinfo_parse()
+ * Reads the meta data of a sprite. No images are loaded.
+ */
+spriteinfo_t *spriteinfo_parse(const parsetree_program_t *tree)
+{
+    spriteinfo_t *sprite;
+
+    sprite = spriteinfo_new();
+    nanoparser_traverse_program_ex(tree, (void*)sprite, traverse_sprite_attributes);
+    validate_sprite(sprite);
+
+    return sprite;
+}
+
 /*
  * load_sprite_images()
  * Loads the sprite by reading the spritesheet
  */
 void load_sprite_images(spriteinfo_t *spr)
 {
-    int i, cur_x, cur_y;
     image_t *sheet;
 
-    spr->frame_count = (spr->rect_w / spr->frame_w) * (spr->rect_h / spr->frame_h);
-    spr->frame_data = mallocx(spr->frame_count * sizeof(*(spr->frame_data)));
-
     /* reading the images... */
     if(NULL == (sheet = image_load(spr->source_file)))
         fatal_error("FATAL ERROR: couldn't load spritesheet \"%s\"", spr->source_file);
 
-    cur_x = spr->rect_x;
-    cur_y = spr->rect_y;
+    spr->source_image = image_create_shared(sheet, spr->rect_x, spr->rect_y, spr->rect_w, spr->rect_h);
+    create_sprite_frames(spr);
+
+    /* keep the reference: the frames share the pixels of the sheet */
+    spr->holds_sheet = TRUE;
+}
+
+/*
+ * create_sprite_frames()
+ * Creates the frames of the sprite as sub-images of spr->source_image
+ */
+void create_sprite_frames(spriteinfo_t *spr)
+{
+    int i, cur_x, cur_y;
+
+    spr->frame_count = (spr->rect_w / spr->frame_w) * (spr->rect_h / spr->frame_h);
+    spr->frame_data = mallocx(spr->frame_count * sizeof(*(spr->frame_data)));
+
+    cur_x = cur_y = 0;
+    for(i=0; i<spr->frame_count; i++) {
+        spr->frame_data[i] = image_create_shared(spr->source_image, cur_x, cur_y, spr->frame_w, spr->frame_h);
+        cur_x += spr->frame_w;
+        if(cur_x >= spr->rect_w) {
+            cur_x = 0;
+            cur_y += spr->frame_h;
+        }
+    }
+}
+
+/*
+ * request_sprite()
+ * Schedules the given sprite to be packed into the atlas
+ */
+void request_sprite(spriteinfo_t *spr)
+{
+    if(!spr->pending) {
+        spr->pending = TRUE;
+        unpacked_sprite = reallocx(unpacked_sprite, (unpacked_sprite_count + 1) * sizeof *unpacked_sprite);
+        unpacked_sprite[unpacked_sprite_count++] = spr;
+    }
+}
+
+/*
+ * pack_sprites()
+ * Decodes the requested sprites and packs their source_rects into
+ * the sprite atlas, so that the frames live in a few large surfaces
+ * rather than being scattered across dozens of spritesheets.
+ * Spritesheets that have been loaded just for this purpose are
+ * released: they no longer take memory once their regions are packed.
+ */
+void pack_sprites()
+{
+    int i, j, n, sheet_bytes = 0;
+    const char **sheet_path;
+    char **loaded_sheet;
+    image_t *sheet;
+    spriteinfo_t *spr;
+
+    if(unpacked_sprite_count == 0)
+        return;
+
+    /* taller regions first: this improves the packing */
+    logfile_message("Packing %d sprites into the sprite atlas...", unpacked_sprite_count);
+    qsort(unpacked_sprite, unpacked_sprite_count, sizeof *unpacked_sprite, sort_by_height);
+    if(atlas == NULL)
+        atlas = atlas_create(SPRITE_ATLAS_PAGE_SIZE, SPRITE_ATLAS_PAGE_SIZE);
+
+    /* decoding the spritesheets in parallel */
+    sheet_path = mallocx(unpacked_sprite_count * sizeof *sheet_path);
+    for(n=i=0; i<unpacked_sprite_count; i++) {
+        for(j=0; j<n && str_icmp(sheet_path[j], unpacked_sprite[i]->source_file) != 0; j++);
+        if(j == n)
+            sheet_path[n++] = unpacked_sprite[i]->source_file;
+    }
+    loader_decode_images(sheet_path, n);
+    free(sheet_path);
+
+    /* copying the source_rects */
+    loaded_sheet = mallocx(unpacked_sprite_count * sizeof *loaded_sheet);
+    packed_sprite = reallocx(packed_sprite, (packed_sprite_count + unpacked_sprite_count) * sizeof *packed_sprite);
+    for(n=i=0; i<unpacked_sprite_count; i++) {
+        spr = unpacked_sprite[i];
+        if(NULL == resourcemanager_find_image(spr->source_file)) {
+            if(NULL == (sheet = image_load(spr->source_file)))
+                fatal_error("FATAL ERROR: couldn't load spritesheet \"%s\"", spr->source_file);
+            sheet_bytes += image_memory_usage(sheet);
+            loaded_sheet[n++] = spr->source_file;
+        }
+        else
+            sheet = image_load(spr->source_file);
+
+        spr->source_image = atlas_add(atlas, sheet, spr->rect_x, spr->rect_y, spr->rect_w, spr->rect_h);
+        create_sprite_frames(spr);
+        fix_sprite_animations(spr);
+        image_unref(spr->source_file);
+        spr->pending = FALSE;
+        packed_sprite[packed_sprite_count++] = spr;
+    }
+
+    /* the spritesheets are no longer needed */
+    for(i=0; i<n; i++)
+        resourcemanager_remove_image(loaded_sheet[i]);
+    free(loaded_sheet);
+
+    /* report */
+    logfile_message("Sprite atlas: %d bytes of spritesheets have been packed into %d pages (%d bytes)", sheet_bytes, atlas_page_count(atlas), atlas_memory_usage(atlas));
+    free(unpacked_sprite);
+    unpacked_sprite = NULL;
+    unpacked_sprite_count = 0;
+}
+
+/*
+ * unpack_sprite()
+ * Removes the given sprite from the atlas. Its frames
+ * (flipped ones included) are destroyed.
+ */
+void unpack_sprite(spriteinfo_t *spr)
+{
+    int i, f;
+
+    for(f=0; f<4; f++) {
+        if(spr->flipped_frame_data[f] != NULL) {
+            for(i=0; i<spr->frame_count; i++)
+                image_destroy(spr->flipped_frame_data[f][i]);
+            free(spr->flipped_frame_data[f]);
+            spr->flipped_frame_data[f] = NULL;
+        }
+        if(spr->flipped_image[f] != NULL) {
+            flipcache_usage -= image_memory_usage(spr->flipped_image[f]);
+            flipcache_exhausted = FALSE;
+            image_destroy(spr->flipped_image[f]);
+            spr->flipped_image[f] = NULL;
+        }
+    }
+
+    for(i=0; i<spr->frame_count; i++)
+        image_destroy(spr->frame_data[i]);
+    free(spr->frame_data);
+    spr->frame_data = NULL;
+    fix_sprite_animations(spr);
+
+    atlas_remove(atlas, spr->source_image);
+    spr->source_image = NULL;
+}
+
+/*
+ * sort_by_height()
+ * qsort() callback: taller sprites come first
+ */
+int sort_by_height(const void *a, const void *b)
+{
+    const spriteinfo_t *x = *((const spriteinfo_t**)a);
+    const spriteinfo_t *y = *((const spriteinfo_t**)b);
+
+    if(x->rect_h != y->rect_h)
+        return y->rect_h - x->rect_h;
+    else
+        return y->rect_w - x->rect_w;
+}
+
+/*
+ * build_flipped_frames()
+ * Builds a mirrored copy of the source_rect of the given sprite
+ * and creates its frames as sub-images of that copy, so that all
+ * the flipped frames of a sprite share a single surface. Returns
+ * FALSE if there isn't enough room in the flipped frames cache.
+ */
+int build_flipped_frames(spriteinfo_t *spr, int flags)
+{
+    int i, w, h, cur_x, cur_y, bytes;
+    image_t *img;
+
+    /* is there enough room in the cache? */
+    if(spr->source_image == NULL)
+        return FALSE;
+    bytes = image_memory_usage(spr->source_image);
+    if(flipcache_usage + bytes > flipcache_budget) {
+        if(!flipcache_exhausted) {
+            logfile_message("The flipped frames cache is full (%d bytes). Frames will be flipped on the fly.", flipcache_budget);
+            flipcache_exhausted = TRUE;
+        }
+        return FALSE;
+    }
+
+    /* mirroring the source_rect */
+    w = image_width(spr->source_image);
+    h = image_height(spr->source_image);
+    img = image_create(w, h);
+    image_clear(img, video_get_maskcolor());
+    image_draw(spr->source_image, img, 0, 0, flags);
+    spr->flipped_image[flags] = img;
+    flipcache_usage += bytes;
+
+    /* creating the frames */
+    spr->flipped_frame_data[flags] = mallocx(spr->frame_count * sizeof(*(spr->flipped_frame_data[flags])));
+    cur_x = cur_y = 0;
     for(i=0; i<spr->frame_count; i++) {
-        spr->frame_data[i] = image_create_shared(sheet, cur_x, cur_y, spr->frame_w, spr->frame_h);
+        spr->flipped_frame_data[flags][i] = image_create_shared(img,
+            (flags & IF_HFLIP) ? w - cur_x - spr->frame_w : cur_x,
+            (flags & IF_VFLIP) ? h - cur_y - spr->frame_h : cur_y,
+            spr->frame_w, spr->frame_h
+        );
         cur_x += spr->frame_w;
-        if(cur_x >= spr->rect_x+spr->rect_w) {
-            cur_x = spr->rect_x;
+        if(cur_x >= spr->rect_w) {
+            cur_x = 0;
             cur_y += spr->frame_h;
         }
     }
 
-    image_unref(spr->source_file);
+    return TRUE;
 }
 
 /*
@@ -360,6 +735,7 @@ void fix_sprite_animations(spriteinfo_t *spr)
 
     for(i=0; i<spr->animation_count; i++) {
         spr->animation_data[i]->frame_data = spr->frame_data;
+        spr->animation_data[i]->sprite = spr;
         spr->animation_data[i]->hot_spot = spr->hot_spot;
     }
 }
@@ -389,8 +765,12 @@ int traverse(const parsetree_statement_t *stmt)
         s = nanoparser_get_string(p1);
         logfile_message("Loading sprite '%s'", s);
 
-        if(NULL == hashtable_spriteinfo_t_find(sprites, s))
-            register_sprite(s, spriteinfo_create(nanoparser_get_program(p2)));
+        if(NULL == hashtable_spriteinfo_t_find(sprites, s)) {
+            /* the images will be loaded on demand by pack_sprites() */
+            spriteinfo_t *spr = spriteinfo_parse(nanoparser_get_program(p2));
+            fix_sprite_animations(spr);
+            register_sprite(s, spr);
+        }
         else
             fatal_error("Can't redefine sprite '%s'\nin\"%s\" near line %d", s, nanoparser_get_file(stmt), nanoparser_get_line_number(stmt));
 
@@ -41,6 +41,7 @@ struct animation_t {
     v2d_t hot_spot; /* hot spot */
     image_t **frame_data; /* reference to spriteinfo->frame_data (not another vector) */
     int repeat_from; /* n. if repeat == TRUE, jump back to the n-th frame of the animation. Defaults to zero */
+    spriteinfo_t *sprite; /* the sprite this animation belongs to (may be NULL) */
 };
 
 /* sprite info */
@@ -56,24 +57,44 @@ struct spriteinfo_t {
 
     int animation_count;
     animation_t **animation_data; /* animation_t* vector */
+
+    image_t *source_image; /* shared image over source_rect (it has no pixel data of its own) */
+    image_t *flipped_image[4]; /* lazily built mirrored copies of source_image, indexed by IF_* flags */
+    image_t **flipped_frame_data[4]; /* frames of flipped_image[flags]: image_t* vectors */
+
+    int pending; /* TRUE if it's waiting to be packed into the sprite atlas */
+    int used; /* TRUE if it has been used since the last call to sprite_release_unused() */
+    int holds_sheet; /* TRUE if we hold a reference to the spritesheet (source_image is shared with it) */
 };
 
 
 
 /* === sprite management: public methods === */
 
-/* initializes the sprite module */
-void sprite_init();
+/* initializes the sprite module. The budget of the cache of flipped frames is given in kilobytes */
+void sprite_init(int flip_cache_budget);
 
 /* releases the sprite module */
 void sprite_release();
 
-/* returns the required animation */
+/* tells the sprite module that the given sprite will be needed soon. Sprites
+   are decoded on demand: preloaded sprites are decoded together, in a batch */
+void sprite_preload(const char *sprite_name);
+
+/* returns the required animation (the sprite is decoded if it isn't already) */
 animation_t *sprite_get_animation(const char *sprite_name, int anim_id);
 
 /* returns the specified frame of the given animation */
 struct image_t *sprite_get_image(const animation_t *anim, int frame_id);
 
+/* like sprite_get_image(), but returns a pre-flipped frame according to *flags (IF_HFLIP | IF_VFLIP).
+   The flags that have been applied to the returned image are cleared from *flags */
+struct image_t *sprite_get_image_ex(const animation_t *anim, int frame_id, uint32 *flags);
+
+/* frees the packed sprites that haven't been used since the last call, along with the
+   atlas pages they leave empty. They're decoded again if needed. Call it between levels */
+void sprite_release_unused();
+
 
 
 
@@ -35,6 +35,7 @@
 #include "../scenes/stageselect.h"
 #include "../scenes/questselect.h"
 #include "../scenes/editorhelp.h"
+#include "../scenes/loading.h"
 
 /* private stuff */
 #define STORYBOARD_CAPACITY         64     /* up to this amount of scenes in the storyboard */
@@ -68,6 +69,7 @@ void storyboard_init()
     storyboard[SCENE_STAGESELECT] = scene_create(stageselect_init, stageselect_update, stageselect_render, stageselect_release);
     storyboard[SCENE_QUESTSELECT] = scene_create(questselect_init, questselect_update, questselect_render, questselect_release);
     storyboard[SCENE_EDITORHELP] = scene_create(editorhelp_init, editorhelp_update, editorhelp_render, editorhelp_release);
+    storyboard[SCENE_LOADING] = scene_create(loading_init, loading_update, loading_render, loading_release);
 }
 
 
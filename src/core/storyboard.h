@@ -36,7 +36,8 @@ typedef enum scenetype_t {
     SCENE_OPTIONS,
     SCENE_STAGESELECT,
     SCENE_QUESTSELECT,
-    SCENE_EDITORHELP
+    SCENE_EDITORHELP,
+    SCENE_LOADING
 } scenetype_t;
 
 /* Storyboard */
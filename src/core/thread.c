@@ -0,0 +1,210 @@
+/*
+ * Open Surge Engine
+ * thread.c - threads and mutexes
+ * Copyright (C) 2013  Alexandre Martins <alemartf(at)gmail(dot)com>
+ * http://opensnc.sourceforge.net
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "thread.h"
+#include "util.h"
+
+#ifndef __WIN32__
+#include <pthread.h>
+#include <time.h>
+#else
+#include <winalleg.h>
+#endif
+
+/* private stuff */
+struct thread_t {
+#ifndef __WIN32__
+    pthread_t handle;
+#else
+    HANDLE handle;
+#endif
+    void (*fun)(void*);
+    void *arg;
+};
+
+struct mutex_t {
+#ifndef __WIN32__
+    pthread_mutex_t handle;
+#else
+    CRITICAL_SECTION handle;
+#endif
+};
+
+#ifndef __WIN32__
+static void* thread_entry(void *thread);
+#else
+static DWORD WINAPI thread_entry(LPVOID thread);
+#endif
+
+
+
+/* public methods */
+
+/*
+ * thread_create()
+ * Runs fun(arg) in a new thread
+ */
+thread_t* thread_create(void (*fun)(void*), void *arg)
+{
+    thread_t *thread = mallocx(sizeof *thread);
+
+    thread->fun = fun;
+    thread->arg = arg;
+
+#ifndef __WIN32__
+    if(pthread_create(&(thread->handle), NULL, thread_entry, thread) != 0)
+        fatal_error("Can't create a new thread");
+#else
+    if(NULL == (thread->handle = CreateThread(NULL, 0, thread_entry, thread, 0, NULL)))
+        fatal_error("Can't create a new thread");
+#endif
+
+    return thread;
+}
+
+/*
+ * thread_join()
+ * Waits for the given thread to finish, then releases it
+ */
+thread_t* thread_join(thread_t *thread)
+{
+#ifndef __WIN32__
+    pthread_join(thread->handle, NULL);
+#else
+    WaitForSingleObject(thread->handle, INFINITE);
+    CloseHandle(thread->handle);
+#endif
+
+    free(thread);
+    return NULL;
+}
+
+/*
+ * mutex_create()
+ * Creates a new mutex
+ */
+mutex_t* mutex_create()
+{
+    mutex_t *mutex = mallocx(sizeof *mutex);
+
+#ifndef __WIN32__
+    pthread_mutex_init(&(mutex->handle), NULL);
+#else
+    InitializeCriticalSection(&(mutex->handle));
+#endif
+
+    return mutex;
+}
+
+/*
+ * mutex_destroy()
+ * Destroys a mutex
+ */
+mutex_t* mutex_destroy(mutex_t *mutex)
+{
+#ifndef __WIN32__
+    pthread_mutex_destroy(&(mutex->handle));
+#else
+    DeleteCriticalSection(&(mutex->handle));
+#endif
+
+    free(mutex);
+    return NULL;
+}
+
+/*
+ * mutex_lock()
+ * Locks a mutex
+ */
+void mutex_lock(mutex_t *mutex)
+{
+#ifndef __WIN32__
+    pthread_mutex_lock(&(mutex->handle));
+#else
+    EnterCriticalSection(&(mutex->handle));
+#endif
+}
+
+/*
+ * mutex_unlock()
+ * Unlocks a mutex
+ */
+void mutex_unlock(mutex_t *mutex)
+{
+#ifndef __WIN32__
+    pthread_mutex_unlock(&(mutex->handle));
+#else
+    LeaveCriticalSection(&(mutex->handle));
+#endif
+}
+
+
+/*
+ * thread_barrier()
+ * Memory barrier: the reads and writes made before
+ * this call are completed before the ones made after it.
+ * Needed by lock-free structures shared between threads
+ */
+void thread_barrier()
+{
+#if defined(__GNUC__)
+    __sync_synchronize();
+#else
+    MemoryBarrier();
+#endif
+}
+
+
+/*
+ * thread_sleep()
+ * Suspends the calling thread for a few milliseconds
+ */
+void thread_sleep(int milliseconds)
+{
+#ifndef __WIN32__
+    struct timespec t;
+    t.tv_sec = milliseconds / 1000;
+    t.tv_nsec = (long)(milliseconds % 1000) * 1000000L;
+    nanosleep(&t, NULL);
+#else
+    Sleep(milliseconds);
+#endif
+}
+
+
+
+/* private methods */
+
+#ifndef __WIN32__
+void* thread_entry(void *thread)
+{
+    thread_t *t = (thread_t*)thread;
+    t->fun(t->arg);
+    return NULL;
+}
+#else
+DWORD WINAPI thread_entry(LPVOID thread)
+{
+    thread_t *t = (thread_t*)thread;
+    t->fun(t->arg);
+    return 0;
+}
+#endif
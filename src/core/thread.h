@@ -0,0 +1,51 @@
+/*
+ * Open Surge Engine
+ * thread.h - threads and mutexes
+ * Copyright (C) 2013  Alexandre Martins <alemartf(at)gmail(dot)com>
+ * http://opensnc.sourceforge.net
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _THREAD_H
+#define _THREAD_H
+
+/*
+ * A thin layer over the threads of the operating system
+ * (POSIX threads on *nix, Win32 threads on Windows).
+ *
+ * Most of the engine (Allegro included) is NOT thread-safe:
+ * worker threads must not touch it. Use them for plain C work.
+ */
+
+typedef struct thread_t thread_t;
+typedef struct mutex_t mutex_t;
+
+/* threads */
+thread_t* thread_create(void (*fun)(void*), void *arg); /* runs fun(arg) in a new thread */
+thread_t* thread_join(thread_t *thread); /* waits for the thread to finish and releases it. Returns NULL */
+void thread_sleep(int milliseconds); /* suspends the calling thread */
+
+/* mutexes */
+mutex_t* mutex_create();
+mutex_t* mutex_destroy(mutex_t *mutex); /* returns NULL */
+void mutex_lock(mutex_t *mutex);
+void mutex_unlock(mutex_t *mutex);
+
+/* memory barrier: the memory accesses made before it are seen
+   by the other threads before the ones made after it */
+void thread_barrier();
+
+#endif
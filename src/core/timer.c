@@ -28,7 +28,7 @@
 #include "logfile.h"
 
 #ifndef __WIN32__
-#include <sys/time.h>
+#include <time.h>
 #else
 #include <winalleg.h>
 #endif
@@ -37,21 +37,42 @@
 
 
 /* constants */
-#define MIN_FRAME_INTERVAL 15 /* (1/15) * 1000 ~ 67 fps max */
-#define MAX_FRAME_INTERVAL 17 /* (1/17) * 1000 ~ 58 fps min */
+#define DEFAULT_STEP_RATE   60 /* logic steps per second */
+#define DEFAULT_MAX_FPS     60 /* rendered frames per second (0 = uncapped) */
+#define MAX_STEPS_PER_FRAME 5  /* if the computer is too slow, the game slows down beyond this */
+#define NS_PER_SECOND       1000000000ULL
+
+#ifndef __WIN32__
+#define SPIN_MARGIN         1000000ULL /* in nanoseconds: we sleep until the deadline minus this, then spin */
+#else
+#define SPIN_MARGIN         2000000ULL /* Sleep() is less accurate */
+#endif
 
 
 /* internal data */
-static int partial_fps, fps_accum, fps;
-static uint32 last_time;
-static float delta;
+static int partial_fps, fps;
+static uint64 fps_accum; /* in nanoseconds */
+static uint64 last_time; /* when the last frame began, in nanoseconds */
+static uint64 deadline; /* when the next frame is due, in nanoseconds */
+static float delta; /* what timer_get_delta() returns */
+static float frame_delta; /* time between the last two frames, in seconds */
+static float step_delta; /* duration of a logic step, in seconds */
+static float accumulator; /* time not yet simulated, in seconds */
+static float interpolation; /* what timer_get_interpolation() returns */
+static uint32 step_count;
+static uint64 frame_interval; /* in nanoseconds; 0 = uncapped */
+static int step_rate; /* logic steps per second */
+static int unpaced; /* one step per frame, regardless of the clock? */
+static int step_clock; /* timer_get_ticks() counts logic steps? */
 static int must_yield_cpu;
-static volatile uint32 elapsed_time;
-static uint32 start_time;
+static uint64 start_time; /* in nanoseconds */
+
+static uint32 real_ticks(); /* elapsed milliseconds, even if step_clock is set */
+static void wait_until(uint64 t); /* waits until timer_get_nanoseconds() >= t */
 
 /* platform-specific code */
-static uint32 get_tick_count(); /* tell me the time */
-static void yield_cpu(); /* we don't like using 100% of the cpu */
+static uint64 get_clock(); /* monotonic clock, in nanoseconds */
+static void sleep_for(uint64 ns); /* may wake up a bit later */
 
 
 /*
@@ -74,11 +95,17 @@ void timer_init(int optimize_cpu_usage)
     partial_fps = 0;
     fps_accum = 0;
     fps = 0;
-    delta = 0.0;
-    start_time = get_tick_count();
+    delta = frame_delta = accumulator = 0.0f;
+    interpolation = 1.0f;
+    step_count = 0;
+    timer_set_step_rate(DEFAULT_STEP_RATE);
+    timer_set_max_fps(DEFAULT_MAX_FPS);
+    unpaced = FALSE;
+    step_clock = FALSE;
+    start_time = get_clock();
 
     /* done! */
-    last_time = timer_get_ticks();
+    last_time = deadline = timer_get_nanoseconds();
 }
 
 
@@ -86,42 +113,80 @@ void timer_init(int optimize_cpu_usage)
  * timer_update()
  * Updates the Time Handler. This routine
  * must be called at every cycle of
- * the main loop
+ * the main loop (i.e., once per frame)
  */
 void timer_update()
 {
-    uint32 current_time, delta_time; /* both in milliseconds */
-
-    /* time control */
-    for(delta_time = 0 ;;) {
-        current_time = timer_get_ticks();
-        delta_time = (current_time > last_time) ? (current_time - last_time) : 0;
-        last_time = (current_time >= last_time) ? last_time : current_time;
-
-        if(delta_time < MIN_FRAME_INTERVAL) {
-            if(must_yield_cpu) {
-                /* we don't like having the cpu usage at 100%. */
-                /* will the OS make our process active again on time? */
-                yield_cpu();
-            }
-        }
-        else
-            break;
+    uint64 current_time, delta_time; /* both in nanoseconds */
+
+    /* frame pacing: each frame is due at an absolute deadline, so
+       that the error of a frame doesn't accumulate over the next ones */
+    if(!unpaced && frame_interval > 0)
+        wait_until(deadline);
+
+    current_time = timer_get_nanoseconds();
+    delta_time = current_time - last_time;
+    last_time = current_time;
+
+    /* the next deadline. If we're late by more than a frame, we
+       start over from now instead of trying to catch up */
+    deadline += frame_interval;
+    if(current_time > deadline + frame_interval)
+        deadline = current_time + frame_interval;
+
+    if(!unpaced) {
+        frame_delta = min((float)((double)delta_time / (double)NS_PER_SECOND), MAX_STEPS_PER_FRAME * step_delta);
+        accumulator = min(accumulator + frame_delta, MAX_STEPS_PER_FRAME * step_delta);
     }
-    delta_time = min(delta_time, MAX_FRAME_INTERVAL);
-    delta = (float)delta_time * 0.001;
+    else {
+        /* the game runs as fast as possible, one step per frame */
+        frame_delta = step_delta;
+        accumulator = step_delta;
+    }
+    delta = frame_delta;
+    interpolation = min(accumulator / step_delta, 1.0f);
 
     /* FPS (frames per second) */
     partial_fps++; /* 1 render per cycle */
-    fps_accum += (int)delta_time;
-    if(fps_accum >= 1000) {
+    fps_accum += delta_time;
+    if(fps_accum >= NS_PER_SECOND) {
         fps = partial_fps;
         partial_fps = 0;
         fps_accum = 0;
     }
+}
 
-    /* done! */
-    last_time = timer_get_ticks();
+
+/*
+ * timer_begin_step()
+ * The logic runs in fixed steps. Call this in a loop after
+ * timer_update(): while it returns TRUE, update the logic
+ * and then call timer_end_step(). Within a step,
+ * timer_get_delta() is the duration of the step.
+ */
+int timer_begin_step()
+{
+    if(accumulator < step_delta)
+        return FALSE;
+
+    accumulator -= step_delta;
+    step_count++;
+    delta = step_delta;
+    interpolation = 1.0f;
+    return TRUE;
+}
+
+
+/*
+ * timer_end_step()
+ * Ends a logic step. Until the next one begins,
+ * timer_get_delta() is the duration of the frame
+ * (so that rendering stuff is paced in real time)
+ */
+void timer_end_step()
+{
+    delta = frame_delta;
+    interpolation = min(accumulator / step_delta, 1.0f);
 }
 
 
@@ -147,6 +212,74 @@ float timer_get_delta()
 }
 
 
+/*
+ * timer_get_interpolation()
+ * When rendering, how far we are from the last logic step
+ * to the next one: 0.0 <= interpolation <= 1.0. Render
+ * things at previous + (current - previous) * interpolation.
+ * Within a step, this is 1.0 (no interpolation)
+ */
+float timer_get_interpolation()
+{
+    return interpolation;
+}
+
+
+/*
+ * timer_get_step_count()
+ * How many logic steps have been run so far
+ */
+uint32 timer_get_step_count()
+{
+    return step_count;
+}
+
+
+/*
+ * timer_set_step_rate()
+ * Sets how many logic steps run per second
+ */
+void timer_set_step_rate(int steps_per_second)
+{
+    step_rate = clip(steps_per_second, 10, 1000);
+    step_delta = 1.0f / (float)step_rate;
+}
+
+
+/*
+ * timer_set_max_fps()
+ * Caps the frame rate. 0 means uncapped
+ */
+void timer_set_max_fps(int max_fps)
+{
+    frame_interval = (max_fps > 0) ? NS_PER_SECOND / (uint64)max_fps : 0;
+    deadline = timer_get_nanoseconds();
+}
+
+
+/*
+ * timer_set_unpaced()
+ * If TRUE, each frame runs exactly one logic step, without
+ * waiting for the clock. Used when there's no one watching
+ */
+void timer_set_unpaced(int is_unpaced)
+{
+    unpaced = is_unpaced;
+}
+
+
+/*
+ * timer_use_step_clock()
+ * If TRUE, timer_get_ticks() tells the time of the
+ * logic steps instead of the real time, so that a run
+ * doesn't depend on the speed of the machine (replays)
+ */
+void timer_use_step_clock(int use_step_clock)
+{
+    step_clock = use_step_clock;
+}
+
+
 /*
  * timer_get_ticks()
  * Elapsed milliseconds since
@@ -154,10 +287,22 @@ float timer_get_delta()
  */
 uint32 timer_get_ticks()
 {
-    uint32 ticks = get_tick_count();
-    if(ticks < start_time)
-        start_time = ticks;
-    return ticks - start_time;
+    if(step_clock)
+        return (uint32)((double)step_count * 1000.0 / (double)step_rate);
+    else
+        return real_ticks();
+}
+
+
+/*
+ * timer_get_nanoseconds()
+ * High-resolution monotonic clock: elapsed
+ * nanoseconds since some point in the past.
+ * It's not affected by the step clock
+ */
+uint64 timer_get_nanoseconds()
+{
+    return get_clock();
 }
 
 
@@ -194,33 +339,64 @@ void timer_optimize_cpu_usage(int optimize)
 
 
 
+/* private functions */
+
+uint32 real_ticks()
+{
+    return (uint32)((get_clock() - start_time) / 1000000ULL);
+}
+
+/* sleeps until a bit before t (if we're optimizing the
+   cpu usage), then spins until t. The OS may not wake us
+   up on time, so the last SPIN_MARGIN nanoseconds are spent
+   checking the clock */
+void wait_until(uint64 t)
+{
+    uint64 now;
+
+    while((now = timer_get_nanoseconds()) < t) {
+        if(must_yield_cpu && t - now > SPIN_MARGIN)
+            sleep_for(t - now - SPIN_MARGIN);
+    }
+}
+
+
 /* platform-specific code */
 
 #ifndef __WIN32__
 
-uint32 get_tick_count()
+uint64 get_clock()
 {
-    static struct timeval now;
-    gettimeofday(&now, NULL);
-    return (now.tv_sec*1000) + (now.tv_usec/1000);
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64)now.tv_sec * NS_PER_SECOND + (uint64)now.tv_nsec;
 }
 
-
-void yield_cpu()
+void sleep_for(uint64 ns)
 {
-    rest(1); /* don't use rest(0) */
+    struct timespec t;
+    t.tv_sec = (time_t)(ns / NS_PER_SECOND);
+    t.tv_nsec = (long)(ns % NS_PER_SECOND);
+    nanosleep(&t, NULL); /* if it's interrupted, wait_until() will try again */
 }
 
 #else
 
-uint32 get_tick_count()
+uint64 get_clock()
 {
-    return GetTickCount();
+    static LARGE_INTEGER freq = { 0 };
+    LARGE_INTEGER now;
+
+    if(freq.QuadPart == 0)
+        QueryPerformanceFrequency(&freq);
+
+    QueryPerformanceCounter(&now);
+    return (uint64)(now.QuadPart / freq.QuadPart) * NS_PER_SECOND + (uint64)((now.QuadPart % freq.QuadPart) * NS_PER_SECOND / freq.QuadPart);
 }
 
-void yield_cpu()
+void sleep_for(uint64 ns)
 {
-    Sleep(1);
+    Sleep(max(1, (DWORD)(ns / 1000000ULL)));
 }
 
 #endif
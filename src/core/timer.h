@@ -32,8 +32,19 @@ void timer_release();
 /* main utilities */
 float timer_get_delta();
 uint32 timer_get_ticks();
+uint64 timer_get_nanoseconds(); /* high-resolution monotonic clock */
 int timer_get_fps();
 
+/* fixed timestep: the logic runs at a constant rate, regardless of the frame rate */
+int timer_begin_step(); /* returns TRUE if a logic step is due */
+void timer_end_step();
+float timer_get_interpolation(); /* for rendering: 0.0 (previous step) <= interpolation <= 1.0 (current step) */
+uint32 timer_get_step_count();
+void timer_set_step_rate(int steps_per_second);
+void timer_set_max_fps(int max_fps); /* 0 = uncapped */
+void timer_set_unpaced(int unpaced); /* if TRUE, each frame runs exactly one step, as fast as possible (headless mode) */
+void timer_use_step_clock(int use_step_clock); /* if TRUE, timer_get_ticks() counts the time of the logic steps (replays) */
+
 /* optimize cpu usage? */
 int timer_is_cpu_usage_optimized();
 void timer_optimize_cpu_usage(int optimize);
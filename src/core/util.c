@@ -176,10 +176,11 @@ void fatal_error(const char *fmt, ...)
     va_list args;
 
     va_start(args, fmt);
-    vsprintf(buf, fmt, args);
+    vsnprintf(buf, sizeof(buf), fmt, args);
     va_end(args);
 
-    logfile_message(buf);
+    logfile_message_ex(LOGFILE_ERROR, "%s", buf);
+    logfile_flush(); /* the program is about to die */
     set_gfx_mode(GFX_TEXT, 0, 0, 0, 0);
     allegro_message("%s", buf);
     exit(1);
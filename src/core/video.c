@@ -42,6 +42,7 @@ static int video_smooth;
 static int video_resolution;
 static int video_fullscreen;
 static int video_showfps;
+static int video_headless; /* no window? */
 static void fast2x_blit(image_t *src, image_t *dest);
 static void smooth2x_blit(image_t *src, image_t *dest);
 static void smooth3x_blit(image_t *src, image_t *dest);
@@ -72,9 +73,10 @@ static char videomsg_data[512];
  * video_init()
  * Initializes the video manager
  */
-void video_init(const char *window_title, int resolution, int smooth, int fullscreen, int bpp)
+void video_init(const char *window_title, int resolution, int smooth, int fullscreen, int bpp, int headless)
 {
     logfile_message("video_init()");
+    video_headless = headless;
     setup_color_depth(bpp);
 
     /* initializing addons */
@@ -88,6 +90,14 @@ void video_init(const char *window_title, int resolution, int smooth, int fullsc
     window_surface = window_surface_half = NULL;
     video_changemode(resolution, smooth, fullscreen);
 
+    /* headless mode */
+    if(video_headless) {
+        logfile_message("video_init(): headless mode");
+        window_active = TRUE;
+        videomsg_endtime = 0;
+        return;
+    }
+
     /* window properties */
     LOCK_FUNCTION(game_quit);
     set_close_button_callback(game_quit);
@@ -165,6 +175,11 @@ void video_changemode(int resolution, int smooth, int fullscreen)
     image_clear(window_surface_half, image_rgb(0,0,0));
 
     /* setting up the window... */
+    if(video_headless) {
+        logfile_message("video_changemode() ok (headless)");
+        return;
+    }
+
     logfile_message("setting up the window...");
     mode = video_fullscreen ? GFX_AUTODETECT : GFX_AUTODETECT_WINDOWED;
     width = (int)(video_get_window_size().x);
@@ -284,6 +299,10 @@ image_t* video_get_backbuffer()
  */
 void video_render()
 {
+    /* there's no window */
+    if(video_headless)
+        return;
+
     /* video message */
     if(timer_get_ticks() < videomsg_endtime)
         textout_ex(IMAGE2BITMAP(video_get_backbuffer()), font, videomsg_data, 0, VIDEO_SCREEN_H-text_height(font), makecol(255,255,255), makecol(0,0,0));
@@ -293,14 +312,19 @@ void video_render()
         textprintf_right_ex(IMAGE2BITMAP(video_get_backbuffer()), font, VIDEO_SCREEN_W, 0, makecol(255,255,255), makecol(0,0,0),"FPS:%3d", timer_get_fps());
 
     /* render */
-    switch(video_get_resolution()) {
-        /* tiny window */
-        case VIDEORESOLUTION_1X:
-        {
-            draw_to_screen(video_get_backbuffer());
-            break;
-        }
+    draw_to_screen(video_scale_backbuffer());
+}
+
 
+/*
+ * video_scale_backbuffer()
+ * Scales the backbuffer to the size of the window,
+ * according to the video resolution, and returns
+ * the result. video_render() does this every frame
+ */
+image_t* video_scale_backbuffer()
+{
+    switch(video_get_resolution()) {
         /* double size */
         case VIDEORESOLUTION_2X:
         {
@@ -311,8 +335,7 @@ void video_render()
             else
                 smooth2x_blit(video_get_backbuffer(), tmp);
 
-            draw_to_screen(tmp);
-            break;
+            return tmp;
         }
 
         /* triple size */
@@ -328,8 +351,7 @@ void video_render()
             else
                 smooth3x_blit(video_get_backbuffer(), tmp);
 
-            draw_to_screen(tmp);
-            break;
+            return tmp;
         }
 
         /* quadruple size */
@@ -345,16 +367,12 @@ void video_render()
             else
                 smooth4x_blit(video_get_backbuffer(), tmp);
 
-            draw_to_screen(tmp);
-            break;
+            return tmp;
         }
 
-        /* level editor */
-        case VIDEORESOLUTION_EDT:
-        {
-            draw_to_screen(video_get_backbuffer());
-            break;
-        }
+        /* tiny window & level editor */
+        default:
+            return video_get_backbuffer();
     }
 }
 
@@ -396,6 +414,16 @@ void video_showmessage(const char *fmt, ...)
 }
 
 
+/*
+ * video_is_headless()
+ * Are we running without a window?
+ */
+int video_is_headless()
+{
+    return video_headless;
+}
+
+
 /*
  * video_get_color_depth()
  * Returns the current color depth
@@ -33,12 +33,13 @@
 #define VIDEORESOLUTION_EDT       4 /* level editor (the window size varies) */
 
 /* video manager */
-void video_init(const char *window_title, int resolution, int smooth, int fullscreen, int bpp);
+void video_init(const char *window_title, int resolution, int smooth, int fullscreen, int bpp, int headless); /* if headless, there's no window: we render to an offscreen backbuffer */
 void video_release();
 void video_render();
 int video_get_desktop_color_depth();
 int video_get_color_depth();
 int video_is_window_active();
+int video_is_headless(); /* running without a window? */
 uint32 video_get_maskcolor();
 void video_changemode(int resolution, int smooth, int fullscreen);
 int video_get_resolution();
@@ -52,6 +53,7 @@ const image_t* video_get_window_surface();
 #define VIDEO_SCREEN_W            ((int)(video_get_playarea_size().x))
 #define VIDEO_SCREEN_H            ((int)(video_get_playarea_size().y))
 image_t *video_get_backbuffer();
+image_t *video_scale_backbuffer(); /* scales the backbuffer to the window size, as video_render() does */
 
 /* fps counter */
 void video_show_fps(int show);
@@ -34,6 +34,7 @@
 /* constants */
 #define MAGIC_DIFF              -2  /* platform movement & collision detectors magic */
 #define SIDE_CORNERS_HEIGHT     0.5 /* height of the left/right sensors */
+#define MAX_INTERPOLATION_DIST  128 /* actors that move farther than this in a single step have been teleported */
 
 
 /* private data */
@@ -44,9 +45,13 @@ static int is_leftwall_disabled = FALSE;
 static int is_rightwall_disabled = FALSE;
 static int is_floor_disabled = FALSE;
 static int is_ceiling_disabled = FALSE;
+static actor_t **actor_table = NULL; /* all the actors */
+static int actor_table_count = 0, actor_table_capacity = 0;
 
 /* private functions */
 static void calculate_rotated_boundingbox(const actor_t *act, v2d_t spot[4]);
+static image_t* actor_image_ex(const actor_t *act, uint32 *flags);
+static v2d_t interpolated_position(const actor_t *act);
 
 
 /* actor functions */
@@ -77,6 +82,17 @@ actor_t* actor_create()
     act->hot_spot = v2d_new(0,0);
     act->scale = v2d_new(1.0f, 1.0f);
 
+    act->previous_position = act->position;
+    act->previous_step = 0;
+
+    /* register the actor */
+    if(actor_table_count >= actor_table_capacity) {
+        actor_table_capacity = max(256, 2 * actor_table_capacity);
+        actor_table = reallocx(actor_table, actor_table_capacity * sizeof *actor_table);
+    }
+    act->table_index = actor_table_count;
+    actor_table[actor_table_count++] = act;
+
     return act;
 }
 
@@ -89,10 +105,38 @@ void actor_destroy(actor_t *act)
 {
     if(act->input)
         input_destroy(act->input);
+
+    /* unregister the actor */
+    actor_table[act->table_index] = actor_table[--actor_table_count];
+    actor_table[act->table_index]->table_index = act->table_index;
+    if(actor_table_count == 0) {
+        free(actor_table);
+        actor_table = NULL;
+        actor_table_capacity = 0;
+    }
+
     free(act);
 }
 
 
+/*
+ * actor_begin_step()
+ * Call this at the beginning of each logic step (after
+ * timer_begin_step()): every actor remembers where it is,
+ * so that it can be rendered between the last two steps
+ */
+void actor_begin_step()
+{
+    uint32 step = timer_get_step_count();
+    int i;
+
+    for(i=0; i<actor_table_count; i++) {
+        actor_table[i]->previous_position = actor_table[i]->position;
+        actor_table[i]->previous_step = step;
+    }
+}
+
+
 /*
  * actor_render()
  * Default rendering function
@@ -100,6 +144,8 @@ void actor_destroy(actor_t *act)
 void actor_render(actor_t *act, v2d_t camera_position)
 {
     image_t *img;
+    uint32 flags;
+    v2d_t position;
 
     if(act->visible && act->animation) {
         /* update animation */
@@ -120,15 +166,22 @@ void actor_render(actor_t *act, v2d_t camera_position)
         }
 
         /* render */
-        img = actor_image(act);
-        if(fabs(act->angle) > EPSILON)
-           image_draw_rotated(img, video_get_backbuffer(), (int)(act->position.x-(camera_position.x-VIDEO_SCREEN_W/2)), (int)(act->position.y-(camera_position.y-VIDEO_SCREEN_H/2)), (int)act->hot_spot.x, (int)act->hot_spot.y, act->angle, act->mirror);
-        else if(fabs(act->alpha - 1.0f) > EPSILON)
-           image_draw_trans(img, video_get_backbuffer(), (int)(act->position.x-act->hot_spot.x-(camera_position.x-VIDEO_SCREEN_W/2)), (int)(act->position.y-act->hot_spot.y-(camera_position.y-VIDEO_SCREEN_H/2)), act->alpha, act->mirror);
-        else if(fabs(act->scale.x - 1.0f) > EPSILON || fabs(act->scale.y - 1.0f) > EPSILON)
-           image_draw_scaled(img, video_get_backbuffer(), (int)(act->position.x-act->hot_spot.x*act->scale.x-(camera_position.x-VIDEO_SCREEN_W/2)), (int)(act->position.y-act->hot_spot.y*act->scale.y-(camera_position.y-VIDEO_SCREEN_H/2)), act->scale, act->mirror);
-        else
-           image_draw(img, video_get_backbuffer(), (int)(act->position.x-act->hot_spot.x-(camera_position.x-VIDEO_SCREEN_W/2)), (int)(act->position.y-act->hot_spot.y-(camera_position.y-VIDEO_SCREEN_H/2)), act->mirror);
+        position = interpolated_position(act);
+        if(fabs(act->angle) > EPSILON) {
+           img = actor_image(act);
+           image_draw_rotated(img, video_get_backbuffer(), (int)(position.x-(camera_position.x-VIDEO_SCREEN_W/2)), (int)(position.y-(camera_position.y-VIDEO_SCREEN_H/2)), (int)act->hot_spot.x, (int)act->hot_spot.y, act->angle, act->mirror);
+        }
+        else {
+           /* no rotation: we may use a pre-flipped frame */
+           flags = act->mirror;
+           img = actor_image_ex(act, &flags);
+           if(fabs(act->alpha - 1.0f) > EPSILON)
+              image_draw_trans(img, video_get_backbuffer(), (int)(position.x-act->hot_spot.x-(camera_position.x-VIDEO_SCREEN_W/2)), (int)(position.y-act->hot_spot.y-(camera_position.y-VIDEO_SCREEN_H/2)), act->alpha, flags);
+           else if(fabs(act->scale.x - 1.0f) > EPSILON || fabs(act->scale.y - 1.0f) > EPSILON)
+              image_draw_scaled(img, video_get_backbuffer(), (int)(position.x-act->hot_spot.x*act->scale.x-(camera_position.x-VIDEO_SCREEN_W/2)), (int)(position.y-act->hot_spot.y*act->scale.y-(camera_position.y-VIDEO_SCREEN_H/2)), act->scale, flags);
+           else
+              image_draw(img, video_get_backbuffer(), (int)(position.x-act->hot_spot.x-(camera_position.x-VIDEO_SCREEN_W/2)), (int)(position.y-act->hot_spot.y-(camera_position.y-VIDEO_SCREEN_H/2)), flags);
+        }
     }
 }
 
@@ -141,7 +194,8 @@ void actor_render(actor_t *act, v2d_t camera_position)
 void actor_render_repeat_xy(actor_t *act, v2d_t camera_position, int repeat_x, int repeat_y)
 {
     int i, j, w, h;
-    image_t *img = actor_image(act);
+    uint32 flags = act->mirror;
+    image_t *img = actor_image_ex(act, &flags);
     v2d_t final_pos;
 
     final_pos.x = (int)act->position.x%(repeat_x?image_width(img):INT_MAX) - act->hot_spot.x-(camera_position.x-VIDEO_SCREEN_W/2) - (repeat_x?image_width(img):0);
@@ -149,20 +203,14 @@ void actor_render_repeat_xy(actor_t *act, v2d_t camera_position, int repeat_x, i
 
     if(act->visible && act->animation) {
         /* update animation */
-        act->animation_frame += (act->animation->fps * act->animation_speed_factor) * timer_get_delta();
-        if((int)act->animation_frame >= act->animation->frame_count) {
-            if(act->animation->repeat)
-                act->animation_frame = (((int)act->animation_frame % act->animation->frame_count) + act->animation->repeat_from) % act->animation->frame_count;
-            else
-                act->animation_frame = act->animation->frame_count-1;
-        }
+        actor_animate(act);
 
         /* render */
         w = repeat_x ? (VIDEO_SCREEN_W/image_width(img) + 3) : 1;
         h = repeat_y ? (VIDEO_SCREEN_H/image_height(img) + 3) : 1;
         for(i=0; i<w; i++) {
             for(j=0; j<h; j++)
-                image_draw(img, video_get_backbuffer(), (int)final_pos.x + i*image_width(img), (int)final_pos.y + j*image_height(img), act->mirror);
+                image_draw(img, video_get_backbuffer(), (int)final_pos.x + i*image_width(img), (int)final_pos.y + j*image_height(img), flags);
         }
     }
 }
@@ -247,7 +295,16 @@ int actor_orientedbox_collision(const actor_t *a, const actor_t *b)
  */
 int actor_pixelperfect_collision(const actor_t *a, const actor_t *b)
 {
-    if(fabs(a->angle) < EPSILON && fabs(b->angle) < EPSILON && a->mirror == IF_NONE && b->mirror == IF_NONE) {
+    uint32 flags_a = a->mirror, flags_b = b->mirror;
+    image_t *image_a = NULL, *image_b = NULL;
+
+    /* mirrored actors may use pre-flipped frames */
+    if(fabs(a->angle) < EPSILON && fabs(b->angle) < EPSILON) {
+        image_a = actor_image_ex(a, &flags_a);
+        image_b = actor_image_ex(b, &flags_b);
+    }
+
+    if(fabs(a->angle) < EPSILON && fabs(b->angle) < EPSILON && flags_a == IF_NONE && flags_b == IF_NONE) {
         if(actor_collision(a, b)) {
             int x1, y1, x2, y2;
 
@@ -256,14 +313,13 @@ int actor_pixelperfect_collision(const actor_t *a, const actor_t *b)
             x2 = (int)(b->position.x - b->hot_spot.x);
             y2 = (int)(b->position.y - b->hot_spot.y);
 
-            return image_pixelperfect_collision(actor_image(a), actor_image(b), x1, y1, x2, y2);
+            return image_pixelperfect_collision(image_a, image_b, x1, y1, x2, y2);
         }
         else
             return FALSE;
     }
     else {
         if(actor_orientedbox_collision(a, b)) {
-            image_t *image_a, *image_b;
             v2d_t size_a, size_b, pos_a, pos_b;
             v2d_t a_spot[4], b_spot[4]; /* rotated spots */
             v2d_t ac, bc; /* rotation spot */
@@ -382,6 +438,23 @@ void actor_synchronize_animation(actor_t *act, int sync)
 }
 
 
+/*
+ * actor_animate()
+ * Advances the animation frame at the pace of the
+ * animation, without rendering the actor
+ */
+void actor_animate(actor_t *act)
+{
+    act->animation_frame += (act->animation->fps * act->animation_speed_factor) * timer_get_delta();
+    if((int)act->animation_frame >= act->animation->frame_count) {
+        if(act->animation->repeat)
+            act->animation_frame = (((int)act->animation_frame % act->animation->frame_count) + act->animation->repeat_from) % act->animation->frame_count;
+        else
+            act->animation_frame = act->animation->frame_count-1;
+    }
+}
+
+
 /*
  * actor_image()
  * Returns the current image of the
@@ -575,6 +648,38 @@ static brick_t* brick_at(const brick_list_t *list, v2d_t spot)
 }
 
 
+/*
+ * actor_image_ex()
+ * Like actor_image(), but it may return a pre-flipped frame.
+ * The flags that have been applied are cleared from *flags.
+ */
+image_t* actor_image_ex(const actor_t *act, uint32 *flags)
+{
+    return sprite_get_image_ex(act->animation, (int)act->animation_frame, flags);
+}
+
+
+/*
+ * interpolated_position()
+ * Where the actor should be rendered: between its positions
+ * at the end of the last two logic steps (see timer.h)
+ */
+v2d_t interpolated_position(const actor_t *act)
+{
+    v2d_t ds;
+
+    /* the actor has been created during the last step */
+    if(act->previous_step != timer_get_step_count())
+        return act->position;
+
+    ds = v2d_subtract(act->position, act->previous_position);
+    if(fabs(ds.x) > MAX_INTERPOLATION_DIST || fabs(ds.y) > MAX_INTERPOLATION_DIST)
+        return act->position;
+
+    return v2d_add(act->previous_position, v2d_multiply(ds, timer_get_interpolation()));
+}
+
+
 /*
  * calculate_rotated_boundingbox()
  * Calculates the rotated bounding box of a given actor
@@ -51,12 +51,18 @@ typedef struct actor_t {
     v2d_t hot_spot; /* anchor */
     v2d_t scale; /* scale */
 
+    /* rendering between logic steps */
+    v2d_t previous_position; /* position at the end of the previous step */
+    uint32 previous_step; /* the step that began at previous_position (0 = none) */
+    int table_index; /* private: see actor_begin_step() */
+
 } actor_t;
 
 
 /* actor functions */
 actor_t* actor_create();
 void actor_destroy(actor_t *act);
+void actor_begin_step(); /* call at the beginning of each logic step: the actors remember where they are */
 void actor_render(actor_t *act, v2d_t camera_position);
 void actor_render_repeat_xy(actor_t *act, v2d_t camera_position, int repeat_x, int repeat_y);
 
@@ -67,6 +73,7 @@ void actor_change_animation_speed_factor(actor_t *act, float factor); /* default
 void actor_change_animation(actor_t *act, animation_t *anim);
 int actor_animation_finished(actor_t *act); /* true if the current animation has finished */
 void actor_synchronize_animation(actor_t *act, int sync); /* should I use a shared animation frame? */
+void actor_animate(actor_t *act); /* advances the animation frame without rendering the actor */
 
 /* collision detection */
 int actor_collision(const actor_t *a, const actor_t *b); /* tests bounding-box collision between a and b */
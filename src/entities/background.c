@@ -20,20 +20,27 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include "background.h"
 #include "actor.h"
 #include "../core/sprite.h"
 #include "../core/video.h"
+#include "../core/image.h"
 #include "../core/osspec.h"
 #include "../core/util.h"
 #include "../core/stringutil.h"
 #include "../core/logfile.h"
 #include "../core/timer.h"
 #include "../core/nanoparser/nanoparser.h"
+#include "../core/scriptcache.h"
+
+/* constants */
+#define BGGROUP_MAX_SIZE            2048 /* maximum width/height of a composited group */
 
 /* forward declarations */
 typedef struct background_t background_t;
+typedef struct bggroup_t bggroup_t;
 typedef struct bgstrategy_t bgstrategy_t;
 typedef struct bgstrategy_default_t bgstrategy_default_t;
 typedef struct bgstrategy_circular_t bgstrategy_circular_t;
@@ -43,7 +50,20 @@ typedef struct bgstrategy_linear_t bgstrategy_linear_t;
 struct bgtheme_t {
     background_t **data; /* array of background_t* */
     int length; /* length of the data vector */
+    bggroup_t **group; /* array of bggroup_t*: a partition of the data vector */
+    int group_count; /* length of the group vector */
+};
+
+/* === bggroup struct (adjacent static layers composited into a single surface) === */
+struct bggroup_t {
+    int first, length; /* these are the layers data[first .. first+length-1] of the theme */
+    image_t *strip; /* cached composition. NULL if it hasn't been built yet */
+    image_t **frame; /* the frames of the layers that have been used to build the strip */
+    int offset_x, offset_y; /* position of the strip relative to the scrolling origin */
+    int width, height; /* size of the strip */
 };
+static bggroup_t *bggroup_new(int first); /* constructor */
+static bggroup_t *bggroup_delete(bggroup_t *group); /* destructor */
 
 /* === <<abstract>> bgstrategy_t === */
 struct bgstrategy_t {
@@ -98,6 +118,13 @@ static void bgstrategy_linear_update(bgstrategy_t *strategy); /* private class m
 static void sort_backgrounds(bgtheme_t *bgtheme);
 static int sort_cmp(const void *a, const void *b);
 static void render(bgtheme_t *theme, v2d_t camera_position, int foreground);
+static void render_layer(background_t *bg, v2d_t topleft);
+static void render_group(bgtheme_t *theme, bggroup_t *group, v2d_t topleft);
+static void build_groups(bgtheme_t *theme);
+static int can_join_group(const bgtheme_t *theme, const bggroup_t *group, const background_t *bg);
+static void layer_rect(const background_t *bg, int *x, int *y, int *w, int *h);
+static int is_static(const background_t *bg);
+static int wrap(int x, int m);
 static int traverse(const parsetree_statement_t *stmt, void *bgtheme);
 static int traverse_background_attributes(const parsetree_statement_t *stmt, void *background);
 static void validate_background(const background_t *bg);
@@ -121,12 +148,15 @@ bgtheme_t* background_load(const char *file)
     bgtheme = mallocx(sizeof *bgtheme);
     bgtheme->data = NULL;
     bgtheme->length = 0;
+    bgtheme->group = NULL;
+    bgtheme->group_count = 0;
 
-    tree = nanoparser_construct_tree(abs_path);
+    tree = scriptcache_construct_tree(abs_path);
     nanoparser_traverse_program_ex(tree, (void*)bgtheme, traverse);
     tree = nanoparser_deconstruct_tree(tree);
 
     sort_backgrounds(bgtheme);
+    build_groups(bgtheme);
     return bgtheme;
 }
 
@@ -142,6 +172,13 @@ bgtheme_t* background_unload(bgtheme_t *bgtheme)
 
     logfile_message("background_unload()");
 
+    if(bgtheme->group != NULL) {
+        for(i=0; i<bgtheme->group_count; i++)
+            bgtheme->group[i] = bggroup_delete(bgtheme->group[i]);
+
+        free(bgtheme->group);
+    }
+
     if(bgtheme->data != NULL) {
         for(i=0; i<bgtheme->length; i++)
             bgtheme->data[i] = background_delete(bgtheme->data[i]);
@@ -310,20 +347,235 @@ void render(bgtheme_t *bgtheme, v2d_t camera_position, int foreground)
     int i;
     v2d_t halfscreen = v2d_new(VIDEO_SCREEN_W/2, VIDEO_SCREEN_H/2);
     v2d_t topleft = v2d_subtract(camera_position, halfscreen);
+    bggroup_t *group;
+    background_t *bg;
+
+    for(i=0; i<bgtheme->group_count; i++) {
+        group = bgtheme->group[i];
+        bg = bgtheme->data[group->first]; /* all the layers of a group are on the same side */
+        if((!foreground && bg->zindex <= 0.5f) || (foreground && bg->zindex > 0.5f)) {
+            if(group->length > 1)
+                render_group(bgtheme, group, topleft);
+            else
+                render_layer(bg, topleft);
+        }
+    }
+}
+
+void render_layer(background_t *bg, v2d_t topleft)
+{
+    v2d_t halfscreen = v2d_new(VIDEO_SCREEN_W/2, VIDEO_SCREEN_H/2);
+
+    bg->actor->position.x += topleft.x * bg->actor->speed.x;
+    bg->actor->position.y += topleft.y * bg->actor->speed.y;
+
+    actor_render_repeat_xy(bg->actor, halfscreen, bg->repeat_x, bg->repeat_y);
+
+    bg->actor->position.y -= topleft.y * bg->actor->speed.y;
+    bg->actor->position.x -= topleft.x * bg->actor->speed.x;
+}
+
+/* renders a group of layers with a single blit per tile. The
+   cached strip is rebuilt whenever an animation frame changes */
+void render_group(bgtheme_t *bgtheme, bggroup_t *group, v2d_t topleft)
+{
+    int i, j, k, x, y, w, h, cols, rows, must_rebuild = FALSE;
+    background_t *first = bgtheme->data[group->first];
+    background_t *bg;
+    image_t *img;
+
+    /* update the animations */
+    for(k=0; k<group->length; k++) {
+        bg = bgtheme->data[group->first + k];
+        if(!bg->actor->visible || !bg->actor->animation)
+            continue;
+        actor_animate(bg->actor);
+        if(actor_image(bg->actor) != group->frame[k])
+            must_rebuild = TRUE;
+    }
+
+    /* composite the layers */
+    if(must_rebuild || group->strip == NULL) {
+        if(group->strip == NULL)
+            group->strip = image_create(group->width, group->height);
+        image_clear(group->strip, video_get_maskcolor());
+
+        for(k=0; k<group->length; k++) {
+            bg = bgtheme->data[group->first + k];
+            group->frame[k] = NULL;
+            if(!bg->actor->visible || !bg->actor->animation)
+                continue;
+
+            img = group->frame[k] = actor_image(bg->actor);
+            layer_rect(bg, &x, &y, &w, &h);
+            x = bg->repeat_x ? wrap(x, group->width) : x - group->offset_x;
+            y = bg->repeat_y ? wrap(y, group->height) : y - group->offset_y;
+            for(i=0; i<=(bg->repeat_x?1:0); i++) {
+                for(j=0; j<=(bg->repeat_y?1:0); j++)
+                    image_draw(img, group->strip, x - i*group->width, y - j*group->height, IF_NONE);
+            }
+        }
+    }
+
+    /* render the strip */
+    x = (int)(topleft.x * first->actor->speed.x) + group->offset_x;
+    y = (int)(topleft.y * first->actor->speed.y) + group->offset_y;
+    if(first->repeat_x) {
+        x = wrap(x, group->width) - group->width;
+        cols = VIDEO_SCREEN_W/group->width + 3;
+    }
+    else
+        cols = 1;
+    if(first->repeat_y) {
+        y = wrap(y, group->height) - group->height;
+        rows = VIDEO_SCREEN_H/group->height + 3;
+    }
+    else
+        rows = 1;
+
+    for(i=0; i<cols; i++) {
+        for(j=0; j<rows; j++)
+            image_draw(group->strip, video_get_backbuffer(), x + i*group->width, y + j*group->height, IF_NONE);
+    }
+}
+
+bggroup_t *bggroup_new(int first)
+{
+    bggroup_t *group = mallocx(sizeof *group);
+
+    group->first = first;
+    group->length = 1;
+    group->strip = NULL;
+    group->frame = NULL;
+    group->offset_x = group->offset_y = 0;
+    group->width = group->height = 0;
+
+    return group;
+}
+
+bggroup_t *bggroup_delete(bggroup_t *group)
+{
+    if(group->strip != NULL)
+        image_destroy(group->strip);
+
+    if(group->frame != NULL)
+        free(group->frame);
+
+    free(group);
+    return NULL;
+}
+
+/* partitions the layers of the theme into groups of adjacent static
+   layers that scroll together, so that each group can be composited
+   into a single surface */
+void build_groups(bgtheme_t *bgtheme)
+{
+    int i, k, x, y, w, h, x1, y1, x2, y2, composited = 0;
+    bggroup_t *group = NULL;
     background_t *bg;
 
     for(i=0; i<bgtheme->length; i++) {
         bg = bgtheme->data[i];
-        if((!foreground && bg->zindex <= 0.5f) || (foreground && bg->zindex > 0.5f)) {
-            bg->actor->position.x += topleft.x * bg->actor->speed.x;
-            bg->actor->position.y += topleft.y * bg->actor->speed.y;
+        if(group != NULL && can_join_group(bgtheme, group, bg)) {
+            group->length++;
+            continue;
+        }
 
-            actor_render_repeat_xy(bg->actor, halfscreen, bg->repeat_x, bg->repeat_y);
+        group = bggroup_new(i);
+        bgtheme->group = reallocx(bgtheme->group, (++(bgtheme->group_count)) * sizeof(*(bgtheme->group)));
+        bgtheme->group[bgtheme->group_count-1] = group;
+    }
 
-            bg->actor->position.y -= topleft.y * bg->actor->speed.y;
-            bg->actor->position.x -= topleft.x * bg->actor->speed.x;
+    /* compute the size of the strips */
+    for(i=0; i<bgtheme->group_count; i++) {
+        group = bgtheme->group[i];
+        if(group->length > 1) {
+            bg = bgtheme->data[group->first];
+            group->frame = mallocx(group->length * sizeof(*(group->frame)));
+            memset(group->frame, 0, group->length * sizeof(*(group->frame)));
+            composited += group->length;
+
+            /* bounding box of the layers */
+            layer_rect(bg, &x1, &y1, &w, &h);
+            x2 = x1 + w;
+            y2 = y1 + h;
+            for(k=group->first+1; k<group->first+group->length; k++) {
+                layer_rect(bgtheme->data[k], &x, &y, &w, &h);
+                x1 = min(x1, x); y1 = min(y1, y);
+                x2 = max(x2, x + w); y2 = max(y2, y + h);
+            }
+
+            /* along a repeating axis, the strip is a single period */
+            group->offset_x = bg->repeat_x ? 0 : x1;
+            group->offset_y = bg->repeat_y ? 0 : y1;
+            group->width = bg->repeat_x ? bg->data->frame_w : x2 - x1;
+            group->height = bg->repeat_y ? bg->data->frame_h : y2 - y1;
         }
     }
+
+    logfile_message("background: %d of %d layers have been composited into groups", composited, bgtheme->length);
+}
+
+/* can bg be composited together with the layers of the group? */
+int can_join_group(const bgtheme_t *bgtheme, const bggroup_t *group, const background_t *bg)
+{
+    const background_t *first = bgtheme->data[group->first];
+    int i, x, y, w, h, x1, y1, x2, y2;
+
+    /* the layers must be static, on the same side and scroll together */
+    if(!is_static(first) || !is_static(bg))
+        return FALSE;
+    if((first->zindex <= 0.5f) != (bg->zindex <= 0.5f))
+        return FALSE;
+    if(fabs(first->actor->speed.x - bg->actor->speed.x) > EPSILON || fabs(first->actor->speed.y - bg->actor->speed.y) > EPSILON)
+        return FALSE;
+    if(first->repeat_x != bg->repeat_x || first->repeat_y != bg->repeat_y)
+        return FALSE;
+
+    /* repeating layers must have the same period */
+    if(first->repeat_x && first->data->frame_w != bg->data->frame_w)
+        return FALSE;
+    if(first->repeat_y && first->data->frame_h != bg->data->frame_h)
+        return FALSE;
+
+    /* the strip can't be too large */
+    layer_rect(bg, &x1, &y1, &w, &h);
+    x2 = x1 + w;
+    y2 = y1 + h;
+    for(i=group->first; i<group->first+group->length; i++) {
+        layer_rect(bgtheme->data[i], &x, &y, &w, &h);
+        x1 = min(x1, x); y1 = min(y1, y);
+        x2 = max(x2, x + w); y2 = max(y2, y + h);
+    }
+    if(x2 - x1 > BGGROUP_MAX_SIZE || y2 - y1 > BGGROUP_MAX_SIZE)
+        return FALSE;
+
+    return TRUE;
+}
+
+/* the rectangle taken by a layer, relative to the scrolling origin */
+void layer_rect(const background_t *bg, int *x, int *y, int *w, int *h)
+{
+    *x = (int)bg->actor->position.x - (int)bg->actor->hot_spot.x;
+    *y = (int)bg->actor->position.y - (int)bg->actor->hot_spot.y;
+    *w = bg->data->frame_w;
+    *h = bg->data->frame_h;
+}
+
+/* static layers don't move by themselves and lie on integer positions */
+int is_static(const background_t *bg)
+{
+    const v2d_t *p = &(bg->actor->position);
+    return bg->strategy->update == bgstrategy_default_update &&
+           fabs(p->x - floor(p->x)) < EPSILON && fabs(p->y - floor(p->y)) < EPSILON &&
+           fabs(bg->actor->hot_spot.x - floor(bg->actor->hot_spot.x)) < EPSILON &&
+           fabs(bg->actor->hot_spot.y - floor(bg->actor->hot_spot.y)) < EPSILON;
+}
+
+/* x mod m, in the range [0, m) */
+int wrap(int x, int m)
+{
+    return ((x % m) + m) % m;
 }
 
 void sort_backgrounds(bgtheme_t *bgtheme)
@@ -38,6 +38,7 @@
 #include "../core/audio.h"
 #include "../core/soundfactory.h"
 #include "../core/nanoparser/nanoparser.h"
+#include "../core/scriptcache.h"
 
 
 /* private data */
@@ -81,7 +82,7 @@ void brickdata_load(const char *filename)
     for(i=0; i<BRKDATA_MAX; i++) 
         brickdata[i] = NULL;
 
-    tree = nanoparser_construct_tree(abs_path);
+    tree = scriptcache_construct_tree(abs_path);
     nanoparser_traverse_program(tree, traverse);
     tree = nanoparser_deconstruct_tree(tree);
 
@@ -156,6 +157,8 @@ brick_t* brick_create(int id)
     b->enabled = TRUE;
     b->state = BRS_IDLE;
     b->layer = BRL_DEFAULT;
+    b->previous_x = b->previous_y = 0;
+    b->previous_step = 0;
 
     for(i=0; i<BRICK_MAXVALUES; i++)
         b->value[i] = 0.0f;
@@ -186,6 +189,11 @@ void brick_update(brick_t *brk, player_t** team, int team_size, brick_list_t *br
     if((brk == NULL) || (brk->brick_ref == NULL))
         return;
 
+    /* where we were at the end of the previous step */
+    brk->previous_x = brk->x;
+    brk->previous_y = brk->y;
+    brk->previous_step = timer_get_step_count();
+
     switch(brk->brick_ref->behavior) {
         /* breakable bricks */
         case BRB_BREAKABLE: {
@@ -331,12 +339,22 @@ void brick_update(brick_t *brk, player_t** team, int team_size, brick_list_t *br
  */
 void brick_render(brick_t *brk, v2d_t camera_position)
 {
+    int x = brk->x, y = brk->y;
+    float t;
+
     brick_animate(brk);
 
+    /* moving bricks are rendered between the last two logic steps, like the actors */
+    if(brk->previous_step == timer_get_step_count() && !level_editmode()) {
+        t = timer_get_interpolation();
+        x = (int)floor(brk->previous_x + (brk->x - brk->previous_x) * t + 0.5f);
+        y = (int)floor(brk->previous_y + (brk->y - brk->previous_y) * t + 0.5f);
+    }
+
     if(brk->layer == BRL_DEFAULT || !level_editmode())
-        image_draw(brick_image(brk), video_get_backbuffer(), brk->x-((int)camera_position.x-VIDEO_SCREEN_W/2), brk->y-((int)camera_position.y-VIDEO_SCREEN_H/2), IF_NONE);
+        image_draw(brick_image(brk), video_get_backbuffer(), x-((int)camera_position.x-VIDEO_SCREEN_W/2), y-((int)camera_position.y-VIDEO_SCREEN_H/2), IF_NONE);
     else
-        image_draw_lit(brick_image(brk), video_get_backbuffer(), brk->x-((int)camera_position.x-VIDEO_SCREEN_W/2), brk->y-((int)camera_position.y-VIDEO_SCREEN_H/2), bricklayer2color(brk->layer), 0.5f, IF_NONE);
+        image_draw_lit(brick_image(brk), video_get_backbuffer(), x-((int)camera_position.x-VIDEO_SCREEN_W/2), y-((int)camera_position.y-VIDEO_SCREEN_H/2), bricklayer2color(brk->layer), 0.5f, IF_NONE);
 }
 
 
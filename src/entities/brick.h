@@ -97,6 +97,8 @@ struct brick_t { /* a real, concrete brick */
     float value[BRICK_MAXVALUES]; /* alterable values */
     float animation_frame; /* controlled by a timer */
     bricklayer_t layer; /* loop system: BRL_* */
+    int previous_x, previous_y; /* position at the end of the previous step (rendering between logic steps) */
+    uint32 previous_step; /* the step that began at (previous_x, previous_y). 0 = none */
 };
 
 /* linked list of bricks */
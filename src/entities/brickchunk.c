@@ -0,0 +1,341 @@
+/*
+ * Open Surge Engine
+ * brickchunk.c - static bricks baked into cached chunks
+ * Copyright (C) 2013  Alexandre Martins <alemartf(at)gmail(dot)com>
+ * http://opensnc.sourceforge.net
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <math.h>
+#include <limits.h>
+#include "brickchunk.h"
+#include "entitymanager.h"
+#include "../core/util.h"
+#include "../core/video.h"
+#include "../core/image.h"
+#include "../core/logfile.h"
+#include "../scenes/level.h"
+
+/* private stuff */
+#define BRICKCHUNK_BUCKETS      97  /* size of the hash table */
+#define BRICKCHUNK_TTL          180 /* unused chunks are discarded after this many frames */
+
+static brickchunk_t* bucket[BRICKCHUNK_BUCKETS];
+static brickchunk_t* garbage; /* invalidated chunks may still be in the render queue */
+static int frame; /* frame counter */
+
+static int cell_of(int coordinate);
+static int hash(int cell_x, int cell_y);
+static int same_group(const brickchunk_t *chunk, const brick_t *brk);
+static int sort_by_ypos(const void *a, const void *b);
+static const image_t* brick_frame(const brick_t *brk);
+static void discard(brickchunk_t *chunk);
+static void collect_garbage();
+static brickchunk_t* brickchunk_create(const brick_t *brk);
+static brickchunk_t* brickchunk_destroy(brickchunk_t *chunk);
+
+
+
+/* public methods */
+
+/*
+ * brickchunk_init()
+ * Initializes the chunk cache
+ */
+void brickchunk_init()
+{
+    int i;
+
+    for(i=0; i<BRICKCHUNK_BUCKETS; i++)
+        bucket[i] = NULL;
+
+    garbage = NULL;
+    frame = 0;
+}
+
+
+/*
+ * brickchunk_release()
+ * Releases all the chunks
+ */
+void brickchunk_release()
+{
+    brickchunk_invalidate_all();
+    collect_garbage();
+}
+
+
+/*
+ * brickchunk_update()
+ * Call once per rendered frame. Chunks that
+ * haven't been used for a while are discarded.
+ */
+void brickchunk_update()
+{
+    brickchunk_t *it, *prev, *next;
+    int i;
+
+    collect_garbage();
+
+    frame++;
+    for(i=0; i<BRICKCHUNK_BUCKETS; i++) {
+        for(prev=NULL, it=bucket[i]; it; it=next) {
+            next = it->next;
+            if(frame - it->last_used > BRICKCHUNK_TTL) {
+                if(prev != NULL)
+                    prev->next = next;
+                else
+                    bucket[i] = next;
+                brickchunk_destroy(it);
+            }
+            else
+                prev = it;
+        }
+    }
+}
+
+
+/*
+ * brickchunk_accepts()
+ * May the given brick be rendered through a chunk?
+ * Moving & animated bricks must be rendered on their own.
+ */
+int brickchunk_accepts(const brick_t *brk)
+{
+    const brickdata_t *ref = brk->brick_ref;
+
+    if(level_editmode())
+        return FALSE;
+
+    if(ref->behavior == BRB_CIRCULAR)
+        return FALSE;
+
+    if(ref->data == NULL || ref->data->animation_data[0]->frame_count != 1)
+        return FALSE;
+
+    return TRUE;
+}
+
+
+/*
+ * brickchunk_claim()
+ * Returns the chunk that contains the given brick,
+ * building it if necessary. If the chunk has already
+ * been claimed in the current frame, returns NULL.
+ */
+brickchunk_t* brickchunk_claim(const brick_t *brk)
+{
+    int cell_x = cell_of(brk->x), cell_y = cell_of(brk->y);
+    int k = hash(cell_x, cell_y);
+    brickchunk_t *it;
+
+    for(it=bucket[k]; it; it=it->next) {
+        if(it->cell_x == cell_x && it->cell_y == cell_y && same_group(it, brk))
+            break;
+    }
+
+    if(it == NULL) {
+        it = brickchunk_create(brk);
+        it->next = bucket[k];
+        bucket[k] = it;
+    }
+    else if(it->last_used == frame)
+        return NULL;
+
+    it->last_used = frame;
+    return it;
+}
+
+
+/*
+ * brickchunk_render()
+ * Renders a chunk
+ */
+void brickchunk_render(const brickchunk_t *chunk, v2d_t camera_position)
+{
+    image_draw(chunk->image, video_get_backbuffer(), chunk->x-((int)camera_position.x-VIDEO_SCREEN_W/2), chunk->y-((int)camera_position.y-VIDEO_SCREEN_H/2), IF_NONE);
+}
+
+
+/*
+ * brickchunk_invalidate()
+ * Discards the chunks of the cell of the given brick.
+ * Call this whenever a brick is created or dies.
+ * Discarded chunks are released on the next update.
+ */
+void brickchunk_invalidate(const brick_t *brk)
+{
+    int cell_x = cell_of(brk->x), cell_y = cell_of(brk->y);
+    int k = hash(cell_x, cell_y);
+    brickchunk_t *it, *prev, *next;
+
+    for(prev=NULL, it=bucket[k]; it; it=next) {
+        next = it->next;
+        if(it->cell_x == cell_x && it->cell_y == cell_y) {
+            if(prev != NULL)
+                prev->next = next;
+            else
+                bucket[k] = next;
+            discard(it);
+        }
+        else
+            prev = it;
+    }
+}
+
+
+/*
+ * brickchunk_invalidate_all()
+ * Discards all the chunks
+ */
+void brickchunk_invalidate_all()
+{
+    brickchunk_t *it, *next;
+    int i;
+
+    for(i=0; i<BRICKCHUNK_BUCKETS; i++) {
+        for(it=bucket[i]; it; it=next) {
+            next = it->next;
+            discard(it);
+        }
+        bucket[i] = NULL;
+    }
+}
+
+
+
+/* private methods */
+
+/* the cell of a world coordinate (rounds towards -inf) */
+int cell_of(int coordinate)
+{
+    return (int)floor((float)coordinate / (float)BRICKCHUNK_SIZE);
+}
+
+/* hash function */
+int hash(int cell_x, int cell_y)
+{
+    unsigned int h = (unsigned int)cell_x * 73856093u ^ (unsigned int)cell_y * 19349663u;
+    return (int)(h % BRICKCHUNK_BUCKETS);
+}
+
+/* can brk be a part of the given chunk? (the cell isn't checked) */
+int same_group(const brickchunk_t *chunk, const brick_t *brk)
+{
+    return (fabs(chunk->zindex - brk->brick_ref->zindex) < 1e-7) && (chunk->property == brk->brick_ref->property) && (chunk->layer == brk->layer);
+}
+
+/* compares two bricks by their y position */
+int sort_by_ypos(const void *a, const void *b)
+{
+    const brick_t *p = *((const brick_t**)a);
+    const brick_t *q = *((const brick_t**)b);
+    return p->y - q->y;
+}
+
+/* the image of a non-animated brick */
+const image_t* brick_frame(const brick_t *brk)
+{
+    const spriteinfo_t *sprite = brk->brick_ref->data;
+    return sprite->frame_data[ sprite->animation_data[0]->data[0] ];
+}
+
+/* moves an invalidated chunk to the garbage list */
+void discard(brickchunk_t *chunk)
+{
+    chunk->next = garbage;
+    garbage = chunk;
+}
+
+/* releases the invalidated chunks */
+void collect_garbage()
+{
+    brickchunk_t *next;
+
+    while(garbage != NULL) {
+        next = garbage->next;
+        brickchunk_destroy(garbage);
+        garbage = next;
+    }
+}
+
+/* builds the chunk of the given brick */
+brickchunk_t* brickchunk_create(const brick_t *brk)
+{
+    brickchunk_t *chunk = mallocx(sizeof *chunk);
+    brick_list_t *list, *it;
+    brick_t **member;
+    int x1, y1, x2, y2;
+    int i, n = 0;
+
+    chunk->cell_x = cell_of(brk->x);
+    chunk->cell_y = cell_of(brk->y);
+    chunk->zindex = brk->brick_ref->zindex;
+    chunk->property = brk->brick_ref->property;
+    chunk->layer = brk->layer;
+    chunk->last_used = frame;
+    chunk->next = NULL;
+
+    /* gather the bricks of the chunk */
+    list = entitymanager_retrieve_bricks_in_region(chunk->cell_x * BRICKCHUNK_SIZE, chunk->cell_y * BRICKCHUNK_SIZE, BRICKCHUNK_SIZE, BRICKCHUNK_SIZE);
+    for(it=list; it; it=it->next)
+        n++;
+
+    member = mallocx((1 + n) * sizeof *member);
+    n = 0;
+    for(it=list; it; it=it->next) {
+        const brick_t *b = it->data;
+        if(cell_of(b->x) == chunk->cell_x && cell_of(b->y) == chunk->cell_y && same_group(chunk, b) && brickchunk_accepts(b))
+            member[n++] = it->data;
+    }
+    list = entitymanager_release_retrieved_brick_list(list);
+
+    /* the brick itself is always a member */
+    for(i=0; i<n && member[i] != brk; i++);
+    if(i == n)
+        member[n++] = (brick_t*)brk;
+
+    /* bounding box */
+    x1 = y1 = INT_MAX;
+    x2 = y2 = INT_MIN;
+    for(i=0; i<n; i++) {
+        const image_t *img = brick_frame(member[i]);
+        x1 = min(x1, member[i]->x);
+        y1 = min(y1, member[i]->y);
+        x2 = max(x2, member[i]->x + image_width(img));
+        y2 = max(y2, member[i]->y + image_height(img));
+    }
+
+    /* bake the surface, preserving the rendering order of the render queue */
+    merge_sort(member, n, sizeof *member, sort_by_ypos);
+    chunk->x = x1;
+    chunk->y = y1;
+    chunk->image = image_create(max(1, x2 - x1), max(1, y2 - y1));
+    image_clear(chunk->image, video_get_maskcolor());
+    for(i=0; i<n; i++)
+        image_draw(brick_frame(member[i]), chunk->image, member[i]->x - x1, member[i]->y - y1, IF_NONE);
+
+    free(member);
+    return chunk;
+}
+
+/* destroys a chunk */
+brickchunk_t* brickchunk_destroy(brickchunk_t *chunk)
+{
+    image_destroy(chunk->image);
+    free(chunk);
+    return NULL;
+}
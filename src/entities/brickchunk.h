@@ -0,0 +1,63 @@
+/*
+ * Open Surge Engine
+ * brickchunk.h - static bricks baked into cached chunks
+ * Copyright (C) 2013  Alexandre Martins <alemartf(at)gmail(dot)com>
+ * http://opensnc.sourceforge.net
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _BRICKCHUNK_H
+#define _BRICKCHUNK_H
+
+#include "../core/v2d.h"
+#include "brick.h"
+
+/*
+ * The world is divided into BRICKCHUNK_SIZE x BRICKCHUNK_SIZE cells. Static,
+ * non-animated bricks of a cell sharing the same z-index, property and layer
+ * are baked into a single surface (a chunk), so that they can be rendered
+ * with a single blit. A brick belongs to the cell of its top-left corner.
+ *
+ * Chunks are built lazily, when rendered for the first time, and discarded
+ * when one of their bricks is created or dies (or when unused for a while).
+ */
+
+#define BRICKCHUNK_SIZE         256
+
+typedef struct brickchunk_t brickchunk_t;
+struct brickchunk_t {
+    int cell_x, cell_y; /* cell coordinates */
+    float zindex; /* z-index of the bricks of this chunk */
+    brickproperty_t property; /* property of the bricks of this chunk */
+    bricklayer_t layer; /* layer of the bricks of this chunk */
+    int x, y; /* position of the surface, in world coordinates */
+    image_t *image; /* baked surface */
+    int last_used; /* frame number of the last claim */
+    brickchunk_t *next; /* linked list */
+};
+
+void brickchunk_init(); /* initializes the chunk cache */
+void brickchunk_release(); /* releases all the chunks */
+void brickchunk_update(); /* call once per rendered frame: discards chunks that haven't been used for a while */
+
+int brickchunk_accepts(const brick_t *brk); /* may the given brick be rendered through a chunk? */
+brickchunk_t* brickchunk_claim(const brick_t *brk); /* returns the chunk of an accepted brick (building it if needed), or NULL if it has already been claimed in this frame */
+void brickchunk_render(const brickchunk_t *chunk, v2d_t camera_position); /* renders a chunk */
+
+void brickchunk_invalidate(const brick_t *brk); /* discards the chunks of the cell of the given brick */
+void brickchunk_invalidate_all(); /* discards all the chunks */
+
+#endif
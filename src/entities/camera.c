@@ -32,6 +32,8 @@ struct camera_t {
     v2d_t position; /* current position */
     v2d_t dest; /* target position: used to make things smooth */
     float speed; /* the camera will move from position to dest in speed px/s */
+    v2d_t previous_position; /* position before the last update (rendering between logic steps) */
+    uint32 previous_step; /* the logic step of the last update */
 
     /* the camera is only allowed to see within the bounds of region[] */
     v2d_t region_topleft, region_bottomright; /* this describes a rectangle: current boundaries */
@@ -63,6 +65,8 @@ void camera_init()
     camera.region_bottomright_speed = 0.0f;
 
     camera.position = camera.dest = v2d_new(0.0f, 0.0f);
+    camera.previous_position = camera.position;
+    camera.previous_step = 0;
     camera.region_topleft.x = camera.dest_region_topleft.x = VIDEO_SCREEN_W/2;
     camera.region_topleft.y = camera.dest_region_topleft.y = VIDEO_SCREEN_H/2;
     camera.region_bottomright.x = camera.dest_region_bottomright.x = level_size().x-VIDEO_SCREEN_W/2;
@@ -82,6 +86,10 @@ void camera_update()
     /* the level size may have changed during the last frame */
     update_boundaries();
 
+    /* where we were at the end of the previous step */
+    camera.previous_position = camera.position;
+    camera.previous_step = timer_get_step_count();
+
     /* updating the camera position */
     ds = v2d_subtract(camera.dest, camera.position);
     if(v2d_magnitude(ds) > threshold) {
@@ -145,7 +153,7 @@ void camera_move_to(v2d_t position, float seconds)
     if(seconds > EPSILON)
         camera.speed = v2d_magnitude( v2d_subtract(camera.position, camera.dest) ) / seconds;
     else
-        camera.position = camera.dest;
+        camera.position = camera.previous_position = camera.dest;
 
 }
 
@@ -170,11 +178,17 @@ void camera_unlock()
 
 /*
  * camera_get_position()
- * returns the position of the camera
+ * returns the position of the camera. When rendering,
+ * it's interpolated between the last two logic steps
  */
 v2d_t camera_get_position()
 {
-    return v2d_new( (int)camera.position.x, (int)camera.position.y );
+    v2d_t pos = camera.position;
+
+    if(camera.previous_step == timer_get_step_count()) /* the camera has been updated in the last step */
+        pos = v2d_add(camera.previous_position, v2d_multiply(v2d_subtract(camera.position, camera.previous_position), timer_get_interpolation()));
+
+    return v2d_new( (int)pos.x, (int)pos.y );
 }
 
 /*
@@ -183,7 +197,7 @@ v2d_t camera_get_position()
  */
 void camera_set_position(v2d_t position)
 {
-    camera.dest = camera.position = position;
+    camera.dest = camera.position = camera.previous_position = position;
 }
 
 /*
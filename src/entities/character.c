@@ -22,6 +22,7 @@
 #include "character.h"
 #include "../core/hashtable.h"
 #include "../core/nanoparser/nanoparser.h"
+#include "../core/scriptcache.h"
 #include "../core/osspec.h"
 #include "../core/util.h"
 #include "../core/stringutil.h"
@@ -141,7 +142,7 @@ void character_delete(character_t* c)
 int dirfill(const char *filename, void *param)
 {
     parsetree_program_t** p = (parsetree_program_t**)param;
-    *p = nanoparser_append_program(*p, nanoparser_construct_tree(filename));
+    *p = nanoparser_append_program(*p, scriptcache_construct_tree(filename));
     return 0;
 }
 
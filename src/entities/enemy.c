@@ -33,6 +33,7 @@
 #include "../core/video.h"
 #include "../core/hashtable.h"
 #include "../core/nanoparser/nanoparser.h"
+#include "../core/scriptcache.h"
 #include "../scenes/level.h"
 #include "actor.h"
 #include "player.h"
@@ -72,6 +73,7 @@ static enemy_t* create_from_script(const char *object_name);
 static int fill_object_names(const parsetree_statement_t *stmt, void *object_name_data);
 static int fill_object_categories(const parsetree_statement_t *stmt, void *object_category_data);
 static int fill_lookup_table(const parsetree_statement_t *stmt, void *lookup_table);
+static int find_always_active(const parsetree_statement_t *stmt, void *always_active);
 static int prepare_to_fill_object_categories(const parsetree_statement_t *stmt, void *object_category_data);
 static int dirfill(const char *filename, void *param); /* file system callback */
 static int is_hidden_object(const char *name);
@@ -151,6 +153,23 @@ const char** objects_get_list_of_categories(int *n)
 }
 
 
+/*
+ * objects_is_always_active()
+ * Does the given object have the 'always_active'
+ * flag? Tells it without spawning the object
+ */
+int objects_is_always_active(const char *name)
+{
+    objectcode_t *object_code = hashtable_objectcode_t_find(lookup_table, name);
+    int always_active = FALSE;
+
+    if(object_code != NULL)
+        nanoparser_traverse_program_ex(object_code, (void*)(&always_active), find_always_active);
+
+    return always_active;
+}
+
+
 
 
 
@@ -511,6 +530,15 @@ int fill_lookup_table(const parsetree_statement_t *stmt, void *lookup_table)
 }
 
 
+int find_always_active(const parsetree_statement_t *stmt, void *always_active)
+{
+    if(str_icmp(nanoparser_get_identifier(stmt), "always_active") == 0)
+        *((int*)always_active) = TRUE;
+
+    return 0;
+}
+
+
 int object_name_table_cmp(const void *a, const void *b)
 {
     const char *i = *((const char**)a);
@@ -529,7 +557,7 @@ int object_category_table_cmp(const void *a, const void *b)
 int dirfill(const char *filename, void *param)
 {
     parsetree_program_t** p = (parsetree_program_t**)param;
-    *p = nanoparser_append_program(*p, nanoparser_construct_tree(filename));
+    *p = nanoparser_append_program(*p, scriptcache_construct_tree(filename));
     return 0;
 }
 
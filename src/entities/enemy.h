@@ -97,6 +97,9 @@ const char** objects_get_list_of_names(int *n);
 /* returns an array v[0..n-1] of available object categories */
 const char** objects_get_list_of_categories(int *n);
 
+/* does the given object have the 'always_active' flag? (it's not spawned) */
+int objects_is_always_active(const char *name);
+
 
 
 
@@ -25,6 +25,7 @@
 #include "item.h"
 #include "enemy.h"
 #include "actor.h"
+#include "brickchunk.h"
 #include "../core/spatialhash.h"
 #include "../core/util.h"
 
@@ -51,6 +52,10 @@ static int brick_count;
 static int item_count;
 static int object_count;
 
+static void (*on_dead_brick)(brick_t*);
+static void (*on_dead_item)(item_t*);
+static void (*on_dead_object)(enemy_t*);
+
 static void add_to_dead_bricks_list(brick_t *brick);
 static void add_to_dead_items_list(item_t *item);
 static void add_to_dead_objects_list(enemy_t *object);
@@ -90,9 +95,15 @@ void entitymanager_init()
     item_count = 0;
     object_count = 0;
 
+    on_dead_brick = NULL;
+    on_dead_item = NULL;
+    on_dead_object = NULL;
+
     bricks = spatialhash_brick_t_create(brick_destroy, get_brick_xpos, get_brick_ypos, get_brick_width, get_brick_height);
     items = spatialhash_item_t_create(item_destroy, get_item_xpos, get_item_ypos, get_item_width, get_item_height);
     objects = spatialhash_enemy_t_create(enemy_destroy, get_object_xpos, get_object_ypos, get_object_width, get_object_height);
+
+    brickchunk_init();
 }
 
 void entitymanager_release()
@@ -100,6 +111,7 @@ void entitymanager_release()
     logfile_message("Releasing the Entity Manager...");
 
     logfile_message("releasing bricks...");
+    brickchunk_release();
     bricks = spatialhash_brick_t_destroy(bricks);
 
     logfile_message("releasing built-in items...");
@@ -112,6 +124,7 @@ void entitymanager_release()
 void entitymanager_store_brick(brick_t *brick)
 {
     (brick->brick_ref->behavior == BRB_CIRCULAR ? spatialhash_brick_t_add_persistent : spatialhash_brick_t_add)(bricks, brick);
+    brickchunk_invalidate(brick);
     brick_count++;
 }
 
@@ -127,6 +140,39 @@ void entitymanager_store_object(enemy_t *object)
     object_count++;
 }
 
+void entitymanager_store_bricks(brick_t **brick, int count)
+{
+    int i;
+
+    for(i=0; i<count; i++)
+        (brick[i]->brick_ref->behavior == BRB_CIRCULAR ? spatialhash_brick_t_add_persistent_new : spatialhash_brick_t_add_new)(bricks, brick[i]);
+
+    for(i=0; i<count; i++)
+        brickchunk_invalidate(brick[i]);
+
+    brick_count += count;
+}
+
+void entitymanager_store_items(item_t **item, int count)
+{
+    int i;
+
+    for(i=0; i<count; i++)
+        (item[i]->always_active ? spatialhash_item_t_add_persistent_new : spatialhash_item_t_add_new)(items, item[i]);
+
+    item_count += count;
+}
+
+void entitymanager_store_objects(enemy_t **object, int count)
+{
+    int i;
+
+    for(i=0; i<count; i++)
+        (object[i]->always_active ? spatialhash_enemy_t_add_persistent_new : spatialhash_enemy_t_add_new)(objects, object[i]);
+
+    object_count += count;
+}
+
 void entitymanager_set_active_region(int rectangle_xpos, int rectangle_ypos, int rectangle_width, int rectangle_height)
 {
     active_rectangle_xpos = rectangle_xpos;
@@ -138,21 +184,28 @@ void entitymanager_set_active_region(int rectangle_xpos, int rectangle_ypos, int
 brick_list_t* entitymanager_retrieve_active_bricks()
 {
     brick_list_t *list = NULL;
-    spatialhash_brick_t_foreach(bricks, active_rectangle_xpos, active_rectangle_ypos, active_rectangle_width, active_rectangle_height, (void*)(&list), retrieve_bricks);
+    spatialhash_brick_t_foreach_ordered(bricks, active_rectangle_xpos, active_rectangle_ypos, active_rectangle_width, active_rectangle_height, (void*)(&list), retrieve_bricks);
     return list;
 }
 
 item_list_t* entitymanager_retrieve_active_items()
 {
     item_list_t *list = NULL;
-    spatialhash_item_t_foreach(items, active_rectangle_xpos, active_rectangle_ypos, active_rectangle_width, active_rectangle_height, (void*)(&list), retrieve_items);
+    spatialhash_item_t_foreach_ordered(items, active_rectangle_xpos, active_rectangle_ypos, active_rectangle_width, active_rectangle_height, (void*)(&list), retrieve_items);
     return list;
 }
 
 enemy_list_t* entitymanager_retrieve_active_objects()
 {
     enemy_list_t *list = NULL;
-    spatialhash_enemy_t_foreach(objects, active_rectangle_xpos, active_rectangle_ypos, active_rectangle_width, active_rectangle_height, (void*)(&list), retrieve_objects);
+    spatialhash_enemy_t_foreach_ordered(objects, active_rectangle_xpos, active_rectangle_ypos, active_rectangle_width, active_rectangle_height, (void*)(&list), retrieve_objects);
+    return list;
+}
+
+brick_list_t* entitymanager_retrieve_bricks_in_region(int rectangle_xpos, int rectangle_ypos, int rectangle_width, int rectangle_height)
+{
+    brick_list_t *list = NULL;
+    spatialhash_brick_t_foreach_ordered(bricks, rectangle_xpos, rectangle_ypos, rectangle_width, rectangle_height, (void*)(&list), retrieve_bricks);
     return list;
 }
 
@@ -237,6 +290,8 @@ void entitymanager_remove_dead_bricks()
 
     for(it = dead_bricks; it != NULL; it = next) {
         next = it->next;
+        if(on_dead_brick != NULL)
+            on_dead_brick(it->data);
         spatialhash_brick_t_remove(bricks, it->data);
         brick_count--;
         free(it);
@@ -245,12 +300,21 @@ void entitymanager_remove_dead_bricks()
     dead_bricks = NULL;
 }
 
+void entitymanager_remove_brick(brick_t *brick)
+{
+    brickchunk_invalidate(brick);
+    spatialhash_brick_t_remove(bricks, brick);
+    brick_count--;
+}
+
 void entitymanager_remove_dead_items()
 {
     item_list_t *it, *next;
 
     for(it = dead_items; it != NULL; it = next) {
         next = it->next;
+        if(on_dead_item != NULL)
+            on_dead_item(it->data);
         spatialhash_item_t_remove(items, it->data);
         item_count--;
         free(it);
@@ -265,6 +329,8 @@ void entitymanager_remove_dead_objects()
 
     for(it = dead_objects; it != NULL; it = next) {
         next = it->next;
+        if(on_dead_object != NULL)
+            on_dead_object(it->data);
         spatialhash_enemy_t_remove(objects, it->data);
         object_count--;
         free(it);
@@ -273,6 +339,25 @@ void entitymanager_remove_dead_objects()
     dead_objects = NULL;
 }
 
+void entitymanager_remove_item(item_t *item)
+{
+    spatialhash_item_t_remove(items, item);
+    item_count--;
+}
+
+void entitymanager_remove_object(enemy_t *object)
+{
+    spatialhash_enemy_t_remove(objects, object);
+    object_count--;
+}
+
+void entitymanager_set_death_callbacks(void (*on_dead_brick_cb)(brick_t*), void (*on_dead_item_cb)(item_t*), void (*on_dead_object_cb)(enemy_t*))
+{
+    on_dead_brick = on_dead_brick_cb;
+    on_dead_item = on_dead_item_cb;
+    on_dead_object = on_dead_object_cb;
+}
+
 /* private methods */
 int get_brick_xpos(const brick_t *brick)
 {
@@ -398,6 +483,9 @@ void add_to_dead_bricks_list(brick_t *brick)
         dead_bricks = node;
     else
         prev->next = node;
+
+    /* the brick must no longer be displayed */
+    brickchunk_invalidate(brick);
 }
 
 void add_to_dead_items_list(item_t *item)
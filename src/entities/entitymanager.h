@@ -40,12 +40,20 @@ void entitymanager_store_brick(struct brick_t *brick);
 void entitymanager_store_item(struct item_t *item);
 void entitymanager_store_object(struct enemy_t *object);
 
-/* retrieving active entities efficiently */
+/* storing lots of newly created entities at once (faster) */
+void entitymanager_store_bricks(struct brick_t **brick, int count);
+void entitymanager_store_items(struct item_t **item, int count);
+void entitymanager_store_objects(struct enemy_t **object, int count);
+
+/* retrieving active entities efficiently (the order of the lists doesn't depend on the active region, so that they can be rendered) */
 void entitymanager_set_active_region(int rectangle_xpos, int rectangle_ypos, int rectangle_width, int rectangle_height);
 struct brick_list_t* entitymanager_retrieve_active_bricks();
 struct item_list_t* entitymanager_retrieve_active_items();
 struct enemy_list_t* entitymanager_retrieve_active_objects();
 
+/* retrieving the bricks of a given region */
+struct brick_list_t* entitymanager_retrieve_bricks_in_region(int rectangle_xpos, int rectangle_ypos, int rectangle_width, int rectangle_height);
+
 /* retrieving all entities */
 struct brick_list_t* entitymanager_retrieve_all_bricks();
 struct item_list_t* entitymanager_retrieve_all_items();
@@ -61,6 +69,14 @@ void entitymanager_remove_dead_bricks();
 void entitymanager_remove_dead_items();
 void entitymanager_remove_dead_objects();
 
+/* removing (and destroying) an entity right away. Don't use it while the entity is in a retrieved list */
+void entitymanager_remove_brick(struct brick_t *brick);
+void entitymanager_remove_item(struct item_t *item);
+void entitymanager_remove_object(struct enemy_t *object);
+
+/* getting notified right before the dead entities are destroyed (NULL: no callback) */
+void entitymanager_set_death_callbacks(void (*on_dead_brick)(struct brick_t*), void (*on_dead_item)(struct item_t*), void (*on_dead_object)(struct enemy_t*));
+
 /* other utilities */
 int entitymanager_get_number_of_bricks();
 int entitymanager_get_number_of_items();
@@ -22,6 +22,7 @@
 #include "set_animation.h"
 #include "../../core/util.h"
 #include "../../core/stringutil.h"
+#include "../../core/sprite.h"
 
 /* strategy pattern */
 typedef struct objectdecorator_setanimationstrategy_t objectdecorator_setanimationstrategy_t;
@@ -172,6 +173,7 @@ objectdecorator_setanimationstrategy_t* objectdecorator_setanimationstrategy_ani
     p->update = objectdecorator_setanimationstrategy_anim_update;
     s->sprite_name = str_dup(sprite_name);
     s->animation_id = animation_id;
+    sprite_preload(sprite_name); /* objects are usually created when the level is loaded */
 
     return p;
 }
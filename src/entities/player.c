@@ -41,6 +41,7 @@
 #include "../core/input.h"
 #include "../core/sprite.h"
 #include "../core/soundfactory.h"
+#include "../core/profiler.h"
 #include "../scenes/level.h"
 #include "physics/physicsactor.h"
 #include "physics/obstaclemap.h"
@@ -214,7 +215,9 @@ void player_update(player_t *player, player_t **team, int team_size, brick_list_
     /* physics */
     if(!player->disable_movement) {
         player->pa_old_state = physicsactor_get_state(player->pa);
+        profiler_begin(PROF_PHYSICS);
         physics_adapter(player, team, team_size, brick_list, item_list, enemy_list);
+        profiler_end(PROF_PHYSICS);
     }
 
     /* the player blinks */
@@ -21,10 +21,12 @@
 
 #include <math.h>
 #include "../core/util.h"
+#include "../core/profiler.h"
 #include "renderqueue.h"
 #include "particle.h"
 #include "player.h"
 #include "brick.h"
+#include "brickchunk.h"
 #include "item.h"
 #include "enemy.h"
 #include "actor.h"
@@ -34,6 +36,7 @@ typedef union renderable_t renderable_t;
 union renderable_t {
     player_t *player;
     brick_t *brick;
+    brickchunk_t *brickchunk;
     item_t *item;
     object_t *object;
 };
@@ -74,18 +77,18 @@ static int cmp_fun(const void *i, const void *j)
         return 1;
 }
 
-static float brick_zindex_offset(const brick_t *b)
+static float brick_zindex_offset(brickproperty_t property, bricklayer_t layer)
 {
     float s = 0.0f;
 
     /* a hackish solution... */
-    switch(b->brick_ref->property) {
+    switch(property) {
         case BRK_NONE:      s -= 0.00002f;
         case BRK_CLOUD:     s -= 0.00001f;
         case BRK_OBSTACLE:  s -= 0.00000f;
     }
 
-    switch(b->layer) {
+    switch(layer) {
         case BRL_YELLOW:    s -= 0.0002f;
         case BRL_GREEN:     s += 0.0001f;
         case BRL_DEFAULT:   s += 0.0000f;
@@ -99,25 +102,29 @@ static float zindex_particles(renderable_t r) { return 1.0f; }
 static float zindex_player(renderable_t r) { return player_is_dying(r.player) ? 1.0f : 0.5f; }
 static float zindex_item(renderable_t r) { return 0.5f; }
 static float zindex_object(renderable_t r) { return r.object->zindex; }
-static float zindex_brick(renderable_t r) { return r.brick->brick_ref->zindex + brick_zindex_offset(r.brick); }
+static float zindex_brick(renderable_t r) { return r.brick->brick_ref->zindex + brick_zindex_offset(r.brick->brick_ref->property, r.brick->layer); }
+static float zindex_brickchunk(renderable_t r) { return r.brickchunk->zindex + brick_zindex_offset(r.brickchunk->property, r.brickchunk->layer); }
 
 static void render_particles(renderable_t r, v2d_t camera_position) { particle_render_all(camera_position); }
 static void render_player(renderable_t r, v2d_t camera_position) { player_render(r.player, camera_position); }
 static void render_item(renderable_t r, v2d_t camera_position) { item_render(r.item, camera_position); }
 static void render_object(renderable_t r, v2d_t camera_position) { enemy_render(r.object, camera_position); }
 static void render_brick(renderable_t r, v2d_t camera_position) { brick_render(r.brick, camera_position); }
+static void render_brickchunk(renderable_t r, v2d_t camera_position) { brickchunk_render(r.brickchunk, camera_position); }
 
 static int ypos_particles(renderable_t r) { return 0; }
 static int ypos_player(renderable_t r) { return 0; /*(int)(r.player->actor->position.y);*/ }
 static int ypos_item(renderable_t r) { return (int)(r.item->actor->position.y); }
 static int ypos_object(renderable_t r) { return (int)(r.object->actor->position.y); }
 static int ypos_brick(renderable_t r) { return r.brick->y; }
+static int ypos_brickchunk(renderable_t r) { return r.brickchunk->y; }
 
 static int type_particles(renderable_t r) { return 0; }
 static int type_player(renderable_t r) { return 1; }
 static int type_item(renderable_t r) { return 2; }
 static int type_object(renderable_t r) { return 3; }
 static int type_brick(renderable_t r) { return 4; }
+static int type_brickchunk(renderable_t r) { return 4; } /* chunks are sorted along with the bricks */
 
 
 
@@ -146,7 +153,9 @@ void renderqueue_end()
         arr[--i] = it->cell;
 
     /* sort stuff. we need an stable sorting algorithm here. */
+    profiler_begin(PROF_SORT);
     merge_sort(arr, size, sizeof *arr, cmp_fun);
+    profiler_end(PROF_SORT);
 
     /* render everything */
     for(i=0; i<size; i++)
@@ -178,6 +187,19 @@ void renderqueue_enqueue_brick(brick_t *brick)
     size++;
 }
 
+void renderqueue_enqueue_brickchunk(brickchunk_t *chunk)
+{
+    renderqueue_t *node = mallocx(sizeof *node);
+    node->cell.entity.brickchunk = chunk;
+    node->cell.zindex = zindex_brickchunk;
+    node->cell.render = render_brickchunk;
+    node->cell.ypos = ypos_brickchunk;
+    node->cell.type = type_brickchunk;
+    node->next = queue;
+    queue = node;
+    size++;
+}
+
 void renderqueue_enqueue_item(item_t *item)
 {
     renderqueue_t *node = mallocx(sizeof *node);
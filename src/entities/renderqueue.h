@@ -37,6 +37,7 @@ struct brick_t;
 struct item_t;
 struct enemy_t;
 struct player_t;
+struct brickchunk_t;
 
 /* starts a new rendering process */
 void renderqueue_begin(v2d_t camera_position);
@@ -46,6 +47,7 @@ void renderqueue_end();
 
 /* enqueues entities */
 void renderqueue_enqueue_brick(struct brick_t *brick);
+void renderqueue_enqueue_brickchunk(struct brickchunk_t *chunk); /* static bricks baked together (see brickchunk.h) */
 void renderqueue_enqueue_item(struct item_t *item);
 void renderqueue_enqueue_object(struct enemy_t *object);
 void renderqueue_enqueue_player(struct player_t *player);
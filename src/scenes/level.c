@@ -47,8 +47,13 @@
 #include "../core/soundfactory.h"
 #include "../core/nanoparser/nanoparser.h"
 #include "../core/font.h"
+#include "../core/loader.h"
+#include "../core/levelfile.h"
+#include "../core/profiler.h"
+#include "../core/pcmcache.h"
 #include "../entities/actor.h"
 #include "../entities/brick.h"
+#include "../entities/brickchunk.h"
 #include "../entities/player.h"
 #include "../entities/item.h"
 #include "../entities/enemy.h"
@@ -59,6 +64,7 @@
 #include "../entities/items/flyingtext.h"
 #include "../entities/entitymanager.h"
 #include "util/editorgrp.h"
+#include "util/levelstream.h"
 
 
 /* ------------------------
@@ -138,11 +144,15 @@ static int level_height; /* height of this level (in pixels) */
 static float level_timer;
 static v2d_t spawn_point;
 static music_t *music;
+static loadhandle_t *music_handle; /* the music is loaded in the background */
 static sound_t *override_music;
 static int block_music;
 static int quit_level;
 static image_t *quit_level_img;
 static bgtheme_t *backgroundtheme;
+static levelfile_t *levelfile; /* kept until the loader tasks have created the entities */
+static char levelfile_path[1024]; /* absolute filepath */
+static loadhandle_t *load_task[3]; /* the heavy part of level_load() runs behind the loading scene */
 static int must_load_another_level;
 static int must_restart_this_level;
 static int must_push_a_quest;
@@ -175,7 +185,12 @@ static font_t *dlgbox_title, *dlgbox_message;
 static void level_load(const char *filepath);
 static void level_unload();
 static int level_save(const char *filepath);
-static void level_interpret_line(const char *filename, int fileline, const char *line);
+static void level_interpret_levelfile(const char *filename, const levelfile_t *lf);
+static void level_create_bricks(const levelfile_t *lf);
+static void level_create_items_and_objects(const levelfile_t *lf);
+static void load_bricks(void *foo);
+static void load_entities(void *foo);
+static void load_background(void *foo);
 static void level_interpret_parsed_line(const char *filename, int fileline, const char *identifier, int param_count, const char **param);
 
 /* internal methods */
@@ -187,6 +202,7 @@ static void render_players(int bring_to_back);
 static void update_music();
 static void spawn_players();
 static void render_entities(brick_list_t *major_bricks, item_list_t *major_items, enemy_list_t *major_enemies); /* render bricks, items, enemies, players, etc. */
+static void enqueue_brick(brick_t *brick); /* enqueues a brick (or its chunk) in the render queue */
 static void render_hud(enemy_list_t *major_enemies); /* gui / hud related */
 static void render_powerups(); /* gui / hud related */
 static void render_dlgbox(); /* dialog boxes */
@@ -386,8 +402,8 @@ static editor_action_list_t* editor_action_delete_list(editor_action_list_t *lis
  */
 void level_load(const char *filepath)
 {
-    char abs_path[1024], line[1024];
-    FILE* fp;
+    char abs_path[1024];
+    levelfile_t *lf;
 
     setlocale(LC_NUMERIC, "C"); /* bugfix */
     logfile_message("level_load(\"%s\")", filepath);
@@ -418,18 +434,13 @@ void level_load(const char *filepath)
     /* startup objects (1) */
     init_startup_object_list();
 
-    /* traversing the level file */
-    fp = fopen(abs_path, "r");
-    if(fp != NULL) {
-        int ln = 0;
-        while(fgets(line, sizeof(line) / sizeof(char), fp)) {
-            line[strlen(line)-1] = 0; /* no newlines, please! */
-            level_interpret_line(abs_path, ++ln, line);
-        }
-        fclose(fp);
-    }
-    else
+    /* reading the level file (text or binary): the header is interpreted
+       right away, the entities are created later by the loader tasks */
+    if(NULL == (lf = levelfile_load_ex(abs_path, FALSE)))
         fatal_error("Can\'t open level file \"%s\".", abs_path);
+    level_interpret_levelfile(abs_path, lf);
+    str_cpy(levelfile_path, abs_path, sizeof(levelfile_path));
+    levelfile = lf;
 
     /* players */
     if(team_size == 0) {
@@ -445,21 +456,80 @@ void level_load(const char *filepath)
     camera_set_position(player->actor->position);
     player_set_collectibles(0);
 
-    /* startup objects (2) */
-    spawn_startup_objects();
+    /* the brickset, the entities and the background are loaded by
+       the loader, in the main thread, while the loading scene is on */
+    load_task[0] = task_run_async("loading the brickset", load_bricks, NULL);
+    load_task[1] = task_run_async("creating the entities", load_entities, NULL);
+    load_task[2] = task_run_async("loading the background", load_background, NULL);
 
-    /* load the music */
+    /* load the music (in the background) */
     block_music = FALSE;
-    music = music_load(musicfile);
+    music = NULL;
+    music_handle = (*musicfile != 0) ? music_load_async(musicfile) : NULL;
 
-    /* misc */
-    update_level_size();
-    backgroundtheme = background_load(bgtheme);
+    /* the loading scene stays on while the loader does its job */
+    if(loader_pending() > 0)
+        scenestack_push(storyboard_get_scene(SCENE_LOADING), NULL);
 
     /* success! */
     logfile_message("level_load() ok");
 }
 
+/*
+ * load_bricks()
+ * Loader task: loads the brickset and creates the bricks
+ */
+void load_bricks(void *foo)
+{
+    if(*theme != 0)
+        brickdata_load(theme);
+
+    level_create_bricks(levelfile);
+}
+
+/*
+ * load_entities()
+ * Loader task: creates the items and the objects,
+ * or hands them to the level stream
+ */
+void load_entities(void *foo)
+{
+    int i, n;
+
+    if(levelfile->bricks_on_disk) {
+        /* huge levels: the entities are streamed. The
+           startup objects are spawned below, though */
+        for(i=n=0; i<levelfile->object_count; i++) {
+            if(str_icmp(levelfile_string(levelfile, levelfile->object[i].name), DEFAULT_STARTUP_OBJECT) != 0)
+                levelfile->object[n++] = levelfile->object[i];
+        }
+        levelfile->object_count = n;
+        levelstream_init(levelfile_path, levelfile);
+        levelfile = NULL; /* the stream owns it */
+
+        /* reloading the level in the editor? It needs everything */
+        if(editor_is_enabled())
+            levelstream_load_everything();
+    }
+    else {
+        level_create_items_and_objects(levelfile);
+        levelfile = levelfile_destroy(levelfile); /* we no longer need it */
+    }
+
+    /* startup objects (2) */
+    spawn_startup_objects();
+}
+
+/*
+ * load_background()
+ * Loader task: loads the background
+ */
+void load_background(void *foo)
+{
+    update_level_size();
+    backgroundtheme = background_load(bgtheme);
+}
+
 /*
  * level_unload()
  * Call manually after level_load() whenever
@@ -471,14 +541,25 @@ void level_unload()
 
     logfile_message("level_unload()");
     music_stop();
-    music_unref(musicfile);
+    music = NULL;
+    if(music_handle != NULL)
+        music_handle = loadhandle_destroy(music_handle);
     music_unref("musics/invincible.ogg");
     music_unref("musics/speed.ogg");
 
+    /* the level may be released before it's fully loaded */
+    for(i=0; i<sizeof(load_task)/sizeof(load_task[0]); i++) {
+        if(load_task[i] != NULL)
+            load_task[i] = loadhandle_destroy(load_task[i]);
+    }
+    if(levelfile != NULL)
+        levelfile = levelfile_destroy(levelfile);
+
     /* releases the startup object list */
     release_startup_object_list();
 
     /* entity manager */
+    levelstream_release();
     entitymanager_release();
 
     /* unloading the brickset */
@@ -487,7 +568,8 @@ void level_unload()
 
     /* unloading the background */
     logfile_message("unloading the background...");
-    backgroundtheme = background_unload(backgroundtheme);
+    if(backgroundtheme != NULL)
+        backgroundtheme = background_unload(backgroundtheme);
 
     /* destroying the players */
     logfile_message("unloading the players...");
@@ -627,63 +709,118 @@ int level_save(const char *filepath)
 }
 
 /*
- * level_interpret_line()
- * Interprets a line from the .lev file
+ * level_interpret_levelfile()
+ * Interprets the commands of the header of a level file.
+ * The entities are created by the loader tasks
  */
-void level_interpret_line(const char *filename, int fileline, const char *line)
+void level_interpret_levelfile(const char *filename, const levelfile_t *lf)
 {
-    int param_count;
-    char *param[1024], *identifier;
-    char tmp[1024], *p, *q;
-    int i;
+    const char *param[1024];
+    int i, j;
 
-    /* skip spaces */
-    for(p=(char*)line; isspace((int)*p); p++);
-    if(0 == *p) return;
+    for(i=0; i<lf->command_count; i++) {
+        const levelfile_command_t *cmd = &(lf->command[i]);
+        for(j=0; j<cmd->param_count && j<1024; j++)
+            param[j] = levelfile_string(lf, lf->param[cmd->first_param + j]);
+        level_interpret_parsed_line(filename, cmd->line, levelfile_string(lf, cmd->identifier), j, param);
+    }
+}
 
-    /* reading the identifier */
-    for(q=tmp; *p && !isspace(*p) && q<tmp+1023; *q++ = *p++); *q=0;
-    if(tmp[0] == '/' && tmp[1] == '/') return; /* comment */
-    identifier = str_dup(tmp);
+/*
+ * level_create_bricks()
+ * Creates the bricks of a level file, storing them
+ * all at once (unless they're streamed)
+ */
+void level_create_bricks(const levelfile_t *lf)
+{
+    int i, n;
+    void **entity;
+    int *layer;
 
-    /* skip spaces */
-    for(; isspace((int)*p); p++);
+    if(lf->brick_count > 0 && str_icmp(theme, "") == 0) {
+        logfile_message("Level loader - warning: cannot create a new brick if the theme is not defined");
+        return;
+    }
+    else if(lf->brick_count == 0 || lf->bricks_on_disk) /* if they're on the disk, they're streamed */
+        return;
 
-    /* read the arguments */
-    param_count = 0;
-    if(0 != *p) {
-        int quotes;
-        while(*p && param_count<1024) {
-            quotes = (*p == '"') && !!(p++); /* short-circuit AND */
-            for(q=tmp; *p && ((!quotes && !isspace(*p)) || (quotes && !(*p == '"' && *(p-1) != '\\'))) && q<tmp+1023; *q++ = *p++); *q=0;
-            quotes = (*p == '"') && !!(p++);
-            param[param_count++] = str_dup(tmp);
-            for(; isspace((int)*p); p++); /* skip spaces */
+    entity = mallocx(lf->brick_count * sizeof *entity);
+    layer = mallocx(max(1, lf->string_count) * sizeof *layer);
+    for(i=0; i<lf->string_count; i++)
+        layer[i] = -1; /* not computed yet */
+
+    for(i=n=0; i<lf->brick_count; i++) {
+        const levelfile_brick_t *b = &(lf->brick[i]);
+        int type = clip(b->type, 0, brickdata_size()-1);
+
+        if(brickdata_get(type) != NULL) {
+            brick_t *brk = brick_create(type);
+            brk->x = brk->sx = b->x;
+            brk->y = brk->sy = b->y;
+            if(b->layer >= 0) {
+                if(layer[b->layer] < 0)
+                    layer[b->layer] = (int)colorname2bricklayer(levelfile_string(lf, b->layer));
+                brk->layer = (bricklayer_t)layer[b->layer];
+            }
+            entity[n++] = brk;
         }
+        else
+            logfile_message("Level loader - invalid brick: %d", type);
+    }
+    entitymanager_store_bricks((brick_t**)entity, n);
+
+    free(layer);
+    free(entity);
+}
+
+/*
+ * level_create_items_and_objects()
+ * Creates the items and the objects of a level
+ * file, storing them all at once
+ */
+void level_create_items_and_objects(const levelfile_t *lf)
+{
+    int i, n;
+    void **entity = mallocx(max(1, max(lf->item_count, lf->object_count)) * sizeof *entity);
+
+    /* items */
+    for(i=0; i<lf->item_count; i++) {
+        const levelfile_item_t *it = &(lf->item[i]);
+        item_t *item = item_create(clip(it->type, 0, ITEMDATA_MAX-1));
+        item->actor->spawn_point = v2d_new(it->x, it->y);
+        item->actor->position = item->actor->spawn_point;
+        entity[i] = item;
     }
+    entitymanager_store_items((item_t**)entity, lf->item_count);
 
-    /* interpret the line */
-    level_interpret_parsed_line(filename, fileline, identifier, param_count, (const char**)param);
+    /* objects */
+    for(i=n=0; i<lf->object_count; i++) {
+        const levelfile_object_t *o = &(lf->object[i]);
+        const char *object_name = levelfile_string(lf, o->name);
 
-    /* free the stuff */
-    for(i=0; i<param_count; i++)
-        free(param[i]);
-    free(identifier);
+        if(str_icmp(object_name, DEFAULT_STARTUP_OBJECT) != 0) {
+            enemy_t *object = enemy_create(object_name);
+            object->actor->spawn_point = v2d_new(o->x, o->y);
+            object->actor->position = object->actor->spawn_point;
+            entity[n++] = object;
+        }
+    }
+    entitymanager_store_objects((enemy_t**)entity, n);
+
+    free(entity);
 }
 
 /*
  * level_interpret_parsed_line()
- * Interprets a line parsed by level_interpret_line()
+ * Interprets a command of the level file
  */
 void level_interpret_parsed_line(const char *filename, int fileline, const char *identifier, int param_count, const char **param)
 {
     /* interpreting the command */
     if(str_icmp(identifier, "theme") == 0) {
         if(param_count == 1) {
-            if(brickdata_size() == 0) {
-                str_cpy(theme, param[0], sizeof(theme));
-                brickdata_load(theme);
-            }
+            if(*theme == 0)
+                str_cpy(theme, param[0], sizeof(theme)); /* load_bricks() loads it */
         }
         else
             logfile_message("Level loader - command 'theme' expects one parameter: brickset filepath. Did you forget to double quote the brickset filepath?");
@@ -904,6 +1041,9 @@ void level_init(void *path_to_lev_file)
     quit_level = FALSE;
     quit_level_img = image_create(image_width(video_get_backbuffer()), image_height(video_get_backbuffer()));
     backgroundtheme = NULL;
+    levelfile = NULL;
+    for(i=0; i<sizeof(load_task)/sizeof(load_task[0]); i++)
+        load_task[i] = NULL;
     must_load_another_level = FALSE;
     must_restart_this_level = FALSE;
     must_push_a_quest = FALSE;
@@ -922,6 +1062,7 @@ void level_init(void *path_to_lev_file)
     editor_init();
 
     /* level init */
+    pcmcache_prefetch();
     level_load(file);
     spawn_players();
 
@@ -1070,6 +1211,8 @@ void level_update()
         /* -------------------------------------- */
 
         /* getting the major entities */
+        profiler_begin(PROF_ENTITIES);
+        levelstream_update(cam);
         entitymanager_set_active_region(
             (int)cam.x - VIDEO_SCREEN_W/2 - (DEFAULT_MARGIN*3)/2,
             (int)cam.y - VIDEO_SCREEN_H/2 - (DEFAULT_MARGIN*3)/2,
@@ -1088,11 +1231,13 @@ void level_update()
         );
 
         major_bricks = entitymanager_retrieve_active_bricks();
+        profiler_end(PROF_ENTITIES);
 
         /* update background */
         background_update(backgroundtheme);
 
         /* update items */
+        profiler_begin(PROF_ITEMS);
         for(inode = major_items; inode != NULL; inode = inode->next) {
             float x = inode->data->actor->position.x;
             float y = inode->data->actor->position.y;
@@ -1113,8 +1258,10 @@ void level_update()
                     inode->data->actor->position = inode->data->actor->spawn_point;
             }
         }
+        profiler_end(PROF_ITEMS);
 
         /* update objects */
+        profiler_begin(PROF_OBJECTS);
         for(enode = major_enemies; enode != NULL; enode = enode->next) {
             float x = enode->data->actor->position.x;
             float y = enode->data->actor->position.y;
@@ -1135,8 +1282,10 @@ void level_update()
                     enode->data->actor->position = enode->data->actor->spawn_point;
             }
         }
+        profiler_end(PROF_OBJECTS);
 
         /* update players */
+        profiler_begin(PROF_PLAYERS);
         for(i=0; i<team_size; i++) {
             float x = team[i]->actor->position.x;
             float y = team[i]->actor->position.y;
@@ -1189,6 +1338,7 @@ void level_update()
                 }
             }
         }
+        profiler_end(PROF_PLAYERS);
 
         /* some objects are attached to the player... */
         for(enode = major_enemies; enode != NULL; enode = enode->next) {
@@ -1209,10 +1359,12 @@ void level_update()
         }
 
         /* update bricks */
+        profiler_begin(PROF_BRICKS);
         for(bnode = major_bricks; bnode != NULL; bnode = bnode->next) {
             /* update this brick */
             brick_update(bnode->data, team, team_size, major_bricks, major_items, major_enemies);
         }
+        profiler_end(PROF_BRICKS);
 
         /* update particles */
         particle_update_all(major_bricks);
@@ -1336,6 +1488,10 @@ void level_release()
     font_destroy(dlgbox_message);
     actor_destroy(dlgbox);
 
+    /* level boundary: the sprites of the previous levels that
+       haven't been used in this one may go */
+    sprite_release_unused();
+
     logfile_message("level_release() ok");
 }
 
@@ -1792,12 +1948,13 @@ void render_entities(brick_list_t *major_bricks, item_list_t *major_items, enemy
 
     /* starting up the render queue... */
     renderqueue_begin( camera_get_position() );
+    brickchunk_update();
 
         /* render bricks - background */
         for(bnode=major_bricks; bnode; bnode=bnode->next) {
             brickdata_t *ref = bnode->data->brick_ref;
             if(ref->zindex < 0.5f)
-                renderqueue_enqueue_brick(bnode->data);
+                enqueue_brick(bnode->data);
         }
 
         /* render players (bring to back?) */
@@ -1807,7 +1964,7 @@ void render_entities(brick_list_t *major_bricks, item_list_t *major_items, enemy
         for(bnode=major_bricks; bnode; bnode=bnode->next) {
             brickdata_t *ref = bnode->data->brick_ref;
             if(fabs(ref->zindex-0.5f) < EPSILON && ref->property != BRK_OBSTACLE)
-                renderqueue_enqueue_brick(bnode->data);
+                enqueue_brick(bnode->data);
         }
 
         /* render items (bring to back) */
@@ -1820,7 +1977,7 @@ void render_entities(brick_list_t *major_bricks, item_list_t *major_items, enemy
         for(bnode=major_bricks; bnode; bnode=bnode->next) {
             brickdata_t *ref = bnode->data->brick_ref;
             if(fabs(ref->zindex-0.5f) < EPSILON && ref->property == BRK_OBSTACLE)
-                renderqueue_enqueue_brick(bnode->data);
+                enqueue_brick(bnode->data);
         }
 
         /* render non-HUD objects */
@@ -1845,13 +2002,26 @@ void render_entities(brick_list_t *major_bricks, item_list_t *major_items, enemy
         for(bnode=major_bricks; bnode; bnode=bnode->next) {
             brickdata_t *ref = bnode->data->brick_ref;
             if(ref->zindex > 0.5f)
-                renderqueue_enqueue_brick(bnode->data);
+                enqueue_brick(bnode->data);
         }
 
     /* okay, enough! let's render */
     renderqueue_end();
 }
 
+/* enqueues a brick in the render queue. Static
+ * bricks are rendered through their chunks */
+void enqueue_brick(brick_t *brick)
+{
+    if(brickchunk_accepts(brick)) {
+        brickchunk_t *chunk = brickchunk_claim(brick);
+        if(chunk != NULL)
+            renderqueue_enqueue_brickchunk(chunk);
+    }
+    else
+        renderqueue_enqueue_brick(brick);
+}
+
 /* true if a given region is inside the screen position */
 int inside_screen(int x, int y, int w, int h, int margin)
 {
@@ -1874,6 +2044,8 @@ void update_level_size()
     brick_list_t *p, *brick_list;
 
     max_x = max_y = -INFINITY;
+    if(levelstream_is_streaming())
+        levelstream_get_bounds(&max_x, &max_y); /* the bricks on the disk */
 
     brick_list = entitymanager_retrieve_all_bricks();
     for(p=brick_list; p; p=p->next) {
@@ -1956,6 +2128,9 @@ void render_players(int bring_to_back)
 /* updates the music */
 void update_music()
 {
+    if(music == NULL && music_handle != NULL)
+        music = loadhandle_music(music_handle); /* NULL until it's loaded */
+
     if(music != NULL && !block_music) {
 
         if(override_music && !sound_is_playing(override_music)) {
@@ -2721,6 +2896,9 @@ void editor_enable()
 {
     logfile_message("editor_enable()");
 
+    /* the editor needs all the bricks */
+    levelstream_load_everything();
+
     /* activating the editor */
     editor_action_init();
     editor_enabled = TRUE;
@@ -2749,6 +2927,7 @@ void editor_disable()
     /* disabling the level editor */
     update_level_size();
     editor_action_release();
+    brickchunk_invalidate_all(); /* bricks may have been modified */
     editor_enabled = FALSE;
 
     /* restoring the video resolution */
@@ -0,0 +1,101 @@
+/*
+ * Open Surge Engine
+ * loading.c - loading screen
+ * Copyright (C) 2013  Alexandre Martins <alemartf(at)gmail(dot)com>
+ * http://opensnc.sourceforge.net
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <math.h>
+#include "loading.h"
+#include "../core/scene.h"
+#include "../core/loader.h"
+#include "../core/util.h"
+#include "../core/video.h"
+#include "../core/image.h"
+#include "../core/timer.h"
+
+/*
+ * This scene is pushed on top of another one while the loader
+ * is busy. It keeps the game responsive (the main loop goes on)
+ * and pops itself as soon as the pending resources get loaded.
+ */
+
+/* private data */
+#define LOADING_IMAGE           "images/loading.png"
+#define LOADING_BAR_WIDTH       (VIDEO_SCREEN_W / 2)
+#define LOADING_BAR_HEIGHT      4
+static image_t *loading_img;
+static float loading_timer;
+
+
+/*
+ * loading_init()
+ * Initializes the loading screen
+ */
+void loading_init(void *foo)
+{
+    loading_img = image_load(LOADING_IMAGE);
+    loading_timer = 0.0f;
+}
+
+
+/*
+ * loading_release()
+ * Releases the loading screen
+ */
+void loading_release()
+{
+    image_unref(LOADING_IMAGE);
+}
+
+
+/*
+ * loading_update()
+ * Updates the loading screen
+ */
+void loading_update()
+{
+    if(loader_pending() == 0) {
+        scenestack_pop();
+        return;
+    }
+
+    loading_timer += timer_get_delta();
+}
+
+
+/*
+ * loading_render()
+ * Renders the loading screen
+ */
+void loading_render()
+{
+    image_t *buf = video_get_backbuffer();
+    int x = (VIDEO_SCREEN_W - LOADING_BAR_WIDTH) / 2, y = VIDEO_SCREEN_H - 3 * LOADING_BAR_HEIGHT;
+    int w = (int)(loader_progress() * LOADING_BAR_WIDTH);
+    int p = (int)((0.5f + 0.5f * sin(2.0f * PI * loading_timer)) * (LOADING_BAR_WIDTH - 1));
+
+    image_clear(buf, image_rgb(0,0,0));
+    if(loading_img != NULL)
+        image_draw(loading_img, buf, (VIDEO_SCREEN_W - image_width(loading_img))/2, (VIDEO_SCREEN_H - image_height(loading_img))/2, IF_NONE);
+
+    /* progress bar */
+    image_rectfill(buf, x, y, x + LOADING_BAR_WIDTH - 1, y + LOADING_BAR_HEIGHT - 1, image_rgb(48,48,48));
+    if(w > 0)
+        image_rectfill(buf, x, y, x + w - 1, y + LOADING_BAR_HEIGHT - 1, image_rgb(255,255,255));
+    image_rectfill(buf, x + p, y, x + p, y + LOADING_BAR_HEIGHT - 1, image_rgb(255,204,0));
+}
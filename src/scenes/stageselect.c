@@ -43,6 +43,7 @@
 #include "../core/timer.h"
 #include "../core/soundfactory.h"
 #include "../core/nanoparser/nanoparser.h"
+#include "../core/scriptcache.h"
 #include "../core/font.h"
 #include "../entities/actor.h"
 #include "../entities/background.h"
@@ -402,7 +403,7 @@ stagedata_t* stagedata_load(const char *filename)
     s->requires[1] = 0;
     s->requires[2] = 0;
 
-    prog = nanoparser_construct_tree(s->filepath);
+    prog = scriptcache_construct_tree(s->filepath);
     nanoparser_traverse_program_ex(prog, (void*)s, traverse);
     prog = nanoparser_deconstruct_tree(prog);
 
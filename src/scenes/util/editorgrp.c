@@ -30,6 +30,7 @@
 #include "../../core/util.h"
 #include "../../core/stringutil.h"
 #include "../../core/nanoparser/nanoparser.h"
+#include "../../core/scriptcache.h"
 
 /* internal data */
 #define EDITORGRP_MAX_GROUPS        501
@@ -86,7 +87,7 @@ void editorgrp_load_from_file(const char *filename)
     resource_filepath(abs_path, filename, sizeof(abs_path), RESFP_READ);
     logfile_message("editorgrp_load_from_file('%s')", filename);
 
-    prog = nanoparser_construct_tree(abs_path);
+    prog = scriptcache_construct_tree(abs_path);
     nanoparser_traverse_program(prog, traverse);
     prog = nanoparser_deconstruct_tree(prog);
 
@@ -0,0 +1,829 @@
+/*
+ * Open Surge Engine
+ * levelstream.c - streams the entities of huge levels around the camera
+ * Copyright (C) 2013  Alexandre Martins <alemartf(at)gmail(dot)com>
+ * http://opensnc.sourceforge.net
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdlib.h>
+#include "levelstream.h"
+#include "../../core/levelfile.h"
+#include "../../core/thread.h"
+#include "../../core/video.h"
+#include "../../core/image.h"
+#include "../../core/timer.h"
+#include "../../core/stringutil.h"
+#include "../../core/logfile.h"
+#include "../../core/util.h"
+#include "../../entities/actor.h"
+#include "../../entities/brick.h"
+#include "../../entities/item.h"
+#include "../../entities/enemy.h"
+#include "../../entities/entitymanager.h"
+
+/* private stuff */
+#define MARGIN              VIDEO_SCREEN_W      /* the sectors closer than this to the screen are needed right away */
+#define PREFETCH_DISTANCE   1                   /* in sectors: the ones this close to the needed sectors are read in the background */
+#define KEEP_DISTANCE       2                   /* in sectors: the ones farther than this from the needed sectors are unloaded */
+
+typedef enum { SECTOR_UNLOADED, SECTOR_QUEUED, SECTOR_READING, SECTOR_READ, SECTOR_LOADED } sectorstate_t;
+
+typedef struct sector_t {
+    int x, y, first_brick, brick_count; /* see levelfile_sector_t. brick_count may be zero */
+    int first_spawn, spawn_count; /* spawn[first_spawn .. first_spawn + spawn_count - 1] */
+    sectorstate_t state; /* protected by mutex */
+    levelfile_brick_t *record; /* what the reader has read, or NULL on errors (state == SECTOR_READ; protected by mutex) */
+    brick_t **brick; /* the bricks of this sector (state == SECTOR_LOADED; main thread only) */
+    int *index; /* brick[i] has been created out of record index[i] */
+    int count; /* length of the brick and index arrays */
+    char *gone; /* gone[j] is TRUE if the brick of record j has been destroyed for good, or NULL if none has */
+} sector_t;
+
+typedef enum {
+    SPAWN_PENDING, /* not created (yet, or again) */
+    SPAWN_TRACKED, /* created. If it's far away when its sector is unloaded, the stream destroys it */
+    SPAWN_DONE /* created and left to the entity manager for good: it's preserved, always active or dead */
+} spawnstate_t;
+
+typedef struct spawn_t {
+    int x, y; /* its sector */
+    int is_object; /* lf->object[index] if TRUE, lf->item[index] otherwise */
+    int index;
+    spawnstate_t state;
+    void *entity; /* item_t* or enemy_t* (state == SPAWN_TRACKED) */
+} spawn_t;
+
+static char *path = NULL; /* absolute filepath of the level being streamed, or NULL */
+static levelfile_t *lf = NULL;
+static sector_t *sector = NULL; /* sorted by (y,x): the sectors of the file plus the ones with items or objects only */
+static int sector_count = 0;
+static spawn_t *spawn = NULL; /* the items and the objects, sorted by sector */
+static int spawn_count = 0;
+static int *resident = NULL; /* indexes of the sectors whose state isn't SECTOR_UNLOADED (main thread only) */
+static int resident_count = 0;
+static int *layer = NULL; /* bricklayer_t of each string of the string table, or -1 if not computed yet */
+static int *object_flag = NULL; /* is the object named by each string of the string table always active? -1 if not computed yet */
+static int item_flag[ITEMDATA_MAX]; /* is each type of item always active? -1 if not computed yet */
+static int bounds_x = 0, bounds_y = 0;
+static int needed_x0, needed_y0, needed_x1, needed_y1; /* the needed sectors */
+static float elapsed_time = 0.0f; /* the clock of the moving bricks */
+
+static mutex_t *mutex = NULL;
+static thread_t *reader = NULL;
+static int reader_running = FALSE; /* protected by mutex */
+static int quitting = FALSE; /* protected by mutex */
+
+static void create_sectors();
+static void compute_bounds();
+static void scan_sector(int index, levelfile_brick_t *record, char *scanned);
+static int find_sector(int x, int y);
+static int sector_of(int coordinate);
+static int distance_to_needed_sectors(int x, int y);
+static sectorstate_t get_state(int index);
+static void queue_sector(int index);
+static void load_sector(int index);
+static void unload_sector(int index);
+static void mark_as_gone(sector_t *s, int record);
+static brickdata_t* record_data(const levelfile_brick_t *record);
+static brick_t* create_brick(const levelfile_brick_t *record);
+static void create_entity(spawn_t *sp);
+static int is_always_active(const spawn_t *sp);
+static int spawn_cmp(const void *a, const void *b);
+static void on_dead_brick(brick_t *brick);
+static void on_dead_item(item_t *item);
+static void on_dead_object(enemy_t *object);
+static void on_dead_entity(void *entity);
+static void spawn_reader();
+static void reader_routine(void *param);
+
+
+
+/* public methods */
+
+/*
+ * levelstream_init()
+ * Starts streaming a level. The bricks of lf must have been
+ * left on the disk. Only a few sectors at the edges of the
+ * level are read, so that its bounds are known. The items
+ * and the objects that are always active are created right
+ * away; the other entities wait for their sectors.
+ */
+void levelstream_init(const char *abs_path, levelfile_t *levelfile)
+{
+    int i, always_active = 0;
+
+    logfile_message("levelstream_init(\"%s\")", abs_path);
+    levelstream_release();
+
+    path = str_dup(abs_path);
+    lf = levelfile;
+    mutex = mutex_create();
+    reader = NULL;
+    reader_running = FALSE;
+    quitting = FALSE;
+    bounds_x = bounds_y = 0;
+    needed_x0 = needed_y0 = needed_x1 = needed_y1 = 0;
+    elapsed_time = 0.0f;
+
+    layer = mallocx(max(1, lf->string_count) * sizeof *layer);
+    object_flag = mallocx(max(1, lf->string_count) * sizeof *object_flag);
+    for(i=0; i<lf->string_count; i++)
+        layer[i] = object_flag[i] = -1;
+    for(i=0; i<ITEMDATA_MAX; i++)
+        item_flag[i] = -1;
+
+    create_sectors();
+    resident = mallocx(max(1, sector_count) * sizeof *resident);
+    resident_count = 0;
+    compute_bounds();
+
+    /* the entity manager tells us about the entities that die */
+    entitymanager_set_death_callbacks(on_dead_brick, on_dead_item, on_dead_object);
+
+    /* these must exist from the start */
+    for(i=0; i<spawn_count; i++) {
+        if(is_always_active(&spawn[i])) {
+            create_entity(&spawn[i]);
+            always_active++;
+        }
+    }
+
+    logfile_message("levelstream_init() ok: %d sectors, %d items and objects (%d always active)", sector_count, spawn_count, always_active);
+}
+
+/*
+ * levelstream_release()
+ * Stops streaming. The entities that have been
+ * created stay in the entity manager, which
+ * releases them
+ */
+void levelstream_release()
+{
+    int i;
+
+    if(path == NULL)
+        return;
+
+    logfile_message("levelstream_release()");
+    entitymanager_set_death_callbacks(NULL, NULL, NULL);
+
+    mutex_lock(mutex);
+    quitting = TRUE;
+    mutex_unlock(mutex);
+    if(reader != NULL)
+        reader = thread_join(reader);
+    mutex = mutex_destroy(mutex);
+
+    for(i=0; i<sector_count; i++) {
+        if(sector[i].record != NULL)
+            free(sector[i].record);
+        if(sector[i].brick != NULL)
+            free(sector[i].brick);
+        if(sector[i].index != NULL)
+            free(sector[i].index);
+        if(sector[i].gone != NULL)
+            free(sector[i].gone);
+    }
+
+    free(sector);
+    sector = NULL;
+    sector_count = 0;
+    free(spawn);
+    spawn = NULL;
+    spawn_count = 0;
+    free(resident);
+    resident = NULL;
+    resident_count = 0;
+    free(layer);
+    layer = NULL;
+    free(object_flag);
+    object_flag = NULL;
+    lf = levelfile_destroy(lf);
+    free(path);
+    path = NULL;
+}
+
+/*
+ * levelstream_update()
+ * Loads the sectors around the camera and unloads the
+ * ones that are far away. Call it before retrieving
+ * the active entities of the entity manager.
+ */
+void levelstream_update(v2d_t camera_position)
+{
+    int i, x, y, need_reader = FALSE;
+
+    if(path == NULL)
+        return;
+
+    elapsed_time += timer_get_delta();
+
+    needed_x0 = sector_of((int)camera_position.x - VIDEO_SCREEN_W/2 - MARGIN);
+    needed_y0 = sector_of((int)camera_position.y - VIDEO_SCREEN_H/2 - MARGIN);
+    needed_x1 = sector_of((int)camera_position.x + VIDEO_SCREEN_W/2 + MARGIN);
+    needed_y1 = sector_of((int)camera_position.y + VIDEO_SCREEN_H/2 + MARGIN);
+
+    /* unloading the sectors that are far away */
+    for(i=resident_count-1; i>=0; i--) {
+        const sector_t *s = &(sector[resident[i]]);
+        if(distance_to_needed_sectors(s->x, s->y) > KEEP_DISTANCE) {
+            unload_sector(resident[i]);
+            resident[i] = resident[--resident_count];
+        }
+    }
+
+    /* loading the needed sectors and prefetching the ones nearby. The
+       entities of a sector are created only once it's needed, whenever
+       the reader is done with it, so that replays are deterministic */
+    for(y=needed_y0-PREFETCH_DISTANCE; y<=needed_y1+PREFETCH_DISTANCE; y++) {
+        for(x=needed_x0-PREFETCH_DISTANCE; x<=needed_x1+PREFETCH_DISTANCE; x++) {
+            if((i = find_sector(x, y)) >= 0) {
+                sectorstate_t state = get_state(i);
+                if(distance_to_needed_sectors(x, y) == 0) {
+                    if(state != SECTOR_LOADED)
+                        load_sector(i);
+                }
+                else if(state == SECTOR_UNLOADED && sector[i].brick_count > 0) {
+                    queue_sector(i);
+                    need_reader = TRUE;
+                }
+            }
+        }
+    }
+
+    if(need_reader)
+        spawn_reader();
+}
+
+/*
+ * levelstream_load_everything()
+ * Creates the entities of all the sectors
+ * and stops streaming
+ */
+void levelstream_load_everything()
+{
+    int i;
+
+    if(path == NULL)
+        return;
+
+    logfile_message("levelstream_load_everything()");
+    for(i=0; i<sector_count; i++) {
+        if(get_state(i) != SECTOR_LOADED)
+            load_sector(i);
+    }
+
+    levelstream_release();
+}
+
+/*
+ * levelstream_is_streaming()
+ * Is there a level being streamed?
+ */
+int levelstream_is_streaming()
+{
+    return path != NULL;
+}
+
+/*
+ * levelstream_get_bounds()
+ * The bottom-right corner of the solid bricks of
+ * the level, considering the bricks on the disk
+ */
+void levelstream_get_bounds(int *max_x, int *max_y)
+{
+    *max_x = bounds_x;
+    *max_y = bounds_y;
+}
+
+
+
+/* private methods */
+
+/* groups the items and the objects by sector, and merges
+   their sectors with the ones of the level file */
+void create_sectors()
+{
+    int i, j, k;
+
+    spawn_count = lf->item_count + lf->object_count;
+    spawn = mallocx(max(1, spawn_count) * sizeof *spawn);
+    for(i=0; i<spawn_count; i++) {
+        spawn_t *sp = &(spawn[i]);
+        sp->is_object = (i >= lf->item_count);
+        sp->index = sp->is_object ? i - lf->item_count : i;
+        sp->x = sector_of(sp->is_object ? lf->object[sp->index].x : lf->item[sp->index].x);
+        sp->y = sector_of(sp->is_object ? lf->object[sp->index].y : lf->item[sp->index].y);
+        sp->state = SPAWN_PENDING;
+        sp->entity = NULL;
+    }
+    qsort(spawn, spawn_count, sizeof *spawn, spawn_cmp);
+
+    /* both lists are sorted by (y,x) */
+    sector = mallocx(max(1, lf->sector_count + spawn_count) * sizeof *sector);
+    sector_count = 0;
+    for(i=j=0; i<lf->sector_count || j<spawn_count; ) {
+        sector_t *s = &(sector[sector_count++]);
+        const levelfile_sector_t *sec = (i < lf->sector_count) ? &(lf->sector[i]) : NULL;
+        const spawn_t *sp = (j < spawn_count) ? &(spawn[j]) : NULL;
+
+        if(sec != NULL && (sp == NULL || sec->y < sp->y || (sec->y == sp->y && sec->x <= sp->x))) {
+            s->x = sec->x;
+            s->y = sec->y;
+            s->first_brick = sec->first_brick;
+            s->brick_count = sec->brick_count;
+            i++;
+        }
+        else {
+            s->x = sp->x;
+            s->y = sp->y;
+            s->first_brick = s->brick_count = 0;
+        }
+
+        for(k=j; k<spawn_count && spawn[k].x == s->x && spawn[k].y == s->y; k++);
+        s->first_spawn = j;
+        s->spawn_count = k - j;
+        j = k;
+
+        s->state = SECTOR_UNLOADED;
+        s->record = NULL;
+        s->brick = NULL;
+        s->index = NULL;
+        s->count = 0;
+        s->gone = NULL;
+    }
+}
+
+/* computes the bounds of the level, reading only the sectors at
+   its right and bottom edges. A brick of the sector column c can't
+   reach beyond (c+1) * LEVELFILE_SECTOR_SIZE - 1 + the width of
+   the widest brick, and so on */
+void compute_bounds()
+{
+    levelfile_brick_t *record;
+    char *scanned;
+    int i, c, max_w = 0, max_h = 0, max_count = 0, lo = 0, hi = -1;
+
+    for(i=0; i<brickdata_size(); i++) {
+        const brickdata_t *data = brickdata_get(i);
+        if(data != NULL && data->property != BRK_NONE) {
+            max_w = max(max_w, image_width(data->image));
+            max_h = max(max_h, image_height(data->image));
+        }
+    }
+
+    for(i=0; i<sector_count; i++) {
+        if(sector[i].brick_count > 0) {
+            lo = (max_count > 0) ? min(lo, sector[i].x) : sector[i].x;
+            hi = (max_count > 0) ? max(hi, sector[i].x) : sector[i].x;
+            max_count = max(max_count, sector[i].brick_count);
+        }
+    }
+
+    if(brickdata_size() == 0 || max_count == 0)
+        return;
+
+    record = mallocx(max_count * sizeof *record);
+    scanned = mallocx(sector_count * sizeof *scanned);
+    for(i=0; i<sector_count; i++)
+        scanned[i] = FALSE;
+
+    /* the rows, from the bottom */
+    for(i=sector_count-1; i>=0 && bounds_y < (sector[i].y + 1) * LEVELFILE_SECTOR_SIZE - 1 + max_h; i--)
+        scan_sector(i, record, scanned);
+
+    /* the columns, from the right */
+    for(c=hi; c>=lo && bounds_x < (c + 1) * LEVELFILE_SECTOR_SIZE - 1 + max_w; c--) {
+        for(i=0; i<sector_count; i++) {
+            if(sector[i].x == c)
+                scan_sector(i, record, scanned);
+        }
+    }
+
+    for(c=i=0; i<sector_count; i++)
+        c += scanned[i] ? 1 : 0;
+    logfile_message("levelstream - %d sectors have been scanned to compute the bounds of the level", c);
+
+    free(scanned);
+    free(record);
+}
+
+/* reads a sector, taking its solid bricks into account (see compute_bounds) */
+void scan_sector(int index, levelfile_brick_t *record, char *scanned)
+{
+    const sector_t *s = &(sector[index]);
+    int j;
+
+    if(scanned[index] || s->brick_count == 0)
+        return;
+
+    if(!levelfile_read_bricks(path, lf, s->first_brick, s->brick_count, record))
+        fatal_error("Can\'t read the bricks of level file \"%s\".", path);
+
+    for(j=0; j<s->brick_count; j++) {
+        const brickdata_t *data = record_data(&record[j]);
+        if(data != NULL && data->property != BRK_NONE) {
+            bounds_x = max(bounds_x, record[j].x + image_width(data->image));
+            bounds_y = max(bounds_y, record[j].y + image_height(data->image));
+        }
+    }
+
+    scanned[index] = TRUE;
+}
+
+/* binary search: the index of the sector (x,y), or -1 if there's no such sector */
+int find_sector(int x, int y)
+{
+    int lo = 0, hi = sector_count - 1, mid;
+
+    while(lo <= hi) {
+        mid = (lo + hi) / 2;
+        if(sector[mid].y < y || (sector[mid].y == y && sector[mid].x < x))
+            lo = mid + 1;
+        else if(sector[mid].y > y || sector[mid].x > x)
+            hi = mid - 1;
+        else
+            return mid;
+    }
+
+    return -1;
+}
+
+/* the sector coordinate of a world coordinate */
+int sector_of(int coordinate)
+{
+    return coordinate >= 0 ? coordinate / LEVELFILE_SECTOR_SIZE : -((LEVELFILE_SECTOR_SIZE - 1 - coordinate) / LEVELFILE_SECTOR_SIZE);
+}
+
+/* the distance, in sectors, between the sector (x,y) and the needed sectors. Zero if it's needed */
+int distance_to_needed_sectors(int x, int y)
+{
+    int dx = max(0, max(needed_x0 - x, x - needed_x1));
+    int dy = max(0, max(needed_y0 - y, y - needed_y1));
+    return max(dx, dy);
+}
+
+/* the state of a sector (main thread) */
+sectorstate_t get_state(int index)
+{
+    sectorstate_t state;
+
+    mutex_lock(mutex);
+    state = sector[index].state;
+    mutex_unlock(mutex);
+
+    return state;
+}
+
+/* hands an unloaded sector to the reader (main thread) */
+void queue_sector(int index)
+{
+    mutex_lock(mutex);
+    sector[index].state = SECTOR_QUEUED;
+    mutex_unlock(mutex);
+
+    resident[resident_count++] = index;
+}
+
+/* creates the bricks, the items and the objects of a sector, reading
+   it on the spot if the reader hasn't done it yet (main thread) */
+void load_sector(int index)
+{
+    sector_t *s = &(sector[index]);
+    levelfile_brick_t *record;
+    sectorstate_t state;
+    int i;
+
+    mutex_lock(mutex);
+    state = s->state;
+    record = s->record;
+    s->record = NULL;
+    s->state = SECTOR_LOADED; /* if it's being read, the reader will discard what it reads */
+    mutex_unlock(mutex);
+
+    if(state == SECTOR_UNLOADED)
+        resident[resident_count++] = index;
+
+    if(state != SECTOR_READ && s->brick_count > 0) {
+        record = mallocx(s->brick_count * sizeof *record);
+        if(!levelfile_read_bricks(path, lf, s->first_brick, s->brick_count, record)) {
+            free(record);
+            record = NULL;
+        }
+    }
+
+    /* bricks */
+    s->count = 0;
+    s->brick = mallocx(max(1, s->brick_count) * sizeof *s->brick);
+    s->index = mallocx(max(1, s->brick_count) * sizeof *s->index);
+    if(record != NULL) {
+        for(i=0; i<s->brick_count; i++) {
+            if(record_data(&record[i]) != NULL && !(s->gone != NULL && s->gone[i])) {
+                s->brick[s->count] = create_brick(&record[i]);
+                s->index[s->count++] = i;
+            }
+        }
+        entitymanager_store_bricks(s->brick, s->count);
+        free(record);
+    }
+    else if(s->brick_count > 0)
+        logfile_message("levelstream - can't read sector (%d,%d) of \"%s\"", s->x, s->y, path);
+
+    /* items and objects */
+    for(i=0; i<s->spawn_count; i++) {
+        if(spawn[s->first_spawn + i].state == SPAWN_PENDING)
+            create_entity(&spawn[s->first_spawn + i]);
+    }
+}
+
+/* destroys the bricks of a sector, as well as the items and the objects
+   that have come from it, unless they're preserved or nearby (main thread) */
+void unload_sector(int index)
+{
+    sector_t *s = &(sector[index]);
+    levelfile_brick_t *record;
+    sectorstate_t state;
+    v2d_t position;
+    int i, dead;
+
+    mutex_lock(mutex);
+    state = s->state;
+    record = s->record;
+    s->record = NULL;
+    s->state = SECTOR_UNLOADED;
+    mutex_unlock(mutex);
+
+    if(record != NULL)
+        free(record);
+
+    if(state != SECTOR_LOADED)
+        return;
+
+    /* bricks. The ones that have been triggered (or broken) won't be back */
+    for(i=0; i<s->count; i++) {
+        if(s->brick[i]->state != BRS_IDLE)
+            mark_as_gone(s, s->index[i]);
+        entitymanager_remove_brick(s->brick[i]);
+    }
+    free(s->brick);
+    free(s->index);
+    s->brick = NULL;
+    s->index = NULL;
+    s->count = 0;
+
+    /* items and objects. The ones that have wandered
+       near the camera are left to the entity manager */
+    for(i=0; i<s->spawn_count; i++) {
+        spawn_t *sp = &(spawn[s->first_spawn + i]);
+        if(sp->state == SPAWN_TRACKED) {
+            if(sp->is_object) {
+                position = ((enemy_t*)sp->entity)->actor->position;
+                dead = (((enemy_t*)sp->entity)->state == ES_DEAD);
+            }
+            else {
+                position = ((item_t*)sp->entity)->actor->position;
+                dead = (((item_t*)sp->entity)->state == IS_DEAD);
+            }
+
+            if(!dead && distance_to_needed_sectors(sector_of((int)position.x), sector_of((int)position.y)) > KEEP_DISTANCE) {
+                if(sp->is_object)
+                    entitymanager_remove_object((enemy_t*)sp->entity);
+                else
+                    entitymanager_remove_item((item_t*)sp->entity);
+                sp->state = SPAWN_PENDING;
+            }
+            else
+                sp->state = SPAWN_DONE;
+            sp->entity = NULL;
+        }
+    }
+}
+
+/* the brick of the given record of a sector won't be created again */
+void mark_as_gone(sector_t *s, int record)
+{
+    int i;
+
+    if(s->gone == NULL) {
+        s->gone = mallocx(s->brick_count * sizeof *s->gone);
+        for(i=0; i<s->brick_count; i++)
+            s->gone[i] = FALSE;
+    }
+
+    s->gone[record] = TRUE;
+}
+
+/* the brickdata of a record, or NULL if there's no such brick */
+brickdata_t* record_data(const levelfile_brick_t *record)
+{
+    return brickdata_size() > 0 ? brickdata_get(clip(record->type, 0, brickdata_size()-1)) : NULL;
+}
+
+/* creates a brick out of a record (main thread) */
+brick_t* create_brick(const levelfile_brick_t *record)
+{
+    brick_t *brk = brick_create(clip(record->type, 0, brickdata_size()-1));
+
+    brk->x = brk->sx = record->x;
+    brk->y = brk->sy = record->y;
+    if(record->layer >= 0 && record->layer < lf->string_count) {
+        if(layer[record->layer] < 0)
+            layer[record->layer] = (int)colorname2bricklayer(levelfile_string(lf, record->layer));
+        brk->layer = (bricklayer_t)layer[record->layer];
+    }
+
+    /* the moving bricks keep moving as if they had never been unloaded */
+    if(brk->brick_ref->behavior == BRB_CIRCULAR)
+        brk->value[0] = elapsed_time;
+
+    return brk;
+}
+
+/* creates an item or an object, and stores it in the entity manager (main thread) */
+void create_entity(spawn_t *sp)
+{
+    int preserve, always_active;
+
+    if(sp->is_object) {
+        const levelfile_object_t *o = &(lf->object[sp->index]);
+        enemy_t *object = enemy_create(levelfile_string(lf, o->name));
+        object->actor->spawn_point = v2d_new(o->x, o->y);
+        object->actor->position = object->actor->spawn_point;
+        preserve = object->preserve;
+        always_active = object->always_active;
+        entitymanager_store_object(object);
+        sp->entity = object;
+    }
+    else {
+        const levelfile_item_t *it = &(lf->item[sp->index]);
+        item_t *item = item_create(clip(it->type, 0, ITEMDATA_MAX-1));
+        item->actor->spawn_point = v2d_new(it->x, it->y);
+        item->actor->position = item->actor->spawn_point;
+        preserve = item->preserve;
+        always_active = item->always_active;
+        entitymanager_store_item(item);
+        sp->entity = item;
+    }
+
+    if(preserve || always_active) {
+        sp->state = SPAWN_DONE;
+        sp->entity = NULL;
+    }
+    else
+        sp->state = SPAWN_TRACKED;
+}
+
+/* must this item or object exist from the start? */
+int is_always_active(const spawn_t *sp)
+{
+    if(sp->is_object) {
+        int name = lf->object[sp->index].name;
+        if(object_flag[name] < 0)
+            object_flag[name] = objects_is_always_active(levelfile_string(lf, name)) ? 1 : 0;
+        return object_flag[name];
+    }
+    else {
+        int type = clip(lf->item[sp->index].type, 0, ITEMDATA_MAX-1);
+        if(item_flag[type] < 0) {
+            item_t *item = item_create(type); /* the flag is set by the constructor of each type */
+            item_flag[type] = item->always_active ? 1 : 0;
+            item = item_destroy(item);
+        }
+        return item_flag[type];
+    }
+}
+
+/* sorts the items and the objects by sector (y,x), keeping the order of the file */
+int spawn_cmp(const void *a, const void *b)
+{
+    const spawn_t *p = (const spawn_t*)a, *q = (const spawn_t*)b;
+
+    if(p->y != q->y)
+        return p->y < q->y ? -1 : 1;
+    else if(p->x != q->x)
+        return p->x < q->x ? -1 : 1;
+    else if(p->is_object != q->is_object)
+        return p->is_object ? 1 : -1;
+    else
+        return p->index - q->index;
+}
+
+/* a breakable or a falling brick is gone: it won't be back (main thread) */
+void on_dead_brick(brick_t *brick)
+{
+    int i, j;
+
+    for(i=0; i<resident_count; i++) {
+        sector_t *s = &(sector[resident[i]]);
+        for(j=0; j<s->count; j++) {
+            if(s->brick[j] == brick) {
+                mark_as_gone(s, s->index[j]);
+                s->brick[j] = s->brick[--s->count];
+                s->index[j] = s->index[s->count];
+                return;
+            }
+        }
+    }
+}
+
+/* an item is gone (main thread) */
+void on_dead_item(item_t *item)
+{
+    on_dead_entity(item);
+}
+
+/* an object is gone (main thread) */
+void on_dead_object(enemy_t *object)
+{
+    on_dead_entity(object);
+}
+
+/* a tracked item or object is gone: it won't be back (main thread) */
+void on_dead_entity(void *entity)
+{
+    int i, j;
+
+    for(i=0; i<resident_count; i++) {
+        const sector_t *s = &(sector[resident[i]]);
+        for(j=s->first_spawn; j<s->first_spawn+s->spawn_count; j++) {
+            if(spawn[j].state == SPAWN_TRACKED && spawn[j].entity == entity) {
+                spawn[j].state = SPAWN_DONE;
+                spawn[j].entity = NULL;
+                return;
+            }
+        }
+    }
+}
+
+/* makes sure that the reader is running (main thread) */
+void spawn_reader()
+{
+    int running;
+
+    mutex_lock(mutex);
+    running = reader_running;
+    mutex_unlock(mutex);
+
+    if(!running) {
+        if(reader != NULL)
+            reader = thread_join(reader); /* it has already quit */
+        reader_running = TRUE;
+        reader = thread_create(reader_routine, NULL);
+    }
+}
+
+/* reads the queued sectors, one at a time (reader thread). It quits
+   as soon as there's nothing left to read. Plain stdio only! */
+void reader_routine(void *param)
+{
+    levelfile_brick_t *record;
+    sector_t *s;
+    int i, first, count, ok;
+
+    for(;;) {
+        mutex_lock(mutex);
+        for(i=0; i<sector_count && sector[i].state != SECTOR_QUEUED; i++);
+        if(i == sector_count || quitting) {
+            reader_running = FALSE;
+            mutex_unlock(mutex);
+            break;
+        }
+        s = &(sector[i]);
+        s->state = SECTOR_READING;
+        first = s->first_brick;
+        count = s->brick_count;
+        mutex_unlock(mutex);
+
+        record = malloc(max(1, count) * sizeof *record);
+        ok = (record != NULL) && levelfile_read_bricks(path, lf, first, count, record);
+        if(!ok && record != NULL) {
+            free(record);
+            record = NULL;
+        }
+
+        mutex_lock(mutex);
+        if(s->state == SECTOR_READING) {
+            s->record = record; /* NULL on errors */
+            s->state = SECTOR_READ;
+            record = NULL;
+        }
+        mutex_unlock(mutex);
+
+        if(record != NULL)
+            free(record); /* the sector has been loaded or unloaded in the meantime */
+    }
+}
@@ -0,0 +1,56 @@
+/*
+ * Open Surge Engine
+ * levelstream.h - streams the entities of huge levels around the camera
+ * Copyright (C) 2013  Alexandre Martins <alemartf(at)gmail(dot)com>
+ * http://opensnc.sourceforge.net
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _LEVELSTREAM_H
+#define _LEVELSTREAM_H
+
+#include "../../core/v2d.h"
+
+/*
+ * The bricks of a binary level file are grouped by sector (see
+ * levelfile.h). Instead of keeping the whole level in memory, the
+ * level stream creates the entities of the sectors that are around
+ * the camera and destroys the ones of the sectors that are far away,
+ * so that memory stays bounded whatever the size of the level. A
+ * background thread reads the sectors that are about to be needed;
+ * a sector that's needed right away is read on the spot.
+ *
+ * The bricks are recreated from the file whenever their sector comes
+ * back, except the breakable and the falling ones that are gone. The
+ * items and the objects are created when their sector is first needed.
+ * The preserved and the always active ones stay in memory from then on
+ * (the always active ones are created at once); the others are destroyed
+ * with their sector and come back with it, unless they're dead or they
+ * have wandered nearby.
+ */
+
+/* forward declarations */
+struct levelfile_t;
+
+/* public methods */
+void levelstream_init(const char *abs_path, struct levelfile_t *lf); /* takes ownership of lf (its bricks must be on the disk). Creates the always active items and objects */
+void levelstream_release(); /* stops streaming. The entities that have been created belong to the entity manager */
+void levelstream_update(v2d_t camera_position); /* call before retrieving the active entities */
+void levelstream_load_everything(); /* creates all the entities and stops streaming (e.g., for the level editor) */
+int levelstream_is_streaming(); /* is there a level being streamed? */
+void levelstream_get_bounds(int *max_x, int *max_y); /* bottom-right corner of the solid bricks of the whole level, streamed or not */
+
+#endif